@@ -11,13 +11,14 @@ public:
     ~AABB2();
 
     void setExtents(const Vector2<T> &v1, const Vector2<T> &v2);
-    const Vector2<T>& getLowerBound();
-    const Vector2<T>& getUpperBound();
+    const Vector2<T>& getLowerBound() const;
+    const Vector2<T>& getUpperBound() const;
 
     Vector2<T> getCenter() const;
     const float getPerimeter() const;
 
     bool contains(const AABB2<T>& other) const;
+    bool contains(const Vector2<T>& point) const;
     bool overlaps(const AABB2<T>& other) const;
 
     void expand(const AABB2<T>& other);
@@ -66,12 +67,12 @@ void AABB2<T>::setExtents(const Vector2<T>& v1, const Vector2<T>& v2) {
 }
 
 template <typename T>
-const Vector2<T>& AABB2<T>::getLowerBound() {
+const Vector2<T>& AABB2<T>::getLowerBound() const {
     return _lower;
 }
 
 template <typename T>
-const Vector2<T>& AABB2<T>::getUpperBound() {
+const Vector2<T>& AABB2<T>::getUpperBound() const {
     return _upper;
 }
 
@@ -95,6 +96,16 @@ bool AABB2<T>::contains(const AABB2<T>& other) const {
     );
 }
 
+template <typename T>
+bool AABB2<T>::contains(const Vector2<T>& point) const {
+    return (
+        (_lower.x <= point.x) &&
+        (_lower.y <= point.y) &&
+        (_upper.x >= point.x) &&
+        (_upper.y >= point.y)
+    );
+}
+
 template <typename T>
 bool AABB2<T>::overlaps(const AABB2<T>& other) const {
     Vector2<T> lowerMargin, upperMargin;
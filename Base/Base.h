@@ -24,7 +24,9 @@
 // Standard data structure libs
 #include <stack>
 #include <queue>
+#include <deque>
 #include <map>
+#include <set>
 #include <list>
 #include <vector>
 
@@ -41,6 +43,9 @@
 # define SYS_PLATFORM PLATFORM_LINUX
 #endif
 
+// Used to pad data shared between threads so that independently written fields don't share a cache line
+#define CACHE_LINE_SIZE 64
+
 #include <GLEW/GL/glew.h>
 
 // SDL
@@ -57,6 +62,10 @@
 
 using namespace std;
 
+// Math helpers
+// Infinity and NaN both come out as NaN, which isn't 0
+inline bool IsFinite(float value) { return value - value == 0; }
+
 // String conversion / manipulation
 template <typename T>
 bool string_to_decimal(const std::string &string, T &t) {
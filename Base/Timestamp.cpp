@@ -1,4 +1,5 @@
 #include <Base/Timestamp.h>
+#include <SDL2/SDL_timer.h>
 
 time_t GetTimestamp() {
     return time(NULL);
@@ -10,4 +11,19 @@ clock_t GetClock() {
 
 double ClocksToSeconds(clock_t clocks) {
     return static_cast<double>(clocks / CLOCKS_PER_SEC);
-}
\ No newline at end of file
+}
+
+// Converts whole seconds and the remainder separately, so the multiplication can't overflow and counters slower than the unit still work
+static uint64_t CounterTo(uint64_t unitsPerSecond) {
+    static uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t counter = SDL_GetPerformanceCounter();
+    return (counter / frequency) * unitsPerSecond + (counter % frequency) * unitsPerSecond / frequency;
+}
+
+uint64_t GetMicroseconds() {
+    return CounterTo(1000000);
+}
+
+uint64_t GetMilliseconds() {
+    return CounterTo(1000);
+}
@@ -2,9 +2,14 @@
 #define TIMESTAMP_H
 
 #include <time.h>
+#include <stdint.h>
 
 extern time_t GetTimestamp();
 extern clock_t GetClock();
 extern double ClocksToSeconds(clock_t clocks);
 
+// Monotonic time, from the high resolution counter, for timing and pacing rather than telling the time of day
+extern uint64_t GetMicroseconds();
+extern uint64_t GetMilliseconds();
+
 #endif
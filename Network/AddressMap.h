@@ -0,0 +1,161 @@
+#ifndef ADDRESSMAP_H
+#define ADDRESSMAP_H
+
+#include <Network/NetAddress.h>
+
+// An open-addressing hash table keyed by NetAddress
+// Linear probing over a power-of-two table, with backward-shift deletion so no tombstones accumulate
+// Not thread-safe; callers are expected to provide their own locking
+template <typename T>
+class AddressMap {
+public:
+    AddressMap(unsigned int initialCapacity = 64);
+    ~AddressMap();
+
+    T *find(const NetAddress &addr);
+    // Returns false if the address is already present
+    bool insert(const NetAddress &addr, const T &value);
+    bool erase(const NetAddress &addr);
+    void clear();
+
+    unsigned int size() const { return _size; }
+
+    // Raw slot access for iteration
+    unsigned int getCapacity() const { return _capacity; }
+    bool isSlotUsed(unsigned int slot) const { return _used[slot]; }
+    const NetAddress &getSlotKey(unsigned int slot) const { return _keys[slot]; }
+    T &getSlotValue(unsigned int slot) { return _values[slot]; }
+
+private:
+    int findSlot(const NetAddress &addr) const;
+    void grow();
+
+private:
+    NetAddress *_keys;
+    T *_values;
+    bool *_used;
+    unsigned int _capacity, _mask, _size;
+};
+
+template <typename T>
+AddressMap<T>::AddressMap(unsigned int initialCapacity): _size(0) {
+    _capacity = 16;
+    while(_capacity < initialCapacity) { _capacity <<= 1; }
+    _mask = _capacity - 1;
+
+    _keys = new NetAddress[_capacity];
+    _values = new T[_capacity];
+    _used = new bool[_capacity];
+    memset(_used, 0, sizeof(bool) * _capacity);
+}
+
+template <typename T>
+AddressMap<T>::~AddressMap() {
+    delete [] _keys;
+    delete [] _values;
+    delete [] _used;
+}
+
+template <typename T>
+T *AddressMap<T>::find(const NetAddress &addr) {
+    int slot = findSlot(addr);
+    return (slot < 0) ? 0 : &_values[slot];
+}
+
+template <typename T>
+bool AddressMap<T>::insert(const NetAddress &addr, const T &value) {
+    unsigned int slot;
+
+    if(findSlot(addr) >= 0) { return false; }
+
+    // Keep the load factor under 3/4 so probe sequences stay short
+    if((_size + 1) * 4 > _capacity * 3) { grow(); }
+
+    slot = addr.hash() & _mask;
+    while(_used[slot]) { slot = (slot + 1) & _mask; }
+
+    _keys[slot] = addr;
+    _values[slot] = value;
+    _used[slot] = true;
+    _size++;
+    return true;
+}
+
+template <typename T>
+bool AddressMap<T>::erase(const NetAddress &addr) {
+    int found = findSlot(addr);
+    unsigned int hole, next, home;
+
+    if(found < 0) { return false; }
+
+    // Shift later members of the probe sequence back into the hole so lookups never need tombstones
+    hole = (unsigned int)found;
+    next = (hole + 1) & _mask;
+    while(_used[next]) {
+        home = _keys[next].hash() & _mask;
+        // Move the entry if its home slot doesn't lie cyclically within (hole, next]
+        if(((next - home) & _mask) >= ((next - hole) & _mask)) {
+            _keys[hole] = _keys[next];
+            _values[hole] = _values[next];
+            hole = next;
+        }
+        next = (next + 1) & _mask;
+    }
+
+    _used[hole] = false;
+    _values[hole] = T();
+    _size--;
+    return true;
+}
+
+template <typename T>
+void AddressMap<T>::clear() {
+    unsigned int c;
+    for(c = 0; c < _capacity; c++) {
+        if(_used[c]) { _values[c] = T(); }
+        _used[c] = false;
+    }
+    _size = 0;
+}
+
+template <typename T>
+int AddressMap<T>::findSlot(const NetAddress &addr) const {
+    unsigned int slot = addr.hash() & _mask;
+
+    while(_used[slot]) {
+        if(_keys[slot] == addr) { return (int)slot; }
+        slot = (slot + 1) & _mask;
+    }
+    return -1;
+}
+
+template <typename T>
+void AddressMap<T>::grow() {
+    NetAddress *oldKeys = _keys;
+    T *oldValues = _values;
+    bool *oldUsed = _used;
+    unsigned int oldCapacity = _capacity, c, slot;
+
+    _capacity <<= 1;
+    _mask = _capacity - 1;
+    _keys = new NetAddress[_capacity];
+    _values = new T[_capacity];
+    _used = new bool[_capacity];
+    memset(_used, 0, sizeof(bool) * _capacity);
+
+    for(c = 0; c < oldCapacity; c++) {
+        if(!oldUsed[c]) { continue; }
+
+        slot = oldKeys[c].hash() & _mask;
+        while(_used[slot]) { slot = (slot + 1) & _mask; }
+        _keys[slot] = oldKeys[c];
+        _values[slot] = oldValues[c];
+        _used[slot] = true;
+    }
+
+    delete [] oldKeys;
+    delete [] oldValues;
+    delete [] oldUsed;
+}
+
+#endif
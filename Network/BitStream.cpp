@@ -0,0 +1,194 @@
+#include <Network/BitStream.h>
+
+BitWriter::BitWriter(char *buffer, unsigned int capacity): _buffer(buffer), _capacity(capacity), _bits(0), _failed(false) {}
+
+bool BitWriter::serializeBits(uint32_t &value, unsigned int bits) {
+    unsigned int written = 0, byte, offset, chunk;
+    uint32_t remaining;
+
+    ASSERT(bits <= 32);
+    if(_failed) { return false; }
+    if(bits < 32 && (value >> bits) != 0) {
+        _failed = true;
+        return false;
+    }
+    if(_bits + bits > _capacity * 8) {
+        _failed = true;
+        return false;
+    }
+
+    remaining = value;
+    while(written < bits) {
+        byte = _bits / 8;
+        offset = _bits % 8;
+        chunk = std::min(8 - offset, bits - written);
+
+        // Starting a fresh byte, so clear whatever the buffer held before
+        if(offset == 0) { _buffer[byte] = 0; }
+        _buffer[byte] |= (char)((remaining & ((1u << chunk) - 1)) << offset);
+
+        remaining >>= chunk;
+        written += chunk;
+        _bits += chunk;
+    }
+    return true;
+}
+
+bool BitWriter::serializeBool(bool &value) {
+    uint32_t bit = value ? 1 : 0;
+    return serializeBits(bit, 1);
+}
+
+bool BitWriter::serializeFloat(float &value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return serializeBits(bits, 32);
+}
+
+bool BitWriter::serializeFloat(float &value, float min, float max, float resolution) {
+    uint32_t range = QuantizedRange(min, max, resolution), quantized;
+    // NaN would pass straight through the clamp, and can't be converted to an integer
+    float clamped = IsFinite(value) ? std::min(std::max(value, min), max) : min;
+
+    quantized = std::min((uint32_t)floor((clamped - min) / resolution + 0.5f), range);
+    return serializeBits(quantized, BitsRequired(range));
+}
+
+bool BitWriter::serializeVector(Vector2<float> &value, float min, float max, float resolution) {
+    return serializeFloat(value.x, min, max, resolution) && serializeFloat(value.y, min, max, resolution);
+}
+
+bool BitWriter::serializeVector(Vector3<float> &value, float min, float max, float resolution) {
+    return serializeFloat(value.x, min, max, resolution) && serializeFloat(value.y, min, max, resolution) && serializeFloat(value.z, min, max, resolution);
+}
+
+bool BitWriter::serializeBytes(char *data, unsigned int size) {
+    if(!align()) { return false; }
+    if(_bits / 8 + size > _capacity) {
+        _failed = true;
+        return false;
+    }
+
+    if(size > 0) { memcpy(_buffer + _bits / 8, data, size); }
+    _bits += size * 8;
+    return true;
+}
+
+bool BitWriter::align() {
+    uint32_t padding = 0;
+    if(_bits % 8 == 0) { return !_failed; }
+    return serializeBits(padding, 8 - _bits % 8);
+}
+
+bool BitWriter::hasFailed() const {
+    return _failed;
+}
+
+unsigned int BitWriter::getBitsWritten() const {
+    return _bits;
+}
+
+unsigned int BitWriter::getBytesWritten() const {
+    return (_bits + 7) / 8;
+}
+
+BitReader::BitReader(const char *buffer, unsigned int size): _buffer(buffer), _size(size), _bits(0), _failed(false) {}
+
+bool BitReader::serializeBits(uint32_t &value, unsigned int bits) {
+    unsigned int read = 0, offset, chunk;
+    uint32_t result = 0, piece;
+
+    ASSERT(bits <= 32);
+    if(_failed) { return false; }
+    if(bits > getBitsRemaining()) {
+        _failed = true;
+        return false;
+    }
+
+    while(read < bits) {
+        offset = _bits % 8;
+        chunk = std::min(8 - offset, bits - read);
+
+        piece = ((uint8_t)_buffer[_bits / 8] >> offset) & ((1u << chunk) - 1);
+        result |= piece << read;
+
+        read += chunk;
+        _bits += chunk;
+    }
+    value = result;
+    return true;
+}
+
+bool BitReader::serializeBool(bool &value) {
+    uint32_t bit;
+    if(!serializeBits(bit, 1)) { return false; }
+    value = (bit != 0);
+    return true;
+}
+
+bool BitReader::serializeFloat(float &value) {
+    uint32_t bits;
+    if(!serializeBits(bits, 32)) { return false; }
+    memcpy(&value, &bits, sizeof(value));
+    return true;
+}
+
+bool BitReader::serializeFloat(float &value, float min, float max, float resolution) {
+    uint32_t range = QuantizedRange(min, max, resolution), quantized;
+
+    if(!serializeBits(quantized, BitsRequired(range))) { return false; }
+    if(quantized > range) {
+        _failed = true;
+        return false;
+    }
+
+    value = std::min(min + quantized * resolution, max);
+    return true;
+}
+
+bool BitReader::serializeVector(Vector2<float> &value, float min, float max, float resolution) {
+    return serializeFloat(value.x, min, max, resolution) && serializeFloat(value.y, min, max, resolution);
+}
+
+bool BitReader::serializeVector(Vector3<float> &value, float min, float max, float resolution) {
+    return serializeFloat(value.x, min, max, resolution) && serializeFloat(value.y, min, max, resolution) && serializeFloat(value.z, min, max, resolution);
+}
+
+bool BitReader::serializeBytes(char *data, unsigned int size) {
+    if(!align()) { return false; }
+    if(size > _size - _bits / 8) {
+        _failed = true;
+        return false;
+    }
+
+    if(size > 0) { memcpy(data, _buffer + _bits / 8, size); }
+    _bits += size * 8;
+    return true;
+}
+
+bool BitReader::align() {
+    uint32_t padding;
+    if(_bits % 8 == 0) { return !_failed; }
+    if(!serializeBits(padding, 8 - _bits % 8)) { return false; }
+    if(padding != 0) {
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool BitReader::hasFailed() const {
+    return _failed;
+}
+
+unsigned int BitReader::getBitsRead() const {
+    return _bits;
+}
+
+unsigned int BitReader::getBytesRead() const {
+    return (_bits + 7) / 8;
+}
+
+unsigned int BitReader::getBitsRemaining() const {
+    return _size * 8 - _bits;
+}
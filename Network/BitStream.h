@@ -0,0 +1,119 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <Base/Vector2.h>
+#include <Base/Vector3.h>
+
+// Packs values into as few bits as their ranges need
+// BitWriter and BitReader share their serialize methods, so a single templated serialize function describes a message's layout for both directions:
+//     template <typename Stream> bool serialize(Stream &stream) { return stream.serializeInteger(health, 0, 100); }
+// Bits are packed least significant first into bytes, so the layout doesn't depend on the host's byte order
+// Any failure (running out of room, or reading a value outside its range) sticks, and every serialize call after it fails too
+
+// The number of bits needed to hold any value from 0 to range
+inline unsigned int BitsRequired(uint32_t range) {
+    unsigned int bits = 0;
+    while(range > 0) {
+        bits++;
+        range >>= 1;
+    }
+    return bits;
+}
+
+// Floats are quantized to the nearest multiple of resolution within [min, max]
+inline uint32_t QuantizedRange(float min, float max, float resolution) {
+    return (uint32_t)ceil((max - min) / resolution);
+}
+
+class BitWriter {
+public:
+    BitWriter(char *buffer, unsigned int capacity);
+
+    bool serializeBits(uint32_t &value, unsigned int bits);
+    bool serializeBool(bool &value);
+    // Values outside [min, max] fail
+    template <typename T>
+    bool serializeInteger(T &value, int64_t min, int64_t max);
+    // All 32 bits
+    bool serializeFloat(float &value);
+    // Values are clamped into [min, max]; infinities and NaN are written as min
+    bool serializeFloat(float &value, float min, float max, float resolution);
+    bool serializeVector(Vector2<float> &value, float min, float max, float resolution);
+    bool serializeVector(Vector3<float> &value, float min, float max, float resolution);
+    // Starts at the next whole byte
+    bool serializeBytes(char *data, unsigned int size);
+    // Pad with zeroes to the next whole byte
+    bool align();
+
+    bool hasFailed() const;
+    unsigned int getBitsWritten() const;
+    // Including any partly written byte
+    unsigned int getBytesWritten() const;
+
+private:
+    char *_buffer;
+    unsigned int _capacity;
+    unsigned int _bits;
+    bool _failed;
+};
+
+class BitReader {
+public:
+    BitReader(const char *buffer, unsigned int size);
+
+    bool serializeBits(uint32_t &value, unsigned int bits);
+    bool serializeBool(bool &value);
+    // Values outside [min, max] fail
+    template <typename T>
+    bool serializeInteger(T &value, int64_t min, int64_t max);
+    bool serializeFloat(float &value);
+    bool serializeFloat(float &value, float min, float max, float resolution);
+    bool serializeVector(Vector2<float> &value, float min, float max, float resolution);
+    bool serializeVector(Vector3<float> &value, float min, float max, float resolution);
+    bool serializeBytes(char *data, unsigned int size);
+    // Skip to the next whole byte; the padding must be zeroes
+    bool align();
+
+    bool hasFailed() const;
+    unsigned int getBitsRead() const;
+    // Including any partly read byte
+    unsigned int getBytesRead() const;
+    unsigned int getBitsRemaining() const;
+
+private:
+    const char *_buffer;
+    unsigned int _size;
+    unsigned int _bits;
+    bool _failed;
+};
+
+template <typename T>
+bool BitWriter::serializeInteger(T &value, int64_t min, int64_t max) {
+    ASSERT(min <= max && (uint64_t)(max - min) <= 0xFFFFFFFFull);
+
+    if((int64_t)value < min || (int64_t)value > max) {
+        _failed = true;
+        return false;
+    }
+
+    uint32_t offset = (uint32_t)((int64_t)value - min);
+    return serializeBits(offset, BitsRequired((uint32_t)(max - min)));
+}
+
+template <typename T>
+bool BitReader::serializeInteger(T &value, int64_t min, int64_t max) {
+    uint32_t offset;
+
+    ASSERT(min <= max && (uint64_t)(max - min) <= 0xFFFFFFFFull);
+
+    if(!serializeBits(offset, BitsRequired((uint32_t)(max - min)))) { return false; }
+    if(offset > (uint64_t)(max - min)) {
+        _failed = true;
+        return false;
+    }
+
+    value = (T)(min + (int64_t)offset);
+    return true;
+}
+
+#endif
@@ -5,7 +5,7 @@ ClientProvider::~ClientProvider() {
     TCPBuffer *buffer;
     for(itr = _buffers.begin(); itr != _buffers.end(); itr++) {
         buffer = (TCPBuffer*)itr->second;
-        buffer->stopBuffering();
+        stopBuffer(buffer);
         delete buffer;
     }
 }
@@ -15,7 +15,7 @@ bool ClientProvider::sendPacket(const Packet &packet) {
     ConnectionBufferMap::iterator itr = _buffers.find(packet.addr);
     if(itr == _buffers.end()) {
         buffer = new TCPBuffer(packet.addr);
-        buffer->startBuffering();
+        startBuffer(buffer);
         _buffers[packet.addr] = buffer;
     } else {
         buffer = (TCPBuffer*)itr->second;
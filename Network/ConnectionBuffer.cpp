@@ -1,4 +1,6 @@
 #include <Network/ConnectionBuffer.h>
+#include <Network/NetworkReactor.h>
+#include <Network/ReadyList.h>
 #include <Base/Assertion.h>
 #include <Base/Log.h>
 
@@ -16,69 +18,113 @@ int InvokeOutboundConnectionBufferThreadFunction(void *params) {
 
 unsigned int ConnectionBuffer::DefaultMaxBufferSize = 5096;
 
-unsigned int ConnectionBuffer::DefaultMaxPacketSize = 1024;
+// The largest UDP payload a 1500 byte Ethernet frame carries, so a datagram sent at any sane MTU is received whole
+unsigned int ConnectionBuffer::DefaultMaxPacketSize = 1472;
 
-ConnectionBuffer::ConnectionBuffer():
-    _socket(0), _inboundThread(0), _outboundThread(0),
-    _packetBuffer(0), _maxBufferSize(DefaultMaxBufferSize), _maxPacketSize(DefaultMaxPacketSize),
-    _droppedPackets(0), _receivedPackets(0), _sentPackets(0), _inboundPackets(0), _outboundPackets(0)
+TokenBucket ConnectionBuffer::GlobalRateLimit;
+
+ConnectionBuffer::ConnectionBuffer(unsigned int maxBufferSize):
+    _socket(0), _inboundThread(0), _outboundThread(0), _packetBuffer(0),
+    _inbound(maxBufferSize), _outbound(maxBufferSize),
+    _maxBufferSize(maxBufferSize), _maxPacketSize(DefaultMaxPacketSize),
+    _hasStalledPacket(false), _readyList(0), _reactor(0), _reactorKey(0), _capture(0)
 {
+    SDL_AtomicSet(&_inboundReady, 0);
+    SDL_AtomicSet(&_reactorWakePending, 0);
+    SDL_AtomicSet(&_inboundShouldDie, 0);
+    SDL_AtomicSet(&_outboundShouldDie, 0);
+    SDL_AtomicSet(&_closed, 0);
 }
 
 ConnectionBuffer::~ConnectionBuffer() {
-    ASSERT(!_inboundThread && !_outboundThread);
+    ASSERT(!_inboundThread && !_outboundThread && !_reactor);
 }
 
 void ConnectionBuffer::startBuffering() {
-    if(!_inboundThread) {
-        _inboundQueueLock  = SDL_CreateMutex();
-        _inboundLock = SDL_CreateMutex();
-        _inboundShouldDie = false;
+    if(_reactor) {
+        Warn("Buffer is already being serviced by a NetworkReactor");
+        return;
+    }
 
-        _packetBuffer = (char*)calloc(_maxPacketSize, sizeof(char));
+    allocateBuffers();
+    if(!_inboundThread) {
+        SDL_AtomicSet(&_inboundShouldDie, 0);
         _inboundThread = SDL_CreateThread(InvokeInboundConnectionBufferThreadFunction, "InboundConnectionBufferThread", (void*)this);
     }
     if(!_outboundThread) {
-        _outboundQueueLock = SDL_CreateMutex();
-        _outboundLock = SDL_CreateMutex();
-        _outboundShouldDie = false;
-
+        SDL_AtomicSet(&_outboundShouldDie, 0);
         _outboundThread = SDL_CreateThread(InvokeOutboundConnectionBufferThreadFunction, "OutboundConnectionBufferThread", (void*)this);
     }
 }
 
 void ConnectionBuffer::stopBuffering() {
+    bool wasBuffering = isBuffering();
+
+    if(_reactor) {
+        _reactor->detach(this);
+    }
     if(_inboundThread) {
         int status;
-    
-        SDL_LockMutex(_inboundLock);
-        _inboundShouldDie = true;
-        SDL_UnlockMutex(_inboundLock);
+
+        SDL_AtomicSet(&_inboundShouldDie, 1);
         SDL_WaitThread(_inboundThread, &status);
         _inboundThread = 0;
-
-        free(_packetBuffer);
-        _packetBuffer = 0;
-        
-        SDL_DestroyMutex(_inboundQueueLock);
-        SDL_DestroyMutex(_inboundLock);
     }
     if(_outboundThread) {
         int status;
 
-        SDL_LockMutex(_outboundLock);
-        _outboundShouldDie = true;
-        SDL_UnlockMutex(_outboundLock);
+        SDL_AtomicSet(&_outboundShouldDie, 1);
         SDL_WaitThread(_outboundThread, &status);
         _outboundThread = 0;
-        
-        SDL_DestroyMutex(_outboundQueueLock);
-        SDL_DestroyMutex(_outboundLock);
+    }
+
+    if(wasBuffering) {
+        freeBuffers();
+    }
+}
+
+bool ConnectionBuffer::isBuffering() const {
+    return (_inboundThread || _outboundThread || _reactor);
+}
+
+void ConnectionBuffer::doInboundBuffering() {
+    Debug("Entering inbound packet buffering loop");
+    while(!inboundShouldDie()) {
+        // Back off briefly when the socket has nothing for us rather than spinning
+        if(!serviceInbound(_maxBufferSize)) {
+            markClosed();
+            SDL_Delay(1);
+        } else if(_socket->recvWouldBlock()) {
+            SDL_Delay(1);
+        }
+    }
+}
+
+void ConnectionBuffer::doOutboundBuffering() {
+    unsigned int delay;
+
+    Debug("Entering outbound packet buffering loop");
+    while(!outboundShouldDie()) {
+        // Sleep while there's nothing queued (or the socket is backed up) instead of polling an empty ring
+        if(serviceOutbound(_maxBufferSize)) {
+            SDL_Delay(1);
+        } else if((delay = getPacingDelay()) > 0) {
+            // Held back by a rate limit; wait until it lets the next packet through
+            SDL_Delay(delay);
+        }
     }
 }
 
 void ConnectionBuffer::setMaxBufferSize(unsigned int maxPackets) {
+    if(isBuffering()) {
+        Warn("Unable to resize buffer while buffering is active");
+        return;
+    }
+
+    // Any packets still sitting in the rings are discarded
     _maxBufferSize = maxPackets;
+    _inbound.resize(_maxBufferSize);
+    _outbound.resize(_maxBufferSize);
 }
 
 unsigned int ConnectionBuffer::getMaxBufferSize() {
@@ -86,50 +132,140 @@ unsigned int ConnectionBuffer::getMaxBufferSize() {
 }
 
 void ConnectionBuffer::setMaxPacketSize(unsigned int maxSize) {
+    if(isBuffering()) {
+        Warn("Unable to change maximum packet size while buffering is active");
+        return;
+    }
+
     _maxPacketSize = maxSize;
-    SDL_LockMutex(_inboundQueueLock);
-    _packetBuffer = (char*)realloc(_packetBuffer, _maxPacketSize*sizeof(char));
-    SDL_UnlockMutex(_inboundQueueLock);
 }
 
 unsigned int ConnectionBuffer::getMaxPacketSize() {
     return _maxPacketSize;
 }
 
+void ConnectionBuffer::setRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes) {
+    _rateLimit.setRate(bytesPerSecond, burstBytes);
+    // Anything the old limit was holding back may be able to go now
+    wakeOutbound();
+}
+
+unsigned int ConnectionBuffer::getRateLimit() {
+    return _rateLimit.getRate();
+}
+
+void ConnectionBuffer::SetGlobalRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes) {
+    GlobalRateLimit.setRate(bytesPerSecond, burstBytes);
+}
+
+unsigned int ConnectionBuffer::GetGlobalRateLimit() {
+    return GlobalRateLimit.getRate();
+}
+
+unsigned int ConnectionBuffer::getPacingDelay() {
+    return std::max(_rateLimit.getDelay(), GlobalRateLimit.getDelay());
+}
+
 bool ConnectionBuffer::providePacket(const Packet &packet) {
-    bool ret;
-
-    SDL_LockMutex(_outboundQueueLock);
-    _outbound.push(packet);
-    if(_outbound.size() > _maxBufferSize) {
-        _outbound.pop();
-        SDL_LockMutex(_inboundQueueLock);
-        _droppedPackets++;
-        SDL_UnlockMutex(_inboundQueueLock);
-        ret = false;
+    if(_outbound.push(packet)) {
+        if(_capture) { _capture->record(CaptureOutbound, packet); }
+        _counters.noteOutboundDepth(_outbound.size());
+        wakeOutbound();
+        return true;
     } else {
-        _outboundPackets++;
-        ret = true;
+        _counters.countDropped(DropOutboundFull);
+        return false;
     }
-    SDL_UnlockMutex(_outboundQueueLock);
+}
 
-    return ret;
+void ConnectionBuffer::wakeOutbound() {
+    // Buffers with their own threads poll instead
+    if(_reactor) { _reactor->notifyOutbound(this); }
 }
 
 bool ConnectionBuffer::consumePacket(Packet &packet) {
-    bool ret;
+    if(!_inbound.pop(packet)) { return false; }
+    if(_capture) { _capture->record(CaptureInbound, packet); }
+    return true;
+}
 
-    SDL_LockMutex(_inboundQueueLock);
-    if(_inbound.empty()) { ret = false; }
-    else {
-        packet = _inbound.front();
-        _inbound.pop();
-        _inboundPackets--;
-        ret = true;
+void ConnectionBuffer::setCapture(PacketCaptureWriter *capture) {
+    _capture = capture;
+}
+
+bool ConnectionBuffer::isClosed() const {
+    return SDL_AtomicGet((SDL_atomic_t*)&_closed) != 0;
+}
+
+void ConnectionBuffer::markClosed() {
+    ReadyList *readyList;
+
+    if(!SDL_AtomicCAS(&_closed, 0, 1)) { return; }
+
+    // If the buffer's already waiting to be consumed, the consumer will find it closed once it's drained anyway
+    if(SDL_AtomicCAS(&_inboundReady, 0, 1)) {
+        readyList = (ReadyList*)SDL_AtomicGetPtr((void**)&_readyList);
+        if(readyList) { readyList->signal(this); }
+    }
+}
+
+void ConnectionBuffer::rearmInbound() {
+    ReadyList *readyList;
+
+    SDL_AtomicSet(&_inboundReady, 0);
+    // A buffer that closed while it was waiting is signalled again, so its consumer gets to see it closed
+    if((!_inbound.empty() || isClosed()) && SDL_AtomicCAS(&_inboundReady, 0, 1)) {
+        readyList = (ReadyList*)SDL_AtomicGetPtr((void**)&_readyList);
+        if(readyList) { readyList->signal(this); }
+    }
+}
+
+bool ConnectionBuffer::bufferInbound(const Packet &packet) {
+    ReadyList *readyList;
+
+    _counters.countReceived(packet.size);
+
+    if(_inbound.push(packet)) {
+        _counters.noteInboundDepth(_inbound.size());
+        // Only the first arrival since the consumer last rearmed the buffer needs to signal it
+        if(SDL_AtomicCAS(&_inboundReady, 0, 1)) {
+            readyList = (ReadyList*)SDL_AtomicGetPtr((void**)&_readyList);
+            if(readyList) { readyList->signal(this); }
+        }
+        return true;
+    } else {
+        _counters.countDropped(DropInboundFull);
+        return false;
     }
-    SDL_UnlockMutex(_inboundQueueLock);
+}
 
-    return ret;
+bool ConnectionBuffer::nextOutbound(Packet &packet) {
+    if(_hasStalledPacket) {
+        packet.release();
+        packet.swap(_stalledPacket);
+        _hasStalledPacket = false;
+        return true;
+    }
+    return _outbound.pop(packet);
+}
+
+bool ConnectionBuffer::hasOutbound() {
+    return (_hasStalledPacket || !_outbound.empty());
+}
+
+void ConnectionBuffer::stallOutbound(Packet &packet) {
+    ASSERT(!_hasStalledPacket);
+    _stalledPacket.swap(packet);
+    _hasStalledPacket = true;
+}
+
+bool ConnectionBuffer::canSend() {
+    return (_rateLimit.hasTokens() && GlobalRateLimit.hasTokens());
+}
+
+void ConnectionBuffer::chargeSent(unsigned int bytes) {
+    _rateLimit.consume(bytes);
+    GlobalRateLimit.consume(bytes);
 }
 
 unsigned short ConnectionBuffer::getLocalPort() const {
@@ -140,14 +276,36 @@ unsigned short ConnectionBuffer::getLocalPort() const {
     }
 }
 
+void ConnectionBuffer::allocateBuffers() {
+    if(!_packetBuffer) {
+        _packetBuffer = (char*)calloc(_maxPacketSize, sizeof(char));
+    }
+}
+
+void ConnectionBuffer::freeBuffers() {
+    if(_packetBuffer) {
+        free(_packetBuffer);
+        _packetBuffer = 0;
+    }
+}
+
+int ConnectionBuffer::getSocketHandle() const {
+    return _socket ? _socket->getHandle() : 0;
+}
+
+void ConnectionBuffer::getMetrics(NetworkMetrics &metrics) const {
+    _counters.snapshot(metrics);
+}
+
 void ConnectionBuffer::logStatistics() {
-    SDL_LockMutex(_inboundQueueLock);
-    SDL_LockMutex(_outboundQueueLock);
-    Info("Inbound packets: " << _inboundPackets);
-    Info("Outbound packets: " << _outboundPackets);
-    Info("Dropped packets: " << _droppedPackets);
-    Info("Sent packets: " << _sentPackets);
-    Info("Received packets: " << _receivedPackets);
-    SDL_UnlockMutex(_outboundQueueLock);
-    SDL_UnlockMutex(_inboundQueueLock);
+    NetworkMetrics metrics;
+    getMetrics(metrics);
+
+    Info("Inbound packets: " << _inbound.size() << " (at most " << metrics.inboundHighWater << ")");
+    Info("Outbound packets: " << _outbound.size() << " (at most " << metrics.outboundHighWater << ")");
+    Info("Dropped packets: " << metrics.getDropped() << " (" << metrics.dropped[DropInboundFull] << " inbound full, " <<
+         metrics.dropped[DropOutboundFull] << " outbound full, " << metrics.dropped[DropOversized] << " oversized, " <<
+         metrics.dropped[DropSendFailed] << " send failed, " << metrics.dropped[DropMalformed] << " malformed)");
+    Info("Sent packets: " << metrics.packetsSent << " (" << metrics.bytesSent << " bytes in " << metrics.sendCalls << " calls)");
+    Info("Received packets: " << metrics.packetsReceived << " (" << metrics.bytesReceived << " bytes in " << metrics.recvCalls << " calls)");
 }
@@ -1,69 +1,152 @@
 #ifndef CONNECTIONBUFFER_H
 #define CONNECTIONBUFFER_H
 
-#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_atomic.h>
 #include <SDL2/SDL_thread.h>
 
 #include <Network/Packet.h>
+#include <Network/PacketRing.h>
+#include <Network/NetworkMetrics.h>
+#include <Network/TokenBucket.h>
+#include <Network/PacketCapture.h>
 
+class NetworkReactor;
+class ReadyList;
+
+// Packets move between the game thread and the buffering threads through a pair of lock-free rings
+// providePacket and consumePacket are each expected to be called from a single (game) thread
+// A buffer's socket is serviced either by its own pair of threads (startBuffering) or by a shared NetworkReactor
 class ConnectionBuffer {
 public:
-    ConnectionBuffer();
+    ConnectionBuffer(unsigned int maxBufferSize = DefaultMaxBufferSize);
     virtual ~ConnectionBuffer();
 
     void startBuffering();
+    // Also detaches the buffer from its NetworkReactor, if it has one
     void stopBuffering();
-    virtual void doInboundBuffering() = 0;
-    virtual void doOutboundBuffering() = 0;
+    bool isBuffering() const;
+    virtual void doInboundBuffering();
+    virtual void doOutboundBuffering();
+
+    // Single non-blocking passes over the socket, moving at most maxPackets packets
+    // serviceInbound returns false once the socket has closed or failed
+    virtual bool serviceInbound(unsigned int maxPackets) = 0;
+    // Set once whatever services the buffer has seen serviceInbound fail; the buffer is signalled ready one last time, so its consumer notices
+    bool isClosed() const;
+    // serviceOutbound returns false if anything is left queued, either because the socket would block or because maxPackets was reached
+    virtual bool serviceOutbound(unsigned int maxPackets) = 0;
 
     // Determine how many packets are buffered before they start being dropped
+    // Can only be changed while the buffer is stopped
     void setMaxBufferSize(unsigned int maxPackets);
     unsigned int getMaxBufferSize();
 
     // Determine the maximum packet size
+    // Can only be changed while the buffer is stopped
     void setMaxPacketSize(unsigned int maxSize);
     unsigned int getMaxPacketSize();
 
-    // TODO - Write bandwidth limiting code
+    // Limit the rate this buffer sends at; a rate of 0 removes the limit
+    // Outgoing packets are held in the outbound queue (rather than handed to the kernel) until the limit allows them through
+    void setRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes = 0);
+    unsigned int getRateLimit();
+
+    // A limit shared by every buffer, checked on top of each buffer's own
+    static void SetGlobalRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes = 0);
+    static unsigned int GetGlobalRateLimit();
+
+    // Milliseconds until the rate limits let anything more through, 0 if they aren't holding anything back
+    virtual unsigned int getPacingDelay();
 
     // Returns false if the packet queue is full
     bool providePacket(const Packet &packet);
+    // Let whatever services this buffer know there's outbound data waiting; providePacket does this itself
+    void wakeOutbound();
     // Returns false if there are no packets to consume
     bool consumePacket(Packet &packet);
+    // The buffer signals its ReadyList once when packets arrive, then stays quiet until the consumer calls this
+    // If packets are still waiting the buffer is signalled again straight away
+    void rearmInbound();
 
     unsigned short getLocalPort() const;
+    int getSocketHandle() const;
+
+    // Safe to call from any thread, at any time
+    void getMetrics(NetworkMetrics &metrics) const;
+
+    // Record every packet provided to or consumed from this buffer; 0 stops recording
+    // The capture must outlive the buffer, or recording be stopped first
+    void setCapture(PacketCaptureWriter *capture);
 
     // DEBUG
     void logStatistics();
 
+protected:
+    // Scratch space needed while the buffer is active, allocated by startBuffering or NetworkReactor::attach
+    virtual void allocateBuffers();
+    virtual void freeBuffers();
+
+    // Called from the buffering threads
+    inline bool inboundShouldDie()  { return SDL_AtomicGet(&_inboundShouldDie) != 0; }
+    inline bool outboundShouldDie() { return SDL_AtomicGet(&_outboundShouldDie) != 0; }
+
+    // Queue an incoming packet for consumption, counting it as dropped if the inbound ring is full
+    virtual bool bufferInbound(const Packet &packet);
+    // Fetch the next packet waiting to be sent
+    virtual bool nextOutbound(Packet &packet);
+    // True while nextOutbound has something to return
+    virtual bool hasOutbound();
+    // Put back a packet the socket wasn't ready for; it will be the next one returned by nextOutbound
+    void stallOutbound(Packet &packet);
+
+    // Called from whichever thread services the inbound side, once the socket has closed
+    void markClosed();
+
+    // True if the rate limits allow anything more to be sent right now
+    bool canSend();
+    // Charge bytes that have just been sent against the rate limits
+    void chargeSent(unsigned int bytes);
+
 protected:
     Socket *_socket;
 
     static unsigned int DefaultMaxBufferSize;
     static unsigned int DefaultMaxPacketSize;
 
-    // Why SDL decided to capitalize Thread and not mutex escapes me
-    SDL_mutex *_inboundQueueLock, *_outboundQueueLock, *_inboundLock, *_outboundLock;
     SDL_Thread *_inboundThread, *_outboundThread;
-    bool _inboundShouldDie, _outboundShouldDie;
+    SDL_atomic_t _inboundShouldDie, _outboundShouldDie;
+    SDL_atomic_t _closed;
 
     char *_packetBuffer;
 
-    typedef std::queue<Packet> PacketQueue;
-    PacketQueue _inbound;
-    PacketQueue _outbound;
+    PacketRing _inbound;
+    PacketRing _outbound;
 
     unsigned int _maxBufferSize;
     unsigned int _maxPacketSize;
 
-    // Statistics
-    unsigned int _droppedPackets;
+    // Only touched by whichever thread services the outbound side
+    Packet _stalledPacket;
+    bool _hasStalledPacket;
+
+    TokenBucket _rateLimit;
+    static TokenBucket GlobalRateLimit;
+
+    // Set by ReadyList::attach; _inboundReady is set from the first arrival until rearmInbound
+    friend class ReadyList;
+    ReadyList *_readyList;
+    SDL_atomic_t _inboundReady;
+
+    // Set by NetworkReactor::attach
+    friend class NetworkReactor;
+    NetworkReactor *_reactor;
+    uint64_t _reactorKey;
+    SDL_atomic_t _reactorWakePending;
 
-    unsigned int _receivedPackets;
-    unsigned int _sentPackets;
+    NetworkCounters _counters;
 
-    unsigned int _inboundPackets;
-    unsigned int _outboundPackets;
+    // Set and used from the game thread, alongside providePacket and consumePacket
+    PacketCaptureWriter *_capture;
 };
 
 typedef std::map<NetAddress,ConnectionBuffer*> ConnectionBufferMap;
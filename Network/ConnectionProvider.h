@@ -2,11 +2,19 @@
 #define CONNECTIONPROVIDER_H
 
 #include <Network/Packet.h>
+#include <Network/NetworkMetrics.h>
+#include <Network/PacketCapture.h>
 
 class ConnectionProvider {
 public:
     virtual bool sendPacket(const Packet &packet) = 0;
     virtual bool recvPacket(Packet &packet) = 0;
+
+    // Totals across everything the provider has sent and received; providers that don't keep count report nothing
+    virtual void getMetrics(NetworkMetrics &metrics) { metrics.clear(); }
+
+    // Record every packet sent and received to a capture, or stop recording with 0; providers that can't record ignore this
+    virtual void setCapture(PacketCaptureWriter *capture) {}
 };
 
 #endif
@@ -1,11 +1,19 @@
 #include <Network/GhastlyClient.h>
 #include <Base/Assertion.h>
 
-GhastlyClient::GhastlyClient(): GhastlyHost(ID_UNASSIGNED), _state(NOT_CONNECTED) {
+GhastlyClient::GhastlyClient(): GhastlyHost(ID_UNASSIGNED), _state(NOT_CONNECTED), _connection(0),
+    _pingInterval(DEFAULT_PING_INTERVAL), _sincePing(0), _hasView(false), _latestSnapshot(0),
+    _time(0)
+{
+    _interpolation.setDelay(DEFAULT_INTERPOLATION_DELAY);
 }
 
 GhastlyClient::~GhastlyClient() {
     disconnect();
+    if(_connection) {
+        _connection->flush();
+        delete _connection;
+    }
 }
 
 ClientState GhastlyClient::getState() const {
@@ -13,43 +21,92 @@ ClientState GhastlyClient::getState() const {
 }
 
 void GhastlyClient::update(int elapsed) {
-    Packet packet;
-    while(recvPacket(packet)) {
-        onPacketReceive(packet);
+    Packet packet, payload;
+    unsigned int received = 0;
+
+    beginUpdate();
+    _time += std::max(elapsed, 0);
+
+    while(received < _maxPacketsPerUpdate && recvPacket(packet)) {
+        received++;
+        // Only the server is listened to
+        if(!_connection || packet.addr != _server) { continue; }
+
+        _connection->receive(packet);
+        while(_connection->nextPayload(payload)) {
+            onPacketReceive(payload);
+        }
+    }
+
+    if(_connection) {
+        // Takes care of resending the ID request (or anything else reliable) if it went missing
+        _connection->update(elapsed);
+        if(_connection->hasFailed() && _state != NOT_CONNECTED) {
+            _id = ID_UNASSIGNED;
+            _state = NOT_CONNECTED;
+            Info("Lost connection to server");
+        }
+
+        // Let the server know we're still here if nothing else has
+        if(_state != NOT_CONNECTED && _connection->getSinceSent() >= _keepaliveInterval) {
+            Keepalive keepalive;
+            SendPayload(_connection, UnreliableChannel, keepalive);
+        }
     }
 
     switch(_state) {
     //case NOT_CONNECTED:
     //    break;
-    case AWAITING_ID: {
-        IDRequest idreq;
-        sendPacket(Packet(_server, (char*)&idreq, sizeof(idreq)));
-        break;
-    }
+    //case AWAITING_ID:
+    //    break;
     case AWAITING_DATA:
         _state = READY;
         break;
-    //case READY:
-    //    break;
+    case READY:
+        _sincePing += std::max(elapsed, 0);
+        if(_sincePing >= _pingInterval) {
+            PingRequest ping(GhastlyLatency::GetTimestamp());
+            SendPayload(_connection, UnreliableChannel, ping);
+            _sincePing = 0;
+
+            // The view goes out on a lossy channel, so keep it fresh
+            sendView();
+        }
+        break;
     //default:
     //    Error("Unknown client state " << _state);
     //    break;
     };
+
+    endUpdate();
+}
+
+void GhastlyClient::holdOutbound() {
+    if(_connection) { _connection->hold(); }
+}
+
+void GhastlyClient::flushOutbound() {
+    if(_connection) { _connection->flush(); }
 }
 
 void GhastlyClient::onPacketReceive(const Packet &packet) {
-    Payload *payload = (Payload*)packet.data;
-    switch(payload->type) {
-    case IDAssignType:
+    switch(GetPayloadType(packet)) {
+    case IDAssignType: {
+        IDAssign assign;
+        if(!ReadPayload(assign, packet)) { break; }
+
         if(_state == AWAITING_ID) {
-            _id = ((IDAssign*)payload)->id;
+            _id = assign.id;
             //_state = AWAITING_DATA;
             _state = READY;
+            // Ping right away rather than waiting out the first interval
+            _sincePing = _pingInterval;
             Info("Got ID " << _id << " from server");
         } else {
-            Warn("Already had ID " << _id << " but got id " << ((IDAssign*)payload)->type << " from server");
+            Warn("Already had ID " << _id << " but got id " << assign.id << " from server");
         }
         break;
+    }
     case HostRejectType:
         if(_state == AWAITING_ID) {
             _state = NOT_CONNECTED;
@@ -62,11 +119,32 @@ void GhastlyClient::onPacketReceive(const Packet &packet) {
         if(_state != NOT_CONNECTED) {
             _id = ID_UNASSIGNED;
             _state = NOT_CONNECTED;
+            // The server may not be around much longer to hear it
+            _connection->flushAcks();
             Info("Server disconnected");
         }
         break;
+    case KeepaliveType:
+        break;
+    case SnapshotType:
+        if(_state == READY) {
+            onSnapshot(packet);
+        }
+        break;
+    case PingResponseType: {
+        PingResponse response;
+        if(!ReadPayload(response, packet)) { break; }
+
+        PingTimestamp now = GhastlyLatency::GetTimestamp();
+        _latency.addSample(response.client, response.server, now);
+
+        // Give the server its half of the measurement
+        PingDone done(response.server, now);
+        SendPayload(_connection, UnreliableChannel, done);
+        break;
+    }
     default:
-        handleCustomPayload(payload);
+        handleCustomPayload(packet);
         break;
     }
 }
@@ -75,15 +153,142 @@ void GhastlyClient::connect(const NetAddress &addr) {
     if(_state == NOT_CONNECTED) {
         _server = addr;
         _state  = AWAITING_ID;
+        // Sequences start over with each connection
+        _snapshots = GhastlySnapshotHistory();
+        _latestSnapshot = 0;
+        _latency = GhastlyLatency();
+        _prediction.reset();
+        _interpolation.reset();
+
+        if(_connection) {
+            _connection->flush();
+            delete _connection;
+        }
+        _connection = new GhastlyConnection(this, _server);
+        _connection->setMTU(_mtu);
+        if(isHoldingOutbound()) { _connection->hold(); }
+
         IDRequest idReq;
-        sendPacket(Packet(_server, (char*)&idReq, sizeof(idReq)));
+        SendPayload(_connection, ReliableChannel, idReq);
     }
 }
 
 void GhastlyClient::disconnect() {
     if(_state != NOT_CONNECTED) {
         Disconnect dc;
-        sendPacket(Packet(_server, (char*)&dc, sizeof(dc)));
+        SendPayload(_connection, ReliableChannel, dc);
         _state = NOT_CONNECTED;
     }
 }
+
+const GhastlySnapshot *GhastlyClient::getSnapshot() const {
+    return _snapshots.find(_latestSnapshot);
+}
+
+const GhastlyConnection *GhastlyClient::getConnection() const {
+    return _connection;
+}
+
+const GhastlyLatency &GhastlyClient::getLatency() const {
+    return _latency;
+}
+
+void GhastlyClient::setPingInterval(unsigned int milliseconds) {
+    _pingInterval = milliseconds;
+}
+
+void GhastlyClient::setMTU(unsigned int mtu) {
+    GhastlyHost::setMTU(mtu);
+    if(_connection) { _connection->setMTU(mtu); }
+}
+
+void GhastlyClient::setView(const AABB2<float> &view) {
+    _view = view;
+    _hasView = true;
+    sendView();
+}
+
+void GhastlyClient::setSimulation(GhastlySimulation *simulation) {
+    _prediction.setSimulation(simulation);
+    _interpolation.setSimulation(simulation);
+}
+
+InputSequence GhastlyClient::sendInput(const char *input, unsigned int size, unsigned int duration) {
+    char buffer[MaxInputCommandsSize];
+    InputCommands commands;
+    InputSequence sequence;
+    unsigned int written;
+
+    if(_state != READY) { return 0; }
+
+    sequence = _prediction.addInput(input, size, duration);
+
+    // Every command the server hasn't been seen to process goes again, so one lost packet costs nothing
+    if(_prediction.getCommands(commands)) {
+        written = WritePayload(commands, buffer, MaxInputCommandsSize);
+        ASSERT(written > 0);
+        _connection->send(UnreliableChannel, buffer, written);
+    }
+    return sequence;
+}
+
+void GhastlyClient::setPredictedEntity(EntityID id) {
+    _prediction.setEntity(id);
+}
+
+const char *GhastlyClient::getPredictedState(unsigned int &size) const {
+    return _prediction.getState(size);
+}
+
+const GhastlyPrediction &GhastlyClient::getPrediction() const {
+    return _prediction;
+}
+
+void GhastlyClient::setInterpolationDelay(unsigned int milliseconds) {
+    _interpolation.setDelay(milliseconds);
+}
+
+bool GhastlyClient::getInterpolated(EntityID id, char *state, unsigned int &size) const {
+    return _interpolation.sample(_snapshots, id, _time, state, size);
+}
+
+void GhastlyClient::sendView() {
+    if(!_hasView || _state != READY) { return; }
+
+    ViewUpdate update(_view.getLowerBound().x, _view.getLowerBound().y, _view.getUpperBound().x, _view.getUpperBound().y);
+    SendPayload(_connection, SequencedChannel, update);
+}
+
+void GhastlyClient::onSnapshot(const Packet &packet) {
+    const GhastlySnapshot *baseline = 0;
+    SnapshotHeader header;
+    unsigned int headerSize;
+
+    if(!ReadPayload(header, packet.data, packet.size, &headerSize)) { return; }
+
+    // Anything older than what we already have is of no use
+    if(header.sequence <= _latestSnapshot) { return; }
+
+    if(header.baseline != 0) {
+        baseline = _snapshots.find(header.baseline);
+        if(!baseline || header.sequence - header.baseline >= GhastlySnapshotHistory::Size) {
+            Warn("Dropping snapshot " << header.sequence << ", baseline " << header.baseline << " is no longer available");
+            return;
+        }
+    }
+
+    GhastlySnapshot &snapshot = _snapshots.record(header.sequence);
+    if(!snapshot.decode(baseline, packet.data + headerSize, packet.size - headerSize)) {
+        Warn("Dropping malformed snapshot " << header.sequence);
+        snapshot.clear();
+        snapshot.setSequence(0);
+        return;
+    }
+    _latestSnapshot = header.sequence;
+
+    _interpolation.record(header.sequence, _time);
+    _prediction.reconcile(header.input, snapshot);
+
+    SnapshotAck ack(header.sequence);
+    SendPayload(_connection, UnreliableChannel, ack);
+}
@@ -2,10 +2,20 @@
 #define GHASTLYCLIENT_H
 
 #include <Network/GhastlyHost.h>
+#include <Network/GhastlySnapshot.h>
+#include <Network/GhastlyPrediction.h>
+#include <Network/GhastlyConnection.h>
+#include <Network/GhastlyLatency.h>
+#include <Base/AABB2.h>
 #include <Network/SimpleUDPProvider.h>
 
 typedef unsigned char ClientState;
 
+// How often a connected client pings the server, in milliseconds
+#define DEFAULT_PING_INTERVAL  1000
+// How far in the past other entities are shown, in milliseconds
+#define DEFAULT_INTERPOLATION_DELAY 100
+
 class GhastlyClient: public GhastlyHost, public SimpleUDPProvider {
 public:
     enum {
@@ -26,9 +36,66 @@ public:
     void connect(const NetAddress &addr);
     void disconnect();
 
+    // The newest world state received from the server, or 0 if none has arrived yet
+    const GhastlySnapshot *getSnapshot() const;
+
+    // The channels to the server, or 0 if the client has never connected
+    const GhastlyConnection *getConnection() const;
+
+    // What pings have measured of the server, including its clock
+    const GhastlyLatency &getLatency() const;
+    void setPingInterval(unsigned int milliseconds);
+
+    void setMTU(unsigned int mtu);
+
+    // Tell the server which region of the world we're looking at, so that snapshots only carry what's nearby
+    void setView(const AABB2<float> &view);
+
+    // The game's rules for predicting and interpolating entity states
+    void setSimulation(GhastlySimulation *simulation);
+
+    // Send an input command for the entity we control, predicting its outcome right away
+    // Returns the command's sequence, or 0 if we aren't connected
+    InputSequence sendInput(const char *input, unsigned int size, unsigned int duration);
+    // The entity our inputs control, as it appears in the server's snapshots
+    void setPredictedEntity(EntityID id);
+    // Our entity's predicted state, or 0 if no snapshot has carried it yet
+    const char *getPredictedState(unsigned int &size) const;
+    const GhastlyPrediction &getPrediction() const;
+
+    void setInterpolationDelay(unsigned int milliseconds);
+    // Any other entity's state, interpolated between the snapshots either side of the interpolation delay ago
+    bool getInterpolated(EntityID id, char *state, unsigned int &size) const;
+
+protected:
+    void holdOutbound();
+    void flushOutbound();
+
+private:
+    void onSnapshot(const Packet &packet);
+    void sendView();
+
 private:
     ClientState _state;
     NetAddress _server;
+    // Outlives a disconnect so that the disconnect itself can still be retransmitted
+    GhastlyConnection *_connection;
+
+    GhastlyLatency _latency;
+    unsigned int _pingInterval;
+    // Milliseconds since the last ping went out
+    unsigned int _sincePing;
+
+    AABB2<float> _view;
+    bool _hasView;
+
+    GhastlySnapshotHistory _snapshots;
+    SnapshotSequence _latestSnapshot;
+
+    // Milliseconds of updates since the client was created, for timing snapshot arrivals
+    uint32_t _time;
+    GhastlyPrediction _prediction;
+    GhastlyInterpolation _interpolation;
 };
 
 #endif
\ No newline at end of file
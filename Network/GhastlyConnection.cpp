@@ -0,0 +1,658 @@
+#include <Network/GhastlyConnection.h>
+#include <Base/Assertion.h>
+#include <Base/Log.h>
+
+const unsigned int GhastlyConnection::ReliableWindow;
+const unsigned int GhastlyConnection::SentHistory;
+const unsigned int GhastlyConnection::MaxReassemblies;
+
+unsigned int GhastlyConnection::DefaultRetransmitTimeout = 100;
+unsigned int GhastlyConnection::MinRetransmitTimeout = 20;
+unsigned int GhastlyConnection::MaxRetransmitTimeout = 1000;
+unsigned int GhastlyConnection::MaxRetransmissions = 10;
+// Leaves room for IP and UDP headers, and then some, under the usual 1500 byte Ethernet MTU
+unsigned int GhastlyConnection::DefaultMTU = 1200;
+// Enough for a payload in as many fragments as can be sent, at the default MTU
+unsigned int GhastlyConnection::DefaultReassemblyLimit = 64 * 1024;
+unsigned int GhastlyConnection::ReassemblyTimeout = 1000;
+
+GhastlyConnection::GhastlyConnection(ConnectionProvider *provider, const NetAddress &remote):
+    _provider(provider), _remote(remote), _time(0), _failed(false),
+    _localSequence(0), _lastSent(0), _holding(false), _mtu(DefaultMTU),
+    _hasRemote(false), _acksOwed(false), _remoteSequence(0), _remoteBits(0),
+    _sequencedOut(0), _reliableOldest(0), _reliableNext(0), _retransmissions(0),
+    _hasSequenced(false), _sequencedIn(0), _reliableExpected(0),
+    _fragmentNext(0), _reassemblyLimit(DefaultReassemblyLimit), _reassemblyDrops(0),
+    _hasRoundTrip(false), _roundTrip(0), _roundTripVariance(0)
+{
+    unsigned int c;
+
+    for(c = 0; c < SentHistory; c++) {
+        _sent[c].pending = false;
+    }
+    for(c = 0; c < ReliableWindow; c++) {
+        _reliableOut[c].pending = false;
+        _reliableArrived[c] = false;
+    }
+    for(c = 0; c < MaxReassemblies; c++) {
+        _reassemblies[c].active = false;
+    }
+}
+
+const NetAddress &GhastlyConnection::getRemote() const {
+    return _remote;
+}
+
+bool GhastlyConnection::send(Channel channel, const char *payload, unsigned int size) {
+    unsigned int fragments;
+    uint16_t sequence;
+
+    if(_failed) { return false; }
+
+    fragments = getFragmentCount(size);
+    if(fragments > ((channel == ReliableChannel) ? MaxReliableFragments : MaxFragments)) {
+        Warn("Payload of " << size << " bytes is too big to send to " << _remote << ", even in fragments");
+        return false;
+    }
+
+    switch(channel) {
+    case UnreliableChannel:
+    case SequencedChannel:
+        sequence = (channel == SequencedChannel) ? _sequencedOut++ : 0;
+        if(fragments > 0) {
+            transmitFragments(channel, sequence, _fragmentNext++, fragments, payload, size, false, 0);
+        } else {
+            transmit(channel, sequence, payload, size, false);
+        }
+        break;
+    case ReliableChannel: {
+        if((uint16_t)(_reliableNext - _reliableOldest) >= ReliableWindow) {
+            Warn("Reliable window to " << _remote << " is full, payload not sent");
+            return false;
+        }
+
+        ReliableMessage &message = _reliableOut[_reliableNext % ReliableWindow];
+        message.payload = Packet(_remote, payload, size);
+        message.sequence = _reliableNext++;
+        message.lastSent = _time;
+        message.transmissions = 1;
+        message.pending = true;
+        message.fragments = fragments;
+        message.fragmentMessage = (fragments > 0) ? _fragmentNext++ : 0;
+        message.fragmentsAcked = 0;
+        transmitReliable(message);
+        break;
+    }
+    default:
+        Error("Can't send a payload on channel " << channel);
+        return false;
+    }
+    return true;
+}
+
+void GhastlyConnection::transmitReliable(ReliableMessage &message) {
+    if(message.fragments > 0) {
+        transmitFragments(ReliableChannel, message.sequence, message.fragmentMessage, message.fragments, message.payload.data, message.payload.size, true, message.fragmentsAcked);
+    } else {
+        transmit(ReliableChannel, message.sequence, message.payload.data, message.payload.size, true);
+    }
+}
+
+unsigned int GhastlyConnection::getFragmentCount(unsigned int size) const {
+    unsigned int room;
+
+    if(MaxChannelHeaderSize + size <= _mtu) { return 0; }
+
+    ASSERT(_mtu > MaxChannelHeaderSize + MaxFragmentHeaderSize);
+    room = _mtu - MaxChannelHeaderSize - MaxFragmentHeaderSize;
+    return (size + room - 1) / room;
+}
+
+void GhastlyConnection::transmitFragments(Channel channel, uint16_t channelSequence, uint16_t message, unsigned int count, const char *payload, unsigned int size, bool reliable, uint64_t acked) {
+    // Spread the payload evenly, so the last fragment isn't left tiny
+    unsigned int fragmentSize = (size + count - 1) / count, offset, c;
+    FragmentHeader fragment;
+
+    fragment.message = message;
+    fragment.count = count;
+    fragment.size = size;
+    for(c = 0; c < count; c++) {
+        if(acked & ((uint64_t)1 << c)) { continue; }
+
+        fragment.index = c;
+        offset = c * fragmentSize;
+        transmit(channel, channelSequence, payload + offset, std::min(fragmentSize, size - offset), reliable, &fragment);
+    }
+}
+
+void GhastlyConnection::transmit(Channel channel, uint16_t channelSequence, const char *payload, unsigned int size, bool reliable, FragmentHeader *fragment) {
+    ChannelHeader header;
+
+    header.sequence = _localSequence;
+    header.ack = _remoteSequence;
+    header.ackBits = _remoteBits;
+    header.channelSequence = channelSequence;
+    header.channel = (uint8_t)(fragment ? FragmentChannel : channel);
+    header.hasAck = _hasRemote;
+
+    // Ack-only packets don't use up a sequence number, since nothing ever acknowledges them
+    if(channel != AckOnlyChannel) {
+        SentPacket &sent = _sent[_localSequence % SentHistory];
+        sent.sequence = _localSequence;
+        sent.sentTime = _time;
+        sent.pending = true;
+        sent.reliable = reliable;
+        sent.reliableSequence = channelSequence;
+        sent.fragment = fragment ? (uint8_t)fragment->index : 0;
+        _localSequence++;
+    }
+
+    Packet packet(_remote, MaxChannelHeaderSize + MaxFragmentHeaderSize + size);
+    BitWriter writer(packet.data, packet.size);
+    header.serialize(writer);
+    if(fragment) {
+        fragment->channel = (uint8_t)channel;
+        fragment->channelSequence = channelSequence;
+        fragment->serialize(writer);
+    }
+    ASSERT(!writer.hasFailed());
+    if(size > 0) { memcpy(packet.data + writer.getBytesWritten(), payload, size); }
+    packet.truncate(writer.getBytesWritten() + size);
+    _lastSent = _time;
+    if(_holding) {
+        _held.push_back(packet);
+    } else {
+        _provider->sendPacket(packet);
+    }
+
+    // Whatever we'd received is acknowledged by this packet
+    _acksOwed = false;
+}
+
+bool GhastlyConnection::receive(const Packet &packet) {
+    ChannelHeader header;
+    bool accepted;
+
+    BitReader reader(packet.data, packet.size);
+    if(!header.serialize(reader)) { return false; }
+    if(header.channel == BundleChannel) { return receiveBundle(packet, reader.getBytesRead()); }
+
+    if(header.hasAck) {
+        processAcks(header.ack, header.ackBits);
+    }
+
+    if(header.channel == AckOnlyChannel) { return true; }
+
+    if(header.channel == FragmentChannel) {
+        if(!receiveFragment(packet, reader, accepted)) { return false; }
+        // A fragment there was no room for goes unacknowledged, so that a reliable one is sent again
+        if(accepted) {
+            _acksOwed = true;
+            markReceived(header.sequence);
+        }
+        return true;
+    }
+
+    // A duplicate still has to be acknowledged again, in case the ack was what got lost
+    _acksOwed = true;
+    if(!markReceived(header.sequence)) { return true; }
+
+    deliver(header.channel, header.channelSequence, packet.data + reader.getBytesRead(), packet.size - reader.getBytesRead());
+    return true;
+}
+
+void GhastlyConnection::deliver(uint8_t channel, uint16_t channelSequence, const char *payload, unsigned int size) {
+    unsigned int index;
+
+    switch(channel) {
+    case UnreliableChannel:
+        _delivered.push_back(Packet(_remote, payload, size));
+        break;
+    case SequencedChannel:
+        if(!_hasSequenced || SequenceNewer(channelSequence, _sequencedIn)) {
+            _hasSequenced = true;
+            _sequencedIn = channelSequence;
+            _delivered.push_back(Packet(_remote, payload, size));
+        }
+        break;
+    case ReliableChannel:
+        // Anything behind the expected sequence was already delivered, and the sender never runs further ahead than the window
+        if((uint16_t)(channelSequence - _reliableExpected) >= ReliableWindow) { break; }
+
+        index = channelSequence % ReliableWindow;
+        if(!_reliableArrived[index]) {
+            _reliableIn[index] = Packet(_remote, payload, size);
+            _reliableArrived[index] = true;
+        }
+
+        // Deliver everything that's now in order
+        while(_reliableArrived[_reliableExpected % ReliableWindow]) {
+            index = _reliableExpected % ReliableWindow;
+            _delivered.push_back(_reliableIn[index]);
+            _reliableIn[index].release();
+            _reliableArrived[index] = false;
+            _reliableExpected++;
+        }
+        break;
+    }
+}
+
+bool GhastlyConnection::receiveFragment(const Packet &packet, BitReader &reader, bool &accepted) {
+    FragmentHeader fragment;
+    Reassembly *reassembly = 0;
+    unsigned int fragmentSize, expected, size, c;
+    const char *data;
+    uint64_t bit;
+
+    accepted = true;
+    if(!fragment.serialize(reader)) { return false; }
+    data = packet.data + reader.getBytesRead();
+    size = packet.size - reader.getBytesRead();
+
+    // Every fragment but the last is the same size, so the header says exactly how big this one should be
+    fragmentSize = (fragment.size + fragment.count - 1) / fragment.count;
+    if((uint64_t)fragmentSize * (fragment.count - 1) >= fragment.size) { return false; }
+    expected = (fragment.index + 1 < fragment.count) ? fragmentSize : fragment.size - fragmentSize * (fragment.count - 1);
+    if(size != expected) { return false; }
+
+    // Retransmissions of a payload that's already been put together, most likely
+    if(isStale(fragment.channel, fragment.channelSequence)) { return true; }
+
+    for(c = 0; c < MaxReassemblies; c++) {
+        if(_reassemblies[c].active && _reassemblies[c].message == fragment.message) {
+            reassembly = &_reassemblies[c];
+            break;
+        }
+    }
+    if(reassembly) {
+        if(reassembly->channel != fragment.channel || reassembly->channelSequence != fragment.channelSequence ||
+           reassembly->count != fragment.count || reassembly->size != fragment.size) { return false; }
+    } else {
+        reassembly = startReassembly(fragment);
+        if(!reassembly) {
+            _reassemblyDrops++;
+            accepted = false;
+            return true;
+        }
+    }
+
+    bit = (uint64_t)1 << fragment.index;
+    if(reassembly->arrived & bit) { return true; }
+    reassembly->arrived |= bit;
+    reassembly->received++;
+    memcpy(&_slab[reassembly->offset + fragment.index * fragmentSize], data, size);
+    if(reassembly->received < reassembly->count) { return true; }
+
+    reassembly->active = false;
+
+    // Older sequenced payloads still being put together would only be thrown away once they were done
+    if(fragment.channel == SequencedChannel) {
+        for(c = 0; c < MaxReassemblies; c++) {
+            Reassembly &other = _reassemblies[c];
+            if(other.active && other.channel == SequencedChannel && SequenceNewer(fragment.channelSequence, other.channelSequence)) {
+                other.active = false;
+                _reassemblyDrops += other.received;
+            }
+        }
+    }
+
+    // The payload is copied out, so its room in the slab is free again right away
+    deliver(fragment.channel, fragment.channelSequence, &_slab[reassembly->offset], reassembly->size);
+    return true;
+}
+
+bool GhastlyConnection::isStale(uint8_t channel, uint16_t channelSequence) const {
+    switch(channel) {
+    case SequencedChannel:
+        return _hasSequenced && !SequenceNewer(channelSequence, _sequencedIn);
+    case ReliableChannel:
+        return (uint16_t)(channelSequence - _reliableExpected) >= ReliableWindow || _reliableArrived[channelSequence % ReliableWindow];
+    default:
+        return false;
+    }
+}
+
+GhastlyConnection::Reassembly *GhastlyConnection::startReassembly(const FragmentHeader &fragment) {
+    Reassembly *slot = 0;
+    unsigned int offset, c, other;
+
+    expireReassemblies();
+
+    for(c = 0; c < MaxReassemblies && !slot; c++) {
+        if(!_reassemblies[c].active) { slot = &_reassemblies[c]; }
+    }
+    if(!slot || fragment.size > _reassemblyLimit) { return 0; }
+    if(_slab.empty()) { _slab.resize(_reassemblyLimit); }
+
+    // First fit: try the start of the slab, then just past each payload already in it
+    for(c = 0; c <= MaxReassemblies; c++) {
+        if(c > 0 && !_reassemblies[c - 1].active) { continue; }
+        offset = (c == 0) ? 0 : _reassemblies[c - 1].offset + _reassemblies[c - 1].size;
+        if(offset + fragment.size > _slab.size()) { continue; }
+
+        for(other = 0; other < MaxReassemblies; other++) {
+            const Reassembly &existing = _reassemblies[other];
+            if(existing.active && offset < existing.offset + existing.size && existing.offset < offset + fragment.size) { break; }
+        }
+        if(other < MaxReassemblies) { continue; }
+
+        slot->active = true;
+        slot->message = fragment.message;
+        slot->channel = fragment.channel;
+        slot->channelSequence = fragment.channelSequence;
+        slot->offset = offset;
+        slot->size = fragment.size;
+        slot->count = fragment.count;
+        slot->received = 0;
+        slot->arrived = 0;
+        slot->started = _time;
+        return slot;
+    }
+    return 0;
+}
+
+void GhastlyConnection::expireReassemblies() {
+    unsigned int c;
+
+    for(c = 0; c < MaxReassemblies; c++) {
+        Reassembly &reassembly = _reassemblies[c];
+        // Reliable fragments that arrived have been acknowledged, and won't be sent again, so reliable payloads are always seen through
+        if(!reassembly.active || reassembly.channel == ReliableChannel || _time - reassembly.started < ReassemblyTimeout) { continue; }
+
+        reassembly.active = false;
+        _reassemblyDrops += reassembly.received;
+    }
+}
+
+bool GhastlyConnection::nextPayload(Packet &payload) {
+    if(_delivered.empty()) { return false; }
+    payload = _delivered.front();
+    _delivered.pop_front();
+    return true;
+}
+
+bool GhastlyConnection::markReceived(uint16_t sequence) {
+    uint16_t distance;
+
+    if(!_hasRemote) {
+        _hasRemote = true;
+        _remoteSequence = sequence;
+        _remoteBits = 0;
+        return true;
+    }
+
+    if(SequenceNewer(sequence, _remoteSequence)) {
+        // Slide the window forward; the previous newest packet becomes one of the bits
+        distance = sequence - _remoteSequence;
+        if(distance >= 32) { _remoteBits = 0; }
+        else { _remoteBits <<= distance; }
+        if(distance <= 32) { _remoteBits |= (1u << (distance - 1)); }
+        _remoteSequence = sequence;
+        return true;
+    }
+
+    distance = _remoteSequence - sequence;
+    if(distance == 0) { return false; }
+    if(distance <= 32) {
+        if(_remoteBits & (1u << (distance - 1))) { return false; }
+        _remoteBits |= (1u << (distance - 1));
+    }
+    // Too old to say either way
+    return true;
+}
+
+void GhastlyConnection::processAcks(uint16_t ack, uint32_t ackBits) {
+    unsigned int c;
+    uint16_t sequence;
+
+    for(c = 0; c <= 32; c++) {
+        if(c > 0 && !(ackBits & (1u << (c - 1)))) { continue; }
+
+        sequence = ack - c;
+        SentPacket &sent = _sent[sequence % SentHistory];
+        if(sent.pending && sent.sequence == sequence) {
+            onAcknowledged(sent);
+        }
+    }
+}
+
+void GhastlyConnection::onAcknowledged(SentPacket &sent) {
+    sent.pending = false;
+
+    // Each transmission gets its own packet sequence, so samples are never confused by retransmission
+    sampleRoundTrip(_time - sent.sentTime);
+
+    if(!sent.reliable) { return; }
+
+    ReliableMessage &message = _reliableOut[sent.reliableSequence % ReliableWindow];
+    if(message.pending && message.sequence == sent.reliableSequence) {
+        // A fragmented payload is only acknowledged once all of it is
+        if(message.fragments > 0) {
+            message.fragmentsAcked |= (uint64_t)1 << sent.fragment;
+            if(message.fragmentsAcked != (~(uint64_t)0 >> (64 - message.fragments))) { return; }
+        }
+        message.pending = false;
+        message.payload.release();
+    }
+
+    while(_reliableOldest != _reliableNext && !_reliableOut[_reliableOldest % ReliableWindow].pending) {
+        _reliableOldest++;
+    }
+}
+
+void GhastlyConnection::sampleRoundTrip(uint32_t sample) {
+    float difference;
+
+    if(!_hasRoundTrip) {
+        _hasRoundTrip = true;
+        _roundTrip = (float)sample;
+        _roundTripVariance = (float)sample / 2;
+    } else {
+        difference = _roundTrip - (float)sample;
+        _roundTripVariance = 0.75f * _roundTripVariance + 0.25f * (difference < 0 ? -difference : difference);
+        _roundTrip = 0.875f * _roundTrip + 0.125f * (float)sample;
+    }
+}
+
+unsigned int GhastlyConnection::GetBackoff(const ReliableMessage &message, unsigned int timeout) {
+    // Back off with each retransmission, so a host that's gone quiet isn't flooded
+    return std::min(timeout << std::min(message.transmissions - 1, 8u), MaxRetransmitTimeout);
+}
+
+void GhastlyConnection::advance(int elapsed) {
+    _time += (uint32_t)std::max(elapsed, 0);
+}
+
+void GhastlyConnection::update(int elapsed) {
+    unsigned int timeout = getRetransmitTimeout(), backoff;
+    uint16_t sequence;
+
+    advance(elapsed);
+    if(_failed) { return; }
+
+    // Only the payloads that are overdue go out again
+    for(sequence = _reliableOldest; sequence != _reliableNext; sequence++) {
+        ReliableMessage &message = _reliableOut[sequence % ReliableWindow];
+        if(!message.pending) { continue; }
+
+        backoff = GetBackoff(message, timeout);
+        if(_time - message.lastSent < backoff) { continue; }
+
+        if(message.transmissions > MaxRetransmissions) {
+            Warn("Reliable payload to " << _remote << " went unacknowledged after " << MaxRetransmissions << " retransmissions");
+            _failed = true;
+            return;
+        }
+
+        message.lastSent = _time;
+        message.transmissions++;
+        _retransmissions++;
+        transmitReliable(message);
+    }
+
+    expireReassemblies();
+    flushAcks();
+}
+
+int GhastlyConnection::getNextRetransmit() const {
+    unsigned int timeout = getRetransmitTimeout(), backoff, since;
+    int next = -1;
+    uint16_t sequence;
+
+    if(_failed) { return -1; }
+
+    for(sequence = _reliableOldest; sequence != _reliableNext; sequence++) {
+        const ReliableMessage &message = _reliableOut[sequence % ReliableWindow];
+        if(!message.pending) { continue; }
+
+        backoff = GetBackoff(message, timeout);
+        since = _time - message.lastSent;
+        if(since >= backoff) { return 0; }
+        if(next < 0 || (int)(backoff - since) < next) { next = (int)(backoff - since); }
+    }
+    return next;
+}
+
+uint32_t GhastlyConnection::getSinceSent() const {
+    return _time - _lastSent;
+}
+
+void GhastlyConnection::flushAcks() {
+    if(_acksOwed) {
+        transmit(AckOnlyChannel, 0, 0, 0, false);
+    }
+}
+
+void GhastlyConnection::hold() {
+    _holding = true;
+}
+
+void GhastlyConnection::flush() {
+    unsigned int first = 0, last, size;
+
+    while(first < _held.size()) {
+        // Take as many packets as fit
+        size = BundleHeaderSize;
+        for(last = first; last < _held.size() && _held[last].size <= MaxBundledSize && size + BundledSize(_held[last].size) <= _mtu; last++) {
+            size += BundledSize(_held[last].size);
+        }
+
+        // Packets with nothing to share a datagram with (or too big to share one) go as they are
+        if(last - first <= 1) {
+            _provider->sendPacket(_held[first]);
+            first++;
+        } else {
+            sendBundle(first, last, size);
+            first = last;
+        }
+    }
+    _held.clear();
+    _holding = false;
+}
+
+void GhastlyConnection::sendBundle(unsigned int first, unsigned int last, unsigned int size) {
+    ChannelHeader header;
+    unsigned int offset, c;
+
+    Packet bundle(_remote, size);
+    header.channel = BundleChannel;
+    BitWriter writer(bundle.data, bundle.size);
+    header.serialize(writer);
+    ASSERT(!writer.hasFailed() && writer.getBytesWritten() == BundleHeaderSize);
+
+    offset = BundleHeaderSize;
+    for(c = first; c < last; c++) {
+        const Packet &packet = _held[c];
+        if(packet.size < 0x80) {
+            bundle.data[offset++] = (char)packet.size;
+        } else {
+            bundle.data[offset++] = (char)(0x80 | (packet.size >> 8));
+            bundle.data[offset++] = (char)(packet.size & 0xFF);
+        }
+        memcpy(bundle.data + offset, packet.data, packet.size);
+        offset += packet.size;
+    }
+    ASSERT(offset == size);
+    _provider->sendPacket(bundle);
+}
+
+bool GhastlyConnection::receiveBundle(const Packet &packet, unsigned int offset) {
+    const unsigned char *data = (const unsigned char*)packet.data;
+    unsigned int size;
+    uint8_t channel;
+
+    while(offset < packet.size) {
+        size = data[offset++];
+        if(size & 0x80) {
+            if(offset >= packet.size) { return false; }
+            size = ((size & 0x7F) << 8) | data[offset++];
+        }
+        if(size == 0 || size > packet.size - offset) { return false; }
+
+        // Bundles within bundles aren't allowed, which keeps a malicious one from recursing forever
+        BitReader peek(packet.data + offset, size);
+        if(!peek.serializeInteger(channel, UnreliableChannel, FragmentChannel) || channel == BundleChannel) { return false; }
+        if(!receive(Packet(packet.addr, packet.data + offset, size))) { return false; }
+        offset += size;
+    }
+    return true;
+}
+
+bool GhastlyConnection::isHolding() const {
+    return _holding;
+}
+
+void GhastlyConnection::setMTU(unsigned int mtu) {
+    _mtu = mtu;
+}
+
+unsigned int GhastlyConnection::getMTU() const {
+    return _mtu;
+}
+
+void GhastlyConnection::setReassemblyLimit(unsigned int bytes) {
+    if(!_slab.empty()) {
+        Warn("Can't change the reassembly limit for " << _remote << " once fragments have arrived");
+        return;
+    }
+    _reassemblyLimit = bytes;
+}
+
+unsigned int GhastlyConnection::getReassemblyLimit() const {
+    return _reassemblyLimit;
+}
+
+unsigned int GhastlyConnection::getMaxPayloadSize(Channel channel) const {
+    return ((channel == ReliableChannel) ? MaxReliableFragments : MaxFragments) * (_mtu - MaxChannelHeaderSize - MaxFragmentHeaderSize);
+}
+
+unsigned int GhastlyConnection::getReassemblyDrops() const {
+    return _reassemblyDrops;
+}
+
+bool GhastlyConnection::hasFailed() const {
+    return _failed;
+}
+
+unsigned int GhastlyConnection::getUnacknowledged() const {
+    return (uint16_t)(_reliableNext - _reliableOldest);
+}
+
+unsigned int GhastlyConnection::getRetransmissions() const {
+    return _retransmissions;
+}
+
+float GhastlyConnection::getRoundTripTime() const {
+    return _roundTrip;
+}
+
+float GhastlyConnection::getRoundTripVariance() const {
+    return _roundTripVariance;
+}
+
+unsigned int GhastlyConnection::getRetransmitTimeout() const {
+    if(!_hasRoundTrip) { return DefaultRetransmitTimeout; }
+
+    unsigned int timeout = (unsigned int)(_roundTrip + 4 * _roundTripVariance);
+    return std::min(std::max(timeout, MinRetransmitTimeout), MaxRetransmitTimeout);
+}
@@ -0,0 +1,202 @@
+#ifndef GHASTLYCONNECTION_H
+#define GHASTLYCONNECTION_H
+
+#include <Network/GhastlyProtocol.h>
+#include <Network/ConnectionProvider.h>
+
+using namespace GhastlyProtocol;
+
+// One end of a conversation with a remote host, layering the channels described in GhastlyProtocol.h over an unreliable provider
+// Packets are acknowledged individually; reliable payloads are retransmitted (alone, not with everything sent after them) once they've gone unacknowledged for longer than the round trip time suggests they should
+// Time only moves forward when update is called, so a connection's timers run on the game's clock
+// Payloads too big for the MTU are sent in fragments, which are reassembled into a slab of memory set aside (once) for the connection; payloads that don't arrive whole in time, or don't fit, are dropped
+class GhastlyConnection {
+public:
+    // The most reliable payloads that can be awaiting acknowledgement at once
+    static const unsigned int ReliableWindow = 256;
+    // The most fragmented payloads that can be reassembled at once
+    static const unsigned int MaxReassemblies = 8;
+
+public:
+    GhastlyConnection(ConnectionProvider *provider, const NetAddress &remote);
+
+    const NetAddress &getRemote() const;
+
+    // Returns false if the reliable window is full, or if the connection has failed
+    bool send(Channel channel, const char *payload, unsigned int size);
+    // Unwrap a packet received from the remote host; any payloads it makes ready are handed out by nextPayload
+    // Returns false if the packet is malformed
+    bool receive(const Packet &packet);
+    bool nextPayload(Packet &payload);
+
+    // Advance the clock by elapsed milliseconds without sending anything
+    void advance(int elapsed);
+    // Advance the clock by elapsed milliseconds, retransmitting reliable payloads that are overdue and acknowledging anything received that hasn't been yet
+    void update(int elapsed);
+    // Acknowledge anything received right away rather than waiting for update
+    void flushAcks();
+
+    // Keep outgoing packets back from the provider until flush, so that everything sent over a tick leaves together
+    void hold();
+    // Hand anything held to the provider, and stop holding
+    // Held packets are bundled together into as few datagrams as the MTU allows
+    void flush();
+    bool isHolding() const;
+
+    // The largest datagram a bundle (or a fragment) may make, in bytes
+    // Must be no bigger than the peer's provider receives, which a UDP provider's buffers do by default
+    void setMTU(unsigned int mtu);
+    unsigned int getMTU() const;
+
+    // The most memory spent reassembling fragmented payloads at once, which also caps how big a fragmented payload can be received
+    // Can only be changed before the first fragment arrives
+    void setReassemblyLimit(unsigned int bytes);
+    unsigned int getReassemblyLimit() const;
+    // The largest payload send will take on a channel, given the MTU
+    unsigned int getMaxPayloadSize(Channel channel = UnreliableChannel) const;
+    // Fragments thrown away, because their payload timed out incomplete or there was no room to put it together
+    unsigned int getReassemblyDrops() const;
+
+    // A reliable payload went unacknowledged through every retransmission; nothing more will be sent
+    bool hasFailed() const;
+    // Reliable payloads still waiting to be acknowledged
+    unsigned int getUnacknowledged() const;
+    unsigned int getRetransmissions() const;
+
+    // Smoothed round trip time and its variation in milliseconds, measured from acknowledgements
+    float getRoundTripTime() const;
+    float getRoundTripVariance() const;
+    unsigned int getRetransmitTimeout() const;
+
+    // Milliseconds until update next has a reliable payload to retransmit, or -1 if none are waiting
+    int getNextRetransmit() const;
+    // Milliseconds since anything was last sent
+    uint32_t getSinceSent() const;
+
+private:
+    static unsigned int DefaultRetransmitTimeout;
+    static unsigned int MinRetransmitTimeout;
+    static unsigned int MaxRetransmitTimeout;
+    static unsigned int MaxRetransmissions;
+    static unsigned int DefaultMTU;
+    static unsigned int DefaultReassemblyLimit;
+    // How long a fragmented payload has to arrive whole, in milliseconds
+    static unsigned int ReassemblyTimeout;
+
+    // Packets older than this can no longer be acknowledged, since the ack bitfield doesn't reach back that far
+    static const unsigned int SentHistory = 64;
+
+    struct SentPacket {
+        uint16_t sequence;
+        uint32_t sentTime;
+        bool pending;
+        // The reliable payload carried, if any, and which of its fragments
+        bool reliable;
+        uint16_t reliableSequence;
+        uint8_t fragment;
+    };
+
+    struct ReliableMessage {
+        Packet payload;
+        uint16_t sequence;
+        uint32_t lastSent;
+        unsigned int transmissions;
+        bool pending;
+        // 0 for payloads that fit in a packet
+        unsigned int fragments;
+        uint16_t fragmentMessage;
+        uint64_t fragmentsAcked;
+    };
+
+    struct Reassembly {
+        bool active;
+        uint16_t message;
+        uint8_t channel;
+        uint16_t channelSequence;
+        // Where the payload goes in the slab
+        unsigned int offset, size;
+        unsigned int count, received;
+        uint64_t arrived;
+        uint32_t started;
+    };
+
+    // Whether sequence a comes after b, allowing for wraparound
+    static inline bool SequenceNewer(uint16_t a, uint16_t b) { return (uint16_t)(a - b) != 0 && (uint16_t)(a - b) < 0x8000; }
+
+    static unsigned int GetBackoff(const ReliableMessage &message, unsigned int timeout);
+
+    // How much room a packet takes up in a bundle, counting its size
+    static inline unsigned int BundledSize(unsigned int size) { return size + (size < 0x80 ? 1 : 2); }
+    // Send held packets [first, last) as one datagram
+    void sendBundle(unsigned int first, unsigned int last, unsigned int size);
+    bool receiveBundle(const Packet &packet, unsigned int offset);
+
+    // Wrap a payload (or, given a fragment header, one fragment of it) in a channel header and send it
+    void transmit(Channel channel, uint16_t channelSequence, const char *payload, unsigned int size, bool reliable, FragmentHeader *fragment = 0);
+    // How many fragments a payload takes, or 0 if it fits in a packet
+    unsigned int getFragmentCount(unsigned int size) const;
+    // Send every fragment of a payload that isn't marked in acked
+    void transmitFragments(Channel channel, uint16_t channelSequence, uint16_t message, unsigned int count, const char *payload, unsigned int size, bool reliable, uint64_t acked);
+    void transmitReliable(ReliableMessage &message);
+    // Hand a payload that's arrived whole to its channel
+    void deliver(uint8_t channel, uint16_t channelSequence, const char *payload, unsigned int size);
+    // Returns false if the fragment is malformed
+    // accepted is cleared for a fragment that had to be turned away, which shouldn't be acknowledged
+    bool receiveFragment(const Packet &packet, BitReader &reader, bool &accepted);
+    // Whether a payload on a channel would be thrown away as a duplicate or out of date, so there's no point reassembling it
+    bool isStale(uint8_t channel, uint16_t channelSequence) const;
+    // Find room in the slab for a payload; returns 0 if there isn't any
+    Reassembly *startReassembly(const FragmentHeader &fragment);
+    void expireReassemblies();
+    // Returns false if the packet has already been received
+    bool markReceived(uint16_t sequence);
+    void processAcks(uint16_t ack, uint32_t ackBits);
+    void onAcknowledged(SentPacket &sent);
+    void sampleRoundTrip(uint32_t sample);
+
+private:
+    ConnectionProvider *_provider;
+    NetAddress _remote;
+    uint32_t _time;
+    bool _failed;
+
+    // Outgoing packets
+    uint16_t _localSequence;
+    uint32_t _lastSent;
+    SentPacket _sent[SentHistory];
+    bool _holding;
+    std::vector<Packet> _held;
+    unsigned int _mtu;
+
+    // Incoming packets, for acknowledgement
+    bool _hasRemote, _acksOwed;
+    uint16_t _remoteSequence;
+    uint32_t _remoteBits;
+
+    // Outgoing channel state
+    uint16_t _sequencedOut;
+    uint16_t _reliableOldest, _reliableNext;
+    ReliableMessage _reliableOut[ReliableWindow];
+    unsigned int _retransmissions;
+
+    // Incoming channel state
+    bool _hasSequenced;
+    uint16_t _sequencedIn;
+    uint16_t _reliableExpected;
+    Packet _reliableIn[ReliableWindow];
+    bool _reliableArrived[ReliableWindow];
+    std::deque<Packet> _delivered;
+
+    // Fragmented payloads
+    uint16_t _fragmentNext;
+    unsigned int _reassemblyLimit, _reassemblyDrops;
+    Reassembly _reassemblies[MaxReassemblies];
+    // Sized when the first fragment arrives, and never again
+    std::vector<char> _slab;
+
+    // Round trip estimation, as in RFC 6298
+    bool _hasRoundTrip;
+    float _roundTrip, _roundTripVariance;
+};
+
+#endif
@@ -1,9 +1,181 @@
 #include <Network/GhastlyHost.h>
 #include <Base/Log.h>
+#include <Base/Timestamp.h>
+#include <SDL2/SDL_timer.h>
 
-GhastlyHost::GhastlyHost(HostID id): _id(id) {
+#if SYS_PLATFORM == PLATFORM_WIN32
+# include <windows.h>
+// Older headers predate high resolution waitable timers
+# ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#  define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+# endif
+#else
+# include <errno.h>
+#endif
+
+void GhastlyHost::SleepUntil(uint64_t when) {
+    uint64_t now = GetMicroseconds();
+
+    if(now >= when) { return; }
+
+#if SYS_PLATFORM == PLATFORM_LINUX
+    // Sleep to an absolute deadline on the monotonic clock, so being interrupted doesn't stretch the wait
+    uint64_t wait = when - now;
+    timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += wait / 1000000;
+    deadline.tv_nsec += (wait % 1000000) * 1000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0) == EINTR) {}
+#elif SYS_PLATFORM == PLATFORM_WIN32
+    // The high resolution timer isn't available before Windows 10, where the plain one has to do
+    HANDLE timer = CreateWaitableTimerExW(0, 0, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    LARGE_INTEGER due;
+
+    if(!timer) { timer = CreateWaitableTimerW(0, TRUE, 0); }
+    if(!timer) {
+        SDL_Delay((Uint32)((when - now + 999) / 1000));
+        return;
+    }
+    // Negative times are relative, in units of 100ns
+    due.QuadPart = -(LONGLONG)((when - now) * 10);
+    if(SetWaitableTimer(timer, &due, 0, 0, 0, FALSE)) {
+        WaitForSingleObject(timer, INFINITE);
+    }
+    CloseHandle(timer);
+#else
+    timespec wait;
+
+    while(now < when) {
+        wait.tv_sec = (time_t)((when - now) / 1000000);
+        wait.tv_nsec = (long)(((when - now) % 1000000) * 1000);
+        nanosleep(&wait, 0);
+        now = GetMicroseconds();
+    }
+#endif
+}
+
+GhastlyHost::GhastlyHost(HostID id): _id(id), _maxPacketsPerUpdate(DEFAULT_MAX_PACKETS_PER_UPDATE),
+    _keepaliveInterval(DEFAULT_KEEPALIVE_INTERVAL), _mtu(DEFAULT_MTU),
+    _tickListener(0), _tickRate(DEFAULT_TICK_RATE), _ticking(false), _holding(false),
+    _nextTick(0), _lastTick(0), _elapsedRemainder(0), _tickCount(0), _tickOverruns(0), _lastTickDuration(0)
+{
+}
+
+void GhastlyHost::tick() {
+    uint64_t tickLength = 1000000 / _tickRate, start, since;
+    int elapsed;
+
+    if(_tickCount == 0) {
+        _nextTick = _lastTick = GetMicroseconds();
+    }
+    SleepUntil(_nextTick);
+
+    start = GetMicroseconds();
+    since = start - _lastTick + _elapsedRemainder;
+    elapsed = (int)(since / 1000);
+    _elapsedRemainder = since % 1000;
+    _lastTick = start;
+
+    _ticking = true;
+    _holding = true;
+    holdOutbound();
+
+    update(elapsed);
+    if(_tickListener) { _tickListener->onTick(this, elapsed); }
+
+    flushOutbound();
+    _holding = false;
+    _ticking = false;
+
+    _tickCount++;
+    _lastTickDuration = (unsigned int)(GetMicroseconds() - start);
+    if(_lastTickDuration > tickLength) {
+        _tickOverruns++;
+        Warn("Tick " << _tickCount << " took " << _lastTickDuration << "us, over the " << tickLength << "us allowed");
+    }
+
+    _nextTick += tickLength;
+    if(GetMicroseconds() > _nextTick + tickLength) {
+        _nextTick = GetMicroseconds();
+    }
+}
+
+void GhastlyHost::setTickRate(unsigned int hz) {
+    ASSERT(hz > 0);
+    _tickRate = hz;
+}
+
+unsigned int GhastlyHost::getTickRate() const {
+    return _tickRate;
+}
+
+void GhastlyHost::setTickListener(GhastlyTickListener *listener) {
+    _tickListener = listener;
+}
+
+unsigned int GhastlyHost::getTickCount() const {
+    return _tickCount;
 }
 
-void GhastlyHost::handleCustomPayload(Payload *payload) {
-    Warn("Custom payload handler not defined; unknown payload type " << payload->type << " will be ignored.");
-}
\ No newline at end of file
+unsigned int GhastlyHost::getTickOverruns() const {
+    return _tickOverruns;
+}
+
+unsigned int GhastlyHost::getLastTickDuration() const {
+    return _lastTickDuration;
+}
+
+void GhastlyHost::setMaxPacketsPerUpdate(unsigned int packets) {
+    ASSERT(packets > 0);
+    _maxPacketsPerUpdate = packets;
+}
+
+unsigned int GhastlyHost::getMaxPacketsPerUpdate() const {
+    return _maxPacketsPerUpdate;
+}
+
+void GhastlyHost::setMTU(unsigned int mtu) {
+    _mtu = mtu;
+}
+
+unsigned int GhastlyHost::getMTU() const {
+    return _mtu;
+}
+
+void GhastlyHost::setKeepaliveInterval(unsigned int milliseconds) {
+    ASSERT(milliseconds > 0);
+    _keepaliveInterval = milliseconds;
+}
+
+unsigned int GhastlyHost::getKeepaliveInterval() const {
+    return _keepaliveInterval;
+}
+
+HostID GhastlyHost::getID() const {
+    return _id;
+}
+
+void GhastlyHost::handleCustomPayload(const Packet &packet) {
+    Warn("Custom payload handler not defined; unknown payload type " << (int)GetPayloadType(packet) << " will be ignored.");
+}
+
+bool GhastlyHost::isHoldingOutbound() const {
+    return _holding;
+}
+
+void GhastlyHost::beginUpdate() {
+    if(_ticking) { return; }
+    _holding = true;
+    holdOutbound();
+}
+
+void GhastlyHost::endUpdate() {
+    if(_ticking) { return; }
+    flushOutbound();
+    _holding = false;
+}
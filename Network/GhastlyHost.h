@@ -2,10 +2,29 @@
 #define GHASTLYHOST_H
 
 #include <Network/GhastlyProtocol.h>
+#include <Network/GhastlyConnection.h>
 #include <Network/ConnectionProvider.h>
+#include <Base/Assertion.h>
 
 using namespace GhastlyProtocol;
 
+// Ticks per second when a host is driven by tick
+#define DEFAULT_TICK_RATE             30
+// The most packets an update takes in; the rest wait for the next update, so that a flood can't stall the tick
+#define DEFAULT_MAX_PACKETS_PER_UPDATE 1024
+// How long a connection may go without sending anything before a keepalive goes out, in milliseconds
+#define DEFAULT_KEEPALIVE_INTERVAL    1000
+// The largest datagram messages sent during an update are bundled into
+#define DEFAULT_MTU                   1200
+
+class GhastlyHost;
+
+class GhastlyTickListener {
+public:
+    // Called each tick after incoming packets have been processed; anything sent from here goes out with the rest of the tick's traffic
+    virtual void onTick(GhastlyHost *host, int elapsed) {}
+};
+
 class GhastlyHost {
 public:
     enum {
@@ -14,16 +33,78 @@ public:
         ID_CLIENT
     };
 
-public:
     GhastlyHost(HostID id = ID_UNASSIGNED);
 
+    // Process incoming packets and advance connection timers by elapsed milliseconds
+    // Everything sent during an update is held and flushed to each peer at the end of it
     virtual void update(int elapsed) = 0;
 
+    // Sleep until the next tick is due, then update, notify the tick listener, and flush everything sent
+    // Ticks that run longer than the tick rate allows are counted as overruns; if the host falls more than a tick behind, the schedule starts over rather than running ticks back to back to catch up
+    void tick();
+
+    void setTickRate(unsigned int hz);
+    unsigned int getTickRate() const;
+    void setTickListener(GhastlyTickListener *listener);
+
+    unsigned int getTickCount() const;
+    unsigned int getTickOverruns() const;
+    // How long the last tick took to run, not counting the sleep before it, in microseconds
+    unsigned int getLastTickDuration() const;
+
+    void setMaxPacketsPerUpdate(unsigned int packets);
+    unsigned int getMaxPacketsPerUpdate() const;
+
+    // Applies to every connection, including those already open
+    // Must be no bigger than the peer's provider receives (a ConnectionBuffer's max packet size), or its datagrams are thrown away on arrival
+    virtual void setMTU(unsigned int mtu);
+    unsigned int getMTU() const;
+
+    void setKeepaliveInterval(unsigned int milliseconds);
+    unsigned int getKeepaliveInterval() const;
+
+    HostID getID() const;
+
 protected:
-    void handleCustomPayload(Payload *payload);
+    void handleCustomPayload(const Packet &packet);
+
+    // Start holding outgoing packets on every connection, and release them all at once
+    virtual void holdOutbound() = 0;
+    virtual void flushOutbound() = 0;
+    // Whether outgoing packets are currently being held, so new connections can join in
+    bool isHoldingOutbound() const;
+    // Called by update around its work; these do nothing inside a tick, which holds and flushes for the whole tick instead
+    void beginUpdate();
+    void endUpdate();
+
+    // Serialize a payload and send it over a connection
+    template <typename T>
+    static bool SendPayload(GhastlyConnection *connection, Channel channel, T &payload) {
+        char buffer[MaxPayloadSize];
+        unsigned int size = WritePayload(payload, buffer, MaxPayloadSize);
+        ASSERT(size > 0);
+        return connection->send(channel, buffer, size);
+    }
+
+private:
+    // Sleeps on a high resolution timer where there is one, since SDL_Delay can oversleep by a millisecond or two
+    static void SleepUntil(uint64_t when);
 
 protected:
     HostID _id;
+    unsigned int _maxPacketsPerUpdate;
+    unsigned int _keepaliveInterval;
+    unsigned int _mtu;
+
+private:
+    GhastlyTickListener *_tickListener;
+    unsigned int _tickRate;
+    bool _ticking, _holding;
+
+    uint64_t _nextTick, _lastTick;
+    // Microseconds left over from converting tick lengths to whole milliseconds
+    uint64_t _elapsedRemainder;
+    unsigned int _tickCount, _tickOverruns, _lastTickDuration;
 };
 
 #endif
@@ -0,0 +1,139 @@
+#include <Network/GhastlyHostRegistry.h>
+#include <Network/GhastlySnapshot.h>
+#include <Base/Assertion.h>
+
+GhastlyHostInfo::GhastlyHostInfo() {}
+GhastlyHostInfo::GhastlyHostInfo(const GhastlyHostInfo &other) { copy(other); }
+GhastlyHostInfo::GhastlyHostInfo(const NetAddress &a, HostID i): addr(a), id(i) {
+    lastReceived = 0;
+    lastUpdated = 0;
+    updateQueued = false;
+    latency = 0;
+    pings = GhastlyLatency();
+    receivedInput = processedInput = 0;
+    controlledEntity = GhastlySnapshot::NoEntity;
+    reportedInput = 0;
+    connection = 0;
+    snapshots = 0;
+    interest = 0;
+    priority = 0;
+    snapshotCredit = 0;
+    idleTimer = keepaliveTimer = retransmitTimer = 0;
+}
+
+void GhastlyHostInfo::operator=(const GhastlyHostInfo &other) { copy(other); }
+void GhastlyHostInfo::copy(const GhastlyHostInfo &other) {
+    addr = other.addr;
+    id = other.id;
+    lastReceived = other.lastReceived;
+    lastUpdated = other.lastUpdated;
+    updateQueued = other.updateQueued;
+    latency = other.latency;
+    pings = other.pings;
+    receivedInput = other.receivedInput;
+    processedInput = other.processedInput;
+    controlledEntity = other.controlledEntity;
+    reportedInput = other.reportedInput;
+    connection = other.connection;
+    snapshots = other.snapshots;
+    interest = other.interest;
+    priority = other.priority;
+    snapshotCredit = other.snapshotCredit;
+    idleTimer = other.idleTimer;
+    keepaliveTimer = other.keepaliveTimer;
+    retransmitTimer = other.retransmitTimer;
+}
+
+const unsigned int GhastlyHostRegistry::IndexBits;
+const unsigned int GhastlyHostRegistry::GenerationBits;
+const unsigned int GhastlyHostRegistry::MaxHosts;
+
+GhastlyHostRegistry::GhastlyHostRegistry(unsigned int maxHosts):
+    _maxHosts(std::min(maxHosts, MaxHosts)), _addressMap(_maxHosts * 2)
+{
+    int c;
+
+    _slots.resize(_maxHosts);
+    _freeSlots.reserve(_maxHosts);
+    _active.reserve(_maxHosts);
+
+    // Hand out the lowest slots first, so a lightly loaded server only touches the front of the array
+    for(c = (int)_maxHosts - 1; c >= 0; c--) {
+        // Generations start at 1 so that no client ID can collide with the reserved low IDs
+        _slots[c].generation = 1;
+        _slots[c].activeIndex = -1;
+        _freeSlots.push_back((uint32_t)c);
+    }
+}
+
+GhastlyHostInfo *GhastlyHostRegistry::add(const NetAddress &addr) {
+    uint32_t index;
+
+    if(_freeSlots.empty()) { return 0; }
+    if(!_addressMap.insert(addr, _freeSlots.back())) { return 0; }
+
+    index = _freeSlots.back();
+    _freeSlots.pop_back();
+
+    Slot &slot = _slots[index];
+    slot.info = GhastlyHostInfo(addr, (HostID)((slot.generation << IndexBits) | index));
+    slot.activeIndex = (int)_active.size();
+    _active.push_back(index);
+
+    return &slot.info;
+}
+
+GhastlyHostInfo *GhastlyHostRegistry::find(HostID id) {
+    uint32_t index = SlotIndex(id);
+
+    if(index >= _maxHosts) { return 0; }
+
+    Slot &slot = _slots[index];
+    if(slot.activeIndex < 0 || slot.generation != SlotGeneration(id)) { return 0; }
+    return &slot.info;
+}
+
+GhastlyHostInfo *GhastlyHostRegistry::find(const NetAddress &addr) {
+    uint32_t *index = _addressMap.find(addr);
+    return index ? &_slots[*index].info : 0;
+}
+
+bool GhastlyHostRegistry::remove(HostID id) {
+    uint32_t index = SlotIndex(id), moved;
+
+    if(!find(id)) { return false; }
+
+    Slot &slot = _slots[index];
+    _addressMap.erase(slot.info.addr);
+
+    // Keep the active list dense by moving its last entry into the hole
+    moved = _active.back();
+    _active[slot.activeIndex] = moved;
+    _slots[moved].activeIndex = slot.activeIndex;
+    _active.pop_back();
+
+    // Skip generation 0 on wraparound, for the same reason it's never used to begin with
+    slot.generation = (slot.generation + 1) & ((1u << GenerationBits) - 1);
+    if(slot.generation == 0) { slot.generation = 1; }
+    slot.activeIndex = -1;
+    _freeSlots.push_back(index);
+
+    return true;
+}
+
+unsigned int GhastlyHostRegistry::size() const {
+    return (unsigned int)_active.size();
+}
+
+unsigned int GhastlyHostRegistry::getMaxHosts() const {
+    return _maxHosts;
+}
+
+bool GhastlyHostRegistry::isFull() const {
+    return _freeSlots.empty();
+}
+
+GhastlyHostInfo &GhastlyHostRegistry::getHost(unsigned int index) {
+    ASSERT(index < _active.size());
+    return _slots[_active[index]].info;
+}
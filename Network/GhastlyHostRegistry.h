@@ -0,0 +1,99 @@
+#ifndef GHASTLYHOSTREGISTRY_H
+#define GHASTLYHOSTREGISTRY_H
+
+#include <Network/GhastlyProtocol.h>
+#include <Network/AddressMap.h>
+#include <Network/GhastlyLatency.h>
+#include <Network/TimerWheel.h>
+
+using namespace GhastlyProtocol;
+
+class GhastlySnapshotHistory;
+class GhastlyConnection;
+class GhastlyInterest;
+class GhastlyPriority;
+
+struct GhastlyHostInfo {
+    NetAddress addr;
+    HostID id;
+    // On the server's clock, in milliseconds
+    uint32_t lastReceived;
+    // When the connection's own clock was last brought up to the server's
+    uint32_t lastUpdated;
+    // Waiting to have its connection updated at the end of the server's update
+    bool updateQueued;
+    // The smoothed round trip time from pings, in milliseconds
+    double latency;
+    GhastlyLatency pings;
+    // The newest input command received from the host, and the newest the game has taken (see GhastlyServer::nextInput)
+    InputSequence receivedInput, processedInput;
+    // The entity the host predicts (GhastlySnapshot::NoEntity if it doesn't), and the newest input its snapshots have acknowledged along with that entity's current state
+    EntityID controlledEntity;
+    InputSequence reportedInput;
+    // Owned by the server
+    GhastlyConnection *connection;
+    GhastlySnapshotHistory *snapshots;
+    GhastlyInterest *interest;
+    GhastlyPriority *priority;
+    // Bytes of snapshot the host's share of the snapshot rate has paid for but that haven't been sent yet
+    float snapshotCredit;
+    TimerWheel::TimerID idleTimer, keepaliveTimer, retransmitTimer;
+
+    GhastlyHostInfo();
+    GhastlyHostInfo(const GhastlyHostInfo &other);
+    GhastlyHostInfo(const NetAddress &a, HostID i);
+
+    void operator=(const GhastlyHostInfo &other);
+    void copy(const GhastlyHostInfo &other);
+};
+
+// The server's table of connected hosts
+// Hosts live in a flat array of slots; a HostID is the slot index combined with a generation counter that changes every time the slot is reused, so a stale ID never finds the slot's new owner
+// Lookups by address go through an open-addressing hash, and connected hosts are also kept densely packed for iteration
+// Adding, finding and removing a host are all constant time
+class GhastlyHostRegistry {
+public:
+    // IDs are laid out as [generation:GenerationBits][slot index:IndexBits]
+    static const unsigned int IndexBits = 20;
+    static const unsigned int GenerationBits = 32 - IndexBits;
+    static const unsigned int MaxHosts = (1u << IndexBits) - 1;
+
+public:
+    GhastlyHostRegistry(unsigned int maxHosts);
+
+    // Returns 0 if the registry is full or the address is already registered
+    GhastlyHostInfo *add(const NetAddress &addr);
+    // Return 0 for unknown addresses, and for IDs that are unknown or stale
+    GhastlyHostInfo *find(HostID id);
+    GhastlyHostInfo *find(const NetAddress &addr);
+    // Returns false if the ID is unknown or stale
+    bool remove(HostID id);
+
+    unsigned int size() const;
+    unsigned int getMaxHosts() const;
+    bool isFull() const;
+
+    // Connected hosts in no particular order; removing a host moves the last one into its place
+    GhastlyHostInfo &getHost(unsigned int index);
+
+private:
+    struct Slot {
+        GhastlyHostInfo info;
+        uint32_t generation;
+        // Position in _active, or -1 if the slot is free
+        int activeIndex;
+    };
+
+    static inline uint32_t SlotIndex(HostID id) { return id & MaxHosts; }
+    static inline uint32_t SlotGeneration(HostID id) { return id >> IndexBits; }
+
+private:
+    unsigned int _maxHosts;
+
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    std::vector<uint32_t> _active;
+    AddressMap<uint32_t> _addressMap;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include <Network/GhastlyInterest.h>
+
+GhastlyInterest::GhastlyInterest(): _hasView(false) {}
+
+void GhastlyInterest::setView(const AABB2<float> &view) {
+    _view = view;
+    _hasView = true;
+}
+
+const AABB2<float> &GhastlyInterest::getView() const {
+    return _view;
+}
+
+bool GhastlyInterest::hasView() const {
+    return _hasView;
+}
+
+const std::vector<EntityID> &GhastlyInterest::update(const InterestGrid &grid, float hysteresis) {
+    Vector2<float> size;
+    float margin;
+    unsigned int c;
+
+    if(!_hasView) {
+        _entities.clear();
+        return _entities;
+    }
+
+    size = _view.getUpperBound() - _view.getLowerBound();
+    margin = std::max(size.x, size.y) * hysteresis;
+
+    // Everything that could possibly be of interest is within the margin
+    AABB2<float> outer(_view);
+    outer.expand(Vector2<float>(margin, margin));
+
+    _candidates.clear();
+    grid.query(outer, _candidates);
+
+    _next.clear();
+    for(c = 0; c < _candidates.size(); c++) {
+        const InterestGrid::Entry &entry = _candidates[c];
+        // Inside the margin but outside the view, only entities we already had are kept
+        if(_view.contains(entry.position) || std::binary_search(_entities.begin(), _entities.end(), entry.id)) {
+            _next.push_back(entry.id);
+        }
+    }
+    std::sort(_next.begin(), _next.end());
+
+    _entities.swap(_next);
+    return _entities;
+}
+
+const std::vector<EntityID> &GhastlyInterest::getEntities() const {
+    return _entities;
+}
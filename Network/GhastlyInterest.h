@@ -0,0 +1,30 @@
+#ifndef GHASTLYINTEREST_H
+#define GHASTLYINTEREST_H
+
+#include <Network/InterestGrid.h>
+
+// Which entities a host should hear about, given the region of the world it's looking at
+// Entities join once they're inside the view, but only leave once they're some way past its edge, so entities sitting on the edge don't flicker in and out
+class GhastlyInterest {
+public:
+    GhastlyInterest();
+
+    void setView(const AABB2<float> &view);
+    const AABB2<float> &getView() const;
+    // Hosts that never set a view are interested in everything
+    bool hasView() const;
+
+    // Work out the entities of interest this tick; hysteresis is how far past the view (as a fraction of the view's size) entities may go before they're dropped
+    // Returns the entities sorted by ID
+    const std::vector<EntityID> &update(const InterestGrid &grid, float hysteresis);
+    const std::vector<EntityID> &getEntities() const;
+
+private:
+    AABB2<float> _view;
+    bool _hasView;
+
+    std::vector<EntityID> _entities, _next;
+    std::vector<InterestGrid::Entry> _candidates;
+};
+
+#endif
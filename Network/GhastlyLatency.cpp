@@ -0,0 +1,46 @@
+#include <Network/GhastlyLatency.h>
+#include <SDL2/SDL_timer.h>
+
+GhastlyLatency::GhastlyLatency(): _samples(0), _roundTrip(0), _roundTripVariance(0), _clockOffset(0) {}
+
+PingTimestamp GhastlyLatency::GetTimestamp() {
+    return SDL_GetTicks();
+}
+
+void GhastlyLatency::addSample(PingTimestamp sent, PingTimestamp remote, PingTimestamp received) {
+    // Unsigned differences survive the clocks wrapping around
+    double roundTrip = (double)(PingTimestamp)(received - sent);
+    // The remote timestamp is assumed to have been taken halfway through the round trip
+    double offset = (double)(int32_t)(remote - sent) - roundTrip / 2;
+
+    if(_samples == 0) {
+        _roundTrip = roundTrip;
+        _roundTripVariance = roundTrip / 2;
+        _clockOffset = offset;
+    } else {
+        _roundTripVariance = 0.75 * _roundTripVariance + 0.25 * fabs(_roundTrip - roundTrip);
+        _roundTrip = 0.875 * _roundTrip + 0.125 * roundTrip;
+        _clockOffset = 0.875 * _clockOffset + 0.125 * offset;
+    }
+    _samples++;
+}
+
+unsigned int GhastlyLatency::getSampleCount() const {
+    return _samples;
+}
+
+double GhastlyLatency::getRoundTripTime() const {
+    return _roundTrip;
+}
+
+double GhastlyLatency::getRoundTripVariance() const {
+    return _roundTripVariance;
+}
+
+double GhastlyLatency::getClockOffset() const {
+    return _clockOffset;
+}
+
+PingTimestamp GhastlyLatency::getRemoteTime() const {
+    return GetTimestamp() + (PingTimestamp)(int32_t)floor(_clockOffset + 0.5);
+}
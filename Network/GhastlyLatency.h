@@ -0,0 +1,35 @@
+#ifndef GHASTLYLATENCY_H
+#define GHASTLYLATENCY_H
+
+#include <Network/GhastlyProtocol.h>
+
+using namespace GhastlyProtocol;
+
+// What the ping exchange has learned about a remote host
+// The round trip time and its variance are smoothed the same way TCP smooths them (RFC 6298), and the clock offset is smoothed like the round trip time
+class GhastlyLatency {
+public:
+    GhastlyLatency();
+
+    // The local clock, which ping timestamps are taken from
+    static PingTimestamp GetTimestamp();
+
+    // Record one ping: sent and received are local timestamps, and remote is the timestamp the other host took in between
+    void addSample(PingTimestamp sent, PingTimestamp remote, PingTimestamp received);
+
+    unsigned int getSampleCount() const;
+    // In milliseconds; all 0 until the first sample
+    double getRoundTripTime() const;
+    double getRoundTripVariance() const;
+    // How far ahead of the local clock the remote clock is
+    double getClockOffset() const;
+
+    // The remote host's clock right now, by our best estimate
+    PingTimestamp getRemoteTime() const;
+
+private:
+    unsigned int _samples;
+    double _roundTrip, _roundTripVariance, _clockOffset;
+};
+
+#endif
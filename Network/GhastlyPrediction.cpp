@@ -0,0 +1,232 @@
+#include <Network/GhastlyPrediction.h>
+#include <Base/Assertion.h>
+
+const unsigned int GhastlyPrediction::Size;
+
+GhastlyPrediction::GhastlyPrediction(): _simulation(0), _entity(0) {
+    reset();
+}
+
+void GhastlyPrediction::reset() {
+    unsigned int c;
+
+    for(c = 0; c < Size; c++) {
+        _slots[c].sequence = 0;
+    }
+    _latest = _acknowledged = 0;
+    _hasState = false;
+    _stateSize = 0;
+    _corrections = _replayed = 0;
+}
+
+void GhastlyPrediction::setSimulation(GhastlySimulation *simulation) {
+    _simulation = simulation;
+}
+
+void GhastlyPrediction::setEntity(EntityID id) {
+    _entity = id;
+    _hasState = false;
+}
+
+EntityID GhastlyPrediction::getEntity() const {
+    return _entity;
+}
+
+InputSequence GhastlyPrediction::addInput(const char *input, unsigned int size, unsigned int duration) {
+    ASSERT(size <= MaxInputSize);
+
+    _latest++;
+    Slot &slot = _slots[_latest % Size];
+    slot.sequence = _latest;
+    slot.duration = (uint8_t)std::min(duration, 255u);
+    slot.inputSize = (uint8_t)size;
+    if(size > 0) { memcpy(slot.input, input, size); }
+
+    apply(slot);
+    return _latest;
+}
+
+bool GhastlyPrediction::getCommands(InputCommands &commands) const {
+    InputSequence first, sequence;
+    const Slot *slot;
+
+    // Only as far back as the ring remembers, and no further than a packet holds
+    first = std::max(_acknowledged + 1, _latest >= MaxInputsPerPacket ? _latest - MaxInputsPerPacket + 1 : 1);
+    if(_latest >= Size) { first = std::max(first, _latest - Size + 1); }
+    if(first > _latest) { return false; }
+
+    commands.newest = _latest;
+    commands.count = 0;
+    for(sequence = first; sequence <= _latest; sequence++) {
+        slot = find(sequence);
+        ASSERT(slot);
+
+        InputCommand &command = commands.commands[commands.count++];
+        command.duration = slot->duration;
+        command.size = slot->inputSize;
+        memcpy(command.data, slot->input, slot->inputSize);
+    }
+    return true;
+}
+
+void GhastlyPrediction::reconcile(InputSequence acknowledged, const GhastlySnapshot &snapshot) {
+    const char *authoritative;
+    unsigned int size;
+    InputSequence sequence;
+    Slot *slot;
+
+    authoritative = snapshot.getEntity(_entity, size);
+    if(!authoritative) { return; }
+
+    // Snapshots come in order, but a server could only ever report going backwards by mistake
+    if(acknowledged > _latest || acknowledged < _acknowledged) { return; }
+    _acknowledged = acknowledged;
+
+    // The usual case: the server came to the same state that was predicted, so every prediction since still holds
+    slot = find(acknowledged);
+    if(slot && slot->predicted && slot->stateSize == size && memcmp(slot->state, authoritative, size) == 0) { return; }
+
+    // Counted only where there was a prediction to be wrong, rather than for the first state to arrive
+    if(slot && slot->predicted) { _corrections++; }
+
+    // Rewind to the server's state, then replay everything it hasn't processed yet
+    memcpy(_state, authoritative, size);
+    _stateSize = size;
+    _hasState = true;
+    if(slot) {
+        // So that the next snapshot to acknowledge the same input doesn't count as another correction
+        slot->predicted = true;
+        slot->stateSize = size;
+        memcpy(slot->state, authoritative, size);
+    }
+    for(sequence = acknowledged + 1; sequence <= _latest; sequence++) {
+        slot = find(sequence);
+        if(!slot) { continue; }
+        apply(*slot);
+        _replayed++;
+    }
+}
+
+const char *GhastlyPrediction::getState(unsigned int &size) const {
+    if(!_hasState) { return 0; }
+    size = _stateSize;
+    return _state;
+}
+
+InputSequence GhastlyPrediction::getLatestInput() const {
+    return _latest;
+}
+
+InputSequence GhastlyPrediction::getAcknowledgedInput() const {
+    return _acknowledged;
+}
+
+unsigned int GhastlyPrediction::getCorrections() const {
+    return _corrections;
+}
+
+unsigned int GhastlyPrediction::getReplayed() const {
+    return _replayed;
+}
+
+GhastlyPrediction::Slot *GhastlyPrediction::find(InputSequence sequence) {
+    if(sequence == 0) { return 0; }
+    Slot &slot = _slots[sequence % Size];
+    return (slot.sequence == sequence) ? &slot : 0;
+}
+
+const GhastlyPrediction::Slot *GhastlyPrediction::find(InputSequence sequence) const {
+    if(sequence == 0) { return 0; }
+    const Slot &slot = _slots[sequence % Size];
+    return (slot.sequence == sequence) ? &slot : 0;
+}
+
+void GhastlyPrediction::apply(Slot &slot) {
+    slot.predicted = _hasState;
+    if(!_hasState) { return; }
+
+    if(_simulation) {
+        _simulation->predict(_state, _stateSize, slot.input, slot.inputSize, slot.duration);
+        ASSERT(_stateSize <= GhastlySnapshot::MaxStateSize);
+    }
+    slot.stateSize = _stateSize;
+    memcpy(slot.state, _state, _stateSize);
+}
+
+const unsigned int GhastlyInterpolation::Size;
+
+GhastlyInterpolation::GhastlyInterpolation(): _simulation(0), _delay(0) {
+    reset();
+}
+
+void GhastlyInterpolation::reset() {
+    _first = _count = 0;
+}
+
+void GhastlyInterpolation::setSimulation(GhastlySimulation *simulation) {
+    _simulation = simulation;
+}
+
+void GhastlyInterpolation::setDelay(unsigned int delay) {
+    _delay = delay;
+}
+
+unsigned int GhastlyInterpolation::getDelay() const {
+    return _delay;
+}
+
+void GhastlyInterpolation::record(SnapshotSequence sequence, uint32_t time) {
+    if(_count == Size) {
+        _first = (_first + 1) % Size;
+        _count--;
+    }
+
+    Arrival &arrival = _arrivals[(_first + _count) % Size];
+    arrival.sequence = sequence;
+    arrival.time = time;
+    _count++;
+}
+
+bool GhastlyInterpolation::sample(const GhastlySnapshotHistory &history, EntityID id, uint32_t time, char *state, unsigned int &size) const {
+    const GhastlySnapshot *from = 0, *to = 0;
+    const char *fromState = 0, *toState = 0;
+    unsigned int fromSize = 0, toSize = 0, c;
+    uint32_t fromTime = 0, toTime = 0;
+    // Signed, so that a render time before the clock started still compares sensibly
+    int64_t renderTime = (int64_t)time - _delay;
+
+    // Newest first, looking for the snapshots either side of the render time
+    for(c = _count; c > 0; c--) {
+        const Arrival &arrival = _arrivals[(_first + c - 1) % Size];
+        const GhastlySnapshot *snapshot = history.find(arrival.sequence);
+        if(!snapshot) { break; }
+
+        if((int64_t)arrival.time <= renderTime) {
+            from = snapshot;
+            fromTime = arrival.time;
+            break;
+        }
+        to = snapshot;
+        toTime = arrival.time;
+    }
+
+    if(from) { fromState = from->getEntity(id, fromSize); }
+    if(to) { toState = to->getEntity(id, toSize); }
+
+    if(fromState && toState && fromSize == toSize && _simulation) {
+        _simulation->interpolate(fromState, toState, fromSize, (float)(renderTime - fromTime) / (float)(toTime - fromTime), state);
+        size = fromSize;
+        return true;
+    }
+
+    // Held at whichever end there is, as when the render time is past the newest snapshot (or before the oldest), or the entity has only just appeared or gone
+    if(!fromState) {
+        fromState = toState;
+        fromSize = toSize;
+    }
+    if(!fromState) { return false; }
+
+    memcpy(state, fromState, fromSize);
+    size = fromSize;
+    return true;
+}
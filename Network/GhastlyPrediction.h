@@ -0,0 +1,123 @@
+#ifndef GHASTLYPREDICTION_H
+#define GHASTLYPREDICTION_H
+
+#include <Network/GhastlySnapshot.h>
+
+// What the game knows about its entities, whose states are opaque to everything else
+class GhastlySimulation {
+public:
+    // Advance the client's own entity by one input command, in place; size may change, up to GhastlySnapshot::MaxStateSize
+    virtual void predict(char *state, unsigned int &size, const char *input, unsigned int inputSize, unsigned int duration) {}
+    // Blend two states of an entity, t (0 to 1) of the way from one to the other; by default the older state is held until the newer one arrives
+    virtual void interpolate(const char *from, const char *to, unsigned int size, float t, char *result) { memcpy(result, from, size); }
+};
+
+// The client's prediction of its own entity, so that its inputs take effect right away instead of a round trip later
+// Each input is applied to the predicted state as it's issued, and the state after it is kept in a ring keyed by input sequence
+// When a snapshot arrives, the state it holds for the entity is compared against what was predicted for the newest input it reflects
+// A match costs nothing more; otherwise the prediction is rewound to the snapshot's state and the inputs the server hasn't processed yet are replayed on top
+class GhastlyPrediction {
+public:
+    // How many inputs are remembered; inputs the server still hasn't processed after this many more are no longer replayed
+    static const unsigned int Size = 64;
+
+public:
+    GhastlyPrediction();
+
+    // Forget every input and prediction, and start numbering inputs from 1 again
+    void reset();
+
+    void setSimulation(GhastlySimulation *simulation);
+    // The entity in the server's snapshots that the client's inputs control
+    void setEntity(EntityID id);
+    EntityID getEntity() const;
+
+    // Record an input and predict its outcome, returning its sequence
+    // Until a snapshot has carried the entity there's nothing to predict from, and inputs are only recorded
+    InputSequence addInput(const char *input, unsigned int size, unsigned int duration);
+    // Fill in the commands the server hasn't been seen to process, newest last; returns false if there aren't any
+    bool getCommands(InputCommands &commands) const;
+
+    // Settle the prediction against a snapshot reflecting inputs up to and including acknowledged
+    void reconcile(InputSequence acknowledged, const GhastlySnapshot &snapshot);
+
+    // The predicted state of the entity, or 0 if a snapshot has yet to carry it
+    const char *getState(unsigned int &size) const;
+
+    InputSequence getLatestInput() const;
+    InputSequence getAcknowledgedInput() const;
+    // Snapshots that disagreed with the prediction, and the inputs replayed to correct for them
+    unsigned int getCorrections() const;
+    unsigned int getReplayed() const;
+
+private:
+    struct Slot {
+        InputSequence sequence;
+        uint8_t duration;
+        uint8_t inputSize;
+        char input[MaxInputSize];
+        // The predicted state once the input was applied, if there was one to predict from
+        bool predicted;
+        unsigned int stateSize;
+        char state[GhastlySnapshot::MaxStateSize];
+    };
+
+    // Returns 0 if the input has been forgotten (or not yet issued)
+    Slot *find(InputSequence sequence);
+    const Slot *find(InputSequence sequence) const;
+    void apply(Slot &slot);
+
+private:
+    GhastlySimulation *_simulation;
+    EntityID _entity;
+
+    Slot _slots[Size];
+    InputSequence _latest, _acknowledged;
+
+    bool _hasState;
+    unsigned int _stateSize;
+    char _state[GhastlySnapshot::MaxStateSize];
+
+    unsigned int _corrections, _replayed;
+};
+
+// Other entities are shown a little in the past, blended between the snapshots either side of that moment, so that they move smoothly even though snapshots arrive at intervals (and unevenly)
+// The delay trades latency for smoothness; it should cover a couple of snapshot intervals plus jitter
+class GhastlyInterpolation {
+public:
+    // Snapshots older than the history remembers can't be interpolated from anyway
+    static const unsigned int Size = GhastlySnapshotHistory::Size;
+
+public:
+    GhastlyInterpolation();
+
+    void reset();
+
+    void setSimulation(GhastlySimulation *simulation);
+    // In milliseconds
+    void setDelay(unsigned int delay);
+    unsigned int getDelay() const;
+
+    // Note when a snapshot arrived, by the client's clock in milliseconds; snapshots must be recorded in sequence order
+    void record(SnapshotSequence sequence, uint32_t time);
+
+    // An entity's state as of the delay before time, from the snapshots in history
+    // Past the newest snapshot the newest state is held rather than guessed at; returns false if neither snapshot has the entity
+    bool sample(const GhastlySnapshotHistory &history, EntityID id, uint32_t time, char *state, unsigned int &size) const;
+
+private:
+    struct Arrival {
+        SnapshotSequence sequence;
+        uint32_t time;
+    };
+
+private:
+    GhastlySimulation *_simulation;
+    unsigned int _delay;
+
+    // Oldest first, starting at _first
+    Arrival _arrivals[Size];
+    unsigned int _first, _count;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include <Network/GhastlyPriority.h>
+#include <Base/Assertion.h>
+
+GhastlyPriority::GhastlyPriority(): _deferred(0) {}
+
+void GhastlyPriority::reset() {
+    _accumulators.clear();
+    _deferred = 0;
+}
+
+bool GhastlyPriority::PriorityOrder(const Entry *lhs, const Entry *rhs) {
+    // Ties go to the lower ID, so that they're broken the same way every time
+    if(lhs->priority != rhs->priority) { return lhs->priority > rhs->priority; }
+    return lhs->id < rhs->id;
+}
+
+bool GhastlyPriority::schedule(const GhastlySnapshot &view, const std::vector<float> &rates, const GhastlySnapshot *baseline, uint32_t elapsed, unsigned int budget, GhastlySnapshot &scheduled, EntityID required) {
+    static const GhastlySnapshot Empty;
+    unsigned int current = 0, base = 0, accumulator = 0, total = 0, currentSize, baseSize, c;
+    const char *currentState, *baseState;
+    float rate;
+    Entry entry;
+
+    ASSERT(rates.size() == view.getEntityCount());
+    if(!baseline) { baseline = &Empty; }
+
+    // Snapshots sent without any time passing still count for something
+    elapsed = std::max(elapsed, 1u);
+
+    // Walk the view and baseline in ID order, as encode does, finding what the host is out of date on
+    _entries.clear();
+    while(current < view.getEntityCount() || base < baseline->getEntityCount()) {
+        entry.current = entry.base = -1;
+        if(base >= baseline->getEntityCount() || (current < view.getEntityCount() && view.getEntityID(current) < baseline->getEntityID(base))) {
+            entry.current = current++;
+        } else if(current >= view.getEntityCount() || baseline->getEntityID(base) < view.getEntityID(current)) {
+            entry.base = base++;
+        } else {
+            entry.current = current++;
+            entry.base = base++;
+        }
+
+        currentSize = baseSize = 0;
+        currentState = (entry.current >= 0) ? view.getEntityState(entry.current, currentSize) : 0;
+        baseState = (entry.base >= 0) ? baseline->getEntityState(entry.base, baseSize) : 0;
+        entry.id = (entry.current >= 0) ? view.getEntityID(entry.current) : baseline->getEntityID(entry.base);
+        entry.priority = 0;
+        entry.selected = false;
+
+        if(currentState && baseState && currentSize == baseSize && memcmp(currentState, baseState, currentSize) == 0) {
+            entry.bits = 0;
+        } else {
+            entry.bits = GhastlySnapshot::GetRecordBits(currentState, currentSize, baseState, baseSize);
+
+            // Both lists are sorted, so the entity's accumulator is found by walking along with it
+            while(accumulator < _accumulators.size() && _accumulators[accumulator].id < entry.id) { accumulator++; }
+            if(accumulator < _accumulators.size() && _accumulators[accumulator].id == entry.id) {
+                entry.priority = _accumulators[accumulator].priority;
+            }
+            rate = (entry.current >= 0) ? rates[entry.current] : 1.0f;
+            entry.priority += rate * elapsed;
+            total += entry.bits;
+        }
+        _entries.push_back(entry);
+    }
+
+    // Everything fits, which is the usual case on a link that keeps up; there's nothing owed to accumulate
+    _deferred = 0;
+    if(total <= budget) {
+        _accumulators.clear();
+        return false;
+    }
+
+    // Greedily take the highest priorities that still fit, passing over any too big for what's left
+    _order.clear();
+    for(c = 0; c < _entries.size(); c++) {
+        if(_entries[c].bits > 0) { _order.push_back(&_entries[c]); }
+    }
+    std::sort(_order.begin(), _order.end(), PriorityOrder);
+    for(c = 0; c < _order.size(); c++) {
+        if(_order[c]->id == required) {
+            std::rotate(_order.begin(), _order.begin() + c, _order.begin() + c + 1);
+            break;
+        }
+    }
+
+    for(c = 0; c < _order.size(); c++) {
+        if(_order[c]->bits > budget) {
+            _deferred++;
+            continue;
+        }
+        budget -= _order[c]->bits;
+        _order[c]->selected = true;
+        _order[c]->priority = 0;
+    }
+
+    // The host gets the view wherever it's up to date or was chosen, and keeps what its baseline has everywhere else
+    scheduled.clear();
+    scheduled.setSequence(view.getSequence());
+    _next.clear();
+    for(c = 0; c < _entries.size(); c++) {
+        const Entry &scheduledEntry = _entries[c];
+        if(scheduledEntry.bits == 0 || scheduledEntry.selected) {
+            if(scheduledEntry.current >= 0) {
+                currentState = view.getEntityState(scheduledEntry.current, currentSize);
+                scheduled.setEntity(scheduledEntry.id, currentState, currentSize);
+            }
+        } else if(scheduledEntry.base >= 0) {
+            baseState = baseline->getEntityState(scheduledEntry.base, baseSize);
+            scheduled.setEntity(scheduledEntry.id, baseState, baseSize);
+        }
+
+        if(scheduledEntry.priority > 0) {
+            Accumulator next;
+            next.id = scheduledEntry.id;
+            next.priority = scheduledEntry.priority;
+            _next.push_back(next);
+        }
+    }
+    _accumulators.swap(_next);
+    return true;
+}
+
+float GhastlyPriority::getPriority(EntityID id) const {
+    unsigned int low = 0, high = _accumulators.size(), middle;
+
+    while(low < high) {
+        middle = (low + high) / 2;
+        if(_accumulators[middle].id < id) { low = middle + 1; }
+        else { high = middle; }
+    }
+    return (low < _accumulators.size() && _accumulators[low].id == id) ? _accumulators[low].priority : 0.0f;
+}
+
+unsigned int GhastlyPriority::getDeferred() const {
+    return _deferred;
+}
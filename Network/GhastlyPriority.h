@@ -0,0 +1,55 @@
+#ifndef GHASTLYPRIORITY_H
+#define GHASTLYPRIORITY_H
+
+#include <Network/GhastlySnapshot.h>
+
+// Decides which entities go in a host's next snapshot when everything the host is out of date on won't fit
+// Each entity that differs from the host's baseline has a priority accumulator, which grows every snapshot by the time passed times the entity's rate (its weight and closeness to the host's view)
+// The highest priorities are packed into the snapshot's budget first and start over once sent, so the entities that lose out keep rising until it's their turn, rather than the same ones always missing out
+class GhastlyPriority {
+public:
+    GhastlyPriority();
+
+    // Forget every accumulated priority
+    void reset();
+
+    // Work out what the host should have after this snapshot, to be encoded against the same baseline (which may be null)
+    // rates holds one value for each of view's entities, in the same order; entities the view has dropped go at a rate of 1
+    // Returns false if every change fits in budget bits, and the view can be sent as it is
+    // Otherwise scheduled is filled in with the changes that fit, taken in priority order, and the rest of the entities as the baseline has them
+    // A required entity's change is taken ahead of everything else, as long as it fits at all
+    bool schedule(const GhastlySnapshot &view, const std::vector<float> &rates, const GhastlySnapshot *baseline, uint32_t elapsed, unsigned int budget, GhastlySnapshot &scheduled, EntityID required = GhastlySnapshot::NoEntity);
+
+    // An entity's accumulated priority, 0 if it was sent (or is up to date) as of the last snapshot
+    float getPriority(EntityID id) const;
+    // How many of the changes owed to the host the last snapshot left out
+    unsigned int getDeferred() const;
+
+private:
+    struct Entry {
+        EntityID id;
+        float priority;
+        // Bits the entity's record could take, or 0 if the host is up to date on it
+        unsigned int bits;
+        // Indices into the view and baseline, -1 for an entity missing from one of them
+        int current, base;
+        bool selected;
+    };
+
+    struct Accumulator {
+        EntityID id;
+        float priority;
+    };
+
+    static bool PriorityOrder(const Entry *lhs, const Entry *rhs);
+
+private:
+    // Only entities with a priority, sorted by ID
+    std::vector<Accumulator> _accumulators, _next;
+
+    std::vector<Entry> _entries;
+    std::vector<Entry*> _order;
+    unsigned int _deferred;
+};
+
+#endif
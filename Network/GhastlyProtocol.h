@@ -3,10 +3,14 @@
 
 #include <Base/Base.h>
 #include <Network/Packet.h>
+#include <Network/BitStream.h>
 
 /*
     This document defines how Ghastly clients and server communicate.  Ghastly attempts to be as stateless as possible, with minimal exception.
     Generally, a packet emitted by the client is denoted with '->', and a packet emitted by the server is denoted with '<-'.]
+
+    Everything is bit-packed (see BitStream.h).  Each payload's serialize method is its layout on the wire, and is used both to write it and to read it back.
+    A payload is written as its type (8 bits) followed by its fields.
 */
 namespace GhastlyProtocol {
     typedef uint8_t PayloadType;
@@ -15,15 +19,144 @@ namespace GhastlyProtocol {
         PayloadType type;
 
         Payload(PayloadType t): type(t) {}
+
+        // Payloads without any fields have nothing to add
+        template <typename Stream>
+        bool serialize(Stream &stream) { return true; }
     };
 
+    // Room for any payload but a snapshot
+    const unsigned int MaxPayloadSize = 64;
+
+    // Returns the number of bytes written, or 0 if the payload doesn't fit
+    template <typename T>
+    unsigned int WritePayload(T &payload, char *buffer, unsigned int size) {
+        BitWriter writer(buffer, size);
+        if(!writer.serializeInteger(payload.type, 0, 255) || !payload.serialize(writer) || !writer.align()) { return 0; }
+        return writer.getBytesWritten();
+    }
+
+    // Returns false if the data isn't a well formed payload of T's type; consumed is how far into the data the payload went
+    template <typename T>
+    bool ReadPayload(T &payload, const char *data, unsigned int size, unsigned int *consumed = 0) {
+        PayloadType type;
+        BitReader reader(data, size);
+        if(!reader.serializeInteger(type, 0, 255) || type != payload.type) { return false; }
+        if(!payload.serialize(reader) || !reader.align()) { return false; }
+        if(consumed) { *consumed = reader.getBytesRead(); }
+        return true;
+    }
+
+    template <typename T>
+    bool ReadPayload(T &payload, const Packet &packet) {
+        return ReadPayload(payload, packet.data, packet.size);
+    }
+
+    // Returns 0 (which no payload uses) for empty packets
+    inline PayloadType GetPayloadType(const Packet &packet) {
+        return (packet.size > 0) ? (PayloadType)packet.data[0] : 0;
+    }
+
+    /*
+    Channels:
+        Every packet begins with a channel header, followed by a single payload.
+        Packet sequence numbers count the packets sent on a connection.  Each packet also acknowledges the newest packet received from the other end, and the 32 before it as a bitfield, so acks ride along with whatever traffic is already flowing.
+        A packet that carries only acks (sent when there's no other traffic to carry them) is neither sequenced nor acknowledged itself.
+
+        Payloads are sent on one of three channels, which keep their own sequence numbers:
+            Unreliable:          delivered as received; may be lost or arrive out of order
+            Sequenced:           may be lost, and anything older than what's already been delivered is dropped, so only the latest state gets through
+            Reliable:            retransmitted until acknowledged, and delivered in the order sent
+
+        Packets sent together (over the course of a tick, say) may be bundled into a single datagram, up to the sender's MTU.
+        A bundle's header has only its channel, and is followed by each packet in turn, preceded by its size:
+            0 size (7 bits)                 for packets under 128 bytes
+            1 size (15 bits)                for the rest, high bits first
+        Bundled packets are handled exactly as if they'd arrived separately, and can't themselves be bundles.
+
+        A payload too big for one packet under the sender's MTU is split into as many equal fragments (bar the last) as it takes, up to MaxFragments.
+        Reliable payloads stop at MaxReliableFragments, so that a single ack can reach every fragment sent in one go.
+        Each fragment is a packet of its own on the fragment channel, sequenced and acknowledged like any other, and its header is followed by a fragment header:
+            Channel                         the channel the whole payload is sent on
+            Channel sequence (16 bits)      for sequenced and reliable payloads
+            Message ID (16 bits)            numbering the sender's fragmented payloads
+            Fragment count, fragment index
+            Payload size (32 bits)
+        Once every fragment has arrived the payload is handled as though it had come in one packet on its channel.
+        A reliable payload is only acknowledged once all its fragments are, and only the fragments that weren't are retransmitted.
+    */
+    enum Channel {
+        UnreliableChannel = 0,
+        SequencedChannel,
+        ReliableChannel,
+        AckOnlyChannel,
+        BundleChannel,
+        FragmentChannel
+    };
+
+    struct ChannelHeader {
+        uint8_t channel;
+        // The ack fields are only sent once something has been received
+        bool hasAck;
+        // Ack-only packets have no sequence number
+        uint16_t sequence;
+        uint16_t ack;
+        uint32_t ackBits;
+        // Only sequenced and reliable channels number their payloads
+        uint16_t channelSequence;
+
+        template <typename Stream>
+        bool serialize(Stream &stream) {
+            if(!stream.serializeInteger(channel, UnreliableChannel, FragmentChannel)) { return false; }
+            if(channel == BundleChannel) { return stream.align(); }
+            if(!stream.serializeBool(hasAck)) { return false; }
+            if(channel != AckOnlyChannel && !stream.serializeInteger(sequence, 0, 0xFFFF)) { return false; }
+            if(hasAck && (!stream.serializeInteger(ack, 0, 0xFFFF) || !stream.serializeBits(ackBits, 32))) { return false; }
+            if((channel == SequencedChannel || channel == ReliableChannel) && !stream.serializeInteger(channelSequence, 0, 0xFFFF)) { return false; }
+            return stream.align();
+        }
+    };
+
+    // A channel header with every field present
+    const unsigned int MaxChannelHeaderSize = 11;
+    const unsigned int BundleHeaderSize = 1;
+    // The largest packet a bundle can carry
+    const unsigned int MaxBundledSize = 0x7FFF;
+
+    // The most fragments a payload can be split into
+    const unsigned int MaxFragments = 64;
+    // The most fragments a reliable payload can be split into; an ack reaches back over 33 packets, leaving one for other traffic
+    const unsigned int MaxReliableFragments = 32;
+
+    struct FragmentHeader {
+        uint8_t channel;
+        uint16_t channelSequence;
+        uint16_t message;
+        uint32_t count;
+        uint32_t index;
+        uint32_t size;
+
+        template <typename Stream>
+        bool serialize(Stream &stream) {
+            if(!stream.serializeInteger(channel, UnreliableChannel, ReliableChannel)) { return false; }
+            if((channel == SequencedChannel || channel == ReliableChannel) && !stream.serializeInteger(channelSequence, 0, 0xFFFF)) { return false; }
+            if(!stream.serializeInteger(message, 0, 0xFFFF)) { return false; }
+            if(!stream.serializeInteger(count, 2, MaxFragments) || !stream.serializeInteger(index, 0, count - 1)) { return false; }
+            if(!stream.serializeBits(size, 32)) { return false; }
+            return stream.align();
+        }
+    };
+
+    // A fragment header with every field present
+    const unsigned int MaxFragmentHeaderSize = 10;
+
     /*
     Host ID Assignment:
-        Every host in the Ghastly Network model has a HostID which must be assigned it by the server.  This ID is acquired with the following exchange:
+        Every host in the Ghastly Network model has a HostID which must be assigned it by the server.  This ID is acquired with the following exchange, on the reliable channel:
         -> Host ID Request (no payload)
         <- Host ID Assign  (Host ID)
 
-        In the event that the server is full, the server responds instead with a Host Reject packet
+        In the event that the server is full, the server responds instead with a Host Reject packet, on the unreliable channel since it keeps no connection for the client
         -> Host ID Request (no payload)
         <- Host Reject (no payload)
     */
@@ -33,11 +166,15 @@ namespace GhastlyProtocol {
     };
 
     const PayloadType IDAssignType = 2;
-    typedef int16_t HostID;
+    // Only meaningful to the server that assigned it; IDs of hosts that have since disconnected are never mistaken for the IDs of new ones
+    typedef uint32_t HostID;
     struct IDAssign: public Payload {
         HostID id;
 
-        IDAssign(HostID i): Payload(IDAssignType), id(i) {}
+        IDAssign(HostID i = 0): Payload(IDAssignType), id(i) {}
+
+        template <typename Stream>
+        bool serialize(Stream &stream) { return stream.serializeBits(id, 32); }
     };
 
     const PayloadType HostRejectType = 3;
@@ -47,7 +184,7 @@ namespace GhastlyProtocol {
 
     /*
     Disconnection and Host ID reclamation:
-        When a host wishes to terminate its connection for whatever reason, it issues a disconnect request.
+        When a host wishes to terminate its connection for whatever reason, it issues a disconnect request on the reliable channel.
         -> Disconnect (no payload)
         The server need not respond to this, and can now reclaim that host's ID
     */
@@ -56,13 +193,199 @@ namespace GhastlyProtocol {
         Disconnect(): Payload(DisconnectType) {}
     };
 
+    /*
+    Snapshot Replication:
+        The server periodically sends each client the state of the world's entities as a snapshot, numbered by a sequence that increases with every snapshot the server takes.
+        Each snapshot is encoded as a delta against the newest snapshot that client has acknowledged (its baseline), so entities that haven't changed since cost nothing.
+        A baseline of 0 means the snapshot is encoded against nothing, and carries every entity in full.
+        Snapshots go on the sequenced channel, since a newer snapshot supersedes any that were lost; acks go on the unreliable channel.
+        <- Snapshot     (sequence, baseline sequence, last input, entity records)
+        -> Snapshot Ack (sequence)
+
+        The last input is the newest of the client's input commands (see below) that the world in the snapshot reflects, if there's been one: a 1 bit followed by the input sequence (32 bits), or a 0 bit.
+
+        Entity records follow the snapshot header, in increasing entity ID order.  Each is preceded by a 1 bit, and the list ends with a 0 bit:
+            Entity ID, as one of
+                1                       the ID after the previous record's
+                0 1 gap (8 bits)        2 + gap after the previous record's
+                0 0 ID (32 bits)
+            Operation (2 bits), then depending on the operation
+                Full:   state size (8 bits), state
+                Delta:  state size (8 bits), a bit per state byte marking those that changed, the changed bytes
+                Remove: nothing
+    */
+    typedef uint32_t SnapshotSequence;
+    typedef uint32_t EntityID;
+
+    // Baselines are never older than this many snapshots
+    const unsigned int MaxBaselineAge = 32;
+
+    const PayloadType SnapshotType = 5;
+    // Input commands are numbered from 1, so 0 means none
+    typedef uint32_t InputSequence;
+
+    struct SnapshotHeader: public Payload {
+        SnapshotSequence sequence;
+        SnapshotSequence baseline;
+        InputSequence input;
+
+        SnapshotHeader(SnapshotSequence s = 0, SnapshotSequence b = 0, InputSequence i = 0): Payload(SnapshotType), sequence(s), baseline(b), input(i) {}
+
+        // The baseline goes as how many snapshots back it is, with 0 for none
+        template <typename Stream>
+        bool serialize(Stream &stream) {
+            uint32_t age = baseline ? sequence - baseline : 0;
+            bool hasInput = (input != 0);
+            if(!stream.serializeBits(sequence, 32) || !stream.serializeInteger(age, 0, MaxBaselineAge - 1)) { return false; }
+            baseline = age ? sequence - age : 0;
+
+            if(!stream.serializeBool(hasInput)) { return false; }
+            if(!hasInput) {
+                input = 0;
+                return true;
+            }
+            return stream.serializeBits(input, 32);
+        }
+    };
+
+    enum SnapshotOperation {
+        SnapshotFull = 1,
+        SnapshotDelta,
+        SnapshotRemove
+    };
+
+    const PayloadType SnapshotAckType = 6;
+    struct SnapshotAck: public Payload {
+        SnapshotSequence sequence;
+
+        SnapshotAck(SnapshotSequence s = 0): Payload(SnapshotAckType), sequence(s) {}
+
+        template <typename Stream>
+        bool serialize(Stream &stream) { return stream.serializeBits(sequence, 32); }
+    };
+
+    /*
+    Areas of Interest:
+        A client can tell the server which region of the world it's looking at, after which its snapshots only carry the entities in and around that region (plus any entities that have no position).
+        Until it does, its snapshots carry the whole world.
+        -> View Update (lower and upper corners of the view)
+
+        The view is sent on the sequenced channel whenever it changes, and again with every ping in case it was lost.
+    */
+    const PayloadType ViewUpdateType = 10;
+    struct ViewUpdate: public Payload {
+        float lowerX, lowerY;
+        float upperX, upperY;
+
+        ViewUpdate(float lx = 0, float ly = 0, float ux = 0, float uy = 0): Payload(ViewUpdateType), lowerX(lx), lowerY(ly), upperX(ux), upperY(uy) {}
+
+        // World coordinates have no known range, so these go at full precision
+        template <typename Stream>
+        bool serialize(Stream &stream) {
+            return stream.serializeFloat(lowerX) && stream.serializeFloat(lowerY) && stream.serializeFloat(upperX) && stream.serializeFloat(upperY);
+        }
+    };
+
+    /*
+    Keepalives:
+        The server assumes a client it hasn't heard from for long enough is gone, and frees its ID.
+        So that a quiet connection isn't mistaken for a dead one, either end sends a keepalive whenever it hasn't sent anything else for a while.
+        Keepalives go on the unreliable channel, and need no response.
+        <-> Keepalive (no payload)
+    */
+    const PayloadType KeepaliveType = 11;
+    struct Keepalive: public Payload {
+        Keepalive(): Payload(KeepaliveType) {}
+    };
+
+    /*
+    Input Commands:
+        A client drives its own entity with input commands, numbered by an input sequence that increases with every command the client issues.
+        Each command carries how long it applies for (in milliseconds) and whatever the game puts in it.
+        Commands go on the unreliable channel.  Rather than being retransmitted, each packet carries the newest command along with the ones before it that the server hasn't yet been seen to process (up to MaxInputsPerPacket), so one that's lost is covered by the next.
+        -> Input Commands (newest sequence, count, then each command oldest first)
+
+        Each command is written as its duration (8 bits), size (up to MaxInputSize) and data.
+        The server takes each command once, in order, skipping any that were lost altogether, and reports the newest it has processed in the client's snapshots.
+    */
+    const unsigned int MaxInputSize = 32;
+    const unsigned int MaxInputsPerPacket = 16;
+
+    struct InputCommand {
+        uint8_t duration;
+        uint8_t size;
+        char data[MaxInputSize];
+    };
+
+    const PayloadType InputCommandsType = 12;
+    struct InputCommands: public Payload {
+        InputSequence newest;
+        uint8_t count;
+        // Oldest first, so commands[count - 1] is the newest
+        InputCommand commands[MaxInputsPerPacket];
+
+        InputCommands(): Payload(InputCommandsType), newest(0), count(0) {}
+
+        template <typename Stream>
+        bool serialize(Stream &stream) {
+            unsigned int c;
+            if(!stream.serializeBits(newest, 32) || !stream.serializeInteger(count, 1, MaxInputsPerPacket)) { return false; }
+            for(c = 0; c < count; c++) {
+                InputCommand &command = commands[c];
+                if(!stream.serializeInteger(command.duration, 0, 255) || !stream.serializeInteger(command.size, 0, MaxInputSize)) { return false; }
+                if(!stream.serializeBytes(command.data, command.size)) { return false; }
+            }
+            return true;
+        }
+    };
+
+    // Room for a packet of the largest commands; too big for MaxPayloadSize
+    const unsigned int MaxInputCommandsSize = 6 + MaxInputsPerPacket * (2 + MaxInputSize);
+
     /*
     Latency Discovery:
         In order to give clients a picture of overall server latency (above and beyond network latency), there is a ping tool available within the Ghastly Protocol which is relatively straightforward:
         -> Ping Request  (client timestamp)
         <- Ping Response (client timestamp, server timestamp)
-        -> Ping Done     (server timestamp)
+        -> Ping Done     (server timestamp, client timestamp)
+
+        Timestamps are in milliseconds, each by the clock of the host that took it.
+        The client measures the round trip from its own timestamp coming back, and the server from its own; halfway through each round trip is assumed to be when the other host took its timestamp, which gives each an estimate of how far the other's clock is from its own.
+        Pings are sent on the unreliable channel, since a lost ping just means one less sample.
     */
+    typedef uint32_t PingTimestamp;
+
+    const PayloadType PingRequestType = 7;
+    struct PingRequest: public Payload {
+        PingTimestamp client;
+
+        PingRequest(PingTimestamp c = 0): Payload(PingRequestType), client(c) {}
+
+        template <typename Stream>
+        bool serialize(Stream &stream) { return stream.serializeBits(client, 32); }
+    };
+
+    const PayloadType PingResponseType = 8;
+    struct PingResponse: public Payload {
+        PingTimestamp client;
+        PingTimestamp server;
+
+        PingResponse(PingTimestamp c = 0, PingTimestamp s = 0): Payload(PingResponseType), client(c), server(s) {}
+
+        template <typename Stream>
+        bool serialize(Stream &stream) { return stream.serializeBits(client, 32) && stream.serializeBits(server, 32); }
+    };
+
+    const PayloadType PingDoneType = 9;
+    struct PingDone: public Payload {
+        PingTimestamp server;
+        PingTimestamp client;
+
+        PingDone(PingTimestamp s = 0, PingTimestamp c = 0): Payload(PingDoneType), server(s), client(c) {}
+
+        template <typename Stream>
+        bool serialize(Stream &stream) { return stream.serializeBits(server, 32) && stream.serializeBits(client, 32); }
+    };
 }
 
 #endif
\ No newline at end of file
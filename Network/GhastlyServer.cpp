@@ -1,75 +1,729 @@
 #include <Network/GhastlyServer.h>
 #include <Base/Assertion.h>
 
-GhastlyHostInfo::GhastlyHostInfo() {}
-GhastlyHostInfo::GhastlyHostInfo(const GhastlyHostInfo &other) { copy(other); }
-GhastlyHostInfo::GhastlyHostInfo(const NetAddress &a, HostID i): addr(a), id(i) {
-    lastReceived = GetClock();
-    latency = 0;
-}
+GhastlyServer::GhastlyServer(unsigned int maxClients, unsigned int shards):
+    GhastlyHost(ID_SERVER), SocketedUDPProvider(0, maxClients + MAX_PENDING_CLIENTS), _hosts(maxClients), _transport(0),
+    _time(0), _idleTimeout(DEFAULT_IDLE_TIMEOUT), _threaded(false), _shardsDone(0),
+    _snapshotSequence(0), _snapshotSize(DEFAULT_SNAPSHOT_SIZE), _snapshotRate(DEFAULT_SNAPSHOT_RATE), _lastSnapshot(0),
+    _priorityFalloff(DEFAULT_PRIORITY_FALLOFF),
+    _interestGrid(DEFAULT_INTEREST_CELL_SIZE), _interestHysteresis(DEFAULT_INTEREST_HYSTERESIS),
+    _maxViewSize(DEFAULT_MAX_VIEW_SIZE)
+{
+    unsigned int c;
 
-void GhastlyHostInfo::operator=(const GhastlyHostInfo &other) { copy(other); }
-void GhastlyHostInfo::copy(const GhastlyHostInfo &other) {
-    addr = other.addr;
-    id = other.id;
-    lastReceived = other.lastReceived;
-    latency = other.latency;
-}
+    shards = std::max(shards, 1u);
+    for(c = 0; c < shards; c++) {
+        _shards.push_back(new GhastlyShard(c));
+    }
+    if(shards == 1) { return; }
+
+    _shardsDone = SDL_CreateSemaphore(0);
+    for(c = 0; c < shards; c++) {
+        if(!_shards[c]->start(this)) { break; }
+    }
+    if(c == shards) {
+        _threaded = true;
+        return;
+    }
 
-GhastlyServer::GhastlyServer(unsigned int maxClients): GhastlyHost(ID_SERVER), _maxClients(maxClients) {
-    _idPool = new IndexPool(maxClients);
+    // Without every worker there's no splitting the hosts up, so they all go on the calling thread
+    Warn("Failed to start " << shards << " Ghastly shards, processing hosts on a single thread");
+    for(c = 0; c < shards; c++) {
+        delete _shards[c];
+    }
+    _shards.resize(1);
+    _shards[0] = new GhastlyShard(0);
+    SDL_DestroySemaphore(_shardsDone);
+    _shardsDone = 0;
 }
 
 GhastlyServer::~GhastlyServer() {
+    unsigned int c;
+
+    for(c = 0; c < _shards.size(); c++) {
+        _shards[c]->stop();
+    }
+
     // Send disconnect messages to all the clients before tearing down
-    HostMap::iterator itr;
-    for(itr = _hostMap.begin(); itr != _hostMap.end(); itr++) {
+    // There's no waiting around for acknowledgement, so this is only a best effort
+    for(c = 0; c < _hosts.size(); c++) {
+        GhastlyHostInfo &host = _hosts.getHost(c);
         Disconnect dc;
-        sendPacket(Packet(itr->second.addr, (char*)&dc, sizeof(dc)));
+        SendPayload(host.connection, ReliableChannel, dc);
+        host.connection->flush();
+        delete host.connection;
+        delete host.snapshots;
+        delete host.interest;
+        delete host.priority;
     }
+    drainOutbound();
 
-    delete _idPool;
+    for(c = 0; c < _shards.size(); c++) {
+        delete _shards[c];
+    }
+    if(_shardsDone) { SDL_DestroySemaphore(_shardsDone); }
 }
 
 void GhastlyServer::update(int elapsed) {
     Packet packet;
-    while(recvPacket(packet)) {
-        onPacketReceive(packet);
+    GhastlyHostInfo *host;
+    unsigned int received = 0, c;
+
+    beginUpdate();
+    _time += (uint32_t)std::max(elapsed, 0);
+
+    // Workers start on their mail while the rest of it is still being received
+    if(_threaded) {
+        for(c = 0; c < _shards.size(); c++) {
+            _shards[c]->run(_shardsDone);
+        }
     }
+
+    // Whatever's past the limit waits in the provider for the next update
+    while(received < _maxPacketsPerUpdate && recvPacket(packet)) {
+        received++;
+        host = _hosts.find(packet.addr);
+        if(!host) {
+            onUnconnectedPacket(packet);
+            continue;
+        }
+        deliver(GhastlyMail(host->id, packet));
+    }
+
+    if(_threaded) {
+        for(c = 0; c < _shards.size(); c++) {
+            _shards[c]->post(GhastlyMail());
+        }
+        for(c = 0; c < _shards.size(); c++) {
+            SDL_SemWait(_shardsDone);
+        }
+    } else {
+        finishShard(*_shards[0]);
+    }
+
+    // Anything sent to retired hosts goes out before their addresses are forgotten
+    drainOutbound();
+    releaseRetired();
+    collectInputs();
+
+    endUpdate();
+    drainOutbound();
 }
 
-void GhastlyServer::onPacketReceive(const Packet &packet) {
-    Payload *payload = (Payload*)packet.data;
-    switch(payload->type) {
-    case IDRequestType: {
-        HostID assignID = (HostID)_idPool->allocate();
-        if(assignID == -1) {
-            HostReject reject;
+GhastlyShard &GhastlyServer::shardOf(HostID id) {
+    return *_shards[id % _shards.size()];
+}
 
-            Warn("All IDs allocated, client " << packet.addr << " will be rejected");
-            sendPacket(Packet(packet.addr, (char*)&reject, sizeof(reject)));
-        } else {
-            IDAssign assign(assignID);
+void GhastlyServer::deliver(const GhastlyMail &mail) {
+    GhastlyShard &shard = shardOf(mail.host);
 
-            Info("Client connecting, associated ID " << assignID << " with address " << packet.addr);
-            sendPacket(Packet(packet.addr, (char*)&assign, sizeof(assign)));
+    if(!_threaded) {
+        processMail(shard, mail);
+        return;
+    }
 
-            _idMap[packet.addr] = assignID;
-            _hostMap[assignID] = GhastlyHostInfo(packet.addr, assignID);
+    shard.post(mail);
+}
+
+void GhastlyServer::processMail(GhastlyShard &shard, const GhastlyMail &mail) {
+    Packet payload;
+
+    shard._processed++;
+
+    // The host may have been retired by an earlier packet in this update
+    GhastlyHostInfo *host = findLive(mail.host);
+    if(!host) { return; }
+
+    if(mail.opening) {
+        host->idleTimer = shard._timers.create(host->id);
+        host->keepaliveTimer = shard._timers.create(host->id);
+        host->retransmitTimer = shard._timers.create(host->id);
+        shard._timers.schedule(host->keepaliveTimer, _keepaliveInterval);
+    }
+
+    host->lastReceived = _time;
+    shard._timers.schedule(host->idleTimer, _idleTimeout);
+    syncClock(host);
+    queueUpdate(shard, host);
+
+    host->connection->receive(mail.packet);
+    // A payload may disconnect the host, taking its connection with it
+    while(host->connection && host->connection->nextPayload(payload)) {
+        onPayload(shard, host, payload);
+    }
+}
+
+void GhastlyServer::finishShard(GhastlyShard &shard) {
+    GhastlyHostInfo *host;
+    unsigned int c;
+
+    shard._expired.clear();
+    shard._timers.advance(_time - shard._timers.getTime(), shard._expired);
+    for(c = 0; c < shard._expired.size(); c++) {
+        onTimer(shard, shard._expired[c]);
+    }
+
+    for(c = 0; c < shard._updateQueue.size(); c++) {
+        // The host may have gone since it was queued
+        host = findLive(shard._updateQueue[c]);
+        if(!host) { continue; }
+
+        host->updateQueued = false;
+        updateConnection(shard, host);
+    }
+    shard._updateQueue.clear();
+}
+
+GhastlyHostInfo *GhastlyServer::findLive(HostID id) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    return (host && host->connection) ? host : 0;
+}
+
+void GhastlyServer::onTimer(GhastlyShard &shard, const TimerWheel::Expiry &expiry) {
+    // Timers go with their hosts, but one that expired alongside its host's removal can still turn up
+    GhastlyHostInfo *host = findLive((HostID)expiry.data);
+    if(!host) { return; }
+
+    if(expiry.timer == host->idleTimer) {
+        Info("Client " << host->id << " at " << host->addr << " timed out after " << (_time - host->lastReceived) << "ms without a word");
+        retireHost(shard, host);
+    } else if(expiry.timer == host->keepaliveTimer) {
+        syncClock(host);
+        if(host->connection->getSinceSent() >= _keepaliveInterval) {
+            Keepalive keepalive;
+            SendPayload(host->connection, UnreliableChannel, keepalive);
         }
+        // Anything else sent since the last keepalive pushes the next one back
+        shard._timers.schedule(host->keepaliveTimer, _keepaliveInterval - std::min(host->connection->getSinceSent(), (uint32_t)_keepaliveInterval));
+    } else if(expiry.timer == host->retransmitTimer) {
+        queueUpdate(shard, host);
+    }
+}
+
+void GhastlyServer::syncClock(GhastlyHostInfo *host) {
+    host->connection->advance((int)(_time - host->lastUpdated));
+    host->lastUpdated = _time;
+}
 
+void GhastlyServer::queueUpdate(GhastlyShard &shard, GhastlyHostInfo *host) {
+    if(host->updateQueued) { return; }
+    host->updateQueued = true;
+    shard._updateQueue.push_back(host->id);
+}
+
+bool GhastlyServer::updateConnection(GhastlyShard &shard, GhastlyHostInfo *host) {
+    int next;
+
+    syncClock(host);
+    host->connection->update(0);
+    if(host->connection->hasFailed()) {
+        Info("Lost connection to client " << host->id << " at " << host->addr);
+        retireHost(shard, host);
+        return false;
+    }
+
+    next = host->connection->getNextRetransmit();
+    if(next >= 0) {
+        shard._timers.schedule(host->retransmitTimer, (uint32_t)next);
+    } else {
+        shard._timers.cancel(host->retransmitTimer);
+    }
+    return true;
+}
+
+void GhastlyServer::holdOutbound() {
+    unsigned int c;
+    for(c = 0; c < _hosts.size(); c++) {
+        _hosts.getHost(c).connection->hold();
+    }
+}
+
+void GhastlyServer::flushOutbound() {
+    unsigned int c;
+    for(c = 0; c < _hosts.size(); c++) {
+        _hosts.getHost(c).connection->flush();
+    }
+    drainOutbound();
+}
+
+void GhastlyServer::drainOutbound() {
+    unsigned int c, p;
+
+    // Connections only send to their shards when the shards have threads of their own
+    if(!_threaded) { return; }
+
+    for(c = 0; c < _shards.size(); c++) {
+        std::vector<Packet> &outbound = _shards[c]->_outbound;
+        for(p = 0; p < outbound.size(); p++) {
+            sendPacket(outbound[p]);
+        }
+        outbound.clear();
+    }
+}
+
+void GhastlyServer::releaseRetired() {
+    GhastlyHostInfo *host;
+    NetAddress addr;
+    unsigned int c, h;
+
+    for(c = 0; c < _shards.size(); c++) {
+        std::vector<HostID> &retired = _shards[c]->_retired;
+        for(h = 0; h < retired.size(); h++) {
+            host = _hosts.find(retired[h]);
+            if(!host) { continue; }
+
+            addr = host->addr;
+            _hosts.remove(host->id);
+            dropClient(addr);
+        }
+        retired.clear();
+    }
+}
+
+void GhastlyServer::collectInputs() {
+    unsigned int c;
+
+    for(c = 0; c < _shards.size(); c++) {
+        std::vector<GhastlyInput> &inputs = _shards[c]->_inputs;
+        _inputs.insert(_inputs.end(), inputs.begin(), inputs.end());
+        inputs.clear();
+    }
+}
+
+bool GhastlyServer::nextInput(GhastlyInput &input) {
+    GhastlyHostInfo *host;
+
+    while(!_inputs.empty()) {
+        input = _inputs.front();
+        _inputs.pop_front();
+
+        // Commands from clients that have since gone are of no use
+        host = findLive(input.host);
+        if(!host) { continue; }
+
+        host->processedInput = input.sequence;
+        return true;
+    }
+    return false;
+}
+
+void GhastlyServer::setTransport(ConnectionProvider *transport) {
+    _transport = transport;
+}
+
+bool GhastlyServer::sendPacket(const Packet &packet) {
+    return _transport ? _transport->sendPacket(packet) : SocketedUDPProvider::sendPacket(packet);
+}
+
+bool GhastlyServer::recvPacket(Packet &packet) {
+    return _transport ? _transport->recvPacket(packet) : SocketedUDPProvider::recvPacket(packet);
+}
+
+void GhastlyServer::onUnconnectedPacket(const Packet &packet) {
+    Packet payload;
+    IDRequest request;
+
+    // A throwaway connection is enough to unwrap the packet and acknowledge it
+    GhastlyConnection connection(this, packet.addr);
+    connection.receive(packet);
+    if(!connection.nextPayload(payload) || !ReadPayload(request, payload)) {
+        // Stragglers from clients that are already gone, most likely
+        dropClient(packet.addr);
+        return;
+    }
+
+    GhastlyHostInfo *host = _hosts.add(packet.addr);
+    if(!host) {
+        HostReject reject;
+
+        Warn("All IDs allocated, client " << packet.addr << " will be rejected");
+        SendPayload(&connection, UnreliableChannel, reject);
+        // The rejection is still sent, but nothing more is kept for this client
+        dropClient(packet.addr);
+        return;
+    }
+
+    // A sharded host's connection sends into its shard, since its shard's thread is the one sending
+    GhastlyShard &shard = shardOf(host->id);
+    host->connection = new GhastlyConnection(_threaded ? (ConnectionProvider*)&shard : (ConnectionProvider*)this, packet.addr);
+    host->connection->setMTU(_mtu);
+    if(isHoldingOutbound()) { host->connection->hold(); }
+    host->snapshots = new GhastlySnapshotHistory();
+    host->interest = new GhastlyInterest();
+    host->priority = new GhastlyPriority();
+    // A new client can have a whole snapshot right away
+    host->snapshotCredit = (float)_snapshotSize;
+    host->lastReceived = host->lastUpdated = _time;
+    Info("Client connecting, associated ID " << host->id << " with address " << packet.addr);
+
+    // Now that there's a connection to keep, the shard goes through it properly (and sets up the host's timers)
+    deliver(GhastlyMail(host->id, packet, true));
+}
+
+void GhastlyServer::onPacketReceive(const Packet &packet) {
+    GhastlyHostInfo *host = _hosts.find(packet.addr);
+    if(!host || !host->connection) { return; }
+
+    onPayload(shardOf(host->id), host, packet);
+    drainOutbound();
+    releaseRetired();
+    collectInputs();
+}
+
+void GhastlyServer::onPayload(GhastlyShard &shard, GhastlyHostInfo *host, const Packet &packet) {
+    switch(GetPayloadType(packet)) {
+    case IDRequestType: {
+        // The request is reliable, so this only happens once per connection
+        IDAssign assign(host->id);
+        SendPayload(host->connection, ReliableChannel, assign);
         break;
     }
     case DisconnectType: {
-        HostID releasedID = _idMap[packet.addr];
-        _idPool->free(releasedID);
+        HostID releasedID = host->id;
 
-        _idMap.erase(packet.addr);
-        _hostMap.erase(releasedID);
+        // Let the client know its disconnect arrived, since the connection won't be around to do it later
+        host->connection->flushAcks();
+        retireHost(shard, host);
 
         Info("Client disconnected, dissociating ID " << releasedID << " from address " << packet.addr);
 
         break;
     }
+    case SnapshotAckType: {
+        SnapshotAck ack;
+        if(!ReadPayload(ack, packet)) { break; }
+
+        host->snapshots->acknowledge(ack.sequence);
+        break;
     }
+    case ViewUpdateType: {
+        ViewUpdate view;
+        if(!ReadPayload(view, packet)) { break; }
+
+        AABB2<float> bounds(Vector2<float>(view.lowerX, view.lowerY), Vector2<float>(view.upperX, view.upperY));
+        // The box would quietly swallow a NaN in favour of the other bound, so the raw values are checked too
+        if(!IsFinite(view.lowerX) || !IsFinite(view.lowerY) || !IsFinite(view.upperX) || !IsFinite(view.upperY) || !isValidView(bounds)) {
+            Warn("Ignoring out of bounds view from client " << host->id);
+            break;
+        }
+        host->interest->setView(bounds);
+        break;
+    }
+    case PingRequestType: {
+        PingRequest request;
+        if(!ReadPayload(request, packet)) { break; }
+
+        PingResponse response(request.client, GhastlyLatency::GetTimestamp());
+        SendPayload(host->connection, UnreliableChannel, response);
+        break;
+    }
+    case KeepaliveType:
+        break;
+    case PingDoneType: {
+        PingDone done;
+        if(!ReadPayload(done, packet)) { break; }
+
+        host->pings.addSample(done.server, done.client, GhastlyLatency::GetTimestamp());
+        host->latency = host->pings.getRoundTripTime();
+        break;
+    }
+    case InputCommandsType: {
+        InputCommands commands;
+        GhastlyInput input;
+        unsigned int c;
+
+        if(!ReadPayload(commands, packet) || commands.newest < commands.count) { break; }
+
+        // Commands the client is still repeating because it hasn't seen them processed are skipped, as are ones past what a slow game has room for
+        input.host = host->id;
+        for(c = 0; c < commands.count; c++) {
+            input.sequence = commands.newest - commands.count + 1 + c;
+            if(input.sequence <= host->receivedInput) { continue; }
+            if(input.sequence - host->processedInput > MAX_QUEUED_INPUTS) { break; }
+
+            const InputCommand &command = commands.commands[c];
+            input.duration = command.duration;
+            input.size = command.size;
+            memcpy(input.data, command.data, command.size);
+            shard._inputs.push_back(input);
+            host->receivedInput = input.sequence;
+        }
+        break;
+    }
+    }
+}
+
+void GhastlyServer::setMTU(unsigned int mtu) {
+    unsigned int c;
+
+    GhastlyHost::setMTU(mtu);
+    for(c = 0; c < _hosts.size(); c++) {
+        _hosts.getHost(c).connection->setMTU(mtu);
+    }
+}
+
+void GhastlyServer::setIdleTimeout(unsigned int milliseconds) {
+    _idleTimeout = milliseconds;
+}
+
+unsigned int GhastlyServer::getIdleTimeout() const {
+    return _idleTimeout;
+}
+
+unsigned int GhastlyServer::getHostCount() const {
+    return _hosts.size();
+}
+
+unsigned int GhastlyServer::getShardCount() const {
+    return _shards.size();
+}
+
+const GhastlyShard *GhastlyServer::getShard(unsigned int index) const {
+    return (index < _shards.size()) ? _shards[index] : 0;
+}
+
+const GhastlyConnection *GhastlyServer::getConnection(HostID id) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    return host ? host->connection : 0;
+}
+
+const GhastlyLatency *GhastlyServer::getLatency(HostID id) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    return host ? &host->pings : 0;
+}
+
+GhastlySnapshot &GhastlyServer::getWorldSnapshot() {
+    return _world;
+}
+
+void GhastlyServer::sendSnapshots() {
+    const GhastlySnapshot *baseline, *view;
+    Vector2<float> position;
+    unsigned int c, headerSize, size, budget;
+    uint32_t elapsed;
+
+    _snapshotSequence++;
+    _world.setSequence(_snapshotSequence);
+    _snapshotBuffer.resize(_snapshotSize);
+    elapsed = _time - _lastSnapshot;
+    _lastSnapshot = _time;
+
+    _interestGrid.build();
+    _globalEntities.clear();
+    for(c = 0; c < _world.getEntityCount(); c++) {
+        if(!_interestGrid.getPosition(_world.getEntityID(c), position)) {
+            _globalEntities.push_back(_world.getEntityID(c));
+        }
+    }
+
+    for(c = 0; c < _hosts.size(); c++) {
+        GhastlyHostInfo &host = _hosts.getHost(c);
+
+        // A limited host only gets as much as its share of the rate has paid for, banking up to a whole snapshot's worth
+        budget = _snapshotSize;
+        if(_snapshotRate > 0) {
+            host.snapshotCredit = std::min(host.snapshotCredit + (float)_snapshotRate * elapsed / 1000.0f, (float)_snapshotSize);
+            budget = std::min(budget, (unsigned int)host.snapshotCredit);
+        }
+
+        view = &_world;
+        if(host.interest->hasView()) {
+            filterSnapshot(host.interest, _filtered);
+            view = &_filtered;
+        }
+
+        // A baseline as old as the history is about to be overwritten by this snapshot, and the client may have lost it too
+        baseline = host.snapshots->getBaseline();
+        if(baseline && _snapshotSequence - baseline->getSequence() >= GhastlySnapshotHistory::Size) {
+            baseline = 0;
+        }
+
+        // Without room for the header and the end of the entity list, the host waits for the next snapshot
+        // The header is sized as if it acknowledged the newest input, which is as big as it gets
+        SnapshotHeader header(_snapshotSequence, baseline ? baseline->getSequence() : 0, host.processedInput);
+        headerSize = WritePayload(header, &_snapshotBuffer[0], budget);
+        if(headerSize == 0 || headerSize >= budget) { continue; }
+
+        // When everything that's changed won't fit, the most pressing changes go and the rest wait their turn
+        computeRates(host, *view);
+        if(host.priority->schedule(*view, _rates, baseline, elapsed, (budget - headerSize) * 8 - 1, _scheduled, host.controlledEntity)) {
+            view = &_scheduled;
+        }
+
+        // The client replays its input from the controlled entity's state, so input is only acknowledged along with the state it led to
+        if(isCurrent(*view, host.controlledEntity)) { host.reportedInput = host.processedInput; }
+        header.input = host.reportedInput;
+        headerSize = WritePayload(header, &_snapshotBuffer[0], budget);
+        ASSERT(headerSize > 0);
+
+        // Keep the connection's timing of what it sends honest
+        syncClock(&host);
+
+        // What's recorded is what the client will have once it decodes this, not necessarily the whole world
+        GhastlySnapshot &sent = host.snapshots->record(_snapshotSequence);
+        size = view->encode(baseline, &_snapshotBuffer[headerSize], budget - headerSize, sent);
+
+        host.connection->send(SequencedChannel, &_snapshotBuffer[0], headerSize + size);
+        if(_snapshotRate > 0) { host.snapshotCredit -= (float)(headerSize + size); }
+    }
+    drainOutbound();
+}
+
+bool GhastlyServer::isCurrent(const GhastlySnapshot &view, EntityID id) const {
+    const char *state, *current;
+    unsigned int size, currentSize;
+
+    state = _world.getEntity(id, size);
+    current = view.getEntity(id, currentSize);
+    // An entity the world doesn't have (or the host has no view of) has nothing to be stale
+    if(!state || !current) { return true; }
+    return size == currentSize && memcmp(state, current, size) == 0;
+}
+
+void GhastlyServer::computeRates(GhastlyHostInfo &host, const GhastlySnapshot &view) {
+    std::map<EntityID, float>::const_iterator weight;
+    Vector2<float> center, position;
+    bool hasView = host.interest->hasView();
+    unsigned int c;
+    EntityID id;
+    float rate;
+
+    if(hasView) { center = host.interest->getView().getCenter(); }
+
+    _rates.resize(view.getEntityCount());
+    for(c = 0; c < view.getEntityCount(); c++) {
+        id = view.getEntityID(c);
+        weight = _weights.find(id);
+        rate = (weight != _weights.end()) ? weight->second : 1.0f;
+
+        // Entities without a position, or hosts without a view, have no distance to go by
+        if(hasView && _interestGrid.getPosition(id, position)) {
+            rate *= _priorityFalloff / (_priorityFalloff + (position - center).length());
+        }
+        _rates[c] = rate;
+    }
+}
+
+void GhastlyServer::filterSnapshot(GhastlyInterest *interest, GhastlySnapshot &filtered) {
+    const std::vector<EntityID> &local = interest->update(_interestGrid, _interestHysteresis);
+    std::vector<EntityID>::const_iterator localItr = local.begin(), globalItr = _globalEntities.begin();
+    const char *state;
+    unsigned int size;
+    EntityID id;
+
+    filtered.clear();
+    filtered.setSequence(_snapshotSequence);
+
+    // Both lists are sorted, so merging them keeps the snapshot in ID order
+    while(localItr != local.end() || globalItr != _globalEntities.end()) {
+        if(globalItr == _globalEntities.end() || (localItr != local.end() && *localItr < *globalItr)) {
+            id = *localItr++;
+        } else {
+            id = *globalItr++;
+        }
+
+        // The grid may know about entities the world snapshot doesn't
+        state = _world.getEntity(id, size);
+        if(state) {
+            filtered.setEntity(id, state, size);
+        }
+    }
+}
+
+void GhastlyServer::setSnapshotSize(unsigned int size) {
+    // Room for the header (sequence, baseline age and last input) and the end of the entity list
+    ASSERT(size > 10);
+    _snapshotSize = size;
+}
+
+unsigned int GhastlyServer::getSnapshotSize() const {
+    return _snapshotSize;
+}
+
+void GhastlyServer::setSnapshotRate(unsigned int bytesPerSecond) {
+    _snapshotRate = bytesPerSecond;
+}
+
+unsigned int GhastlyServer::getSnapshotRate() const {
+    return _snapshotRate;
+}
+
+void GhastlyServer::setEntityWeight(EntityID id, float weight) {
+    if(weight == 1.0f) {
+        _weights.erase(id);
+    } else {
+        _weights[id] = weight;
+    }
+}
+
+float GhastlyServer::getEntityWeight(EntityID id) const {
+    std::map<EntityID, float>::const_iterator weight = _weights.find(id);
+    return (weight != _weights.end()) ? weight->second : 1.0f;
+}
+
+void GhastlyServer::setPriorityFalloff(float distance) {
+    ASSERT(distance > 0);
+    _priorityFalloff = distance;
+}
+
+const GhastlyPriority *GhastlyServer::getPriority(HostID id) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    return host ? host->priority : 0;
+}
+
+InterestGrid &GhastlyServer::getInterestGrid() {
+    return _interestGrid;
+}
+
+void GhastlyServer::setInterestHysteresis(float hysteresis) {
+    _interestHysteresis = hysteresis;
+}
+
+void GhastlyServer::setMaxViewSize(float size) {
+    _maxViewSize = size;
+}
+
+bool GhastlyServer::setView(HostID id, const AABB2<float> &view) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    if(!host || !isValidView(view)) { return false; }
+
+    host->interest->setView(view);
+    return true;
+}
+
+bool GhastlyServer::isValidView(const AABB2<float> &view) const {
+    const Vector2<float> &lower = view.getLowerBound(), &upper = view.getUpperBound();
+
+    return IsFinite(lower.x) && IsFinite(lower.y) && IsFinite(upper.x) && IsFinite(upper.y) &&
+           upper.x - lower.x <= _maxViewSize && upper.y - lower.y <= _maxViewSize;
+}
+
+bool GhastlyServer::setControlledEntity(HostID id, EntityID entity) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    if(!host) { return false; }
+
+    host->controlledEntity = entity;
+    return true;
+}
+
+const GhastlyInterest *GhastlyServer::getInterest(HostID id) {
+    GhastlyHostInfo *host = _hosts.find(id);
+    return host ? host->interest : 0;
+}
+
+void GhastlyServer::retireHost(GhastlyShard &shard, GhastlyHostInfo *host) {
+    // Anything held for the host (like the ack of its disconnect) still goes out
+    host->connection->flush();
+    delete host->connection;
+    host->connection = 0;
+    shard._timers.destroy(host->idleTimer);
+    shard._timers.destroy(host->keepaliveTimer);
+    shard._timers.destroy(host->retransmitTimer);
+    delete host->snapshots;
+    delete host->interest;
+    delete host->priority;
+    host->snapshots = 0;
+    host->interest = 0;
+    host->priority = 0;
+    shard._retired.push_back(host->id);
 }
@@ -2,44 +2,193 @@
 #define GHASTLYSERVER_H
 
 #include <Network/GhastlyHost.h>
-#include <Network/SimpleUDPProvider.h>
-#include <Base/IndexPool.h>
-#include <Base/Timestamp.h>
-
-struct GhastlyHostInfo {
-    NetAddress addr;
-    HostID id;
-    clock_t lastReceived;
-    double latency;
-
-    GhastlyHostInfo();
-    GhastlyHostInfo(const GhastlyHostInfo &other);
-    GhastlyHostInfo(const NetAddress &a, HostID i);
-
-    void operator=(const GhastlyHostInfo &other);
-    void copy(const GhastlyHostInfo &other);
-};
+#include <Network/GhastlyHostRegistry.h>
+#include <Network/GhastlySnapshot.h>
+#include <Network/GhastlyConnection.h>
+#include <Network/GhastlyInterest.h>
+#include <Network/GhastlyPriority.h>
+#include <Network/GhastlyShard.h>
+#include <Network/SocketedUDPProvider.h>
 
 #define DEFAULT_MAX_CLIENTS    256
 
-class GhastlyServer: public GhastlyHost, public SimpleUDPProvider {
+// Hosts are processed on the thread calling update unless the server is given more shards than this
+#define DEFAULT_SHARDS         1
+
+// How long a client can go unheard before it's assumed gone and its ID freed, in milliseconds
+#define DEFAULT_IDLE_TIMEOUT   10000
+
+// Room for addresses the provider has to track beyond the connected clients, like ones waiting to be rejected
+#define MAX_PENDING_CLIENTS    256
+
+// The most bytes of snapshot sent to a client at once; entities that don't fit catch up in later snapshots
+#define DEFAULT_SNAPSHOT_SIZE  1000
+
+// The most bytes of snapshot a second sent to each client, or 0 for no limit beyond the snapshot size
+#define DEFAULT_SNAPSHOT_RATE  0
+
+// How far from the centre of a client's view an entity is owed updates half as often, in world units
+#define DEFAULT_PRIORITY_FALLOFF    64.0f
+
+// The size of the cells entity positions are bucketed into, in world units; roughly the size of a view works well
+#define DEFAULT_INTEREST_CELL_SIZE  64.0f
+// How far past the edge of a client's view (as a fraction of the view's size) entities go before the client stops hearing about them
+#define DEFAULT_INTEREST_HYSTERESIS 0.1f
+// The widest or tallest view a client may ask for, in world units; anything bigger is ignored, along with views that aren't finite
+#define DEFAULT_MAX_VIEW_SIZE       4096.0f
+
+// The most input commands a client can have waiting for the game; past that its newer commands are dropped
+#define MAX_QUEUED_INPUTS      64
+
+// With more than one shard, hosts are split between that many worker threads by HostID (see GhastlyShard)
+// The thread calling update receives every packet and passes it to its host's shard, which processes it while the rest are still being received
+// Everything else (snapshots, ticks, new connections) stays on the calling thread, and the workers only run during update
+class GhastlyServer: public GhastlyHost, public SocketedUDPProvider {
 public:
-    GhastlyServer(unsigned int maxClients = DEFAULT_MAX_CLIENTS);
+    GhastlyServer(unsigned int maxClients = DEFAULT_MAX_CLIENTS, unsigned int shards = DEFAULT_SHARDS);
     ~GhastlyServer();
 
+    // Only hosts that have something to acknowledge, or a timer come due, are looked at; the rest cost nothing
     void update(int elapsed);
+    // Handle a payload from a connected host; payloads from unknown addresses are ignored
     void onPacketReceive(const Packet &packet);
 
+    // Send and receive through another provider instead of the server's own socket (a ReplayProvider, for instance); 0 goes back to the socket
+    void setTransport(ConnectionProvider *transport);
+    bool sendPacket(const Packet &packet);
+    bool recvPacket(Packet &packet);
+
+    void setMTU(unsigned int mtu);
+
+    void setIdleTimeout(unsigned int milliseconds);
+    unsigned int getIdleTimeout() const;
+
+    unsigned int getHostCount() const;
+    // 1 for a server that does all its work on the calling thread
+    unsigned int getShardCount() const;
+    const GhastlyShard *getShard(unsigned int index) const;
+    // Returns 0 for unknown hosts
+    const GhastlyConnection *getConnection(HostID id);
+    // What pings have measured of a host; returns 0 for unknown hosts
+    const GhastlyLatency *getLatency(HostID id);
+
+    // The world state replicated to clients; fill it in each tick, then call sendSnapshots
+    GhastlySnapshot &getWorldSnapshot();
+    // Send every client the difference between the world snapshot and the last snapshot it acknowledged
+    void sendSnapshots();
+
+    void setSnapshotSize(unsigned int size);
+    unsigned int getSnapshotSize() const;
+    // Snapshots to a client are cut down to what this rate (in bytes a second) has paid for since its last one, so a slow link gets fewer entities rather than a backlog of packets
+    void setSnapshotRate(unsigned int bytesPerSecond);
+    unsigned int getSnapshotRate() const;
+
+    // When a client's snapshot can't fit everything that's changed, entities are prioritized by how long they've waited, scaled by their weight and closeness to its view (see GhastlyPriority)
+    // Entities have a weight of 1 unless they're given another; weights are kept until they're set back to 1
+    void setEntityWeight(EntityID id, float weight);
+    float getEntityWeight(EntityID id) const;
+    void setPriorityFalloff(float distance);
+    // Returns 0 for unknown hosts
+    const GhastlyPriority *getPriority(HostID id);
+
+    // Where the world's entities are, so that each client only hears about the ones near its view; fill it in each tick along with the world snapshot
+    // Entities in the world snapshot that aren't in the grid are sent to every client
+    InterestGrid &getInterestGrid();
+    void setInterestHysteresis(float hysteresis);
+    void setMaxViewSize(float size);
+    // Views normally come from the clients themselves; returns false for unknown hosts, and for views past the max view size
+    bool setView(HostID id, const AABB2<float> &view);
+    // Returns 0 for unknown hosts
+    const GhastlyInterest *getInterest(HostID id);
+
+    // The entity a client predicts its own input on; every snapshot to it carries that entity's change ahead of anything else
+    // Input is only acknowledged in snapshots where the entity's state is current, so the client never reconciles against a stale one
+    // Returns false for unknown hosts
+    bool setControlledEntity(HostID id, EntityID entity);
+
+    // Take the next input command a client has sent, in the order they arrived; returns false if there aren't any
+    // Each client's commands come once each and in sequence, and its snapshots report the last one taken, so call this before filling in the world snapshot
+    bool nextInput(GhastlyInput &input);
+
+protected:
+    void holdOutbound();
+    void flushOutbound();
+
+private:
+    friend class GhastlyShard;
+
+    // Packets from addresses without a connection are only looked at for ID requests
+    void onUnconnectedPacket(const Packet &packet);
+    GhastlyShard &shardOf(HostID id);
+    // Hand a packet to its host's shard, processing it right away if the server isn't sharded
+    void deliver(const GhastlyMail &mail);
+
+    // The rest of these run on the host's shard, on whichever thread that shard is processed on
+    void processMail(GhastlyShard &shard, const GhastlyMail &mail);
+    // Run the shard's timers and connection updates, once all its mail has been processed
+    void finishShard(GhastlyShard &shard);
+    void onPayload(GhastlyShard &shard, GhastlyHostInfo *host, const Packet &payload);
+    // Returns 0 for hosts that are unknown or have been retired
+    GhastlyHostInfo *findLive(HostID id);
+    // Tear down a host's connection and timers; the host stays in the registry until releaseRetired
+    void retireHost(GhastlyShard &shard, GhastlyHostInfo *host);
+    // Bring a host's connection clock up to the server's
+    void syncClock(GhastlyHostInfo *host);
+    // Have the host's connection updated at the end of this update
+    void queueUpdate(GhastlyShard &shard, GhastlyHostInfo *host);
+    // Retransmit and acknowledge whatever the connection has waiting; returns false if the connection failed and the host was removed
+    bool updateConnection(GhastlyShard &shard, GhastlyHostInfo *host);
+    void onTimer(GhastlyShard &shard, const TimerWheel::Expiry &expiry);
+
+    // These only run on the calling thread, while no shard is being processed
+    // Send everything the shards have collected, then forget the hosts they've retired
+    void drainOutbound();
+    void releaseRetired();
+    // Queue the input commands the shards have received for the game
+    void collectInputs();
+    // The part of the world snapshot a host with a view should hear about
+    void filterSnapshot(GhastlyInterest *interest, GhastlySnapshot &filtered);
+    // Views come straight off the wire, and one that's huge or not a number would make every snapshot crawl
+    bool isValidView(const AABB2<float> &view) const;
+    // How fast each entity in a host's view accumulates priority
+    void computeRates(GhastlyHostInfo &host, const GhastlySnapshot &view);
+    // Whether view has the world's state for an entity
+    bool isCurrent(const GhastlySnapshot &view, EntityID id) const;
+
 private:
-    unsigned int _maxClients;
+    GhastlyHostRegistry _hosts;
+    ConnectionProvider *_transport;
+
+    // The sum of elapsed time passed to update, in milliseconds; host timers run on it
+    uint32_t _time;
+    unsigned int _idleTimeout;
+
+    std::vector<GhastlyShard*> _shards;
+    // Set when the shards run on worker threads, which post _shardsDone as they finish
+    bool _threaded;
+    SDL_sem *_shardsDone;
+
+    GhastlySnapshot _world;
+    SnapshotSequence _snapshotSequence;
+    unsigned int _snapshotSize;
+    unsigned int _snapshotRate;
+    // When the last snapshots went out, on the server's clock
+    uint32_t _lastSnapshot;
+    std::vector<char> _snapshotBuffer;
 
-    IndexPool *_idPool;
+    std::map<EntityID, float> _weights;
+    float _priorityFalloff;
+    std::vector<float> _rates;
+    GhastlySnapshot _scheduled;
 
-    typedef std::map<NetAddress,HostID> IDMap;
-    IDMap _idMap;
+    InterestGrid _interestGrid;
+    float _interestHysteresis;
+    float _maxViewSize;
+    // World entities with no position, which every client hears about
+    std::vector<EntityID> _globalEntities;
+    GhastlySnapshot _filtered;
 
-    typedef std::map<HostID,GhastlyHostInfo> HostMap;
-    HostMap _hostMap;
+    std::deque<GhastlyInput> _inputs;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,121 @@
+#include <Network/GhastlyShard.h>
+#include <Network/GhastlyServer.h>
+#include <Base/Assertion.h>
+#include <Base/Log.h>
+
+void GhastlyMail::swap(GhastlyMail &other) {
+    std::swap(host, other.host);
+    std::swap(opening, other.opening);
+    packet.swap(other.packet);
+}
+
+void GhastlyMail::release() {
+    host = 0;
+    opening = false;
+    packet.release();
+}
+
+unsigned int GhastlyShard::MailboxSize = 1024;
+
+int InvokeGhastlyShardLoop(void *params) {
+    GhastlyShard *shard = (GhastlyShard*)params;
+    shard->doShardLoop();
+    return 1;
+}
+
+GhastlyShard::GhastlyShard(unsigned int index):
+    _index(index), _server(0), _inbox(MailboxSize), _processed(0), _thread(0), _wake(0), _done(0), _mail(0)
+{
+    SDL_AtomicSet(&_shouldDie, 0);
+}
+
+GhastlyShard::~GhastlyShard() {
+    stop();
+}
+
+unsigned int GhastlyShard::getIndex() const {
+    return _index;
+}
+
+bool GhastlyShard::sendPacket(const Packet &packet) {
+    _outbound.push_back(packet);
+    return true;
+}
+
+unsigned int GhastlyShard::getProcessed() const {
+    return _processed;
+}
+
+bool GhastlyShard::start(GhastlyServer *server) {
+    if(_thread) { return false; }
+
+    _server = server;
+    _wake = SDL_CreateSemaphore(0);
+    _mail = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&_shouldDie, 0);
+    _thread = SDL_CreateThread(InvokeGhastlyShardLoop, "GhastlyShardThread", (void*)this);
+    if(!_thread) {
+        Error("Failed to start thread for Ghastly shard " << _index);
+        SDL_DestroySemaphore(_wake);
+        SDL_DestroySemaphore(_mail);
+        _wake = _mail = 0;
+        return false;
+    }
+    return true;
+}
+
+void GhastlyShard::stop() {
+    int status;
+
+    if(!_thread) { return; }
+
+    SDL_AtomicSet(&_shouldDie, 1);
+    SDL_SemPost(_wake);
+    SDL_WaitThread(_thread, &status);
+    _thread = 0;
+
+    SDL_DestroySemaphore(_wake);
+    SDL_DestroySemaphore(_mail);
+    _wake = _mail = 0;
+}
+
+bool GhastlyShard::isRunning() const {
+    return (_thread != 0);
+}
+
+void GhastlyShard::run(SDL_sem *done) {
+    ASSERT(_thread);
+    _done = done;
+    SDL_SemPost(_wake);
+}
+
+void GhastlyShard::post(const GhastlyMail &mail) {
+    ASSERT(_thread);
+
+    // The worker is taking mail as fast as it can, so a full mailbox soon has room
+    while(!_inbox.push(mail)) { SDL_Delay(1); }
+    SDL_SemPost(_mail);
+}
+
+void GhastlyShard::doShardLoop() {
+    GhastlyMail mail;
+
+    while(true) {
+        // Idle between updates
+        SDL_SemWait(_wake);
+        if(SDL_AtomicGet(&_shouldDie)) { break; }
+
+        // Mail keeps coming for as long as the server is receiving, and ends with an empty host
+        while(true) {
+            // Sleeps while the server's waiting on the network, rather than spinning
+            SDL_SemWait(_mail);
+            // Mail is counted only once it's in the mailbox, so there's always some to take
+            if(!_inbox.pop(mail)) { continue; }
+            if(mail.host == 0) { break; }
+            _server->processMail(*this, mail);
+        }
+
+        _server->finishShard(*this);
+        SDL_SemPost(_done);
+    }
+}
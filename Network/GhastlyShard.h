@@ -0,0 +1,104 @@
+#ifndef GHASTLYSHARD_H
+#define GHASTLYSHARD_H
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include <Network/GhastlyProtocol.h>
+#include <Network/ConnectionProvider.h>
+#include <Network/RingQueue.h>
+#include <Network/TimerWheel.h>
+
+using namespace GhastlyProtocol;
+
+// A packet for one of a shard's hosts
+struct GhastlyMail {
+    // 0 marks the end of an update's mail
+    HostID host;
+    // Set for the first packet from a newly connected host, whose timers the shard has yet to create
+    bool opening;
+    Packet packet;
+
+    GhastlyMail(): host(0), opening(false) {}
+    GhastlyMail(HostID h, const Packet &p, bool o = false): host(h), opening(o), packet(p) {}
+
+    // What a RingQueue needs to hand mail over without copying the packet
+    void swap(GhastlyMail &other);
+    void release();
+};
+
+// An input command from one of the server's clients, waiting for the game to take it
+struct GhastlyInput {
+    HostID host;
+    InputSequence sequence;
+    unsigned int duration;
+    unsigned int size;
+    char data[MaxInputSize];
+};
+
+// The server's thread pushes mail and the shard's worker pops it
+typedef RingQueue<GhastlyMail> GhastlyMailbox;
+
+class GhastlyServer;
+
+// A slice of a GhastlyServer's hosts, chosen by HostID, along with everything needed to process them apart from the rest
+// Each shard has its own timers and update queue, and its hosts' connections send into its outbound batch, which the server hands to its provider once every shard is done
+// Hosts a shard removes are only retired (their connections and timers are gone); the server takes them out of its registry afterwards
+// A sharded server runs every shard on a worker thread of its own; an unsharded one processes its single shard on the calling thread
+class GhastlyShard: public ConnectionProvider {
+public:
+    GhastlyShard(unsigned int index);
+    virtual ~GhastlyShard();
+
+    unsigned int getIndex() const;
+
+    // Collects packets for the server to send later; never fails
+    bool sendPacket(const Packet &packet);
+    bool recvPacket(Packet &packet) { return false; }
+
+    // Packets processed since the shard was created
+    unsigned int getProcessed() const;
+
+    // Start (or stop) the worker thread; the worker sleeps until run is called
+    bool start(GhastlyServer *server);
+    void stop();
+    bool isRunning() const;
+
+    // Wake the worker to process a round of mail; the server posts done once the shard's finished
+    void run(SDL_sem *done);
+    // Hand the worker a piece of mail, waking it if it's waiting for some
+    void post(const GhastlyMail &mail);
+
+private:
+    friend class GhastlyServer;
+    friend int InvokeGhastlyShardLoop(void *params);
+
+    static unsigned int MailboxSize;
+
+    void doShardLoop();
+
+private:
+    unsigned int _index;
+    GhastlyServer *_server;
+
+    GhastlyMailbox _inbox;
+
+    TimerWheel _timers;
+    std::vector<TimerWheel::Expiry> _expired;
+    std::vector<HostID> _updateQueue;
+
+    std::vector<Packet> _outbound;
+    std::vector<HostID> _retired;
+    // Input commands received this update, which the server hands on to the game once every shard is done
+    std::vector<GhastlyInput> _inputs;
+    unsigned int _processed;
+
+    SDL_Thread *_thread;
+    SDL_sem *_wake, *_done;
+    // Counts the mail posted, so the worker can sleep until there's some to take
+    SDL_sem *_mail;
+    SDL_atomic_t _shouldDie;
+};
+
+#endif
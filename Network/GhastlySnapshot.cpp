@@ -0,0 +1,385 @@
+#include <Network/GhastlySnapshot.h>
+#include <Base/Assertion.h>
+
+const unsigned int GhastlySnapshot::MaxStateSize;
+const unsigned int GhastlySnapshotHistory::Size;
+
+const EntityID GhastlySnapshot::NoEntity;
+const unsigned int GhastlySnapshot::NearbyBits;
+const unsigned int GhastlySnapshot::NearbyRange;
+const unsigned int GhastlySnapshot::OperationBits;
+const unsigned int GhastlySnapshot::SizeBits;
+
+GhastlySnapshot::GhastlySnapshot(): _sequence(0) {}
+
+void GhastlySnapshot::clear() {
+    _records.clear();
+    _data.clear();
+}
+
+bool GhastlySnapshot::setEntity(EntityID id, const char *state, unsigned int size) {
+    unsigned int index;
+
+    if(size > MaxStateSize) {
+        Error("Entity " << id << " has " << size << " bytes of state, more than the maximum of " << MaxStateSize);
+        return false;
+    }
+
+    // Entities are usually set in order, so check the end before searching
+    if(_records.empty() || _records.back().id < id) {
+        appendEntity(id, state, size);
+        return true;
+    }
+
+    index = lowerBound(id);
+    if(index < _records.size() && _records[index].id == id) {
+        Record &record = _records[index];
+        if(record.size != size) {
+            // The old state is left where it is until the snapshot is cleared
+            record.offset = _data.size();
+            record.size = size;
+            _data.resize(_data.size() + size);
+        }
+        if(size > 0) { memcpy(&_data[record.offset], state, size); }
+    } else {
+        Record record;
+        record.id = id;
+        record.offset = _data.size();
+        record.size = size;
+        _data.insert(_data.end(), state, state + size);
+        _records.insert(_records.begin() + index, record);
+    }
+    return true;
+}
+
+bool GhastlySnapshot::removeEntity(EntityID id) {
+    unsigned int index = lowerBound(id);
+    if(index >= _records.size() || _records[index].id != id) { return false; }
+    _records.erase(_records.begin() + index);
+    return true;
+}
+
+const char *GhastlySnapshot::getEntity(EntityID id, unsigned int &size) const {
+    unsigned int index = lowerBound(id);
+    if(index >= _records.size() || _records[index].id != id) { return 0; }
+    return getEntityState(index, size);
+}
+
+unsigned int GhastlySnapshot::getEntityCount() const {
+    return _records.size();
+}
+
+EntityID GhastlySnapshot::getEntityID(unsigned int index) const {
+    ASSERT(index < _records.size());
+    return _records[index].id;
+}
+
+const char *GhastlySnapshot::getEntityState(unsigned int index, unsigned int &size) const {
+    ASSERT(index < _records.size());
+    size = _records[index].size;
+    // Zero-sized states still need a valid pointer so that they can be told apart from missing entities
+    return _data.empty() ? (const char*)this : &_data[_records[index].offset];
+}
+
+bool GhastlySnapshot::operator==(const GhastlySnapshot &rhs) const {
+    unsigned int c, lhsSize, rhsSize;
+    const char *lhsState, *rhsState;
+
+    if(_records.size() != rhs._records.size()) { return false; }
+    for(c = 0; c < _records.size(); c++) {
+        if(_records[c].id != rhs._records[c].id) { return false; }
+        lhsState = getEntityState(c, lhsSize);
+        rhsState = rhs.getEntityState(c, rhsSize);
+        if(lhsSize != rhsSize || memcmp(lhsState, rhsState, lhsSize) != 0) { return false; }
+    }
+    return true;
+}
+
+void GhastlySnapshot::appendEntity(EntityID id, const char *state, unsigned int size) {
+    Record record;
+    record.id = id;
+    record.offset = _data.size();
+    record.size = size;
+    _data.insert(_data.end(), state, state + size);
+    _records.push_back(record);
+}
+
+unsigned int GhastlySnapshot::lowerBound(EntityID id) const {
+    unsigned int low = 0, high = _records.size(), middle;
+    while(low < high) {
+        middle = (low + high) / 2;
+        if(_records[middle].id < id) { low = middle + 1; }
+        else { high = middle; }
+    }
+    return low;
+}
+
+unsigned int GhastlySnapshot::encode(const GhastlySnapshot *baseline, char *dest, unsigned int maxSize, GhastlySnapshot &sent) const {
+    static const GhastlySnapshot Empty;
+    unsigned int current = 0, base = 0, currentSize = 0, baseSize = 0, bits;
+    const char *currentState, *baseState;
+    EntityID id, previous = NoEntity;
+    uint32_t op;
+
+    if(!baseline) { baseline = &Empty; }
+
+    BitWriter writer(dest, maxSize);
+    // Room for the bit that ends the list is always kept back
+    const unsigned int capacity = maxSize * 8 - 1;
+
+    sent.clear();
+    sent.setSequence(_sequence);
+
+    // Walk both entity lists in ID order, writing a record for each entity that differs
+    while(current < _records.size() || base < baseline->_records.size()) {
+        if(base >= baseline->_records.size() || (current < _records.size() && _records[current].id < baseline->_records[base].id)) {
+            // New since the baseline
+            id = _records[current].id;
+            currentState = getEntityState(current++, currentSize);
+
+            if(writer.getBitsWritten() + 1 + IDBits(id, previous) + OperationBits + SizeBits + currentSize * 8 <= capacity) {
+                WriteRecord(writer, id, previous, SnapshotFull, currentState, currentSize, 0);
+                previous = id;
+                sent.appendEntity(id, currentState, currentSize);
+            }
+        } else if(current >= _records.size() || baseline->_records[base].id < _records[current].id) {
+            // Gone since the baseline
+            id = baseline->_records[base].id;
+            baseState = baseline->getEntityState(base++, baseSize);
+
+            if(writer.getBitsWritten() + 1 + IDBits(id, previous) + OperationBits <= capacity) {
+                WriteRecord(writer, id, previous, SnapshotRemove, 0, 0, 0);
+                previous = id;
+            } else {
+                sent.appendEntity(id, baseState, baseSize);
+            }
+        } else {
+            id = _records[current].id;
+            currentState = getEntityState(current++, currentSize);
+            baseState = baseline->getEntityState(base++, baseSize);
+
+            if(currentSize == baseSize && memcmp(currentState, baseState, currentSize) == 0) {
+                sent.appendEntity(id, baseState, baseSize);
+                continue;
+            }
+
+            op = ChooseOperation(currentState, currentSize, baseState, baseSize, bits);
+            if(writer.getBitsWritten() + 1 + IDBits(id, previous) + OperationBits + bits > capacity) {
+                sent.appendEntity(id, baseState, baseSize);
+                continue;
+            }
+
+            WriteRecord(writer, id, previous, op, currentState, currentSize, baseState);
+            previous = id;
+            sent.appendEntity(id, currentState, currentSize);
+        }
+    }
+
+    bool more = false;
+    writer.serializeBool(more);
+    writer.align();
+    ASSERT(!writer.hasFailed());
+
+    return writer.getBytesWritten();
+}
+
+bool GhastlySnapshot::decode(const GhastlySnapshot *baseline, const char *src, unsigned int size) {
+    static const GhastlySnapshot Empty;
+    unsigned int base = 0, baseSize = 0, stateSize, c;
+    const char *baseState;
+    char state[MaxStateSize];
+    bool mask[MaxStateSize];
+    EntityID id, previous = NoEntity;
+    uint32_t op, byte;
+    bool more, changed;
+
+    if(!baseline) { baseline = &Empty; }
+    ASSERT(baseline != this);
+
+    clear();
+
+    BitReader reader(src, size);
+    while(true) {
+        if(!reader.serializeBool(more)) { return false; }
+        if(!more) { break; }
+
+        if(!ReadID(reader, previous, id)) { return false; }
+        // Records arrive in increasing ID order, which is what lets them be merged with the baseline in one pass
+        if(previous != NoEntity && id <= previous) { return false; }
+        previous = id;
+
+        // Everything in the baseline before this entity is unchanged
+        while(base < baseline->_records.size() && baseline->_records[base].id < id) {
+            baseState = baseline->getEntityState(base, baseSize);
+            appendEntity(baseline->_records[base].id, baseState, baseSize);
+            base++;
+        }
+        baseState = 0;
+        if(base < baseline->_records.size() && baseline->_records[base].id == id) {
+            baseState = baseline->getEntityState(base++, baseSize);
+        }
+
+        if(!reader.serializeInteger(op, SnapshotFull, SnapshotRemove)) { return false; }
+        switch(op) {
+        case SnapshotFull:
+            if(!reader.serializeInteger(stateSize, 0, MaxStateSize)) { return false; }
+            for(c = 0; c < stateSize; c++) {
+                if(!reader.serializeBits(byte, 8)) { return false; }
+                state[c] = (char)byte;
+            }
+            appendEntity(id, state, stateSize);
+            break;
+        case SnapshotDelta:
+            if(!reader.serializeInteger(stateSize, 0, MaxStateSize)) { return false; }
+            if(!baseState || baseSize != stateSize) { return false; }
+
+            // The change mask comes first, then the bytes it marks
+            memcpy(state, baseState, stateSize);
+            for(c = 0; c < stateSize; c++) {
+                if(!reader.serializeBool(changed)) { return false; }
+                mask[c] = changed;
+            }
+            for(c = 0; c < stateSize; c++) {
+                if(!mask[c]) { continue; }
+                if(!reader.serializeBits(byte, 8)) { return false; }
+                state[c] = (char)byte;
+            }
+            appendEntity(id, state, stateSize);
+            break;
+        case SnapshotRemove:
+            if(!baseState) { return false; }
+            break;
+        }
+    }
+
+    // Nothing but padding may follow the list
+    if(!reader.align() || reader.getBitsRemaining() != 0) { return false; }
+
+    // The rest of the baseline is unchanged
+    for(; base < baseline->_records.size(); base++) {
+        baseState = baseline->getEntityState(base, baseSize);
+        appendEntity(baseline->_records[base].id, baseState, baseSize);
+    }
+
+    return true;
+}
+
+unsigned int GhastlySnapshot::GetRecordBits(const char *state, unsigned int size, const char *baseState, unsigned int baseSize) {
+    // The bit announcing the record, and an ID as far from the previous one as can be
+    unsigned int bits = 1 + 2 + 32 + OperationBits, stateBits;
+
+    if(!state) { return bits; }
+    if(!baseState) { return bits + SizeBits + size * 8; }
+
+    ChooseOperation(state, size, baseState, baseSize, stateBits);
+    return bits + stateBits;
+}
+
+uint32_t GhastlySnapshot::ChooseOperation(const char *state, unsigned int size, const char *baseState, unsigned int baseSize, unsigned int &bits) {
+    unsigned int fullBits, deltaBits, changed, c;
+
+    // Only send the bytes that changed when that works out smaller than sending the whole state
+    fullBits = SizeBits + size * 8;
+    deltaBits = ~0u;
+    if(size == baseSize) {
+        for(changed = 0, c = 0; c < size; c++) {
+            if(state[c] != baseState[c]) { changed++; }
+        }
+        deltaBits = SizeBits + size + changed * 8;
+    }
+
+    bits = std::min(deltaBits, fullBits);
+    return (deltaBits < fullBits) ? SnapshotDelta : SnapshotFull;
+}
+
+unsigned int GhastlySnapshot::IDBits(EntityID id, EntityID previous) {
+    if(id == previous + 1) { return 1; }
+    if((uint32_t)(id - previous - 2) < NearbyRange) { return 2 + NearbyBits; }
+    return 2 + 32;
+}
+
+void GhastlySnapshot::WriteRecord(BitWriter &writer, EntityID id, EntityID previous, uint32_t op, const char *state, unsigned int size, const char *baseState) {
+    bool more = true, sequential, nearby, changed;
+    uint32_t gap, byte;
+    unsigned int c;
+
+    writer.serializeBool(more);
+
+    // IDs are mostly close to the one before, so they go as the gap from it where they can
+    sequential = (id == previous + 1);
+    writer.serializeBool(sequential);
+    if(!sequential) {
+        gap = id - previous - 2;
+        nearby = (gap < NearbyRange);
+        writer.serializeBool(nearby);
+        if(nearby) { writer.serializeBits(gap, NearbyBits); }
+        else { writer.serializeBits(id, 32); }
+    }
+
+    writer.serializeInteger(op, SnapshotFull, SnapshotRemove);
+    switch(op) {
+    case SnapshotFull:
+        writer.serializeInteger(size, 0, MaxStateSize);
+        for(c = 0; c < size; c++) {
+            byte = (uint8_t)state[c];
+            writer.serializeBits(byte, 8);
+        }
+        break;
+    case SnapshotDelta:
+        writer.serializeInteger(size, 0, MaxStateSize);
+        for(c = 0; c < size; c++) {
+            changed = (state[c] != baseState[c]);
+            writer.serializeBool(changed);
+        }
+        for(c = 0; c < size; c++) {
+            if(state[c] == baseState[c]) { continue; }
+            byte = (uint8_t)state[c];
+            writer.serializeBits(byte, 8);
+        }
+        break;
+    }
+}
+
+bool GhastlySnapshot::ReadID(BitReader &reader, EntityID previous, EntityID &id) {
+    bool sequential, nearby;
+    uint32_t gap;
+
+    if(!reader.serializeBool(sequential)) { return false; }
+    if(sequential) {
+        id = previous + 1;
+        return true;
+    }
+
+    if(!reader.serializeBool(nearby)) { return false; }
+    if(nearby) {
+        if(!reader.serializeBits(gap, NearbyBits)) { return false; }
+        id = previous + 2 + gap;
+        return true;
+    }
+    return reader.serializeBits(id, 32);
+}
+
+GhastlySnapshotHistory::GhastlySnapshotHistory(): _acknowledged(0) {}
+
+GhastlySnapshot &GhastlySnapshotHistory::record(SnapshotSequence sequence) {
+    GhastlySnapshot &snapshot = _ring[sequence % Size];
+    snapshot.clear();
+    snapshot.setSequence(sequence);
+    return snapshot;
+}
+
+const GhastlySnapshot *GhastlySnapshotHistory::find(SnapshotSequence sequence) const {
+    const GhastlySnapshot &snapshot = _ring[sequence % Size];
+    // Sequence 0 is never recorded, so unused slots never match
+    return (sequence != 0 && snapshot.getSequence() == sequence) ? &snapshot : 0;
+}
+
+void GhastlySnapshotHistory::acknowledge(SnapshotSequence sequence) {
+    if(sequence > _acknowledged && find(sequence)) {
+        _acknowledged = sequence;
+    }
+}
+
+const GhastlySnapshot *GhastlySnapshotHistory::getBaseline() const {
+    return find(_acknowledged);
+}
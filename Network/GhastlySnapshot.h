@@ -0,0 +1,107 @@
+#ifndef GHASTLYSNAPSHOT_H
+#define GHASTLYSNAPSHOT_H
+
+#include <Network/GhastlyProtocol.h>
+
+using namespace GhastlyProtocol;
+
+// The replicated state of a set of entities at one moment
+// Each entity's state is an opaque blob of up to MaxStateSize bytes; entities are kept sorted by ID
+class GhastlySnapshot {
+public:
+    static const unsigned int MaxStateSize = 255;
+    // Never a real entity's ID, so it stands for none
+    static const EntityID NoEntity = 0xFFFFFFFF;
+
+public:
+    GhastlySnapshot();
+
+    void clear();
+
+    SnapshotSequence getSequence() const { return _sequence; }
+    void setSequence(SnapshotSequence sequence) { _sequence = sequence; }
+
+    // Insert or replace an entity's state; cheapest when entities are set in increasing ID order
+    bool setEntity(EntityID id, const char *state, unsigned int size);
+    bool removeEntity(EntityID id);
+    // Returns 0 if the entity isn't in the snapshot
+    const char *getEntity(EntityID id, unsigned int &size) const;
+
+    unsigned int getEntityCount() const;
+    EntityID getEntityID(unsigned int index) const;
+    const char *getEntityState(unsigned int index, unsigned int &size) const;
+
+    bool operator==(const GhastlySnapshot &rhs) const;
+
+    // Write the records that turn baseline (which may be null, meaning empty) into this snapshot
+    // Unchanged entities cost nothing; changed ones send only the bytes that differ when that's smaller than the whole state
+    // States are opaque here, so an entity's state is best written with a BitWriter too, at whatever precision it needs
+    // Records that don't fit in maxSize are left out, and sent becomes what the receiver will have after decoding, ready to be used as a later baseline
+    // Returns the number of bytes written
+    unsigned int encode(const GhastlySnapshot *baseline, char *dest, unsigned int maxSize, GhastlySnapshot &sent) const;
+    // Rebuild a snapshot from baseline and the records written by encode; returns false if the records are malformed or don't match the baseline
+    bool decode(const GhastlySnapshot *baseline, const char *src, unsigned int size);
+
+    // The most bits encode can spend on one entity's record, whatever IDs come before it
+    // state is 0 for an entity being removed, and baseState is 0 for one the baseline doesn't have
+    static unsigned int GetRecordBits(const char *state, unsigned int size, const char *baseState, unsigned int baseSize);
+
+private:
+    struct Record {
+        EntityID id;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // Record layout; see GhastlyProtocol.h
+    static const unsigned int NearbyBits = 8;
+    static const unsigned int NearbyRange = 1 << NearbyBits;
+    static const unsigned int OperationBits = 2;
+    static const unsigned int SizeBits = 8;
+
+    // How many bits id takes to write, following previous
+    static unsigned int IDBits(EntityID id, EntityID previous);
+    // Whether a changed entity is cheaper to send whole or as the bytes that differ; bits is set to what the chosen operation and state take
+    static uint32_t ChooseOperation(const char *state, unsigned int size, const char *baseState, unsigned int baseSize, unsigned int &bits);
+    static void WriteRecord(BitWriter &writer, EntityID id, EntityID previous, uint32_t op, const char *state, unsigned int size, const char *baseState);
+    static bool ReadID(BitReader &reader, EntityID previous, EntityID &id);
+
+    // Entities must be appended in increasing ID order
+    void appendEntity(EntityID id, const char *state, unsigned int size);
+    // Index of the first entity with an ID no lower than id
+    unsigned int lowerBound(EntityID id) const;
+
+private:
+    SnapshotSequence _sequence;
+
+    std::vector<Record> _records;
+    std::vector<char> _data;
+};
+
+// The last few snapshots exchanged with one host, indexed by sequence
+// The server keeps one per client to find the baseline each delta is encoded against, and the client keeps one to find the baseline to decode against
+class GhastlySnapshotHistory {
+public:
+    // Baselines older than this many snapshots are forgotten, after which the host is sent full state again
+    static const unsigned int Size = MaxBaselineAge;
+
+public:
+    GhastlySnapshotHistory();
+
+    // Start recording a snapshot, replacing whichever one was Size sequences ago
+    GhastlySnapshot &record(SnapshotSequence sequence);
+    // Returns 0 if the snapshot has been forgotten (or was never recorded)
+    const GhastlySnapshot *find(SnapshotSequence sequence) const;
+
+    // Note that the other end has the snapshot; older acknowledgements are ignored
+    void acknowledge(SnapshotSequence sequence);
+    // The newest acknowledged snapshot that hasn't been forgotten, or 0 if there isn't one
+    const GhastlySnapshot *getBaseline() const;
+    SnapshotSequence getLatestAcknowledged() const { return _acknowledged; }
+
+private:
+    GhastlySnapshot _ring[Size];
+    SnapshotSequence _acknowledged;
+};
+
+#endif
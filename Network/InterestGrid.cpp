@@ -0,0 +1,124 @@
+#include <Network/InterestGrid.h>
+#include <Base/Assertion.h>
+
+// Cells further out than this share the outermost cell, so coordinates never overflow
+static const float MaxCellCoordinate = 1073741824.0f;
+
+InterestGrid::InterestGrid(float cellSize): _cellSize(cellSize), _built(true) {
+    ASSERT(cellSize > 0);
+}
+
+void InterestGrid::setCellSize(float cellSize) {
+    ASSERT(cellSize > 0);
+    _cellSize = cellSize;
+    clear();
+}
+
+float InterestGrid::getCellSize() const {
+    return _cellSize;
+}
+
+void InterestGrid::clear() {
+    _entries.clear();
+    _byID.clear();
+    _built = true;
+}
+
+void InterestGrid::insert(EntityID id, const Vector2<float> &position) {
+    Entry entry;
+    entry.cell = makeCell(getCellCoordinate(position.x), getCellCoordinate(position.y));
+    entry.id = id;
+    entry.position = position;
+    _entries.push_back(entry);
+    _built = false;
+}
+
+unsigned int InterestGrid::size() const {
+    return _entries.size();
+}
+
+void InterestGrid::build() {
+    unsigned int c;
+
+    if(_built) { return; }
+
+    std::sort(_entries.begin(), _entries.end(), CellOrder);
+
+    _byID.resize(_entries.size());
+    for(c = 0; c < _entries.size(); c++) {
+        _byID[c] = &_entries[c];
+    }
+    std::sort(_byID.begin(), _byID.end(), IDOrder);
+
+    _built = true;
+}
+
+void InterestGrid::query(const AABB2<float> &bounds, std::vector<Entry> &results) const {
+    int32_t lowX, lowY, highX, highY, y;
+    std::vector<Entry>::const_iterator itr;
+    Entry first;
+
+    ASSERT(_built);
+
+    lowX  = getCellCoordinate(bounds.getLowerBound().x);
+    lowY  = getCellCoordinate(bounds.getLowerBound().y);
+    highX = getCellCoordinate(bounds.getUpperBound().x);
+    highY = getCellCoordinate(bounds.getUpperBound().y);
+
+    // Each row of cells is contiguous, so every row costs one search
+    for(y = lowY; y <= highY;) {
+        first.cell = makeCell(lowX, y);
+        uint64_t last = makeCell(highX, y);
+
+        itr = std::lower_bound(_entries.begin(), _entries.end(), first, CellOrder);
+        for(; itr != _entries.end() && itr->cell <= last; itr++) {
+            // Cells at the edges are only partly covered
+            if(bounds.contains(itr->position)) {
+                results.push_back(*itr);
+            }
+        }
+
+        // Rows with nothing in them are skipped, so a huge query costs no more than the rows actually occupied
+        if(itr == _entries.end()) { break; }
+        y = std::max(y + 1, getRow(itr->cell));
+    }
+}
+
+bool InterestGrid::getPosition(EntityID id, Vector2<float> &position) const {
+    Entry key;
+    std::vector<const Entry*>::const_iterator itr;
+
+    ASSERT(_built);
+
+    key.id = id;
+    itr = std::lower_bound(_byID.begin(), _byID.end(), &key, IDOrder);
+    if(itr == _byID.end() || (*itr)->id != id) { return false; }
+
+    position = (*itr)->position;
+    return true;
+}
+
+int32_t InterestGrid::getCellCoordinate(float value) const {
+    float cell = floor(value / _cellSize);
+    // Written so that NaN lands in a cell too, rather than reaching the cast
+    if(!(cell >= -MaxCellCoordinate)) { cell = -MaxCellCoordinate; }
+    if(cell > MaxCellCoordinate) { cell = MaxCellCoordinate; }
+    return (int32_t)cell;
+}
+
+uint64_t InterestGrid::makeCell(int32_t x, int32_t y) const {
+    // Bias the coordinates so that unsigned order matches signed order, and put rows in the high bits
+    return ((uint64_t)((uint32_t)y ^ 0x80000000u) << 32) | (uint64_t)((uint32_t)x ^ 0x80000000u);
+}
+
+int32_t InterestGrid::getRow(uint64_t cell) const {
+    return (int32_t)((uint32_t)(cell >> 32) ^ 0x80000000u);
+}
+
+bool InterestGrid::CellOrder(const Entry &lhs, const Entry &rhs) {
+    return lhs.cell < rhs.cell;
+}
+
+bool InterestGrid::IDOrder(const Entry *lhs, const Entry *rhs) {
+    return lhs->id < rhs->id;
+}
@@ -0,0 +1,56 @@
+#ifndef INTERESTGRID_H
+#define INTERESTGRID_H
+
+#include <Base/AABB2.h>
+#include <Network/GhastlyProtocol.h>
+
+using namespace GhastlyProtocol;
+
+// A spatial index of entity positions, for finding the entities within a region without visiting the whole world
+// Entities are bucketed into square cells and kept sorted by cell, row by row, so that a query only searches the rows it covers
+// The grid is meant to be refilled every tick: clear it, insert every entity, then build before querying
+class InterestGrid {
+public:
+    struct Entry {
+        uint64_t cell;
+        EntityID id;
+        Vector2<float> position;
+    };
+
+public:
+    InterestGrid(float cellSize);
+
+    // Discards the entities in the grid
+    void setCellSize(float cellSize);
+    float getCellSize() const;
+
+    void clear();
+    void insert(EntityID id, const Vector2<float> &position);
+    unsigned int size() const;
+
+    // Sort newly inserted entities into place; must be called before querying
+    void build();
+
+    // Appends the entities positioned within bounds to results
+    void query(const AABB2<float> &bounds, std::vector<Entry> &results) const;
+    // Returns false for entities that weren't inserted
+    bool getPosition(EntityID id, Vector2<float> &position) const;
+
+private:
+    int32_t getCellCoordinate(float value) const;
+    uint64_t makeCell(int32_t x, int32_t y) const;
+    int32_t getRow(uint64_t cell) const;
+
+    static bool CellOrder(const Entry &lhs, const Entry &rhs);
+    static bool IDOrder(const Entry *lhs, const Entry *rhs);
+
+private:
+    float _cellSize;
+    bool _built;
+
+    std::vector<Entry> _entries;
+    // The same entries sorted by ID, for looking entities up individually
+    std::vector<const Entry*> _byID;
+};
+
+#endif
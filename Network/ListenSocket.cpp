@@ -2,90 +2,251 @@
 #include <Base/Assertion.h>
 #include <Base/Log.h>
 
+#if SYS_PLATFORM != PLATFORM_WIN32
+# include <poll.h>
+#endif
+
+int ListenSocket::DefaultBacklog = SOMAXCONN;
+unsigned int ListenSocket::DefaultMaxClients = 1024;
+unsigned int ListenSocket::AcceptBatchSize = 64;
+int ListenSocket::PollTimeout = 100;
+unsigned int ListenSocket::ResourceBackoff = 100;
+
 int InvokeListenSocketLoop(void *params) {
-    ListenSocket *socket = (ListenSocket*)params;
-    socket->doListening();
+    ListenSocket::Acceptor *acceptor = (ListenSocket::Acceptor*)params;
+    acceptor->owner->doListening(acceptor->handle);
     return 1;
 }
 
-ListenSocket::ListenSocket(SocketCreationListener *acceptListener): Socket(true), _acceptListener(acceptListener), _listenThread(0), _listenMutex(0), _shouldDie(false) {
+bool ListenSocket::Shard::open(unsigned short localPort, int backlog) {
+    return createSocket(SOCK_STREAM, IPPROTO_TCP) && setReusePort() && bindSocket(localPort) && listenSocket(backlog);
+}
+
+ListenSocket::ListenSocket(SocketCreationListener *acceptListener, unsigned int acceptors):
+    Socket(false), _acceptListener(acceptListener), _acceptorsWanted(std::max(acceptors, 1u)), _backlog(DefaultBacklog),
+    _maxClients(DefaultMaxClients), _activeClients(0), _refusedClients(0), _shouldDie(false)
+{
+    _admitMutex = SDL_CreateMutex();
+    _listenMutex = SDL_CreateMutex();
 }
 
 ListenSocket::~ListenSocket() {
     stopListening();
+    SDL_DestroyMutex(_admitMutex);
+    SDL_DestroyMutex(_listenMutex);
 }
 
 bool ListenSocket::startListening(unsigned short localPort) {
-    if(!_listenThread) {
-        if(!createSocket(SOCK_STREAM, IPPROTO_TCP)) { return false; }
-        if(!bindSocket(localPort)) { return false; }
+    unsigned int c;
+
+    if(!_acceptors.empty()) { return false; }
+
+    if(!createSocket(SOCK_STREAM, IPPROTO_TCP)) { return false; }
+    if(_acceptorsWanted > 1 && !setReusePort()) {
+        Warn("SO_REUSEPORT is unavailable, accepting connections on a single thread");
+        _acceptorsWanted = 1;
+    }
+    if(!bindSocket(localPort) || !listenSocket(_backlog)) {
+        closeSocket();
+        return false;
+    }
 
-        // Listen for connections, setting the backlog to 5
-        SDL_LockMutex(_lock);
-        listen(_socketHandle, 5);
-        SDL_UnlockMutex(_lock);
+    // Every other acceptor listens on whichever port the first was given
+    localPort = getLocalPort();
+    for(c = 1; c < _acceptorsWanted; c++) {
+        Shard *shard = new Shard();
+        if(!shard->open(localPort, _backlog)) {
+            Warn("Failed to open acceptor " << c << " on port " << localPort << ", continuing with " << c);
+            delete shard;
+            break;
+        }
+        _shards.push_back(shard);
+    }
 
-        // Start looping to accept connections
-        _listenMutex = SDL_CreateMutex();
-        _listenThread = SDL_CreateThread(InvokeListenSocketLoop, "ListenSocketThread", (void*)this);
+    // Start looping to accept connections
+    _shouldDie = false;
+    for(c = 0; c <= _shards.size(); c++) {
+        Acceptor *acceptor = new Acceptor();
+        acceptor->owner = this;
+        acceptor->handle = (c == 0) ? _socketHandle : _shards[c - 1]->getHandle();
+        acceptor->thread = SDL_CreateThread(InvokeListenSocketLoop, "ListenSocketThread", (void*)acceptor);
+        _acceptors.push_back(acceptor);
+    }
 
-        Info("Listening for connections on port " << localPort);
+    Info("Listening for connections on port " << localPort << " with " << _acceptors.size() << " acceptor(s), backlog " << _backlog);
 
-        return true;
-    } else { return false; }
+    return true;
 }
 
 void ListenSocket::stopListening() {
-    if(_listenThread) {
-        int status;
-        
-        // Tell the thread to die
-        SDL_mutexP(_listenMutex);
-        _shouldDie = true;
-        SDL_mutexV(_listenMutex);
-        
-        // Wait for the thread to die
-        SDL_WaitThread(_listenThread, &status);
-        
-        // Teardown
-        SDL_DestroyMutex(_listenMutex);
-        _listenThread = 0;
-        closeSocket();
+    unsigned int c;
+    int status;
 
-        Info("ListenSocked closed");
+    if(_acceptors.empty()) { return; }
+
+    // Tell the threads to die
+    SDL_mutexP(_listenMutex);
+    _shouldDie = true;
+    SDL_mutexV(_listenMutex);
+
+    // Wait for the threads to die, which they do within a poll timeout
+    for(c = 0; c < _acceptors.size(); c++) {
+        SDL_WaitThread(_acceptors[c]->thread, &status);
+        delete _acceptors[c];
+    }
+    _acceptors.clear();
+
+    // Teardown
+    for(c = 0; c < _shards.size(); c++) {
+        delete _shards[c];
     }
+    _shards.clear();
+    closeSocket();
+
+    Info("ListenSocket closed");
 }
 
-void ListenSocket::doListening() {
-    while(true) {
-        sockaddr_in clientAddr;
-        socklen_t clientAddrLength;
-        int newSocketHandle;
-        
-        SDL_mutexP(_listenMutex);
-        if(_shouldDie) {
-            SDL_mutexV(_listenMutex);
-            break;
-        } else {
-            SDL_mutexV(_listenMutex);
-        }
+void ListenSocket::setBacklog(int backlog) {
+    SDL_mutexP(_listenMutex);
+    _backlog = std::max(backlog, 1);
+    SDL_mutexV(_listenMutex);
+}
 
-        clientAddrLength = sizeof(clientAddr);
-        newSocketHandle = accept(_socketHandle, (sockaddr*)&clientAddr, &clientAddrLength);
+int ListenSocket::getBacklog() {
+    return _backlog;
+}
 
-        if(newSocketHandle <= 0) {
-            // Fail gracefully and go on to processing the next connection
-            //Error("ListenSocket failed to accept incoming connection");
-            continue;
-        }
+void ListenSocket::setMaxClients(unsigned int maxClients) {
+    SDL_mutexP(_listenMutex);
+    _maxClients = maxClients;
+    SDL_mutexV(_listenMutex);
+}
+
+unsigned int ListenSocket::getMaxClients() {
+    return _maxClients;
+}
 
-        NetAddress clientAddress(&clientAddr);
-        Info("Incoming connection from " << clientAddress);
+void ListenSocket::releaseClient() {
+    SDL_mutexP(_listenMutex);
+    ASSERT(_activeClients > 0);
+    _activeClients--;
+    SDL_mutexV(_listenMutex);
+}
+
+unsigned int ListenSocket::getActiveClients() {
+    unsigned int ret;
+    SDL_mutexP(_listenMutex);
+    ret = _activeClients;
+    SDL_mutexV(_listenMutex);
+    return ret;
+}
+
+unsigned int ListenSocket::getRefusedClients() {
+    unsigned int ret;
+    SDL_mutexP(_listenMutex);
+    ret = _refusedClients;
+    SDL_mutexV(_listenMutex);
+    return ret;
+}
+
+unsigned int ListenSocket::getAcceptorCount() {
+    return _acceptors.size();
+}
+
+bool ListenSocket::shouldDie() {
+    bool ret;
+    SDL_mutexP(_listenMutex);
+    ret = _shouldDie;
+    SDL_mutexV(_listenMutex);
+    return ret;
+}
+
+bool ListenSocket::waitForConnections(int handle) {
+    pollfd entry;
+
+    entry.fd = handle;
+    entry.events = POLLIN;
+    entry.revents = 0;
+#if SYS_PLATFORM == PLATFORM_WIN32
+    return WSAPoll(&entry, 1, PollTimeout) > 0;
+#else
+    return poll(&entry, 1, PollTimeout) > 0;
+#endif
+}
+
+void ListenSocket::doListening(int handle) {
+    unsigned int c;
+
+    while(!shouldDie()) {
+        if(!waitForConnections(handle)) { continue; }
 
-        TCPSocket *newSocket = new TCPSocket(newSocketHandle, false);
-        newSocket->setBlockingFlag(false);
-        if(!_acceptListener->onSocketCreation(clientAddress, newSocket)) {
-            delete newSocket;
+        // Drain as much of the backlog as is waiting, up to a batch
+        for(c = 0; c < AcceptBatchSize; c++) {
+            sockaddr_in clientAddr;
+            socklen_t clientAddrLength = sizeof(clientAddr);
+            int newSocketHandle, error;
+
+#if SYS_PLATFORM == PLATFORM_LINUX
+            // Accepted sockets come out non-blocking, saving a syscall apiece
+            newSocketHandle = accept4(handle, (sockaddr*)&clientAddr, &clientAddrLength, SOCK_NONBLOCK);
+#else
+            newSocketHandle = accept(handle, (sockaddr*)&clientAddr, &clientAddrLength);
+#endif
+
+            if(newSocketHandle <= 0) {
+                error = LastSocketError();
+#if SYS_PLATFORM != PLATFORM_WIN32
+                if(error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                    // Pending connections stay in the backlog until descriptors free up
+                    Warn("ListenSocket out of resources (error " << error << "), backing off");
+                    SDL_Delay(ResourceBackoff);
+                    break;
+                }
+#endif
+                // The backlog is empty, or a connection was dropped before it could be accepted
+                if(error == E_WOULD_BLOCK || error == EAGAIN) { break; }
+                continue;
+            }
+
+            admit(clientAddr, newSocketHandle);
         }
     }
 }
+
+void ListenSocket::admit(const sockaddr_in &clientAddr, int handle) {
+    NetAddress clientAddress(&clientAddr);
+    bool admitted;
+
+    // Claim a place up front; the listener may release others (replacing an old connection, say) while it runs
+    SDL_mutexP(_listenMutex);
+    admitted = (_activeClients < _maxClients);
+    if(admitted) { _activeClients++; }
+    else { _refusedClients++; }
+    SDL_mutexV(_listenMutex);
+
+    if(!admitted) {
+        Warn("Refusing connection from " << clientAddress << ", already at " << _maxClients << " clients");
+#if SYS_PLATFORM == PLATFORM_WIN32
+        closesocket(handle);
+#else
+        close(handle);
+#endif
+        return;
+    }
+
+    Info("Incoming connection from " << clientAddress);
+
+    TCPSocket *newSocket = new TCPSocket(handle, false);
+#if SYS_PLATFORM != PLATFORM_LINUX
+    newSocket->setBlockingFlag(false);
+#endif
+
+    SDL_mutexP(_admitMutex);
+    admitted = _acceptListener->onSocketCreation(clientAddress, newSocket);
+    SDL_mutexV(_admitMutex);
+
+    if(!admitted) {
+        delete newSocket;
+        releaseClient();
+    }
+}
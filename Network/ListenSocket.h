@@ -10,26 +10,80 @@ public:
     virtual bool onSocketCreation(const NetAddress &client, TCPSocket *socket) { return false; }
 };
 
+// Accepts connections on a thread of its own, handing each to the listener
+// With more than one acceptor (Linux only), that many sockets listen on the same port with SO_REUSEPORT, each on its own thread, and the kernel spreads connections between them
+// The listener is only ever called by one acceptor at a time
 class ListenSocket: public Socket {
 public:
-    ListenSocket(SocketCreationListener *acceptListener);
+    ListenSocket(SocketCreationListener *acceptListener, unsigned int acceptors = 1);
     virtual ~ListenSocket();
 
     bool startListening(unsigned short localPort = 0);
     void stopListening();
 
-    void doListening();
+    // How many connections the kernel may hold waiting to be accepted; takes effect on the next startListening
+    void setBacklog(int backlog);
+    int getBacklog();
+
+    // Connections past this many are closed as soon as they're accepted
+    // Whoever owns the accepted sockets must call releaseClient as each one closes to make room for more
+    void setMaxClients(unsigned int maxClients);
+    unsigned int getMaxClients();
+    void releaseClient();
+
+    unsigned int getActiveClients();
+    unsigned int getRefusedClients();
+    // How many acceptors are actually running, which may be fewer than asked for where SO_REUSEPORT isn't available
+    unsigned int getAcceptorCount();
+
+    // Accept connections on one of the listening sockets until stopListening is called
+    void doListening(int handle);
 
 private:
+    // An extra socket listening on the same port
+    class Shard: public Socket {
+    public:
+        Shard(): Socket(false) {}
+        bool open(unsigned short localPort, int backlog);
+    };
+
+    struct Acceptor {
+        ListenSocket *owner;
+        int handle;
+        SDL_Thread *thread;
+    };
+    friend int InvokeListenSocketLoop(void *params);
+
+    bool shouldDie();
+    // Returns false if nothing arrived before the poll timed out
+    bool waitForConnections(int handle);
+    void admit(const sockaddr_in &clientAddr, int handle);
+
+private:
+    static int DefaultBacklog;
     static unsigned int DefaultMaxClients;
+    // The most connections taken from the backlog before checking whether to stop
+    static unsigned int AcceptBatchSize;
+    // How long an acceptor waits for connections before checking whether to stop, in milliseconds
+    static int PollTimeout;
+    // How long to hold off accepting once out of file descriptors, so the backlog waits rather than the acceptor spinning
+    static unsigned int ResourceBackoff;
 
 private:
     SocketCreationListener *_acceptListener;
 
-    SDL_Thread *_listenThread;
+    unsigned int _acceptorsWanted;
+    std::vector<Shard*> _shards;
+    std::vector<Acceptor*> _acceptors;
+
+    // Held while the listener is called, so that only one acceptor calls it at a time
+    SDL_mutex *_admitMutex;
+    // Held around the fields below
     SDL_mutex *_listenMutex;
+    int _backlog;
     unsigned int _maxClients;
-    
+    unsigned int _activeClients, _refusedClients;
+
     bool _shouldDie;
 };
 
@@ -1,21 +1,154 @@
 #include <Network/MultiConnectionProvider.h>
 
-void MultiConnectionProvider::getAndPrioritizePackets() {
+unsigned int MultiConnectionProvider::DefaultReactorThreads = 1;
+
+unsigned int MultiConnectionProvider::DefaultFairnessCap = 8;
+
+MultiConnectionProvider::MultiConnectionProvider(unsigned int reactorThreads):
+    _nextReactor(0), _roundOffset(0), _roundTaken(0), _fairnessCap(DefaultFairnessCap), _capture(0)
+{
+    unsigned int c;
+
+    _round.reserve(256);
+
+    if(!NetworkReactor::IsSupported()) { return; }
+
+    for(c = 0; c < reactorThreads; c++) {
+        NetworkReactor *reactor = new NetworkReactor();
+        if(reactor->start()) {
+            _reactors.push_back(reactor);
+        } else {
+            delete reactor;
+        }
+    }
+}
+
+MultiConnectionProvider::~MultiConnectionProvider() {
+    unsigned int c;
+
+    // Subclasses are expected to have stopped and deleted their buffers by now
+    for(c = 0; c < _reactors.size(); c++) {
+        _reactors[c]->stop();
+        delete _reactors[c];
+    }
+    _reactors.clear();
+}
+
+void MultiConnectionProvider::setFairnessCap(unsigned int packets) {
+    _fairnessCap = std::max(packets, 1u);
+}
+
+unsigned int MultiConnectionProvider::getFairnessCap() {
+    return _fairnessCap;
+}
+
+void MultiConnectionProvider::startBuffer(ConnectionBuffer *buffer) {
+    watchBuffer(buffer);
+    if(!_reactors.empty()) {
+        NetworkReactor *reactor = _reactors[_nextReactor++ % _reactors.size()];
+        if(reactor->attach(buffer)) { return; }
+    }
+    buffer->startBuffering();
+}
+
+void MultiConnectionProvider::stopBuffer(ConnectionBuffer *buffer) {
+    // Detaches from the reactor as well
+    buffer->stopBuffering();
+    unwatchBuffer(buffer);
+}
+
+void MultiConnectionProvider::watchBuffer(ConnectionBuffer *buffer) {
+    buffer->setCapture(_capture);
+    _ready.attach(buffer);
+}
+
+void MultiConnectionProvider::unwatchBuffer(ConnectionBuffer *buffer) {
+    unsigned int c, kept = 0, offset = _roundOffset;
+
+    _ready.detach(buffer);
+
+    // Drop the buffer from the current round, keeping the rest of the round where it was
+    for(c = 0; c < _round.size(); c++) {
+        if(_round[c] == buffer) {
+            if(c < _roundOffset) { offset--; }
+            else if(c == _roundOffset) { _roundTaken = 0; }
+        } else {
+            _round[kept++] = _round[c];
+        }
+    }
+    _round.resize(kept);
+    _roundOffset = offset;
+}
+
+void MultiConnectionProvider::setCapture(PacketCaptureWriter *capture) {
     ConnectionBufferMap::iterator itr;
+
+    _capture = capture;
     for(itr = _buffers.begin(); itr != _buffers.end(); itr++) {
-        Packet packet;
-        while(itr->second->consumePacket(packet)) {
-            _prioritizedPackets.push(packet);
-        }
+        itr->second->setCapture(capture);
+    }
+}
+
+void MultiConnectionProvider::getMetrics(NetworkMetrics &metrics) {
+    ConnectionBufferMap::iterator itr;
+    NetworkMetrics buffer;
+
+    metrics = _retiredMetrics;
+    for(itr = _buffers.begin(); itr != _buffers.end(); itr++) {
+        itr->second->getMetrics(buffer);
+        metrics += buffer;
     }
 }
 
+bool MultiConnectionProvider::getMetrics(const NetAddress &addr, NetworkMetrics &metrics) {
+    ConnectionBufferMap::iterator itr = _buffers.find(addr);
+    if(itr == _buffers.end()) { return false; }
+
+    itr->second->getMetrics(metrics);
+    return true;
+}
+
+void MultiConnectionProvider::retireMetrics(ConnectionBuffer *buffer) {
+    NetworkMetrics metrics;
+    buffer->getMetrics(metrics);
+    _retiredMetrics += metrics;
+}
+
 bool MultiConnectionProvider::recvPacket(Packet &packet) {
-    getAndPrioritizePackets();
-    if(_prioritizedPackets.empty()) { return false; }
-    else {
-        packet = _prioritizedPackets.top();
-        _prioritizedPackets.pop();
-        return true;
+    ConnectionBuffer *buffer;
+
+    while(true) {
+        // Start a new round with every buffer that's become ready since the last one began
+        if(_roundOffset == _round.size()) {
+            _round.clear();
+            _roundOffset = 0;
+            _roundTaken = 0;
+            _ready.take(_round);
+            if(_round.empty()) { return false; }
+        }
+
+        buffer = _round[_roundOffset];
+        if(_roundTaken < _fairnessCap && buffer->consumePacket(packet)) {
+            _roundTaken++;
+            return true;
+        }
+
+        // A closed buffer with nothing left to consume is done for good
+        // Its last packets may have arrived just before it was marked closed, so it's checked once more first
+        if(_roundTaken < _fairnessCap && buffer->isClosed()) {
+            if(buffer->consumePacket(packet)) {
+                _roundTaken++;
+                return true;
+            }
+            _roundOffset++;
+            _roundTaken = 0;
+            onBufferClosed(buffer);
+            continue;
+        }
+
+        // This buffer's had its turn; if it still has packets waiting it gets another in the next round
+        _roundOffset++;
+        _roundTaken = 0;
+        buffer->rearmInbound();
     }
 }
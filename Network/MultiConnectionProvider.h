@@ -3,17 +3,67 @@
 
 #include <Network/ConnectionBuffer.h>
 #include <Network/ConnectionProvider.h>
+#include <Network/NetworkReactor.h>
+#include <Network/ReadyList.h>
 
+// Where the platform supports it, every buffer is serviced by a small fixed pool of NetworkReactors rather than two threads apiece
+// Packets are received round-robin from whichever buffers have signalled that they have any, so the cost of a receive doesn't grow with the number of connections
 class MultiConnectionProvider: public ConnectionProvider {
 public:
+    MultiConnectionProvider(unsigned int reactorThreads = DefaultReactorThreads);
+    virtual ~MultiConnectionProvider();
+
     bool recvPacket(Packet &packet);
 
+    // The most packets taken from one connection before moving on to the next, so that a flooding client can't starve the rest
+    void setFairnessCap(unsigned int packets);
+    unsigned int getFairnessCap();
+
+    // Totals across every connection, including those since closed
+    // Both must be called from the game thread, since that's where connections come and go
+    virtual void getMetrics(NetworkMetrics &metrics);
+    // Returns false if there's no connection to addr
+    bool getMetrics(const NetAddress &addr, NetworkMetrics &metrics);
+
+    // Applies to connections opened later as well
+    void setCapture(PacketCaptureWriter *capture);
+
 protected:
-    void getAndPrioritizePackets();
+    // Start (or stop) moving data for a buffer, on a reactor if one is available and on its own threads otherwise
+    // Also starts (or stops) receiving from the buffer
+    void startBuffer(ConnectionBuffer *buffer);
+    void stopBuffer(ConnectionBuffer *buffer);
+
+    // Start (or stop) receiving from a buffer that's serviced some other way
+    // Once unwatchBuffer returns the provider holds no reference to the buffer
+    void watchBuffer(ConnectionBuffer *buffer);
+    void unwatchBuffer(ConnectionBuffer *buffer);
+
+    // Keep a closing connection's counts in the provider's totals
+    void retireMetrics(ConnectionBuffer *buffer);
+
+    // Called from recvPacket once a closed buffer's last packet has been consumed; the buffer may be stopped and deleted here
+    virtual void onBufferClosed(ConnectionBuffer *buffer) {}
 
 protected:
-    std::priority_queue<Packet> _prioritizedPackets;
+    static unsigned int DefaultReactorThreads;
+    static unsigned int DefaultFairnessCap;
+
     ConnectionBufferMap _buffers;
+
+    std::vector<NetworkReactor*> _reactors;
+    unsigned int _nextReactor;
+
+private:
+    ReadyList _ready;
+
+    // The buffers taking turns in the current round, which one's turn it is, and how many packets it's had
+    std::vector<ConnectionBuffer*> _round;
+    unsigned int _roundOffset, _roundTaken;
+    unsigned int _fairnessCap;
+
+    NetworkMetrics _retiredMetrics;
+    PacketCaptureWriter *_capture;
 };
 
 #endif
@@ -37,6 +37,29 @@ unsigned int NetAddress::getSockAddrSize() const {
     return (_ipVersion == 4) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
 }
 
+unsigned int NetAddress::hash() const {
+    // FNV-1a over the address and port bytes
+    const unsigned char *bytes;
+    unsigned int length, c, h = 2166136261u;
+
+    if(_ipVersion == 4) {
+        bytes = (const unsigned char*)&_ipv4Addr.sin_addr;
+        length = sizeof(_ipv4Addr.sin_addr);
+        h = (h ^ (_ipv4Addr.sin_port & 0xFF)) * 16777619u;
+        h = (h ^ (_ipv4Addr.sin_port >> 8)) * 16777619u;
+    } else {
+        bytes = (const unsigned char*)&_ipv6Addr.sin6_addr;
+        length = sizeof(_ipv6Addr.sin6_addr);
+        h = (h ^ (_ipv6Addr.sin6_port & 0xFF)) * 16777619u;
+        h = (h ^ (_ipv6Addr.sin6_port >> 8)) * 16777619u;
+    }
+
+    for(c = 0; c < length; c++) {
+        h = (h ^ bytes[c]) * 16777619u;
+    }
+    return h;
+}
+
 void NetAddress::print(std::ostream &stream) const {
     stream << "NetAddress(";
     if(_ipVersion == 4) {
@@ -28,7 +28,7 @@ public:
                          _ipv4Addr.sin_port        == rhs._ipv4Addr.sin_port)
                     ) ||
                     (_ipVersion == 6 &&
-                        (_ipv6Addr.sin6_addr.s6_addr == rhs._ipv6Addr.sin6_addr.s6_addr &&
+                        (memcmp(&_ipv6Addr.sin6_addr, &rhs._ipv6Addr.sin6_addr, sizeof(_ipv6Addr.sin6_addr)) == 0 &&
                          _ipv6Addr.sin6_port         == rhs._ipv6Addr.sin6_port)
                     )
                );
@@ -45,10 +45,11 @@ public:
                 return (_ipv4Addr.sin_addr.s_addr < rhs._ipv4Addr.sin_addr.s_addr);
             }
         } else if(_ipVersion == 6 && rhs._ipVersion == 6) {
-            if(_ipv6Addr.sin6_addr.s6_addr == rhs._ipv6Addr.sin6_addr.s6_addr) {
+            int addrOrder = memcmp(&_ipv6Addr.sin6_addr, &rhs._ipv6Addr.sin6_addr, sizeof(_ipv6Addr.sin6_addr));
+            if(addrOrder == 0) {
                 return (_ipv6Addr.sin6_port < rhs._ipv6Addr.sin6_port);
             } else {
-                return (_ipv6Addr.sin6_addr.s6_addr < rhs._ipv6Addr.sin6_addr.s6_addr);
+                return (addrOrder < 0);
             }
         } else if(_ipVersion == 4) {
             return true;
@@ -57,6 +58,9 @@ public:
         }
     }
 
+    // Suitable for hash tables; equal addresses always hash equally
+    unsigned int hash() const;
+
     void print(std::ostream &stream) const;
 
 protected:
@@ -0,0 +1,126 @@
+#include <Network/NetworkMetrics.h>
+
+const NetworkCounters::Side NetworkCounters::ReasonSide[DropReasonCount] = {
+    InboundSide,    // DropInboundFull
+    GameSide,       // DropOutboundFull
+    OutboundSide,   // DropOversized
+    OutboundSide,   // DropSendFailed
+    InboundSide,    // DropMalformed
+    InboundSide     // DropNoClient
+};
+
+NetworkMetrics::NetworkMetrics() {
+    clear();
+}
+
+void NetworkMetrics::clear() {
+    packetsSent = bytesSent = 0;
+    packetsReceived = bytesReceived = 0;
+    memset(dropped, 0, sizeof(dropped));
+    inboundHighWater = outboundHighWater = 0;
+    sendCalls = recvCalls = 0;
+}
+
+uint32_t NetworkMetrics::getDropped() const {
+    uint32_t total = 0;
+    for(unsigned int c = 0; c < DropReasonCount; c++) {
+        total += dropped[c];
+    }
+    return total;
+}
+
+NetworkMetrics NetworkMetrics::since(const NetworkMetrics &earlier) const {
+    NetworkMetrics delta(*this);
+
+    // Unsigned subtraction comes out right across a wrap
+    delta.packetsSent -= earlier.packetsSent;
+    delta.bytesSent -= earlier.bytesSent;
+    delta.packetsReceived -= earlier.packetsReceived;
+    delta.bytesReceived -= earlier.bytesReceived;
+    for(unsigned int c = 0; c < DropReasonCount; c++) {
+        delta.dropped[c] -= earlier.dropped[c];
+    }
+    delta.sendCalls -= earlier.sendCalls;
+    delta.recvCalls -= earlier.recvCalls;
+    return delta;
+}
+
+NetworkMetrics &NetworkMetrics::operator+=(const NetworkMetrics &rhs) {
+    packetsSent += rhs.packetsSent;
+    bytesSent += rhs.bytesSent;
+    packetsReceived += rhs.packetsReceived;
+    bytesReceived += rhs.bytesReceived;
+    for(unsigned int c = 0; c < DropReasonCount; c++) {
+        dropped[c] += rhs.dropped[c];
+    }
+    inboundHighWater = std::max(inboundHighWater, rhs.inboundHighWater);
+    outboundHighWater = std::max(outboundHighWater, rhs.outboundHighWater);
+    sendCalls += rhs.sendCalls;
+    recvCalls += rhs.recvCalls;
+    return *this;
+}
+
+NetworkCounters::NetworkCounters() {
+    unsigned int c, d;
+
+    for(c = 0; c < SideCount; c++) {
+        SDL_AtomicSet(&_lines[c].packets, 0);
+        SDL_AtomicSet(&_lines[c].bytes, 0);
+        SDL_AtomicSet(&_lines[c].calls, 0);
+        SDL_AtomicSet(&_lines[c].highWater, 0);
+        for(d = 0; d < DropReasonCount; d++) {
+            SDL_AtomicSet(&_lines[c].dropped[d], 0);
+        }
+    }
+}
+
+void NetworkCounters::countSent(unsigned int packets, unsigned int bytes) {
+    Add(_lines[OutboundSide].packets, packets);
+    Add(_lines[OutboundSide].bytes, bytes);
+}
+
+void NetworkCounters::countSendCall() {
+    Add(_lines[OutboundSide].calls, 1);
+}
+
+void NetworkCounters::countReceived(unsigned int bytes) {
+    Add(_lines[InboundSide].packets, 1);
+    Add(_lines[InboundSide].bytes, bytes);
+}
+
+void NetworkCounters::countRecvCall() {
+    Add(_lines[InboundSide].calls, 1);
+}
+
+void NetworkCounters::noteInboundDepth(unsigned int depth) {
+    RaiseHighWater(_lines[InboundSide].highWater, depth);
+}
+
+void NetworkCounters::noteOutboundDepth(unsigned int depth) {
+    RaiseHighWater(_lines[GameSide].highWater, depth);
+}
+
+void NetworkCounters::countDropped(DropReason reason, unsigned int packets) {
+    Add(_lines[ReasonSide[reason]].dropped[reason], packets);
+}
+
+void NetworkCounters::snapshot(NetworkMetrics &metrics) const {
+    metrics.packetsSent = Get(_lines[OutboundSide].packets);
+    metrics.bytesSent = Get(_lines[OutboundSide].bytes);
+    metrics.sendCalls = Get(_lines[OutboundSide].calls);
+    metrics.packetsReceived = Get(_lines[InboundSide].packets);
+    metrics.bytesReceived = Get(_lines[InboundSide].bytes);
+    metrics.recvCalls = Get(_lines[InboundSide].calls);
+    metrics.inboundHighWater = Get(_lines[InboundSide].highWater);
+    metrics.outboundHighWater = Get(_lines[GameSide].highWater);
+    for(unsigned int c = 0; c < DropReasonCount; c++) {
+        metrics.dropped[c] = Get(_lines[ReasonSide[c]].dropped[c]);
+    }
+}
+
+void NetworkCounters::RaiseHighWater(SDL_atomic_t &highWater, unsigned int depth) {
+    // Only one thread writes each mark, so there's no race to lose between the check and the set
+    if(depth > (uint32_t)SDL_AtomicGet(&highWater)) {
+        SDL_AtomicSet(&highWater, (int)depth);
+    }
+}
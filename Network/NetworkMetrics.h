@@ -0,0 +1,102 @@
+#ifndef NETWORKMETRICS_H
+#define NETWORKMETRICS_H
+
+#include <SDL2/SDL_atomic.h>
+
+#include <Base/Base.h>
+
+// Why a packet was thrown away
+enum DropReason {
+    // The game thread fell behind and the inbound queue filled up
+    DropInboundFull = 0,
+    // The socket fell behind and the outbound queue filled up
+    DropOutboundFull,
+    // Larger than the connection's maximum packet size
+    DropOversized,
+    // The socket refused it
+    DropSendFailed,
+    // Arrived in a form that couldn't be made sense of
+    DropMalformed,
+    // Arrived from a client there was no room to track
+    DropNoClient,
+    DropReasonCount
+};
+
+// A copy of a connection's (or a whole provider's) counters at one moment
+// Counters are 32 bits and wrap around, so rates should be taken from the difference between two snapshots (see since)
+struct NetworkMetrics {
+    uint32_t packetsSent, bytesSent;
+    uint32_t packetsReceived, bytesReceived;
+    uint32_t dropped[DropReasonCount];
+    // The deepest each queue has been
+    uint32_t inboundHighWater, outboundHighWater;
+    // Calls into the socket layer, each of which may move many packets
+    uint32_t sendCalls, recvCalls;
+
+    NetworkMetrics();
+
+    void clear();
+
+    // Across every reason
+    uint32_t getDropped() const;
+
+    // What was counted between earlier and this snapshot; high-water marks are this snapshot's
+    NetworkMetrics since(const NetworkMetrics &earlier) const;
+
+    // Sums the counters, and keeps the higher of each high-water mark
+    NetworkMetrics &operator+=(const NetworkMetrics &rhs);
+};
+
+// The live counters behind a NetworkMetrics
+// Each counter is only ever written by one thread - the game thread, or whichever services the inbound or outbound side - and each thread's counters have a cache line to themselves
+// Nothing is ever locked, so a snapshot can be taken from any thread at any time without holding up the I/O threads
+class NetworkCounters {
+public:
+    NetworkCounters();
+
+    // Outbound side
+    void countSent(unsigned int packets, unsigned int bytes);
+    void countSendCall();
+
+    // Inbound side
+    void countReceived(unsigned int bytes);
+    void countRecvCall();
+    void noteInboundDepth(unsigned int depth);
+
+    // Game thread
+    void noteOutboundDepth(unsigned int depth);
+
+    // Each reason belongs to the side that detects it (see DropReason)
+    void countDropped(DropReason reason, unsigned int packets = 1);
+
+    void snapshot(NetworkMetrics &metrics) const;
+
+private:
+    enum Side {
+        GameSide = 0,
+        InboundSide,
+        OutboundSide,
+        SideCount
+    };
+
+    struct Line {
+        SDL_atomic_t packets, bytes, calls, highWater;
+        SDL_atomic_t dropped[DropReasonCount];
+        char padding[CACHE_LINE_SIZE];
+    };
+
+    static const Side ReasonSide[DropReasonCount];
+
+    static inline void Add(SDL_atomic_t &counter, unsigned int amount) {
+        SDL_AtomicAdd(&counter, (int)amount);
+    }
+    static inline uint32_t Get(const SDL_atomic_t &counter) {
+        return (uint32_t)SDL_AtomicGet(const_cast<SDL_atomic_t*>(&counter));
+    }
+    static void RaiseHighWater(SDL_atomic_t &highWater, unsigned int depth);
+
+private:
+    Line _lines[SideCount];
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include <Network/NetworkReactor.h>
+#include <Base/Assertion.h>
+#include <Base/Log.h>
+#include <Base/Timestamp.h>
+
+#if SYS_PLATFORM == PLATFORM_LINUX
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#endif
+
+int InvokeNetworkReactorLoop(void *params) {
+    NetworkReactor *reactor = (NetworkReactor*)params;
+    reactor->doReactorLoop();
+    return 1;
+}
+
+unsigned int NetworkReactor::InboundBudget = 64;
+unsigned int NetworkReactor::OutboundBudget = 64;
+
+bool NetworkReactor::IsSupported() {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    return true;
+#else
+    return false;
+#endif
+}
+
+NetworkReactor::NetworkReactor(): _epollHandle(-1), _wakeHandle(-1), _thread(0), _bufferCount(0), _pendingLock(0) {
+    SDL_AtomicSet(&_shouldDie, 0);
+    _lock = SDL_CreateMutex();
+}
+
+NetworkReactor::~NetworkReactor() {
+    stop();
+    if(_bufferCount > 0) {
+        Warn("NetworkReactor destroyed with " << _bufferCount << " buffers still attached");
+    }
+    SDL_DestroyMutex(_lock);
+}
+
+bool NetworkReactor::start() {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    if(_thread) { return false; }
+
+    _epollHandle = epoll_create1(EPOLL_CLOEXEC);
+    if(_epollHandle < 0) {
+        Error("Failed to create epoll instance");
+        return false;
+    }
+
+    _wakeHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(_wakeHandle < 0) {
+        Error("Failed to create reactor wakeup eventfd");
+        ::close(_epollHandle);
+        _epollHandle = -1;
+        return false;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = MakeKey(WakeSlot, 0);
+    epoll_ctl(_epollHandle, EPOLL_CTL_ADD, _wakeHandle, &ev);
+
+    SDL_AtomicSet(&_shouldDie, 0);
+    _thread = SDL_CreateThread(InvokeNetworkReactorLoop, "NetworkReactorThread", (void*)this);
+    return true;
+#else
+    Error("NetworkReactor is not supported on this platform");
+    return false;
+#endif
+}
+
+void NetworkReactor::stop() {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    if(_thread) {
+        int status;
+        uint64_t one = 1;
+
+        SDL_AtomicSet(&_shouldDie, 1);
+        if(write(_wakeHandle, &one, sizeof(one)) < 0) {
+            Warn("Failed to wake NetworkReactor for shutdown");
+        }
+        SDL_WaitThread(_thread, &status);
+        _thread = 0;
+
+        ::close(_wakeHandle);
+        ::close(_epollHandle);
+        _wakeHandle = -1;
+        _epollHandle = -1;
+    }
+#endif
+}
+
+bool NetworkReactor::isRunning() const {
+    return (_thread != 0);
+}
+
+bool NetworkReactor::attach(ConnectionBuffer *buffer) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    uint32_t index;
+    uint64_t key;
+
+    if(!_thread) {
+        Error("Unable to attach buffer, NetworkReactor is not running");
+        return false;
+    }
+    if(buffer->isBuffering()) {
+        Error("Unable to attach buffer, it's already buffering");
+        return false;
+    }
+
+    buffer->allocateBuffers();
+
+    SDL_LockMutex(_lock);
+    if(_freeSlots.empty()) {
+        Slot slot;
+        slot.generation = 0;
+        _slots.push_back(slot);
+        index = (uint32_t)(_slots.size() - 1);
+    } else {
+        index = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+
+    Slot &slot = _slots[index];
+    slot.buffer = buffer;
+    slot.writeArmed = false;
+    slot.closed = false;
+    slot.paced = false;
+    key = MakeKey(index, slot.generation);
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = key;
+    if(epoll_ctl(_epollHandle, EPOLL_CTL_ADD, buffer->getSocketHandle(), &ev) < 0) {
+        Error("Failed to add socket to NetworkReactor");
+        slot.buffer = 0;
+        slot.generation++;
+        _freeSlots.push_back(index);
+        SDL_UnlockMutex(_lock);
+        buffer->freeBuffers();
+        return false;
+    }
+
+    buffer->_reactorKey = key;
+    SDL_AtomicSet(&buffer->_reactorWakePending, 0);
+    buffer->_reactor = this;
+    _bufferCount++;
+    SDL_UnlockMutex(_lock);
+
+    // Anything queued before the buffer was attached needs flushing
+    notifyOutbound(buffer);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void NetworkReactor::detach(ConnectionBuffer *buffer) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    SDL_LockMutex(_lock);
+    Slot *slot = lookup(buffer->_reactorKey);
+    if(slot && slot->buffer == buffer) {
+        if(!slot->closed) {
+            epoll_ctl(_epollHandle, EPOLL_CTL_DEL, buffer->getSocketHandle(), 0);
+        }
+
+        // Bumping the generation invalidates any events or wakeups still in flight for this slot
+        slot->buffer = 0;
+        slot->generation++;
+        _freeSlots.push_back((uint32_t)(buffer->_reactorKey & 0xFFFFFFFF));
+        _bufferCount--;
+    }
+    buffer->_reactor = 0;
+    SDL_UnlockMutex(_lock);
+#endif
+}
+
+void NetworkReactor::notifyOutbound(ConnectionBuffer *buffer) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    // Only the first packet queued since the reactor last flushed this buffer needs to wake it
+    if(!SDL_AtomicCAS(&buffer->_reactorWakePending, 0, 1)) { return; }
+
+    SDL_AtomicLock(&_pendingLock);
+    _pending.push_back(buffer->_reactorKey);
+    SDL_AtomicUnlock(&_pendingLock);
+
+    uint64_t one = 1;
+    if(write(_wakeHandle, &one, sizeof(one)) < 0) {
+        Warn("Failed to wake NetworkReactor");
+    }
+#endif
+}
+
+unsigned int NetworkReactor::getBufferCount() {
+    unsigned int ret;
+    SDL_LockMutex(_lock);
+    ret = _bufferCount;
+    SDL_UnlockMutex(_lock);
+    return ret;
+}
+
+void NetworkReactor::doReactorLoop() {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    epoll_event events[MaxEvents];
+    int eventCount, timeout = -1, c;
+    unsigned int p;
+    bool woken;
+
+    Debug("Entering NetworkReactor loop");
+    while(!SDL_AtomicGet(&_shouldDie)) {
+        eventCount = epoll_wait(_epollHandle, events, MaxEvents, timeout);
+        if(eventCount < 0) {
+            if(errno != EINTR) { Error("epoll_wait failed with error " << errno); }
+            continue;
+        }
+
+        woken = false;
+        SDL_LockMutex(_lock);
+        for(c = 0; c < eventCount; c++) {
+            uint64_t key = events[c].data.u64;
+            uint32_t flags = events[c].events;
+
+            if((uint32_t)(key & 0xFFFFFFFF) == WakeSlot) {
+                uint64_t count;
+                if(read(_wakeHandle, &count, sizeof(count)) < 0) {}
+                woken = true;
+                continue;
+            }
+
+            // The slot may have been detached (or reused) since epoll_wait returned
+            Slot *slot = lookup(key);
+            if(!slot || slot->closed) { continue; }
+
+            if(flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                if(!slot->buffer->serviceInbound(InboundBudget) || (flags & (EPOLLHUP | EPOLLERR))) {
+                    closeSlot(slot);
+                    continue;
+                }
+            }
+            if(flags & EPOLLOUT) {
+                flush(slot, key);
+            }
+        }
+
+        if(woken) {
+            SDL_AtomicLock(&_pendingLock);
+            _servicing.swap(_pending);
+            SDL_AtomicUnlock(&_pendingLock);
+
+            for(p = 0; p < _servicing.size(); p++) {
+                Slot *slot = lookup(_servicing[p]);
+                if(!slot) { continue; }
+
+                // Clear the flag before flushing so that anything queued from here on triggers another wakeup
+                SDL_AtomicSet(&slot->buffer->_reactorWakePending, 0);
+                if(!slot->closed) {
+                    flush(slot, _servicing[p]);
+                }
+            }
+            _servicing.clear();
+        }
+
+        timeout = flushPaced();
+        SDL_UnlockMutex(_lock);
+    }
+    Debug("Leaving NetworkReactor loop");
+#endif
+}
+
+NetworkReactor::Slot *NetworkReactor::lookup(uint64_t key) {
+    uint32_t index = (uint32_t)(key & 0xFFFFFFFF),
+             generation = (uint32_t)(key >> 32);
+
+    if(index >= _slots.size()) { return 0; }
+
+    Slot *slot = &_slots[index];
+    if(slot->generation != generation || !slot->buffer) { return 0; }
+    return slot;
+}
+
+void NetworkReactor::flush(Slot *slot, uint64_t key) {
+    bool drained = slot->buffer->serviceOutbound(OutboundBudget);
+    unsigned int delay = drained ? 0 : slot->buffer->getPacingDelay();
+
+    if(delay > 0) {
+        // The socket isn't what's holding things up, so there's no point waiting for it to become writable
+        if(!slot->paced) {
+            _paced.insert(std::make_pair(GetMilliseconds() + delay, key));
+            slot->paced = true;
+        }
+        if(slot->writeArmed) {
+            setWriteInterest(slot, key, false);
+        }
+        return;
+    }
+
+    // Only ask for writability while there's something left to write; it's almost always reported otherwise
+    if(drained == slot->writeArmed) {
+        setWriteInterest(slot, key, !drained);
+    }
+}
+
+int NetworkReactor::flushPaced() {
+    uint64_t now = GetMilliseconds(), key;
+
+    while(!_paced.empty() && _paced.begin()->first <= now) {
+        key = _paced.begin()->second;
+        _paced.erase(_paced.begin());
+
+        // Entries for detached buffers are simply dropped
+        Slot *slot = lookup(key);
+        if(!slot) { continue; }
+
+        slot->paced = false;
+        if(!slot->closed) {
+            flush(slot, key);
+        }
+    }
+
+    if(_paced.empty()) { return -1; }
+    return (int)(_paced.begin()->first - now);
+}
+
+void NetworkReactor::closeSlot(Slot *slot) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    // Leave the slot allocated; its owner still has to detach it
+    epoll_ctl(_epollHandle, EPOLL_CTL_DEL, slot->buffer->getSocketHandle(), 0);
+    slot->closed = true;
+    slot->buffer->markClosed();
+    Debug("NetworkReactor stopped servicing closed socket " << slot->buffer->getSocketHandle());
+#endif
+}
+
+bool NetworkReactor::setWriteInterest(Slot *slot, uint64_t key, bool enabled) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (enabled ? EPOLLOUT : 0);
+    ev.data.u64 = key;
+    if(epoll_ctl(_epollHandle, EPOLL_CTL_MOD, slot->buffer->getSocketHandle(), &ev) < 0) {
+        Error("Failed to update NetworkReactor write interest");
+        return false;
+    }
+    slot->writeArmed = enabled;
+    return true;
+#else
+    return false;
+#endif
+}
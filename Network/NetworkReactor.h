@@ -0,0 +1,86 @@
+#ifndef NETWORKREACTOR_H
+#define NETWORKREACTOR_H
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include <Network/ConnectionBuffer.h>
+
+// Services the sockets of any number of ConnectionBuffers from a single thread
+// Readiness comes from epoll; providePacket wakes the reactor through an eventfd when outbound data is queued
+// Buffers held back by a rate limit are revisited on a timer instead of waiting for writability
+// Only available on Linux - IsSupported returns false elsewhere, and buffers should fall back to startBuffering
+class NetworkReactor {
+public:
+    static bool IsSupported();
+
+public:
+    NetworkReactor();
+    ~NetworkReactor();
+
+    bool start();
+    void stop();
+    bool isRunning() const;
+
+    // Begin servicing a buffer's socket; the buffer must not already be buffering
+    bool attach(ConnectionBuffer *buffer);
+    // Stop servicing a buffer; once this returns the reactor will never touch the buffer again
+    void detach(ConnectionBuffer *buffer);
+
+    // Called by ConnectionBuffer::providePacket from the game thread
+    void notifyOutbound(ConnectionBuffer *buffer);
+
+    unsigned int getBufferCount();
+
+    void doReactorLoop();
+
+private:
+    // How many packets a single readiness event may move, so that one busy socket can't starve the rest
+    static unsigned int InboundBudget;
+    static unsigned int OutboundBudget;
+
+    static const unsigned int MaxEvents = 256;
+    static const uint32_t WakeSlot = 0xFFFFFFFF;
+
+    struct Slot {
+        ConnectionBuffer *buffer;
+        uint32_t generation;
+        bool writeArmed;
+        bool closed;
+        // Waiting in _paced for its rate limit to allow more through
+        bool paced;
+    };
+
+    inline static uint64_t MakeKey(uint32_t index, uint32_t generation) { return ((uint64_t)generation << 32) | index; }
+
+    // These must be called with _lock held
+    Slot *lookup(uint64_t key);
+    void flush(Slot *slot, uint64_t key);
+    void closeSlot(Slot *slot);
+    bool setWriteInterest(Slot *slot, uint64_t key, bool enabled);
+    // Flush every paced buffer whose delay has run out, returning how long until the next one is due (-1 if none are waiting)
+    int flushPaced();
+
+private:
+    int _epollHandle, _wakeHandle;
+
+    SDL_Thread *_thread;
+    SDL_atomic_t _shouldDie;
+
+    // Held by the reactor thread while it's dispatching, and by attach/detach
+    SDL_mutex *_lock;
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    unsigned int _bufferCount;
+
+    // Keys of rate limited buffers, ordered by when they're next allowed to send
+    std::multimap<uint64_t,uint64_t> _paced;
+
+    // Keys of buffers with newly queued outbound packets
+    SDL_SpinLock _pendingLock;
+    std::vector<uint64_t> _pending;
+    std::vector<uint64_t> _servicing;
+};
+
+#endif
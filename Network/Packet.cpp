@@ -3,28 +3,32 @@
 #include <Base/Log.h>
 #include <Base/Timestamp.h>
 
-Packet::Packet(): size(0), data(0) {
+Packet::Packet(): size(0), data(0), clockStamp(0), _block(0) {
 }
 
-Packet::Packet(const Packet &other): size(0), data(0), clockStamp(0) {
+Packet::Packet(const Packet &other): size(0), data(0), clockStamp(0), _block(0) {
     duplicate(other);
 }
 
-Packet::Packet(const NetAddress &a, const char *d, unsigned int s): addr(a), size(s) {
-    data = (char*)calloc(s, sizeof(char));
+Packet::Packet(const NetAddress &a, const char *d, unsigned int s): addr(a), size(0), data(0), _block(0) {
+    reserve(s);
     memcpy(data, d, s);
     clockStamp = GetClock();
 }
 
+Packet::Packet(const NetAddress &a, unsigned int s): addr(a), size(0), data(0), _block(0) {
+    reserve(s);
+    clockStamp = GetClock();
+}
+
 Packet::~Packet() {
-    if(data) {
-        free(data);
-        data = 0;
-    }
+    release();
 }
 
 const Packet& Packet::operator=(const Packet &rhs) {
-    duplicate(rhs);
+    if(this != &rhs) {
+        duplicate(rhs);
+    }
     return *this;
 }
 
@@ -33,14 +37,66 @@ bool Packet::operator<(const Packet &rhs) const {
     return (clockStamp > rhs.clockStamp);
 }
 
-void Packet::duplicate(const Packet &other) {
-    if(data) {
-        free(data);
-        data = 0;
+void Packet::swap(Packet &other) {
+    NetAddress tempAddr = addr;
+    addr = other.addr;
+    other.addr = tempAddr;
+
+    std::swap(size, other.size);
+    std::swap(clockStamp, other.clockStamp);
+    std::swap(_block, other._block);
+
+    // Inline data has to physically move, and the data pointers have to follow it
+    bool thisInline = (data == _inline),
+         otherInline = (other.data == other._inline);
+    char tempInline[InlineSize];
+    memcpy(tempInline, _inline, InlineSize);
+    memcpy(_inline, other._inline, InlineSize);
+    memcpy(other._inline, tempInline, InlineSize);
+
+    char *tempData = data;
+    data = otherInline ? _inline : other.data;
+    other.data = thisInline ? other._inline : tempData;
+}
+
+void Packet::truncate(unsigned int s) {
+    ASSERT(s <= size);
+    size = s;
+}
+
+void Packet::release() {
+    if(_block) {
+        PacketPool::Release(_block);
+        _block = 0;
+    }
+    data = 0;
+    size = 0;
+}
+
+void Packet::reserve(unsigned int s) {
+    release();
+    if(s <= InlineSize) {
+        data = _inline;
+    } else {
+        _block = PacketPool::Allocate(s);
+        data = _block->getData();
     }
+    size = s;
+}
+
+void Packet::duplicate(const Packet &other) {
+    // Retain before releasing in case both packets share a block
+    if(other._block) { PacketPool::Retain(other._block); }
+    release();
+
     clockStamp = other.clockStamp;
     addr = other.addr;
     size = other.size;
-    data = (char*)calloc(size, sizeof(char));
-    memcpy(data, other.data, size);
+    _block = other._block;
+    if(other.data == other._inline) {
+        memcpy(_inline, other._inline, size);
+        data = _inline;
+    } else {
+        data = other.data;
+    }
 }
@@ -3,8 +3,13 @@
 
 #include <Base/Timestamp.h>
 #include <Network/NetAddress.h>
+#include <Network/PacketPool.h>
 
+// Packet data is either stored inline (for tiny payloads) or in a reference-counted PacketPool block
+// Copying a packet shares its block rather than duplicating the data, so packet data must not be modified once the packet has been copied
 struct Packet {
+    static const unsigned int InlineSize = 16;
+
     NetAddress addr;
     unsigned int size;
     char *data;
@@ -13,13 +18,27 @@ struct Packet {
     Packet();
     Packet(const Packet &other);
     Packet(const NetAddress &a, const char *d, unsigned int s);
+    // Reserves room for s bytes without initializing them, so data can be written in place (by a socket read, for example)
+    Packet(const NetAddress &a, unsigned int s);
     ~Packet();
 
     const Packet& operator=(const Packet &rhs);
     bool operator<(const Packet &rhs) const;
 
+    // Exchange contents with another packet without touching any reference counts
+    void swap(Packet &other);
+    // Shrink the packet after filling it in place
+    void truncate(unsigned int s);
+    // Drop this packet's data, leaving it empty
+    void release();
+
 private:
+    void reserve(unsigned int s);
     void duplicate(const Packet &other);
+
+private:
+    PacketBlock *_block;
+    char _inline[InlineSize];
 };
 
 #endif
@@ -0,0 +1,214 @@
+#include <Network/PacketCapture.h>
+#include <Base/Log.h>
+#include <Base/Timestamp.h>
+
+static const char CaptureMagic[4] = { 'G', 'C', 'A', 'P' };
+static const unsigned char CaptureVersion = 1;
+
+static const unsigned char FlagOutbound = 0x1;
+static const unsigned char FlagIPv6 = 0x2;
+
+static FILE *OpenCaptureFile(const std::string &path, const char *mode) {
+    FILE *file;
+
+#if SYS_PLATFORM == PLATFORM_WIN32
+    if(fopen_s(&file, path.c_str(), mode) != 0) { file = 0; }
+#else
+    file = fopen(path.c_str(), mode);
+#endif
+    return file;
+}
+
+const unsigned int PacketCaptureWriter::MaxRecordHeader;
+
+unsigned int PacketCaptureWriter::WriteVarint(uint64_t value, unsigned char *dest) {
+    unsigned int size = 0;
+
+    while(value >= 0x80) {
+        dest[size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    dest[size++] = (unsigned char)value;
+    return size;
+}
+
+PacketCaptureWriter::PacketCaptureWriter(): _file(0), _lock(0), _start(0), _lastTime(0), _records(0) {
+}
+
+PacketCaptureWriter::~PacketCaptureWriter() {
+    close();
+}
+
+bool PacketCaptureWriter::open(const std::string &path) {
+    close();
+
+    _file = OpenCaptureFile(path, "wb");
+    if(!_file) {
+        Error("Unable to open packet capture " << path << " for writing");
+        return false;
+    }
+
+    fwrite(CaptureMagic, 1, sizeof(CaptureMagic), _file);
+    fwrite(&CaptureVersion, 1, 1, _file);
+
+    _start = GetMicroseconds();
+    _lastTime = 0;
+    _records = 0;
+    return true;
+}
+
+void PacketCaptureWriter::close() {
+    SDL_AtomicLock(&_lock);
+    if(_file) {
+        fclose(_file);
+        _file = 0;
+    }
+    SDL_AtomicUnlock(&_lock);
+}
+
+bool PacketCaptureWriter::isOpen() const {
+    return _file != 0;
+}
+
+bool PacketCaptureWriter::record(CaptureDirection direction, const Packet &packet) {
+    unsigned char header[MaxRecordHeader];
+    unsigned int size = 1;
+    uint64_t time;
+    bool written;
+
+    const sockaddr *addr = packet.addr.getSockAddr();
+    header[0] = (direction == CaptureOutbound) ? FlagOutbound : 0;
+
+    SDL_AtomicLock(&_lock);
+    if(!_file) {
+        SDL_AtomicUnlock(&_lock);
+        return false;
+    }
+
+    // Taken under the lock, so that records are in time order whichever thread they come from
+    time = GetMicroseconds() - _start;
+    size += WriteVarint(time - _lastTime, header + size);
+    _lastTime = time;
+
+    if(addr->sa_family == AF_INET6) {
+        const sockaddr_in6 *ipv6 = (const sockaddr_in6*)addr;
+        header[0] |= FlagIPv6;
+        memcpy(header + size, &ipv6->sin6_addr, 16);
+        memcpy(header + size + 16, &ipv6->sin6_port, 2);
+        size += 18;
+    } else {
+        const sockaddr_in *ipv4 = (const sockaddr_in*)addr;
+        memcpy(header + size, &ipv4->sin_addr, 4);
+        memcpy(header + size + 4, &ipv4->sin_port, 2);
+        size += 6;
+    }
+    size += WriteVarint(packet.size, header + size);
+
+    written = fwrite(header, 1, size, _file) == size && fwrite(packet.data, 1, packet.size, _file) == packet.size;
+    _records++;
+    SDL_AtomicUnlock(&_lock);
+
+    return written;
+}
+
+unsigned int PacketCaptureWriter::getRecordCount() const {
+    return _records;
+}
+
+PacketCaptureReader::PacketCaptureReader(): _file(0), _time(0), _failed(false) {
+}
+
+PacketCaptureReader::~PacketCaptureReader() {
+    close();
+}
+
+bool PacketCaptureReader::open(const std::string &path) {
+    char magic[sizeof(CaptureMagic)];
+    unsigned char version;
+
+    close();
+    _time = 0;
+    _failed = false;
+
+    _file = OpenCaptureFile(path, "rb");
+    if(!_file) {
+        Error("Unable to open packet capture " << path);
+        return false;
+    }
+
+    if(fread(magic, 1, sizeof(magic), _file) != sizeof(magic) || memcmp(magic, CaptureMagic, sizeof(magic)) != 0 ||
+       fread(&version, 1, 1, _file) != 1 || version != CaptureVersion) {
+        Error(path << " isn't a packet capture this build can read");
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PacketCaptureReader::close() {
+    if(_file) {
+        fclose(_file);
+        _file = 0;
+    }
+}
+
+bool PacketCaptureReader::readVarint(uint64_t &value) {
+    unsigned int shift;
+    int byte;
+
+    value = 0;
+    for(shift = 0; shift < 64; shift += 7) {
+        byte = fgetc(_file);
+        if(byte == EOF) { return false; }
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) { return true; }
+    }
+    return false;
+}
+
+bool PacketCaptureReader::next(CapturedPacket &record) {
+    unsigned char address[18];
+    uint64_t delta, size;
+    int flags;
+
+    if(!_file || _failed) { return false; }
+
+    // A capture cut off between records just ends; one cut off partway through a record is malformed
+    flags = fgetc(_file);
+    if(flags == EOF) { return false; }
+
+    _failed = true;
+    if(!readVarint(delta)) { return false; }
+
+    if(flags & FlagIPv6) {
+        sockaddr_in6 ipv6;
+        if(fread(address, 1, 18, _file) != 18) { return false; }
+        memset(&ipv6, 0, sizeof(ipv6));
+        ipv6.sin6_family = AF_INET6;
+        memcpy(&ipv6.sin6_addr, address, 16);
+        memcpy(&ipv6.sin6_port, address + 16, 2);
+        record.packet.addr = NetAddress(&ipv6);
+    } else {
+        sockaddr_in ipv4;
+        if(fread(address, 1, 6, _file) != 6) { return false; }
+        memset(&ipv4, 0, sizeof(ipv4));
+        ipv4.sin_family = AF_INET;
+        memcpy(&ipv4.sin_addr, address, 4);
+        memcpy(&ipv4.sin_port, address + 4, 2);
+        record.packet.addr = NetAddress(&ipv4);
+    }
+
+    if(!readVarint(size) || size > 0xFFFF) { return false; }
+    record.packet = Packet(record.packet.addr, (unsigned int)size);
+    if(size > 0 && fread(record.packet.data, 1, (size_t)size, _file) != size) { return false; }
+
+    _time += delta;
+    record.time = _time;
+    record.direction = (flags & FlagOutbound) ? CaptureOutbound : CaptureInbound;
+    _failed = false;
+    return true;
+}
+
+bool PacketCaptureReader::hasFailed() const {
+    return _failed;
+}
@@ -0,0 +1,78 @@
+#ifndef PACKETCAPTURE_H
+#define PACKETCAPTURE_H
+
+#include <SDL2/SDL_atomic.h>
+
+#include <Network/Packet.h>
+
+/*
+    A capture is a compact binary log of the packets a provider sent and received, for replaying real traffic offline (see ReplayProvider).
+    It starts with the magic "GCAP" and a version byte, followed by a record per packet:
+        flags (1 byte)              bit 0 set for outbound, bit 1 set for IPv6
+        time (varint)               microseconds since the previous record (or the start of the capture), on a monotonic clock
+        address (6 or 18 bytes)     IPv4 or IPv6 address, then the port, both in network byte order
+        size (varint), data
+    Varints are 7 bits to a byte, least significant first, with the top bit set on every byte but the last.
+*/
+enum CaptureDirection {
+    CaptureInbound = 0,
+    CaptureOutbound
+};
+
+struct CapturedPacket {
+    // Microseconds since the capture started
+    uint64_t time;
+    CaptureDirection direction;
+    Packet packet;
+};
+
+// Records are written from whichever thread hands packets to a ConnectionBuffer, so any number of buffers can share a writer
+class PacketCaptureWriter {
+public:
+    PacketCaptureWriter();
+    ~PacketCaptureWriter();
+
+    // Starts a new capture, replacing anything already at path; the capture's clock starts now
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const;
+
+    // Returns false if the capture isn't open, or couldn't be written to
+    bool record(CaptureDirection direction, const Packet &packet);
+    unsigned int getRecordCount() const;
+
+private:
+    static const unsigned int MaxRecordHeader = 1 + 10 + 18 + 5;
+
+    static unsigned int WriteVarint(uint64_t value, unsigned char *dest);
+
+private:
+    FILE *_file;
+    SDL_SpinLock _lock;
+    uint64_t _start, _lastTime;
+    unsigned int _records;
+};
+
+class PacketCaptureReader {
+public:
+    PacketCaptureReader();
+    ~PacketCaptureReader();
+
+    // Returns false if the file can't be read or isn't a capture
+    bool open(const std::string &path);
+    void close();
+
+    // Returns false at the end of the capture, or if the rest of it is malformed
+    bool next(CapturedPacket &record);
+    bool hasFailed() const;
+
+private:
+    bool readVarint(uint64_t &value);
+
+private:
+    FILE *_file;
+    uint64_t _time;
+    bool _failed;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include <Network/PacketPool.h>
+#include <Base/Assertion.h>
+
+SDL_SpinLock PacketPool::Lock = 0;
+PacketBlock *PacketPool::FreeList = 0;
+char *PacketPool::Slabs = 0;
+unsigned int PacketPool::FreeBlocks = 0;
+unsigned int PacketPool::TotalBlocks = 0;
+
+// Keep each block's header and payload aligned
+static const unsigned int BlockStride = ((sizeof(PacketBlock) + PacketPool::BlockSize + 15) / 16) * 16;
+static const unsigned int SlabHeaderSize = 16;
+
+PacketBlock *PacketPool::Allocate(unsigned int size) {
+    PacketBlock *block;
+
+    if(size > BlockSize) {
+        block = (PacketBlock*)malloc(sizeof(PacketBlock) + size);
+        block->capacity = size;
+        block->pooled = false;
+    } else {
+        SDL_AtomicLock(&Lock);
+        if(!FreeList) { AddSlab(); }
+        block = FreeList;
+        FreeList = block->next;
+        FreeBlocks--;
+        SDL_AtomicUnlock(&Lock);
+    }
+
+    block->next = 0;
+    SDL_AtomicSet(&block->refs, 1);
+    return block;
+}
+
+void PacketPool::Retain(PacketBlock *block) {
+    SDL_AtomicIncRef(&block->refs);
+}
+
+void PacketPool::Release(PacketBlock *block) {
+    // SDL_AtomicDecRef returns true when the last reference is dropped
+    if(!SDL_AtomicDecRef(&block->refs)) { return; }
+
+    if(!block->pooled) {
+        free(block);
+    } else {
+        SDL_AtomicLock(&Lock);
+        block->next = FreeList;
+        FreeList = block;
+        FreeBlocks++;
+        SDL_AtomicUnlock(&Lock);
+    }
+}
+
+void PacketPool::Reserve(unsigned int blocks) {
+    SDL_AtomicLock(&Lock);
+    while(FreeBlocks < blocks) { AddSlab(); }
+    SDL_AtomicUnlock(&Lock);
+}
+
+unsigned int PacketPool::GetFreeBlocks() {
+    unsigned int ret;
+    SDL_AtomicLock(&Lock);
+    ret = FreeBlocks;
+    SDL_AtomicUnlock(&Lock);
+    return ret;
+}
+
+unsigned int PacketPool::GetTotalBlocks() {
+    unsigned int ret;
+    SDL_AtomicLock(&Lock);
+    ret = TotalBlocks;
+    SDL_AtomicUnlock(&Lock);
+    return ret;
+}
+
+// Must be called with the lock held
+// Slabs are chained together through their first word and retained for the life of the process
+void PacketPool::AddSlab() {
+    unsigned int c;
+    char *slab = (char*)malloc(SlabHeaderSize + BlockStride * BlocksPerSlab);
+    ASSERT(slab);
+
+    *(char**)slab = Slabs;
+    Slabs = slab;
+
+    for(c = 0; c < BlocksPerSlab; c++) {
+        PacketBlock *block = (PacketBlock*)(slab + SlabHeaderSize + BlockStride * c);
+        block->capacity = BlockSize;
+        block->pooled = true;
+        block->next = FreeList;
+        FreeList = block;
+    }
+
+    FreeBlocks += BlocksPerSlab;
+    TotalBlocks += BlocksPerSlab;
+}
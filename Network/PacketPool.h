@@ -0,0 +1,51 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include <SDL2/SDL_atomic.h>
+
+#include <Base/Base.h>
+
+// Reference-counted storage for packet data
+// The payload immediately follows the header in memory
+struct PacketBlock {
+    SDL_atomic_t refs;
+    PacketBlock *next;
+    unsigned int capacity;
+    bool pooled;
+
+    inline char *getData() { return (char*)(this + 1); }
+};
+
+// A slab allocator of MTU-sized packet blocks shared by every thread
+// Blocks are carved out of large slabs and recycled through a free list, so steady-state traffic never touches the heap
+// Requests larger than BlockSize fall back to a one-off heap allocation with the same reference counting
+class PacketPool {
+public:
+    static const unsigned int BlockSize = 1536;
+    static const unsigned int BlocksPerSlab = 256;
+
+    // Returns a block with a single reference and room for at least size bytes
+    static PacketBlock *Allocate(unsigned int size);
+    static void Retain(PacketBlock *block);
+    static void Release(PacketBlock *block);
+
+    // Make sure at least this many blocks are available without growing the pool later
+    static void Reserve(unsigned int blocks);
+
+    // DEBUG
+    static unsigned int GetFreeBlocks();
+    static unsigned int GetTotalBlocks();
+
+private:
+    static void AddSlab();
+
+private:
+    // All of these are plain data so the pool is usable before static constructors have run
+    static SDL_SpinLock Lock;
+    static PacketBlock *FreeList;
+    static char *Slabs;
+    static unsigned int FreeBlocks;
+    static unsigned int TotalBlocks;
+};
+
+#endif
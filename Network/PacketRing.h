@@ -0,0 +1,10 @@
+#ifndef PACKETRING_H
+#define PACKETRING_H
+
+#include <Network/Packet.h>
+#include <Network/RingQueue.h>
+
+// Carries packets between the game thread and the buffering threads
+typedef RingQueue<Packet> PacketRing;
+
+#endif
@@ -0,0 +1,44 @@
+#include <Network/ReadyList.h>
+#include <Network/ConnectionBuffer.h>
+
+ReadyList::ReadyList(): _lock(0) {
+    // Steady state traffic should never need to grow the list
+    _ready.reserve(256);
+}
+
+ReadyList::~ReadyList() {
+}
+
+void ReadyList::attach(ConnectionBuffer *buffer) {
+    SDL_AtomicLock(&_lock);
+    SDL_AtomicSetPtr((void**)&buffer->_readyList, this);
+    SDL_AtomicUnlock(&_lock);
+
+    // A packet that arrived before the list was attached may have claimed the flag without signalling anyone
+    buffer->rearmInbound();
+}
+
+void ReadyList::detach(ConnectionBuffer *buffer) {
+    SDL_AtomicLock(&_lock);
+    if(SDL_AtomicGetPtr((void**)&buffer->_readyList) == this) {
+        SDL_AtomicSetPtr((void**)&buffer->_readyList, 0);
+        _ready.erase(std::remove(_ready.begin(), _ready.end(), buffer), _ready.end());
+    }
+    SDL_AtomicUnlock(&_lock);
+}
+
+void ReadyList::signal(ConnectionBuffer *buffer) {
+    SDL_AtomicLock(&_lock);
+    // The buffer may have been detached since the caller looked
+    if(SDL_AtomicGetPtr((void**)&buffer->_readyList) == this) {
+        _ready.push_back(buffer);
+    }
+    SDL_AtomicUnlock(&_lock);
+}
+
+void ReadyList::take(std::vector<ConnectionBuffer*> &dest) {
+    SDL_AtomicLock(&_lock);
+    dest.insert(dest.end(), _ready.begin(), _ready.end());
+    _ready.clear();
+    SDL_AtomicUnlock(&_lock);
+}
@@ -0,0 +1,34 @@
+#ifndef READYLIST_H
+#define READYLIST_H
+
+#include <SDL2/SDL_atomic.h>
+
+#include <Base/Base.h>
+
+class ConnectionBuffer;
+
+// Buffers with inbound packets waiting to be consumed, in the order they became ready
+// Any thread may signal a buffer onto the list; only the thread that owns the list takes from it
+// A buffer is on the list at most once until its owner calls ConnectionBuffer::rearmInbound
+class ReadyList {
+public:
+    ReadyList();
+    ~ReadyList();
+
+    // Start signalling the buffer's arrivals onto this list; if packets are already waiting it's signalled right away
+    void attach(ConnectionBuffer *buffer);
+    // Once this returns the buffer will never be signalled onto this list again, and any pending signal for it is gone
+    void detach(ConnectionBuffer *buffer);
+
+    // Called by ConnectionBuffer when its inbound ring goes from idle to ready
+    void signal(ConnectionBuffer *buffer);
+
+    // Move everything signalled so far onto the end of dest
+    void take(std::vector<ConnectionBuffer*> &dest);
+
+private:
+    SDL_SpinLock _lock;
+    std::vector<ConnectionBuffer*> _ready;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <Network/ReplayProvider.h>
+#include <Base/Log.h>
+#include <Base/Timestamp.h>
+
+ReplayProvider::ReplayProvider(bool paced): _paced(paced), _started(false), _stepped(false), _start(0), _captureTime(0), _stepTime(0), _hasNext(false) {
+}
+
+bool ReplayProvider::open(const std::string &path) {
+    _started = false;
+    _stepped = false;
+    _captureTime = 0;
+    _metrics.clear();
+    _hasNext = false;
+
+    if(!_reader.open(path)) { return false; }
+    readNext();
+    return true;
+}
+
+bool ReplayProvider::sendPacket(const Packet &packet) {
+    _metrics.packetsSent++;
+    _metrics.bytesSent += packet.size;
+    return true;
+}
+
+bool ReplayProvider::recvPacket(Packet &packet) {
+    if(!_hasNext) { return false; }
+
+    if(_paced) {
+        if(!_started) {
+            _start = GetMicroseconds() - _next.time;
+            _started = true;
+        }
+        if(GetMicroseconds() - _start < _next.time) { return false; }
+    } else if(_stepped && _next.time > _stepTime) {
+        return false;
+    }
+
+    packet = _next.packet;
+    _captureTime = _next.time;
+    _metrics.packetsReceived++;
+    _metrics.bytesReceived += packet.size;
+
+    readNext();
+    return true;
+}
+
+void ReplayProvider::stepTo(uint64_t captureTime) {
+    _stepped = true;
+    _stepTime = captureTime;
+}
+
+bool ReplayProvider::isFinished() const {
+    return !_hasNext;
+}
+
+uint64_t ReplayProvider::getCaptureTime() const {
+    return _captureTime;
+}
+
+void ReplayProvider::getMetrics(NetworkMetrics &metrics) {
+    metrics = _metrics;
+}
+
+void ReplayProvider::readNext() {
+    while((_hasNext = _reader.next(_next)) && _next.direction != CaptureInbound) {}
+
+    if(!_hasNext && _reader.hasFailed()) {
+        Warn("Packet capture is malformed; replay stopped after " << _metrics.packetsReceived << " packets");
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef REPLAYPROVIDER_H
+#define REPLAYPROVIDER_H
+
+#include <Network/ConnectionProvider.h>
+#include <Network/PacketCapture.h>
+
+// Plays the inbound side of a packet capture back through recvPacket, as though the packets were arriving again
+// Paced, packets keep the spacing they were recorded with, starting from the first recvPacket; unpaced, they come out as fast as they're asked for, so the same capture always gives the same packets in the same order
+// An unpaced replay can also be stepped through the capture a tick at a time with stepTo, so each update sees the packets recorded over its tick, however fast it runs
+// Anything sent is counted and thrown away; the outbound records in the capture are skipped
+class ReplayProvider: public ConnectionProvider {
+public:
+    ReplayProvider(bool paced = false);
+
+    // Returns false if the capture can't be read
+    bool open(const std::string &path);
+
+    bool sendPacket(const Packet &packet);
+    bool recvPacket(Packet &packet);
+
+    // Hold back packets recorded after captureTime (microseconds into the capture) until the replay is stepped past them
+    void stepTo(uint64_t captureTime);
+
+    // Every inbound packet has been handed out (or the rest of the capture was malformed)
+    bool isFinished() const;
+    // Microseconds into the capture of the last packet handed out
+    uint64_t getCaptureTime() const;
+
+    void getMetrics(NetworkMetrics &metrics);
+
+private:
+    // Read ahead to the next inbound record
+    void readNext();
+
+private:
+    PacketCaptureReader _reader;
+    bool _paced, _started, _stepped;
+    uint64_t _start, _captureTime, _stepTime;
+
+    CapturedPacket _next;
+    bool _hasNext;
+
+    NetworkMetrics _metrics;
+};
+
+#endif
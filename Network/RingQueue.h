@@ -0,0 +1,142 @@
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+#include <SDL2/SDL_atomic.h>
+
+#include <Base/Base.h>
+#include <Base/Assertion.h>
+
+// A bounded single-producer/single-consumer queue
+// Exactly one thread may push and exactly one (other) thread may pop; neither side ever takes a lock
+// The head and tail indices live on separate cache lines so the producer and consumer don't contend for them
+// T must provide swap, and release to let go of whatever it holds, so that items are handed over rather than copied out
+template <typename T>
+class RingQueue {
+public:
+    RingQueue(unsigned int maxItems);
+    ~RingQueue();
+
+    // Producer side - returns false (and discards the item) if the ring is full
+    bool push(const T &item);
+    // Consumer side - returns false if the ring is empty
+    bool pop(T &item);
+
+    // Only safe to call while neither the producer nor the consumer is active
+    void resize(unsigned int maxItems);
+    void clear();
+
+    // Approximate when called from a thread other than the producer or consumer
+    unsigned int size();
+    bool empty();
+    unsigned int getMaxSize() const;
+
+private:
+    void allocate(unsigned int maxItems);
+
+private:
+    // Written by the consumer, read by the producer
+    SDL_atomic_t _head;
+    char _headPadding[CACHE_LINE_SIZE - sizeof(SDL_atomic_t)];
+
+    // Written by the producer, read by the consumer
+    SDL_atomic_t _tail;
+    char _tailPadding[CACHE_LINE_SIZE - sizeof(SDL_atomic_t)];
+
+    // Read-only while the ring is in use
+    T *_slots;
+    unsigned int _mask;
+    unsigned int _maxSize;
+};
+
+template <typename T>
+RingQueue<T>::RingQueue(unsigned int maxItems): _slots(0), _mask(0), _maxSize(0) {
+    SDL_AtomicSet(&_head, 0);
+    SDL_AtomicSet(&_tail, 0);
+    allocate(maxItems);
+}
+
+template <typename T>
+RingQueue<T>::~RingQueue() {
+    delete [] _slots;
+}
+
+template <typename T>
+bool RingQueue<T>::push(const T &item) {
+    unsigned int head = (unsigned int)SDL_AtomicGet(&_head),
+                 tail = (unsigned int)SDL_AtomicGet(&_tail);
+
+    // Indices increase monotonically and wrap naturally, so the difference is always the current depth
+    if((tail - head) >= _maxSize) { return false; }
+
+    _slots[tail & _mask] = item;
+
+    // Make sure the slot contents are visible before the consumer can see the new tail
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&_tail, (int)(tail + 1));
+    return true;
+}
+
+template <typename T>
+bool RingQueue<T>::pop(T &item) {
+    unsigned int head = (unsigned int)SDL_AtomicGet(&_head),
+                 tail = (unsigned int)SDL_AtomicGet(&_tail);
+
+    if(head == tail) { return false; }
+
+    SDL_MemoryBarrierAcquire();
+
+    // Hand the slot's contents over rather than copying them, leaving the slot empty
+    item.release();
+    item.swap(_slots[head & _mask]);
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&_head, (int)(head + 1));
+    return true;
+}
+
+template <typename T>
+void RingQueue<T>::resize(unsigned int maxItems) {
+    delete [] _slots;
+    _slots = 0;
+    allocate(maxItems);
+}
+
+template <typename T>
+void RingQueue<T>::clear() {
+    T item;
+    while(pop(item)) {}
+}
+
+template <typename T>
+unsigned int RingQueue<T>::size() {
+    return (unsigned int)SDL_AtomicGet(&_tail) - (unsigned int)SDL_AtomicGet(&_head);
+}
+
+template <typename T>
+bool RingQueue<T>::empty() {
+    return (size() == 0);
+}
+
+template <typename T>
+unsigned int RingQueue<T>::getMaxSize() const {
+    return _maxSize;
+}
+
+template <typename T>
+void RingQueue<T>::allocate(unsigned int maxItems) {
+    unsigned int capacity = 1;
+
+    ASSERT(maxItems > 0);
+
+    // Round the slot count up to a power of two so that indices can be masked rather than divided
+    while(capacity < maxItems) { capacity <<= 1; }
+
+    _slots = new T[capacity];
+    _mask = capacity - 1;
+    _maxSize = maxItems;
+
+    SDL_AtomicSet(&_head, 0);
+    SDL_AtomicSet(&_tail, 0);
+}
+
+#endif
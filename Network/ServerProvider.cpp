@@ -1,24 +1,36 @@
 #include <Network/ServerProvider.h>
 #include <Base/Assertion.h>
 
-ServerProvider::ServerProvider(unsigned short localPort) {
-    _listenSocket = new ListenSocket(this);
+ServerProvider::ServerProvider(unsigned short localPort, unsigned int acceptors): _acceptedLock(0) {
+    SDL_AtomicSet(&_acceptedCount, 0);
+    _listenSocket = new ListenSocket(this, acceptors);
     _listenSocket->startListening(localPort);
 }
 
 ServerProvider::~ServerProvider() {
+    unsigned int c;
+
     delete _listenSocket;
 
+    // The acceptors are gone, so nothing else touches the queue
+    for(c = 0; c < _accepted.size(); c++) {
+        stopBuffer(_accepted[c].buffer);
+        delete _accepted[c].buffer;
+    }
+    _accepted.clear();
+
     ConnectionBufferMap::iterator itr;
     TCPBuffer *buffer;
     for(itr = _buffers.begin(); itr != _buffers.end(); itr++) {
         buffer = (TCPBuffer*)itr->second;
-        buffer->stopBuffering();
+        stopBuffer(buffer);
         delete buffer;
     }
 }
 
 bool ServerProvider::sendPacket(const Packet &packet) {
+    adoptAccepted();
+
     ConnectionBufferMap::iterator itr = _buffers.find(packet.addr);
 
     if(itr == _buffers.end()) {
@@ -29,20 +41,80 @@ bool ServerProvider::sendPacket(const Packet &packet) {
     return itr->second->providePacket(packet);
 }
 
+bool ServerProvider::recvPacket(Packet &packet) {
+    adoptAccepted();
+    return MultiConnectionProvider::recvPacket(packet);
+}
+
 unsigned short ServerProvider::getLocalPort() {
     return _listenSocket->getLocalPort();
 }
 
+ListenSocket *ServerProvider::getListenSocket() {
+    return _listenSocket;
+}
+
 bool ServerProvider::onSocketCreation(const NetAddress &client, TCPSocket *socket) {
-    ConnectionBufferMap::iterator itr = _buffers.find(client);
+    Accepted accepted;
 
-    if(itr != _buffers.end()) {
-        // This connection already exists, kill the old one and replace it with this one
-        delete itr->second;
-        _buffers.erase(itr);
-    }
+    accepted.client = client;
+    accepted.buffer = new TCPBuffer(client, socket);
 
-    _buffers[client] = new TCPBuffer(client, socket);
-    ((TCPBuffer*)_buffers[client])->startBuffering();
+    // Started here, so that whatever the client sends first is already on its way in
+    // The count goes up first, so the game thread can't see the buffer become ready without waiting for it to be queued
+    SDL_AtomicLock(&_acceptedLock);
+    SDL_AtomicIncRef(&_acceptedCount);
+    startBuffer(accepted.buffer);
+    _accepted.push_back(accepted);
+    SDL_AtomicUnlock(&_acceptedLock);
     return true;
 }
+
+void ServerProvider::adoptAccepted() {
+    ConnectionBufferMap::iterator itr;
+    unsigned int c;
+
+    if(SDL_AtomicGet(&_acceptedCount) == 0) { return; }
+
+    SDL_AtomicLock(&_acceptedLock);
+    _adopting.swap(_accepted);
+    SDL_AtomicSet(&_acceptedCount, 0);
+    SDL_AtomicUnlock(&_acceptedLock);
+
+    for(c = 0; c < _adopting.size(); c++) {
+        const Accepted &accepted = _adopting[c];
+
+        itr = _buffers.find(accepted.client);
+        if(itr != _buffers.end()) {
+            // This connection already exists, kill the old one and replace it with this one
+            removeBuffer(itr);
+        }
+
+        _buffers[accepted.client] = accepted.buffer;
+    }
+    _adopting.clear();
+}
+
+void ServerProvider::onBufferClosed(ConnectionBuffer *buffer) {
+    ConnectionBufferMap::iterator itr;
+
+    // The buffer may have been accepted since recvPacket last looked
+    adoptAccepted();
+
+    // Closures are rare next to packets, so a search is cheap enough
+    for(itr = _buffers.begin(); itr != _buffers.end(); itr++) {
+        if(itr->second == buffer) {
+            Debug("Connection from " << itr->first << " closed");
+            removeBuffer(itr);
+            return;
+        }
+    }
+}
+
+void ServerProvider::removeBuffer(ConnectionBufferMap::iterator itr) {
+    stopBuffer(itr->second);
+    retireMetrics(itr->second);
+    delete itr->second;
+    _buffers.erase(itr);
+    _listenSocket->releaseClient();
+}
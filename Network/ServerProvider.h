@@ -5,19 +5,43 @@
 #include <Network/TCPBuffer.h>
 #include <Network/ListenSocket.h>
 
+// Connections start buffering as soon as they're accepted on the ListenSocket's threads, but only join _buffers on the game thread (the next time a packet is sent or received), so the map is only ever touched from one thread
+// Each connection holds one of the ListenSocket's admission places until its socket closes and its last packet has been received
 class ServerProvider: public MultiConnectionProvider, public SocketCreationListener {
 public:
-    ServerProvider(unsigned short localPort = 0);
+    // More than one acceptor spreads accepting connections across threads (see ListenSocket)
+    ServerProvider(unsigned short localPort = 0, unsigned int acceptors = 1);
     virtual ~ServerProvider();
 
     bool sendPacket(const Packet &packet);
+    bool recvPacket(Packet &packet);
 
     unsigned short getLocalPort();
+    // For admission control and accept statistics
+    ListenSocket *getListenSocket();
 
     bool onSocketCreation(const NetAddress &client, TCPSocket *socket);
 
+protected:
+    void onBufferClosed(ConnectionBuffer *buffer);
+
+private:
+    struct Accepted {
+        NetAddress client;
+        TCPBuffer *buffer;
+    };
+
+    // Take in the connections accepted since the last call
+    void adoptAccepted();
+    void removeBuffer(ConnectionBufferMap::iterator itr);
+
 private:
     ListenSocket *_listenSocket;
+
+    // Handed over from the acceptors; _acceptedCount lets the game thread skip the lock when nothing's waiting
+    SDL_SpinLock _acceptedLock;
+    SDL_atomic_t _acceptedCount;
+    std::vector<Accepted> _accepted, _adopting;
 };
 
 #endif
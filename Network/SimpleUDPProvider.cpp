@@ -20,4 +20,12 @@ bool SimpleUDPProvider::recvPacket(Packet &packet) {
 
 unsigned short SimpleUDPProvider::getLocalPort() {
     return _buffer->getLocalPort();
-}
\ No newline at end of file
+}
+
+void SimpleUDPProvider::getMetrics(NetworkMetrics &metrics) {
+    _buffer->getMetrics(metrics);
+}
+
+void SimpleUDPProvider::setCapture(PacketCaptureWriter *capture) {
+    _buffer->setCapture(capture);
+}
@@ -14,6 +14,9 @@ public:
 
     unsigned short getLocalPort();
 
+    void getMetrics(NetworkMetrics &metrics);
+    void setCapture(PacketCaptureWriter *capture);
+
 private:
     UDPBuffer *_buffer;
 };
@@ -39,7 +39,7 @@ int Socket::LastSocketError() {
 
 bool Socket::SocketLayerInitialized = false;
 
-Socket::Socket(bool blocking): _state(Uninitialized), _blocking(blocking), _socketHandle(0) {
+Socket::Socket(bool blocking): _state(Uninitialized), _blocking(blocking), _socketHandle(0), _lastSendError(0), _lastRecvError(0) {
     if(!IsSocketLayerReady()) {
         Warn("Socket layer not yet initialized! Please call InitializeSocketLayer if you expect your sockets to send data.");
     }
@@ -108,6 +108,49 @@ bool Socket::bindSocket(unsigned short localPort) {
     return ret;
 }
 
+bool Socket::listenSocket(int backlog) {
+    bool ret = true;
+
+    if(_state != Bound) {
+        Error("Failed to listen on socket, socket not yet bound");
+        return false;
+    }
+
+    SDL_LockMutex(_lock);
+    if(listen(_socketHandle, backlog) < 0) {
+        Error("Failed to listen on socket with backlog " << backlog);
+        ret = false;
+    } else {
+        _state = Listening;
+    }
+    SDL_UnlockMutex(_lock);
+
+    return ret;
+}
+
+bool Socket::setReusePort() {
+#if SYS_PLATFORM == PLATFORM_LINUX && defined(SO_REUSEPORT)
+    int enabled = 1;
+    bool ret = true;
+
+    if(_state != Created) {
+        Error("Failed to set SO_REUSEPORT, socket must be created and not yet bound");
+        return false;
+    }
+
+    SDL_LockMutex(_lock);
+    if(setsockopt(_socketHandle, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)) < 0) {
+        Error("Failed to set SO_REUSEPORT, error code " << LastSocketError());
+        ret = false;
+    }
+    SDL_UnlockMutex(_lock);
+
+    return ret;
+#else
+    return false;
+#endif
+}
+
 bool Socket::setBlockingFlag(bool value) {
 #if SYS_PLATFORM == PLATFORM_WIN32
     DWORD nonBlock = (value ? 0 : 1);
@@ -176,10 +219,13 @@ bool Socket::send(const char *data, unsigned int size, const sockaddr *addr, int
 
     SDL_LockMutex(_lock);
     bytesSent = (int)sendto(_socketHandle, data, size, 0, addr, addrSize);
+    _lastSendError = (bytesSent < 0) ? LastSocketError() : 0;
     SDL_UnlockMutex(_lock);
 
     if(bytesSent < 0) {
-        Error("Failed to write to socket");
+        if(!sendWouldBlock()) {
+            Error("Failed to write to socket");
+        }
         return false;
     } else if(bytesSent != (int)size) {
         Error("Bytes sent does not match bytes given: " << bytesSent << "/" << size);
@@ -196,5 +242,14 @@ void Socket::recv(char *data, int &size, unsigned int maxSize, sockaddr *addr, i
 
     SDL_LockMutex(_lock);
     size = (int)recvfrom(_socketHandle, data, maxSize, 0, addr, (socklen_t*)&addrSize);
+    _lastRecvError = (size < 0) ? LastSocketError() : 0;
     SDL_UnlockMutex(_lock);
 }
+
+bool Socket::sendWouldBlock() const {
+    return (_lastSendError == E_WOULD_BLOCK || _lastSendError == EAGAIN);
+}
+
+bool Socket::recvWouldBlock() const {
+    return (_lastRecvError == E_WOULD_BLOCK || _lastRecvError == EAGAIN);
+}
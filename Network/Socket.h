@@ -9,6 +9,7 @@
 # define E_ADDR_IN_USE WSAEADDRINUSE
 # define E_ALREADY WSAEINPROGRESS
 # define E_IN_PROGRESS WSAEWOULDBLOCK
+# define E_WOULD_BLOCK WSAEWOULDBLOCK
 # pragma comment(lib, "Ws2_32.lib")
 #else
 # include <errno.h>
@@ -19,6 +20,7 @@
 # define E_ADDR_IN_USE EADDRINUSE
 # define E_ALREADY EALREADY
 # define E_IN_PROGRESS EINPROGRESS
+# define E_WOULD_BLOCK EWOULDBLOCK
 #endif
 
 #include <SDL2/SDL_mutex.h>
@@ -39,6 +41,7 @@ public:
     virtual ~Socket();
     
     bool isOpen();
+    inline int getHandle() const { return _socketHandle; }
 
     unsigned short getLocalPort();
     bool setBlockingFlag(bool value = true);
@@ -46,11 +49,21 @@ public:
     bool send(const char *data, unsigned int size, const sockaddr *addr, int addrSize);
     void recv(char *data, int &size, unsigned int maxSize, sockaddr *addr, int &addrSize);
 
+    // True if the last send (or recv) failed only because a non-blocking socket wasn't ready
+    // Tracked separately since sends and receives usually happen on different threads
+    bool sendWouldBlock() const;
+    bool recvWouldBlock() const;
+
 protected:
     bool createSocket(int type, int proto = 0);
     bool bindSocket(unsigned short localPort);
+    bool listenSocket(int backlog);
     void closeSocket();
 
+    // Let other sockets bind the same port, with the kernel spreading incoming connections between them
+    // Must be called before bindSocket; only Linux balances connections this way, so elsewhere this fails
+    bool setReusePort();
+
 protected:
     typedef unsigned char SocketState;
     enum SocketStates {
@@ -68,6 +81,7 @@ protected:
     SocketState _state;
     bool _blocking;
     int _socketHandle;
+    int _lastSendError, _lastRecvError;
 };
 
 #endif
@@ -1,9 +1,361 @@
 #include <Network/SocketedUDPProvider.h>
 #include <Base/Assertion.h>
+#include <Base/Log.h>
 
-SocketedUDPProvider::SocketedUDPProvider(unsigned short port) {
-    ASSERT(0);
+SocketedUDPClient::SocketedUDPClient(const NetAddress &addr, unsigned int maxBufferSize):
+    ConnectionBuffer(maxBufferSize), _addr(addr)
+{
+    SDL_AtomicSet(&_sendScheduled, 0);
+    SDL_AtomicSet(&_retired, 0);
+}
+
+unsigned int SocketedUDPBuffer::DefaultClientBurst = 8;
+
+SocketedUDPBuffer::SocketedUDPBuffer(SocketedUDPProvider *provider, unsigned short localPort):
+    UDPBuffer(localPort, UDPSocket::MaxBatchSize), _provider(provider),
+    _current(0), _currentSent(0), _clientBurst(DefaultClientBurst), _clientPacingDelay(0)
+{}
+
+SocketedUDPBuffer::~SocketedUDPBuffer() {
+    deleteRetiredClients();
+}
+
+void SocketedUDPBuffer::doInboundBuffering() {
+    bool recvIdle, sendIdle;
+
+    Debug("Entering shared UDP socket buffering loop");
+    while(!inboundShouldDie()) {
+        recvIdle = !serviceInbound(_maxBufferSize) || getSocket()->recvWouldBlock();
+        sendIdle = serviceOutbound(_maxBufferSize) || getSocket()->sendWouldBlock() || getPacingDelay() > 0;
+
+        if(recvIdle && sendIdle) {
+            SDL_Delay(1);
+        }
+    }
+}
+
+void SocketedUDPBuffer::doOutboundBuffering() {
+    // Sending is done by the inbound thread
+}
+
+void SocketedUDPBuffer::setClientBurst(unsigned int packets) {
+    if(isBuffering()) {
+        Warn("Unable to change client burst while buffering is active");
+        return;
+    }
+
+    _clientBurst = std::max(packets, 1u);
+}
+
+unsigned int SocketedUDPBuffer::getClientBurst() {
+    return _clientBurst;
+}
+
+unsigned int SocketedUDPBuffer::getPacingDelay() {
+    return std::max(UDPBuffer::getPacingDelay(), _clientPacingDelay);
+}
+
+bool SocketedUDPBuffer::bufferInbound(const Packet &packet) {
+    SocketedUDPClient *client = _provider->findClient(packet.addr, true, false);
+
+    // The shared socket counts everything it receives; each client counts its own share
+    _counters.countReceived(packet.size);
+    if(!client) {
+        // Too many clients already
+        _counters.countDropped(DropNoClient);
+        return false;
+    }
+    return client->bufferInbound(packet);
+}
+
+bool SocketedUDPBuffer::nextOutbound(Packet &packet) {
+    unsigned int throttled = 0, delay;
+
+    _clientPacingDelay = 0;
+    while(true) {
+        if(!_current) {
+            if(_rotation.empty()) { collectScheduled(); }
+            if(_rotation.empty()) { return false; }
+
+            // Everyone waiting has been turned away by their rate limit since the last packet went out
+            if(throttled >= _rotation.size()) { return false; }
+
+            _current = _rotation.front();
+            _rotation.pop_front();
+            _currentSent = 0;
+        }
+
+        if(_currentSent < _clientBurst && _current->hasOutbound() && !_current->canSend()) {
+            // Held back by its own rate limit; it keeps its place in line without holding up anyone else
+            delay = _current->getPacingDelay();
+            _clientPacingDelay = (throttled == 0) ? delay : std::min(_clientPacingDelay, delay);
+            throttled++;
+
+            _rotation.push_back(_current);
+            _current = 0;
+            continue;
+        }
+
+        if(_currentSent < _clientBurst && _current->nextOutbound(packet)) {
+            _current->chargeSent(packet.size);
+            // As far as the client is concerned the packet's sent once it's handed to the socket
+            _current->_counters.countSent(1, packet.size);
+            _currentSent++;
+            _clientPacingDelay = 0;
+            return true;
+        }
+
+        if(_current->hasOutbound()) {
+            // Out of turns for now; go to the back of the line
+            _rotation.push_back(_current);
+        } else if(SDL_AtomicGet(&_current->_retired)) {
+            // Nobody else holds this client any more, and its last packet is gone
+            delete _current;
+        } else {
+            SDL_AtomicSet(&_current->_sendScheduled, 0);
+            // A packet queued between the last nextOutbound and clearing the flag wouldn't have rescheduled the client
+            if(_current->hasOutbound() && SDL_AtomicCAS(&_current->_sendScheduled, 0, 1)) {
+                _rotation.push_back(_current);
+            }
+        }
+        _current = 0;
+    }
+}
+
+bool SocketedUDPBuffer::hasOutbound() {
+    bool scheduled;
+
+    if(_current || !_rotation.empty()) { return true; }
+
+    SDL_AtomicLock(&_provider->_clientLock);
+    scheduled = !_provider->_scheduled.empty();
+    SDL_AtomicUnlock(&_provider->_clientLock);
+    return scheduled;
+}
+
+void SocketedUDPBuffer::collectScheduled() {
+    unsigned int c;
+
+    SDL_AtomicLock(&_provider->_clientLock);
+    for(c = 0; c < _provider->_scheduled.size(); c++) {
+        _rotation.push_back(_provider->_scheduled[c]);
+    }
+    _provider->_scheduled.clear();
+    SDL_AtomicUnlock(&_provider->_clientLock);
+}
+
+void SocketedUDPBuffer::deleteRetiredClients() {
+    unsigned int c;
+
+    // Clients that are still live belong to the provider; retired ones only exist in the rotation
+    collectScheduled();
+    if(_current) {
+        _rotation.push_back(_current);
+        _current = 0;
+    }
+    for(c = 0; c < _rotation.size(); c++) {
+        if(SDL_AtomicGet(&_rotation[c]->_retired)) {
+            delete _rotation[c];
+        }
+    }
+    _rotation.clear();
+}
+
+unsigned int SocketedUDPProvider::DefaultMaxClients = 4096;
+
+unsigned int SocketedUDPProvider::DefaultClientBufferSize = 256;
+
+SocketedUDPProvider::SocketedUDPProvider(unsigned short port, unsigned int maxClients):
+    _maxClients(maxClients), _clientBufferSize(DefaultClientBufferSize), _clientRateLimit(0), _clientRateBurst(0),
+    _clientLock(0), _clients(maxClients)
+{
+    _socketBuffer = new SocketedUDPBuffer(this, port);
+    startBuffer(_socketBuffer);
 }
 
 SocketedUDPProvider::~SocketedUDPProvider() {
-}
\ No newline at end of file
+    ConnectionBufferMap::iterator itr;
+
+    stopBuffer(_socketBuffer);
+
+    // With the socket's thread gone, give anything still queued (goodbyes, typically) one last chance to go out
+    _socketBuffer->serviceOutbound(_clientBufferSize * (_clients.size() + 1));
+    delete _socketBuffer;
+
+    adoptNewClients();
+    for(itr = _buffers.begin(); itr != _buffers.end(); itr++) {
+        delete itr->second;
+    }
+    _buffers.clear();
+    _clients.clear();
+}
+
+bool SocketedUDPProvider::sendPacket(const Packet &packet) {
+    SocketedUDPClient *client = findClient(packet.addr, true, true);
+
+    if(!client) {
+        Warn("Unable to send packet: too many clients to track " << packet.addr);
+        return false;
+    }
+
+    if(!client->providePacket(packet)) { return false; }
+
+    scheduleClient(client);
+    return true;
+}
+
+bool SocketedUDPProvider::recvPacket(Packet &packet) {
+    adoptNewClients();
+    return MultiConnectionProvider::recvPacket(packet);
+}
+
+unsigned short SocketedUDPProvider::getLocalPort() {
+    return _socketBuffer->getLocalPort();
+}
+
+void SocketedUDPProvider::dropClient(const NetAddress &addr) {
+    SocketedUDPClient **found;
+    SocketedUDPClient *client = 0;
+
+    // The client may not have been adopted yet, and it mustn't be adopted after this
+    adoptNewClients();
+
+    SDL_AtomicLock(&_clientLock);
+    found = _clients.find(addr);
+    if(found) {
+        client = *found;
+        _clients.erase(addr);
+    }
+    SDL_AtomicUnlock(&_clientLock);
+
+    if(!client) { return; }
+
+    _buffers.erase(addr);
+    unwatchBuffer(client);
+    // Anything it sends from here on goes uncounted
+    retireMetrics(client);
+
+    // The socket's thread deletes the client once it's had its last turn
+    SDL_AtomicSet(&client->_retired, 1);
+    scheduleClient(client);
+}
+
+void SocketedUDPProvider::getMetrics(NetworkMetrics &metrics) {
+    NetworkMetrics socket;
+
+    // Clients created by the socket's thread aren't counted until they're adopted
+    adoptNewClients();
+    MultiConnectionProvider::getMetrics(metrics);
+
+    _socketBuffer->getMetrics(socket);
+    metrics.sendCalls += socket.sendCalls;
+    metrics.recvCalls += socket.recvCalls;
+    metrics.dropped[DropSendFailed] += socket.dropped[DropSendFailed];
+    metrics.dropped[DropNoClient] += socket.dropped[DropNoClient];
+}
+
+unsigned int SocketedUDPProvider::getClientCount() {
+    unsigned int ret;
+    SDL_AtomicLock(&_clientLock);
+    ret = _clients.size();
+    SDL_AtomicUnlock(&_clientLock);
+    return ret;
+}
+
+void SocketedUDPProvider::setClientBufferSize(unsigned int maxPackets) {
+    _clientBufferSize = maxPackets;
+}
+
+unsigned int SocketedUDPProvider::getClientBufferSize() {
+    return _clientBufferSize;
+}
+
+void SocketedUDPProvider::setClientBurst(unsigned int packets) {
+    // The socket's thread reads the burst without locking
+    stopBuffer(_socketBuffer);
+    _socketBuffer->setClientBurst(packets);
+    startBuffer(_socketBuffer);
+}
+
+unsigned int SocketedUDPProvider::getClientBurst() {
+    return _socketBuffer->getClientBurst();
+}
+
+void SocketedUDPProvider::setClientRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes) {
+    _clientRateLimit = bytesPerSecond;
+    _clientRateBurst = burstBytes;
+}
+
+unsigned int SocketedUDPProvider::getClientRateLimit() {
+    return _clientRateLimit;
+}
+
+bool SocketedUDPProvider::setClientRateLimit(const NetAddress &addr, unsigned int bytesPerSecond, unsigned int burstBytes) {
+    SocketedUDPClient *client = findClient(addr, false, true);
+
+    if(!client) { return false; }
+
+    client->setRateLimit(bytesPerSecond, burstBytes);
+    _socketBuffer->wakeOutbound();
+    return true;
+}
+
+void SocketedUDPProvider::setRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes) {
+    _socketBuffer->setRateLimit(bytesPerSecond, burstBytes);
+}
+
+unsigned int SocketedUDPProvider::getRateLimit() {
+    return _socketBuffer->getRateLimit();
+}
+
+SocketedUDPClient *SocketedUDPProvider::findClient(const NetAddress &addr, bool create, bool fromGameThread) {
+    SocketedUDPClient **found, *client = 0;
+
+    SDL_AtomicLock(&_clientLock);
+    found = _clients.find(addr);
+    if(found) {
+        client = *found;
+    } else if(create && _clients.size() < _maxClients) {
+        client = new SocketedUDPClient(addr, _clientBufferSize);
+        if(_clientRateLimit) {
+            client->setRateLimit(_clientRateLimit, _clientRateBurst);
+        }
+        _clients.insert(addr, client);
+
+        // Only the game thread may touch _buffers
+        if(!fromGameThread) {
+            _newClients.push_back(client);
+        }
+    }
+    SDL_AtomicUnlock(&_clientLock);
+
+    if(client && !found && fromGameThread) {
+        _buffers[addr] = client;
+        watchBuffer(client);
+    }
+    return client;
+}
+
+void SocketedUDPProvider::scheduleClient(SocketedUDPClient *client) {
+    if(SDL_AtomicCAS(&client->_sendScheduled, 0, 1)) {
+        SDL_AtomicLock(&_clientLock);
+        _scheduled.push_back(client);
+        SDL_AtomicUnlock(&_clientLock);
+    }
+    _socketBuffer->wakeOutbound();
+}
+
+void SocketedUDPProvider::adoptNewClients() {
+    unsigned int c;
+
+    SDL_AtomicLock(&_clientLock);
+    _adopting.swap(_newClients);
+    SDL_AtomicUnlock(&_clientLock);
+
+    // Watching a client can signal it right away, so it's done outside the client lock
+    for(c = 0; c < _adopting.size(); c++) {
+        _buffers[_adopting[c]->getAddress()] = _adopting[c];
+        watchBuffer(_adopting[c]);
+    }
+    _adopting.clear();
+}
@@ -3,14 +3,148 @@
 
 #include <Network/MultiConnectionProvider.h>
 #include <Network/UDPBuffer.h>
+#include <Network/AddressMap.h>
 
 // The SocketedUDPProvider is designed to mimic the behavior of a ServerProvider over UDP instead of TCP
 // This allows individual ConnectionBuffers to be created for each unique client address, which allows greater control over per-client bandwidth
+// Every client shares one bound socket; a single SocketedUDPBuffer demultiplexes incoming datagrams into the clients' queues and takes turns sending from them
+
+class SocketedUDPProvider;
+
+// A client's pair of queues; it owns no socket and is never serviced on its own
+class SocketedUDPClient: public ConnectionBuffer {
+public:
+    SocketedUDPClient(const NetAddress &addr, unsigned int maxBufferSize);
+
+    bool serviceInbound(unsigned int maxPackets) { return true; }
+    bool serviceOutbound(unsigned int maxPackets) { return true; }
+
+    const NetAddress &getAddress() const { return _addr; }
+
+private:
+    friend class SocketedUDPBuffer;
+    friend class SocketedUDPProvider;
+
+    NetAddress _addr;
+
+    // Set while the client is waiting for (or taking) its turn at the socket, so it's only ever scheduled once
+    SDL_atomic_t _sendScheduled;
+    // Set once the provider has forgotten the client; the socket's buffer deletes it after its last packet is sent
+    SDL_atomic_t _retired;
+};
+
+// Owns the shared socket; both directions are serviced from one thread so the client queues keep a single producer and consumer
+class SocketedUDPBuffer: public UDPBuffer {
+public:
+    SocketedUDPBuffer(SocketedUDPProvider *provider, unsigned short localPort);
+    virtual ~SocketedUDPBuffer();
+
+    void doInboundBuffering();
+    void doOutboundBuffering();
+
+    // Packets sent to one client before moving on to the next, so a busy client can't monopolize the socket
+    void setClientBurst(unsigned int packets);
+    unsigned int getClientBurst();
+
+    // Also accounts for clients held back by their own rate limits
+    unsigned int getPacingDelay();
+
+protected:
+    bool bufferInbound(const Packet &packet);
+    bool nextOutbound(Packet &packet);
+    bool hasOutbound();
+
+private:
+    friend class SocketedUDPProvider;
+
+    // Take in clients that have been scheduled since the last turn
+    void collectScheduled();
+    // Only safe once the buffer has stopped
+    void deleteRetiredClients();
+
+private:
+    SocketedUDPProvider *_provider;
+
+    // Clients with packets to send, in the order they'll get their turn
+    std::deque<SocketedUDPClient*> _rotation;
+    SocketedUDPClient *_current;
+    unsigned int _currentSent;
+    unsigned int _clientBurst;
+
+    // Set when every client waiting for a turn was held back by its rate limit; how long until the first of them can send
+    unsigned int _clientPacingDelay;
+
+    static unsigned int DefaultClientBurst;
+};
 
 class SocketedUDPProvider: public MultiConnectionProvider {
 public:
-    SocketedUDPProvider(unsigned short port = 0);
+    SocketedUDPProvider(unsigned short port = 0, unsigned int maxClients = DefaultMaxClients);
     virtual ~SocketedUDPProvider();
+
+    bool sendPacket(const Packet &packet);
+    bool recvPacket(Packet &packet);
+
+    unsigned short getLocalPort();
+
+    // Forget a client, discarding anything it sent that hasn't been received yet
+    // Packets already queued for it are still sent; a later datagram from the same address starts a new client
+    void dropClient(const NetAddress &addr);
+    unsigned int getClientCount();
+
+    // Packets and queues are counted by the clients they belong to; the shared socket adds its calls, and the drops only it sees
+    void getMetrics(NetworkMetrics &metrics);
+    using MultiConnectionProvider::getMetrics;
+
+    // Determine how many packets each client can have queued in each direction
+    // Only affects clients created after the call
+    void setClientBufferSize(unsigned int maxPackets);
+    unsigned int getClientBufferSize();
+
+    void setClientBurst(unsigned int packets);
+    unsigned int getClientBurst();
+
+    // Limit the rate each client is sent data at, on top of any limit on the provider as a whole (see setRateLimit)
+    // Affects clients created after the call; a rate of 0 removes the limit
+    void setClientRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes = 0);
+    unsigned int getClientRateLimit();
+    // Limit a single known client; returns false if the client is unknown
+    bool setClientRateLimit(const NetAddress &addr, unsigned int bytesPerSecond, unsigned int burstBytes = 0);
+
+    // Limit the rate of everything sent from the shared socket
+    void setRateLimit(unsigned int bytesPerSecond, unsigned int burstBytes = 0);
+    unsigned int getRateLimit();
+
+private:
+    friend class SocketedUDPBuffer;
+
+    // Returns 0 if the client is unknown and can't be created
+    SocketedUDPClient *findClient(const NetAddress &addr, bool create, bool fromGameThread);
+    // Queue the client for a turn at the socket if it isn't already waiting for one
+    void scheduleClient(SocketedUDPClient *client);
+    // Move clients created by the socket's thread into _buffers
+    void adoptNewClients();
+
+private:
+    static unsigned int DefaultMaxClients;
+    static unsigned int DefaultClientBufferSize;
+
+    SocketedUDPBuffer *_socketBuffer;
+
+    unsigned int _maxClients;
+    unsigned int _clientBufferSize;
+    unsigned int _clientRateLimit, _clientRateBurst;
+
+    // Only touched by the game thread, while taking in new clients
+    std::vector<SocketedUDPClient*> _adopting;
+
+    // Everything below is shared between the game thread and the socket's thread
+    SDL_SpinLock _clientLock;
+    AddressMap<SocketedUDPClient*> _clients;
+    // Created by the socket's thread, waiting to be added to _buffers by the game thread
+    std::vector<SocketedUDPClient*> _newClients;
+    // Waiting to be taken into the socket's rotation
+    std::vector<SocketedUDPClient*> _scheduled;
 };
 
 #endif
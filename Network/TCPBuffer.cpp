@@ -1,132 +1,222 @@
 #include <Network/TCPBuffer.h>
 #include <Base/Assertion.h>
+#include <Base/Log.h>
 
-TCPBuffer::TCPBuffer(const NetAddress &dest, unsigned short localPort): _serializationBuffer(0), _dest(dest) {
+const unsigned int TCPBuffer::MaxBatchSize;
+const unsigned int TCPBuffer::FrameHeaderSize;
+
+unsigned int TCPBuffer::DefaultStreamBufferSize = 65536;
+
+TCPBuffer::TCPBuffer(const NetAddress &dest, unsigned short localPort):
+    _dest(dest), _connected(false), _streamBuffer(0), _streamCapacity(0), _streamStart(0), _streamEnd(0),
+    _sendBatchOffset(0), _sendBatchCount(0), _sendFrameOffset(0)
+{
     _socket = new TCPSocket();
     getSocket()->connectSocket(dest, localPort);
 }
 
-TCPBuffer::TCPBuffer(const NetAddress &dest, TCPSocket *establishedSocket): _serializationBuffer(0), _dest(dest) {
+TCPBuffer::TCPBuffer(const NetAddress &dest, TCPSocket *establishedSocket):
+    _dest(dest), _connected(false), _streamBuffer(0), _streamCapacity(0), _streamStart(0), _streamEnd(0),
+    _sendBatchOffset(0), _sendBatchCount(0), _sendFrameOffset(0)
+{
     _socket = establishedSocket;
 }
 
 TCPBuffer::~TCPBuffer() {
      if(_socket) { delete getSocket(); }
+     if(_streamBuffer) { free(_streamBuffer); }
 }
 
-void TCPBuffer::startBuffering() {
-    if(!_serializationBuffer) {
-        _serializationBuffer = (char*)calloc(_maxPacketSize, sizeof(char));
+void TCPBuffer::allocateBuffers() {
+    ConnectionBuffer::allocateBuffers();
+    if(!_streamBuffer) {
+        // Big enough to take many small frames per read, and always at least one whole frame
+        _streamCapacity = std::max(DefaultStreamBufferSize, _maxPacketSize);
+        _streamBuffer = (char*)calloc(_streamCapacity, sizeof(char));
     }
-    ConnectionBuffer::startBuffering();
 }
 
-void TCPBuffer::stopBuffering() {
-    ConnectionBuffer::stopBuffering();
-    if(_serializationBuffer) {
-        free(_serializationBuffer);
+void TCPBuffer::freeBuffers() {
+    ConnectionBuffer::freeBuffers();
+
+    // A partial frame left in the buffer is kept, since the rest of it is still on its way
+    if(_streamBuffer && _streamStart == _streamEnd) {
+        free(_streamBuffer);
+        _streamBuffer = 0;
+        _streamCapacity = 0;
+        _streamStart = _streamEnd = 0;
     }
 }
 
-void TCPBuffer::doInboundBuffering() {
-    int totalBufferSize, currentOffset,
-        packetSize;
-    unsigned int dataSize;
-    char *dataBuffer;
-    char *currentPacket;
+bool TCPBuffer::isConnected() {
+    if(!_connected) {
+        _connected = getSocket()->isConnected();
+    }
+    return _connected;
+}
 
+void TCPBuffer::doInboundBuffering() {
     Debug("Waiting for TCPSocket to connect before starting inbound buffering");
-    while(!getSocket()->isConnected()) { sleep(1); }
+    while(!isConnected() && !inboundShouldDie()) { sleep(1); }
 
-    Debug("Entering TCPBuffer inbound packet buffering loop");
-    while(true) {
-        SDL_LockMutex(_inboundLock);
-        if(_inboundShouldDie) {
-            SDL_UnlockMutex(_inboundLock);
-            break;
-        } else {
-            SDL_UnlockMutex(_inboundLock);
-        }
-        
-        SDL_LockMutex(_inboundQueueLock);
-
-        // Get the next packet from the socket
-        getSocket()->recv(_packetBuffer, totalBufferSize, _maxBufferSize);
-        currentOffset = 0;
-        dataBuffer = 0;
-        while(currentOffset < totalBufferSize) {
-            currentPacket = _packetBuffer + currentOffset;
-            packetSize = tcpDeserialize(currentPacket, &dataBuffer, dataSize);
-
-            // Update received stats
-            _receivedPackets++;
-
-            // Push the incoming packet onto the queue
-            _inbound.push(Packet(_dest, dataBuffer, dataSize));
-            if(_inbound.size() > _maxBufferSize) {
-                _inbound.pop();
-                SDL_LockMutex(_outboundQueueLock);
-                _droppedPackets++;
-                SDL_UnlockMutex(_outboundQueueLock);
-            } else {
-                _inboundPackets++;
-            }
-
-            currentOffset += packetSize;
-        }
-        SDL_UnlockMutex(_inboundQueueLock);
-    }
+    ConnectionBuffer::doInboundBuffering();
 }
 
 void TCPBuffer::doOutboundBuffering() {
-    Packet packet;
-    int serializedSize;
-
     Debug("Waiting for TCPSocket to connect before starting outbound buffering");
-    while(!getSocket()->isConnected()) { sleep(1); }
+    while(!isConnected() && !outboundShouldDie()) { sleep(1); }
+
+    ConnectionBuffer::doOutboundBuffering();
+}
+
+bool TCPBuffer::serviceInbound(unsigned int maxPackets) {
+    unsigned int total = 0, extracted;
+    int received;
+
+    if(!isConnected()) { return true; }
 
-    Debug("Entering TCPBuffer outbound packet buffering loop");
     while(true) {
-        SDL_LockMutex(_outboundLock);
-        if(_outboundShouldDie) {
-            SDL_UnlockMutex(_outboundLock);
-            break;
-        } else {
-            SDL_UnlockMutex(_outboundLock);
+        // Frames left over from the last read go first
+        if(!extractFrames(maxPackets - total, extracted)) { return false; }
+        total += extracted;
+        if(total >= maxPackets) { break; }
+
+        // Whatever's left is less than a frame; move it to the front to make room for the rest
+        if(_streamStart > 0) {
+            memmove(_streamBuffer, _streamBuffer + _streamStart, _streamEnd - _streamStart);
+            _streamEnd -= _streamStart;
+            _streamStart = 0;
         }
-        
-        SDL_LockMutex(_outboundQueueLock);
-        if(!_outbound.empty()) {
-            // Pop the next outgoing packet off the queue
-            packet = _outbound.front();
-            _outbound.pop();
-            _outboundPackets--;
-
-            // TODO - This is where we'd sleep the thread when throttling bandwidth
-
-            // Send the next outgoing packet to the socket
-            serializedSize = tcpSerialize(_serializationBuffer, packet.data, (unsigned int)packet.size, _maxPacketSize);
-            getSocket()->send(_serializationBuffer, serializedSize);
-            _sentPackets++;
+
+        getSocket()->recv(_streamBuffer + _streamEnd, received, _streamCapacity - _streamEnd);
+        _counters.countRecvCall();
+        if(received == 0) {
+            // The other end has closed the connection
+            return false;
+        } else if(received < 0) {
+            return getSocket()->recvWouldBlock();
         }
-        SDL_UnlockMutex(_outboundQueueLock);
+        _streamEnd += received;
     }
+
+    return true;
 }
 
-int TCPBuffer::tcpSerialize(char *dest, const char *src, unsigned int size, unsigned int maxSize) {
-    uint32_t totalSize = sizeof(uint32_t) + size;
+bool TCPBuffer::extractFrames(unsigned int maxPackets, unsigned int &extracted) {
+    uint32_t frameSize;
+
+    extracted = 0;
+    while(extracted < maxPackets && (_streamEnd - _streamStart) >= FrameHeaderSize) {
+        // The header isn't necessarily aligned within the stream
+        memcpy(&frameSize, _streamBuffer + _streamStart, FrameHeaderSize);
+        if(frameSize < FrameHeaderSize || frameSize > _maxPacketSize) {
+            Error("Received malformed frame of size " << frameSize << " from " << _dest);
+            _counters.countDropped(DropMalformed);
+            return false;
+        }
+        if((_streamEnd - _streamStart) < frameSize) { break; }
 
-    ASSERT(totalSize <= maxSize);
-    ((uint32_t*)dest)[0] = totalSize;
+        // Push the incoming packet onto the queue
+        bufferInbound(Packet(_dest, _streamBuffer + _streamStart + FrameHeaderSize, frameSize - FrameHeaderSize));
 
-    memcpy((void*)(dest + sizeof(uint32_t)), (void*)src, size);
+        _streamStart += frameSize;
+        extracted++;
+    }
 
-    return totalSize;
+    if(_streamStart == _streamEnd) {
+        _streamStart = _streamEnd = 0;
+    }
+    return true;
 }
 
-int TCPBuffer::tcpDeserialize(const char *srcData, char **data, unsigned int &size) {
-    size = ((uint32_t*)srcData)[0] - sizeof(uint32_t);
-    *data = (char*)(srcData + sizeof(uint32_t));
+bool TCPBuffer::serviceOutbound(unsigned int maxPackets) {
+    const char *data[TCPSocket::MaxGatherSize];
+    unsigned int sizes[TCPSocket::MaxGatherSize];
+    unsigned int total = 0, vectors, skip, remaining, frameLeft, sent, bytes, c;
+    int written;
+
+    if(!isConnected()) { return false; }
+
+    while(total < maxPackets) {
+        // Pull the next batch of outgoing packets off the queue
+        if(_sendBatchOffset == _sendBatchCount) {
+            _sendBatchOffset = 0;
+            _sendBatchCount = 0;
+            _sendFrameOffset = 0;
+            // Frames are only taken while the rate limits have room; the rest wait in the queue rather than in the kernel
+            while(_sendBatchCount < std::min(MaxBatchSize, maxPackets - total) && canSend() && nextOutbound(_sendBatch[_sendBatchCount])) {
+                Packet &packet = _sendBatch[_sendBatchCount];
+                if(packet.size + FrameHeaderSize > _maxPacketSize) {
+                    Warn("Dropping outgoing packet of size " << packet.size << ", larger than the maximum packet size");
+                    _counters.countDropped(DropOversized);
+                    packet.release();
+                    continue;
+                }
+                _sendHeaders[_sendBatchCount] = packet.size + FrameHeaderSize;
+                chargeSent(_sendHeaders[_sendBatchCount]);
+                _sendBatchCount++;
+            }
+            if(_sendBatchCount == 0) { return !hasOutbound(); }
+        }
+
+        // Gather every unsent header and payload in the batch, picking up partway through the first frame if need be
+        vectors = 0;
+        for(c = _sendBatchOffset; c < _sendBatchCount; c++) {
+            skip = (c == _sendBatchOffset) ? _sendFrameOffset : 0;
+            if(skip < FrameHeaderSize) {
+                data[vectors] = (const char*)&_sendHeaders[c] + skip;
+                sizes[vectors] = FrameHeaderSize - skip;
+                vectors++;
+                skip = 0;
+            } else {
+                skip -= FrameHeaderSize;
+            }
+            if(_sendBatch[c].size > skip) {
+                data[vectors] = _sendBatch[c].data + skip;
+                sizes[vectors] = _sendBatch[c].size - skip;
+                vectors++;
+            }
+        }
+
+        written = getSocket()->sendGather(data, sizes, vectors);
+        _counters.countSendCall();
+        if(written < 0) {
+            if(getSocket()->sendWouldBlock()) { return false; }
+
+            // The connection has failed; anything in this batch is lost
+            _counters.countDropped(DropSendFailed, _sendBatchCount - _sendBatchOffset);
+            for(c = _sendBatchOffset; c < _sendBatchCount; c++) {
+                _sendBatch[c].release();
+            }
+            total += _sendBatchCount - _sendBatchOffset;
+            _sendBatchOffset = _sendBatchCount;
+            continue;
+        }
+
+        // Retire every frame the socket took all of
+        remaining = (unsigned int)written;
+        sent = 0;
+        bytes = 0;
+        while(remaining > 0) {
+            frameLeft = _sendHeaders[_sendBatchOffset] - _sendFrameOffset;
+            if(remaining < frameLeft) {
+                _sendFrameOffset += remaining;
+                break;
+            }
+
+            remaining -= frameLeft;
+            bytes += _sendBatch[_sendBatchOffset].size;
+            _sendBatch[_sendBatchOffset].release();
+            _sendBatchOffset++;
+            _sendFrameOffset = 0;
+            sent++;
+        }
+        _counters.countSent(sent, bytes);
+        total += sent;
+
+        // A short write means the socket's send buffer is full
+        if(_sendBatchOffset < _sendBatchCount) { return false; }
+    }
 
-    return sizeof(int) + size;
+    return (_sendBatchOffset == _sendBatchCount && !hasOutbound());
 }
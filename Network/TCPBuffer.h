@@ -4,28 +4,56 @@
 #include <Network/ConnectionBuffer.h>
 #include <Network/TCPSocket.h>
 
+// Each packet travels as a frame: a 32-bit length (header included) followed by the payload
+// Received bytes are reassembled into frames however the stream happens to split them, and outgoing frames are gathered into as few writes as possible
 class TCPBuffer: public ConnectionBuffer {
+public:
+    // The most frames gathered into a single write
+    static const unsigned int MaxBatchSize = TCPSocket::MaxGatherSize / 2;
+
 public:
     TCPBuffer(const NetAddress &dest, unsigned short localPort = 0);
     TCPBuffer(const NetAddress &dest, TCPSocket *establishedSocket);
     virtual ~TCPBuffer();
 
-    void startBuffering();
-    void stopBuffering();
-
     void doInboundBuffering();
     void doOutboundBuffering();
 
-    int tcpSerialize(char *dest, const char *src, unsigned int size, unsigned int maxSize);
-    int tcpDeserialize(const char *srcData, char **data, unsigned int &size);
+    bool serviceInbound(unsigned int maxPackets);
+    bool serviceOutbound(unsigned int maxPackets);
+
+protected:
+    void allocateBuffers();
+    void freeBuffers();
 
 private:
     // Make sure the Socket* is properly cast so the correct functions get called
     inline TCPSocket *getSocket() { return (TCPSocket*)_socket; }
 
+    // Caches the result once the socket has finished connecting
+    bool isConnected();
+
+    // Queue up to maxPackets complete frames from the stream buffer
+    // Returns false if the stream contains a frame that can't be valid, at which point the connection can't be trusted
+    bool extractFrames(unsigned int maxPackets, unsigned int &extracted);
+
 private:
-    char *_serializationBuffer;
+    static const unsigned int FrameHeaderSize = sizeof(uint32_t);
+    static unsigned int DefaultStreamBufferSize;
+
     NetAddress _dest;
+    bool _connected;
+
+    // Bytes read from the socket that haven't been queued yet; everything before _streamStart has been consumed
+    char *_streamBuffer;
+    unsigned int _streamCapacity, _streamStart, _streamEnd;
+
+    // Frames pulled off the outbound ring that haven't fully made it to the socket yet
+    Packet _sendBatch[MaxBatchSize];
+    uint32_t _sendHeaders[MaxBatchSize];
+    unsigned int _sendBatchOffset, _sendBatchCount;
+    // How much of the frame at _sendBatchOffset (header included) the socket has already taken
+    unsigned int _sendFrameOffset;
 };
 
 #endif
@@ -2,6 +2,17 @@
 #include <Base/Assertion.h>
 #include <Base/Log.h>
 
+#if SYS_PLATFORM != PLATFORM_WIN32
+# include <sys/uio.h>
+#endif
+
+// Writing to a connection the peer has closed shouldn't kill the process
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+const unsigned int TCPSocket::MaxGatherSize;
+
 TCPSocket::TCPSocket(bool blocking): Socket(blocking) {
 }
 
@@ -60,8 +71,21 @@ bool TCPSocket::isConnected() {
     SDL_UnlockMutex(_lock);
 
     if(ret == 0) {
-        if(error == 0) { return true; }
-        else { return false; }
+        if(error != 0) { return false; }
+
+        // A non-blocking connect that's still in progress reports no error either, so make sure there's actually a peer
+        if(_state == Connecting) {
+            sockaddr_in peerAddr;
+            socklen_t peerAddrSize = sizeof(peerAddr);
+
+            SDL_LockMutex(_lock);
+            ret = getpeername(_socketHandle, (sockaddr*)&peerAddr, &peerAddrSize);
+            if(ret == 0) { _state = Connected; }
+            SDL_UnlockMutex(_lock);
+
+            return (ret == 0);
+        }
+        return true;
     } else {
         Error("Failed to get socket options");
         return false;
@@ -76,3 +100,48 @@ void TCPSocket::recv(char *data, int &size, unsigned int maxSize) {
     int addrSize;
     Socket::recv(data, size, maxSize, 0, addrSize);
 }
+
+int TCPSocket::sendGather(const char **data, const unsigned int *sizes, unsigned int count) {
+    int written;
+    unsigned int c;
+
+    ASSERT(isOpen());
+    if(count > MaxGatherSize) { count = MaxGatherSize; }
+
+#if SYS_PLATFORM != PLATFORM_WIN32
+    msghdr message;
+    iovec vectors[MaxGatherSize];
+
+    for(c = 0; c < count; c++) {
+        vectors[c].iov_base = (void*)data[c];
+        vectors[c].iov_len = sizes[c];
+    }
+
+    memset(&message, 0, sizeof(msghdr));
+    message.msg_iov = vectors;
+    message.msg_iovlen = count;
+
+    SDL_LockMutex(_lock);
+    written = (int)sendmsg(_socketHandle, &message, MSG_NOSIGNAL);
+    _lastSendError = (written < 0) ? LastSocketError() : 0;
+    SDL_UnlockMutex(_lock);
+#else
+    WSABUF buffers[MaxGatherSize];
+    DWORD bytesSent;
+
+    for(c = 0; c < count; c++) {
+        buffers[c].buf = (char*)data[c];
+        buffers[c].len = sizes[c];
+    }
+
+    SDL_LockMutex(_lock);
+    written = (WSASend(_socketHandle, buffers, count, &bytesSent, 0, 0, 0) == 0) ? (int)bytesSent : -1;
+    _lastSendError = (written < 0) ? LastSocketError() : 0;
+    SDL_UnlockMutex(_lock);
+#endif
+
+    if(written < 0 && !sendWouldBlock()) {
+        Error("Failed to write to socket");
+    }
+    return written;
+}
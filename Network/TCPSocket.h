@@ -5,6 +5,10 @@
 #include <Network/NetAddress.h>
 
 class TCPSocket: public Socket {
+public:
+    // The most buffers written by a single gathered send
+    static const unsigned int MaxGatherSize = 128;
+
 public:
     TCPSocket(bool blocking = false);
     TCPSocket(int establishedSocketHandle, bool blocking = false);
@@ -15,6 +19,10 @@ public:
 
     bool send(const char *data, unsigned int size);
     void recv(char *data, int &size, unsigned int maxSize);
+
+    // Write count separate buffers to the stream with as few syscalls as possible (one, where scatter/gather IO is available)
+    // The socket may take only part of the data; returns the number of bytes written, or -1 if nothing was (see sendWouldBlock)
+    int sendGather(const char **data, const unsigned int *sizes, unsigned int count);
 };
 
 #endif
@@ -0,0 +1,146 @@
+#include <Network/TimerWheel.h>
+#include <Base/Assertion.h>
+
+const unsigned int TimerWheel::SlotBits;
+const unsigned int TimerWheel::Slots;
+const unsigned int TimerWheel::Levels;
+const uint32_t TimerWheel::MaxDelay;
+const int TimerWheel::None;
+
+TimerWheel::TimerWheel(): _time(0), _scheduled(0), _freeTimers(None) {
+    unsigned int c;
+    for(c = 0; c < Slots * Levels; c++) {
+        _heads[c] = None;
+    }
+}
+
+TimerWheel::TimerID TimerWheel::create(uint32_t data) {
+    TimerID timer;
+
+    if(_freeTimers != None) {
+        timer = (TimerID)_freeTimers;
+        _freeTimers = _timers[timer].next;
+    } else {
+        timer = (TimerID)_timers.size();
+        _timers.push_back(Timer());
+    }
+
+    Timer &t = _timers[timer];
+    t.deadline = 0;
+    t.data = data;
+    t.prev = t.next = None;
+    t.slot = None;
+    return timer;
+}
+
+void TimerWheel::destroy(TimerID timer) {
+    ASSERT(timer < _timers.size());
+    cancel(timer);
+    _timers[timer].next = _freeTimers;
+    _freeTimers = (int)timer;
+}
+
+void TimerWheel::schedule(TimerID timer, uint32_t delay) {
+    ASSERT(timer < _timers.size());
+    cancel(timer);
+
+    _timers[timer].deadline = _time + std::min(std::max(delay, 1u), MaxDelay);
+    place(timer);
+    _scheduled++;
+}
+
+void TimerWheel::cancel(TimerID timer) {
+    ASSERT(timer < _timers.size());
+    if(_timers[timer].slot == None) { return; }
+
+    unlink(timer);
+    _scheduled--;
+}
+
+bool TimerWheel::isScheduled(TimerID timer) const {
+    ASSERT(timer < _timers.size());
+    return _timers[timer].slot != None;
+}
+
+void TimerWheel::advance(uint32_t ticks, std::vector<Expiry> &expired) {
+    unsigned int level;
+    int slot, timer;
+    Expiry expiry;
+
+    while(ticks > 0) {
+        // Nothing to step through, so the clock can just jump ahead
+        if(_scheduled == 0) {
+            _time += ticks;
+            return;
+        }
+
+        _time++;
+        ticks--;
+
+        // Each wheel's hand moves on a slot whenever the one below it comes full circle
+        for(level = 1; level < Levels && (_time & ((1u << (SlotBits * level)) - 1)) == 0; level++) {
+            cascade(level);
+        }
+
+        slot = _time & (Slots - 1);
+        while((timer = _heads[slot]) != None) {
+            ASSERT(_timers[timer].deadline == _time);
+            unlink(timer);
+            _scheduled--;
+
+            expiry.timer = timer;
+            expiry.data = _timers[timer].data;
+            expired.push_back(expiry);
+        }
+    }
+}
+
+uint32_t TimerWheel::getTime() const {
+    return _time;
+}
+
+unsigned int TimerWheel::size() const {
+    return _scheduled;
+}
+
+void TimerWheel::place(TimerID timer) {
+    Timer &t = _timers[timer];
+    uint32_t delay = t.deadline - _time;
+    unsigned int level = 0;
+
+    while(level < Levels - 1 && delay >= (1u << (SlotBits * (level + 1)))) {
+        level++;
+    }
+
+    t.slot = level * Slots + ((t.deadline >> (SlotBits * level)) & (Slots - 1));
+    t.prev = None;
+    t.next = _heads[t.slot];
+    if(t.next != None) { _timers[t.next].prev = timer; }
+    _heads[t.slot] = timer;
+}
+
+void TimerWheel::unlink(TimerID timer) {
+    Timer &t = _timers[timer];
+
+    if(t.prev != None) {
+        _timers[t.prev].next = t.next;
+    } else {
+        _heads[t.slot] = t.next;
+    }
+    if(t.next != None) { _timers[t.next].prev = t.prev; }
+
+    t.prev = t.next = None;
+    t.slot = None;
+}
+
+void TimerWheel::cascade(unsigned int level) {
+    int slot = level * Slots + ((_time >> (SlotBits * level)) & (Slots - 1));
+    int timer = _heads[slot], next;
+
+    _heads[slot] = None;
+    while(timer != None) {
+        next = _timers[timer].next;
+        place(timer);
+        timer = next;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <Base/Base.h>
+
+// Timers on a clock of whole ticks, moved forward by advance
+// Timers are kept in a hierarchy of wheels, each slot of a wheel covering as many ticks as the whole wheel below it; a timer sits in the lowest wheel its deadline reaches, and drops a wheel each time that wheel's hand comes around to it
+// Scheduling, cancelling and expiring a timer are all constant time, however many timers there are
+class TimerWheel {
+public:
+    typedef uint32_t TimerID;
+
+    static const unsigned int SlotBits = 6;
+    static const unsigned int Slots = 1 << SlotBits;
+    static const unsigned int Levels = 4;
+    // Deadlines further off than this are brought in to it
+    static const uint32_t MaxDelay = (1u << (SlotBits * Levels)) - 1;
+
+    struct Expiry {
+        TimerID timer;
+        uint32_t data;
+    };
+
+public:
+    TimerWheel();
+
+    // Timers are made idle; data is handed back when the timer expires
+    TimerID create(uint32_t data);
+    void destroy(TimerID timer);
+
+    // Set a timer to expire delay ticks from now, replacing any deadline it already had
+    // A delay of 0 expires on the next tick
+    void schedule(TimerID timer, uint32_t delay);
+    void cancel(TimerID timer);
+    bool isScheduled(TimerID timer) const;
+
+    // Move the clock forward, adding each timer that expires on the way to expired (which isn't cleared first)
+    // Expired timers are left idle
+    void advance(uint32_t ticks, std::vector<Expiry> &expired);
+
+    uint32_t getTime() const;
+    // Timers currently scheduled
+    unsigned int size() const;
+
+private:
+    static const int None = -1;
+
+    struct Timer {
+        uint32_t deadline;
+        uint32_t data;
+        // Neighbours within the slot's list, or within the free list
+        int prev, next;
+        // The slot the timer is waiting in, or None if it's idle
+        int slot;
+    };
+
+    // Put a scheduled timer in the slot its deadline belongs in
+    void place(TimerID timer);
+    void unlink(TimerID timer);
+    // Move every timer in a slot of the given level down to where it now belongs
+    void cascade(unsigned int level);
+
+private:
+    uint32_t _time;
+    unsigned int _scheduled;
+
+    std::vector<Timer> _timers;
+    int _freeTimers;
+    int _heads[Slots * Levels];
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include <Network/TokenBucket.h>
+
+unsigned int TokenBucket::DefaultBurstMilliseconds = 10;
+
+TokenBucket::TokenBucket(unsigned int bytesPerSecond, unsigned int burstBytes): _lock(0) {
+    _ticksPerSecond = (double)SDL_GetPerformanceFrequency();
+    setRate(bytesPerSecond, burstBytes);
+}
+
+void TokenBucket::setRate(unsigned int bytesPerSecond, unsigned int burstBytes) {
+    SDL_AtomicLock(&_lock);
+    _rate = bytesPerSecond;
+    if(burstBytes == 0) {
+        burstBytes = std::max((unsigned int)((uint64_t)bytesPerSecond * DefaultBurstMilliseconds / 1000), 1u);
+    }
+    _burst = burstBytes;
+    _tokens = _burst;
+    _lastRefill = SDL_GetPerformanceCounter();
+    SDL_AtomicUnlock(&_lock);
+}
+
+unsigned int TokenBucket::getRate() {
+    return _rate;
+}
+
+unsigned int TokenBucket::getBurst() {
+    return _burst;
+}
+
+bool TokenBucket::isLimited() {
+    return (_rate != 0);
+}
+
+bool TokenBucket::hasTokens() {
+    bool ret;
+
+    if(!isLimited()) { return true; }
+
+    SDL_AtomicLock(&_lock);
+    refill();
+    ret = (_tokens > 0);
+    SDL_AtomicUnlock(&_lock);
+    return ret;
+}
+
+void TokenBucket::consume(unsigned int bytes) {
+    if(!isLimited()) { return; }
+
+    SDL_AtomicLock(&_lock);
+    refill();
+    _tokens -= bytes;
+    SDL_AtomicUnlock(&_lock);
+}
+
+unsigned int TokenBucket::getDelay() {
+    unsigned int ret = 0;
+
+    if(!isLimited()) { return 0; }
+
+    SDL_AtomicLock(&_lock);
+    refill();
+    if(_tokens <= 0) {
+        // Round up, so waiting the full delay always leaves the bucket with something in it
+        ret = (unsigned int)((1.0 - _tokens) * 1000.0 / _rate) + 1;
+    }
+    SDL_AtomicUnlock(&_lock);
+    return ret;
+}
+
+void TokenBucket::refill() {
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    _tokens = std::min(_tokens + (double)(now - _lastRefill) * _rate / _ticksPerSecond, (double)_burst);
+    _lastRefill = now;
+}
@@ -0,0 +1,46 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <SDL2/SDL_atomic.h>
+
+#include <Base/Base.h>
+
+// Limits a byte rate: tokens accrue at the configured rate up to the burst size, and every byte sent spends one
+// Sends are allowed while any tokens remain, so a large packet can overdraw the bucket; the debt is paid back before the next one goes out
+// Safe to share between threads
+class TokenBucket {
+public:
+    // How much can go out at once after an idle period, when no burst size is given
+    static unsigned int DefaultBurstMilliseconds;
+
+public:
+    // A rate of 0 means unlimited
+    TokenBucket(unsigned int bytesPerSecond = 0, unsigned int burstBytes = 0);
+
+    // Starts the bucket off full
+    void setRate(unsigned int bytesPerSecond, unsigned int burstBytes = 0);
+    unsigned int getRate();
+    unsigned int getBurst();
+    bool isLimited();
+
+    // True if anything may be sent right now
+    bool hasTokens();
+    // Spend tokens on bytes that have just been sent
+    void consume(unsigned int bytes);
+    // Milliseconds until hasTokens becomes true, 0 if it already is
+    unsigned int getDelay();
+
+private:
+    // Must be called with _lock held
+    void refill();
+
+private:
+    SDL_SpinLock _lock;
+
+    unsigned int _rate, _burst;
+    double _tokens;
+    Uint64 _lastRefill;
+    double _ticksPerSecond;
+};
+
+#endif
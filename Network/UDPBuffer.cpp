@@ -1,7 +1,9 @@
 #include <Network/UDPBuffer.h>
 #include <Base/Log.h>
 
-UDPBuffer::UDPBuffer(unsigned short localPort) {
+UDPBuffer::UDPBuffer(unsigned short localPort, unsigned int maxBufferSize):
+    ConnectionBuffer(maxBufferSize), _sendBatchOffset(0), _sendBatchCount(0)
+{
     _socket = new UDPSocket();
     getSocket()->openSocket(localPort);
 }
@@ -10,72 +12,85 @@ UDPBuffer::~UDPBuffer() {
     if(_socket) { delete getSocket(); }
 }
 
-void UDPBuffer::doInboundBuffering() {
-    int size;
-    NetAddress addr;
+bool UDPBuffer::serviceInbound(unsigned int maxPackets) {
+    unsigned int total = 0, batchSize, truncated, c;
+    int received;
+    clock_t now;
 
-    Debug("Entering UDPBuffer inbound packet buffering loop");
-    while(true) {
-        SDL_LockMutex(_inboundLock);
-        if(_inboundShouldDie) {
-            SDL_UnlockMutex(_inboundLock);
-            break;
-        } else {
-            SDL_UnlockMutex(_inboundLock);
+    while(total < maxPackets) {
+        batchSize = std::min(maxPackets - total, UDPSocket::MaxBatchSize);
+
+        // Datagrams are received straight into pooled packet storage; fresh blocks are only needed once the last ones have been handed off
+        for(c = 0; c < batchSize; c++) {
+            if(!_recvBatch[c].data || _recvBatch[c].size <= _maxPacketSize) {
+                Packet fresh(NetAddress(), _maxPacketSize + 1);
+                _recvBatch[c].swap(fresh);
+            }
         }
 
-        SDL_LockMutex(_inboundQueueLock);
+        // Either nothing is waiting or an ICMP error was reported; neither closes a UDP socket
+        received = getSocket()->recvBatch(_recvBatch, batchSize, _maxPacketSize, truncated);
+        _counters.countRecvCall();
+        if(received < 0) { return true; }
 
-        // Get the next packet from the socket
-        getSocket()->recv(_packetBuffer, size, _maxBufferSize, addr);
+        // Anything cut short would only be thrown away as malformed further up
+        if(truncated > 0) { _counters.countDropped(DropMalformed, truncated); }
 
-        if(size > 0) {
-            // Update received stats
-            _receivedPackets++;
+        now = GetClock();
+        for(c = 0; (int)c < received; c++) {
+            _recvBatch[c].clockStamp = now;
 
             // Push the incoming packet onto the queue
-            _inbound.push(Packet(addr, _packetBuffer, size));
-            if(_inbound.size() > _maxBufferSize) {
-                _inbound.pop();
-                SDL_LockMutex(_outboundQueueLock);
-                _droppedPackets++;
-                SDL_UnlockMutex(_outboundQueueLock);
-            } else {
-                _inboundPackets++;
-            }
+            bufferInbound(_recvBatch[c]);
+            _recvBatch[c].release();
         }
-        SDL_UnlockMutex(_inboundQueueLock);
+
+        total += received + truncated;
+        if((unsigned int)received + truncated < batchSize) { break; }
     }
+
+    return true;
 }
 
-void UDPBuffer::doOutboundBuffering() {
-    bool ret;
-    Packet packet;
+bool UDPBuffer::serviceOutbound(unsigned int maxPackets) {
+    unsigned int total = 0, bytes;
+    int sent, c;
 
-    Debug("Entering UDP outbound packet buffering loop");
-    while(true) {       
-        SDL_LockMutex(_outboundLock);
-        if(_outboundShouldDie) {
-            SDL_UnlockMutex(_outboundLock);
-            break;
-        } else {
-            SDL_UnlockMutex(_outboundLock);
+    while(total < maxPackets) {
+        // Pull the next batch of outgoing packets off the queue
+        if(_sendBatchOffset == _sendBatchCount) {
+            _sendBatchOffset = 0;
+            _sendBatchCount = 0;
+            // Packets are only taken while the rate limits have room; the rest wait in the queue rather than in the kernel
+            while(_sendBatchCount < UDPSocket::MaxBatchSize && canSend() && nextOutbound(_sendBatch[_sendBatchCount])) {
+                chargeSent(_sendBatch[_sendBatchCount].size);
+                _sendBatchCount++;
+            }
+            if(_sendBatchCount == 0) { return !hasOutbound(); }
         }
 
-        SDL_LockMutex(_outboundQueueLock);
-        ret = _outbound.empty();
-        if(!ret) {
-            // Pop the next outgoing packet off the queue
-            packet = _outbound.front();
-            _outbound.pop();
-            _outboundPackets--;
+        // Send as much of the batch as the socket will take
+        sent = getSocket()->sendBatch(_sendBatch + _sendBatchOffset, _sendBatchCount - _sendBatchOffset);
+        _counters.countSendCall();
+        if(sent < 0) {
+            if(getSocket()->sendWouldBlock()) { return false; }
 
-            // TODO - This is where we'd sleep the thread when throttling bandwidth
+            // Drop the packet that failed and carry on with the rest
+            _counters.countDropped(DropSendFailed);
+            sent = 1;
+        } else {
+            for(bytes = 0, c = 0; c < sent; c++) {
+                bytes += _sendBatch[_sendBatchOffset + c].size;
+            }
+            _counters.countSent(sent, bytes);
+        }
 
-            // Send the next outgoing packet to the socket
-            getSocket()->send(packet.data, packet.size, packet.addr);
-            _sentPackets++;
+        for(c = 0; c < sent; c++) {
+            _sendBatch[_sendBatchOffset + c].release();
         }
-        SDL_UnlockMutex(_outboundQueueLock);
+        _sendBatchOffset += sent;
+        total += sent;
     }
+
+    return (_sendBatchOffset == _sendBatchCount && !hasOutbound());
 }
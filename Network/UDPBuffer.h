@@ -4,17 +4,26 @@
 #include <Network/ConnectionBuffer.h>
 #include <Network/UDPSocket.h>
 
+// Moves datagrams in batches of up to UDPSocket::MaxBatchSize per syscall
 class UDPBuffer: public ConnectionBuffer {
 public:
-    UDPBuffer(unsigned short localPort = 0);
+    UDPBuffer(unsigned short localPort = 0, unsigned int maxBufferSize = DefaultMaxBufferSize);
     virtual ~UDPBuffer();
 
-    void doInboundBuffering();
-    void doOutboundBuffering();
+    bool serviceInbound(unsigned int maxPackets);
+    bool serviceOutbound(unsigned int maxPackets);
 
-private:
+protected:
     // Make sure the Socket* is properly cast so the correct functions get called
     inline UDPSocket* getSocket() { return (UDPSocket*)_socket; }
+
+private:
+    // Pooled storage the next batch of datagrams will be received into
+    Packet _recvBatch[UDPSocket::MaxBatchSize];
+
+    // Packets pulled off the outbound ring that haven't made it to the socket yet
+    Packet _sendBatch[UDPSocket::MaxBatchSize];
+    unsigned int _sendBatchOffset, _sendBatchCount;
 };
 
 #endif
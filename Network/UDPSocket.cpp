@@ -2,7 +2,22 @@
 #include <Base/Assertion.h>
 #include <Base/Log.h>
 
-UDPSocket::UDPSocket(bool blocking): Socket(blocking) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+# include <netinet/udp.h>
+# include <sys/uio.h>
+// Older headers predate UDP generic segmentation offload
+# ifndef UDP_SEGMENT
+#  define UDP_SEGMENT 103
+# endif
+#endif
+
+const unsigned int UDPSocket::MaxBatchSize;
+
+// Limits imposed by the kernel on a single segmented send
+static const unsigned int MaxSegments = 64;
+static const unsigned int MaxSegmentedBytes = 65000;
+
+UDPSocket::UDPSocket(bool blocking): Socket(blocking), _segmentationEnabled(false) {
 }
 
 UDPSocket::~UDPSocket() {
@@ -12,6 +27,13 @@ bool UDPSocket::openSocket(unsigned short localPort) {
     if(!createSocket(SOCK_DGRAM, IPPROTO_UDP)) { return false; }
     if(!bindSocket(localPort)) { return false; }
 
+#if SYS_PLATFORM == PLATFORM_LINUX
+    // Probe for segmentation offload support; the query only succeeds on kernels that know about UDP_SEGMENT
+    int segmentSize;
+    socklen_t optionSize = sizeof(segmentSize);
+    _segmentationEnabled = (getsockopt(_socketHandle, IPPROTO_UDP, UDP_SEGMENT, &segmentSize, &optionSize) == 0);
+#endif
+
     return true;
 }
 
@@ -24,4 +46,170 @@ void UDPSocket::recv(char *data, int &size, unsigned int maxSize, NetAddress &ad
     int addrSize = sizeof(addrData);
     Socket::recv(data, size, maxSize, (sockaddr*)&addrData, addrSize);
     addr = NetAddress(&addrData);
-}
\ No newline at end of file
+}
+
+int UDPSocket::recvBatch(Packet *packets, unsigned int count, unsigned int maxSize, unsigned int &truncated) {
+    unsigned int c, kept;
+    int received;
+
+    ASSERT(isOpen());
+    truncated = 0;
+    if(count > MaxBatchSize) { count = MaxBatchSize; }
+
+#if SYS_PLATFORM == PLATFORM_LINUX
+    mmsghdr messages[MaxBatchSize];
+    iovec vectors[MaxBatchSize];
+    sockaddr_in addrs[MaxBatchSize];
+
+    for(c = 0; c < count; c++) {
+        vectors[c].iov_base = packets[c].data;
+        vectors[c].iov_len = maxSize;
+
+        memset(&messages[c], 0, sizeof(mmsghdr));
+        messages[c].msg_hdr.msg_name = &addrs[c];
+        messages[c].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        messages[c].msg_hdr.msg_iov = &vectors[c];
+        messages[c].msg_hdr.msg_iovlen = 1;
+    }
+
+    SDL_LockMutex(_lock);
+    received = recvmmsg(_socketHandle, messages, count, 0, 0);
+    _lastRecvError = (received < 0) ? LastSocketError() : 0;
+    SDL_UnlockMutex(_lock);
+
+    // Close up the gaps left by datagrams that didn't fit, swapping so every packet keeps its storage
+    kept = 0;
+    for(c = 0; (int)c < received; c++) {
+        if(messages[c].msg_hdr.msg_flags & MSG_TRUNC) {
+            truncated++;
+            continue;
+        }
+        if(kept != c) { packets[kept].swap(packets[c]); }
+        packets[kept].addr = NetAddress(&addrs[c]);
+        packets[kept].truncate(messages[c].msg_len);
+        kept++;
+    }
+    if(received > 0) { received = kept; }
+#else
+    kept = 0;
+    for(c = 0; c < count; c++) {
+        int size;
+        NetAddress addr;
+
+        // Ask for a byte more than fits, so a datagram that's too long shows up as one
+        recv(packets[kept].data, size, maxSize + 1, addr);
+        if(size < 0) { break; }
+        if((unsigned int)size > maxSize) {
+            truncated++;
+            continue;
+        }
+
+        packets[kept].addr = addr;
+        packets[kept].truncate(size);
+        kept++;
+    }
+    received = (kept + truncated > 0) ? kept : -1;
+#endif
+
+    return received;
+}
+
+int UDPSocket::sendBatch(const Packet *packets, unsigned int count) {
+    ASSERT(isOpen());
+    if(count > MaxBatchSize) { count = MaxBatchSize; }
+
+#if SYS_PLATFORM == PLATFORM_LINUX
+    mmsghdr messages[MaxBatchSize];
+    iovec vectors[MaxBatchSize];
+    unsigned int packetsInMessage[MaxBatchSize];
+    char control[MaxBatchSize][CMSG_SPACE(sizeof(uint16_t))];
+    unsigned int messageCount = 0, c = 0, run, runBytes;
+    int sent, packetsSent;
+
+    while(c < count) {
+        // Gather a run of packets that can share one segmented send: same destination, same size
+        // Only the last packet of a run may be shorter, since the kernel splits the payload at every segment boundary
+        run = 1;
+        runBytes = packets[c].size;
+        if(_segmentationEnabled && packets[c].size > 0) {
+            while((c + run) < count && run < MaxSegments &&
+                  packets[c + run].addr == packets[c].addr &&
+                  packets[c + run].size <= packets[c].size &&
+                  (runBytes + packets[c + run].size) <= MaxSegmentedBytes) {
+                runBytes += packets[c + run].size;
+                run++;
+                if(packets[c + run - 1].size < packets[c].size) { break; }
+            }
+        }
+
+        mmsghdr &message = messages[messageCount];
+        memset(&message, 0, sizeof(mmsghdr));
+        message.msg_hdr.msg_name = (void*)packets[c].addr.getSockAddr();
+        message.msg_hdr.msg_namelen = packets[c].addr.getSockAddrSize();
+        message.msg_hdr.msg_iov = &vectors[c];
+        message.msg_hdr.msg_iovlen = run;
+
+        for(unsigned int v = 0; v < run; v++) {
+            vectors[c + v].iov_base = packets[c + v].data;
+            vectors[c + v].iov_len = packets[c + v].size;
+        }
+
+        if(run > 1) {
+            message.msg_hdr.msg_control = control[messageCount];
+            message.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+            cmsghdr *header = CMSG_FIRSTHDR(&message.msg_hdr);
+            header->cmsg_level = IPPROTO_UDP;
+            header->cmsg_type = UDP_SEGMENT;
+            header->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t*)CMSG_DATA(header) = (uint16_t)packets[c].size;
+        }
+
+        packetsInMessage[messageCount] = run;
+        messageCount++;
+        c += run;
+    }
+
+    SDL_LockMutex(_lock);
+    sent = sendmmsg(_socketHandle, messages, messageCount, 0);
+    _lastSendError = (sent < 0) ? LastSocketError() : 0;
+    SDL_UnlockMutex(_lock);
+
+    if(sent < 0) {
+        if(_lastSendError == EIO || _lastSendError == EINVAL) {
+            // The device (or kernel) refused segmentation offload; stop using it
+            // Reporting the failure as a would-block makes the caller retry the same packets without it
+            if(_segmentationEnabled && messageCount < count) {
+                Warn("UDP segmentation offload rejected, falling back to unsegmented sends");
+                _segmentationEnabled = false;
+                _lastSendError = E_WOULD_BLOCK;
+            }
+        } else if(!sendWouldBlock()) {
+            Error("Failed to write batch to socket");
+        }
+        return -1;
+    }
+
+    packetsSent = 0;
+    for(c = 0; (int)c < sent; c++) {
+        packetsSent += packetsInMessage[c];
+    }
+    return packetsSent;
+#else
+    unsigned int c;
+    for(c = 0; c < count; c++) {
+        if(!send(packets[c].data, packets[c].size, packets[c].addr)) { break; }
+    }
+    return (c == 0) ? -1 : (int)c;
+#endif
+}
+
+bool UDPSocket::isSegmentationEnabled() const {
+    return _segmentationEnabled;
+}
+
+void UDPSocket::setSegmentationEnabled(bool enabled) {
+#if SYS_PLATFORM == PLATFORM_LINUX
+    _segmentationEnabled = enabled;
+#endif
+}
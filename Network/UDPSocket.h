@@ -3,9 +3,14 @@
 
 #include <Network/Socket.h>
 #include <Network/NetAddress.h>
+#include <Network/Packet.h>
 
 // IPv6 support is...well, nonexistent. YOU implement an IP-version agnostic socket. Go ahead. I'll wait.
 class UDPSocket: public Socket {
+public:
+    // The most datagrams moved by a single batched call
+    static const unsigned int MaxBatchSize = 64;
+
 public:
     UDPSocket(bool blocking = false);
     virtual ~UDPSocket();
@@ -15,8 +20,24 @@ public:
     bool send(const char *data, unsigned int size, const NetAddress &addr);
     void recv(char *data, int &size, unsigned int maxSize, NetAddress &addr);
 
+    // Receive up to count datagrams with as few syscalls as possible (one, on Linux)
+    // Each packet must already have room for maxSize + 1 bytes; received packets are addressed and truncated to fit
+    // The spare byte is how a datagram that's too long is told apart where the kernel doesn't flag it
+    // Datagrams longer than maxSize are discarded rather than returned cut short, and counted in truncated
+    // Returns the number of whole datagrams received, or -1 if none were taken off the socket at all (see recvWouldBlock)
+    int recvBatch(Packet *packets, unsigned int count, unsigned int maxSize, unsigned int &truncated);
+
+    // Send up to count datagrams with as few syscalls as possible (one, on Linux)
+    // Runs of equally-sized packets to the same address are handed to the kernel as a single segmented send where UDP GSO is available
+    // Returns the number of packets sent, or -1 if the first one failed (see sendWouldBlock)
+    int sendBatch(const Packet *packets, unsigned int count);
+
+    bool isSegmentationEnabled() const;
+    void setSegmentationEnabled(bool enabled);
+
 private:
     unsigned short _port;
+    bool _segmentationEnabled;
 };
 
 #endif
@@ -0,0 +1,421 @@
+#include <Network/ClientProvider.h>
+#include <Network/ServerProvider.h>
+#include <Network/SimpleUDPProvider.h>
+#include <Network/SocketedUDPProvider.h>
+#include <Network/GhastlyClient.h>
+#include <Network/GhastlyServer.h>
+#include <Network/ReplayProvider.h>
+#include <Base/Assertion.h>
+#include <Base/Log.h>
+
+// Drives a server with many simulated clients over loopback and reports how much got through and how long it took
+// Usage: NetworkBenchmark [udp|tcp|ghastly|all] [clients] [messages per second per client] [message size] [seconds] [capture file]
+//        NetworkBenchmark replay [capture file] [shards]
+// Given a capture file, the Ghastly benchmark records the server's traffic to it; replay plays a capture back into a server as fast as it will go, to measure the server's processing cost alone
+// Replaying into a server with several shards shows how that cost spreads over more cores
+
+struct BenchmarkOptions {
+    std::string transport;
+    unsigned int clients;
+    unsigned int rate;
+    unsigned int size;
+    unsigned int seconds;
+    std::string capture;
+    unsigned int shards;
+
+    BenchmarkOptions(): transport("all"), clients(100), rate(20), size(64), seconds(5), shards(DEFAULT_SHARDS) {}
+};
+
+struct BenchmarkResults {
+    uint64_t sent, received, sendFailures, bytes;
+    double seconds;
+    // One-way latencies, in microseconds
+    std::vector<uint32_t> latencies;
+
+    BenchmarkResults(): sent(0), received(0), sendFailures(0), bytes(0), seconds(0) {}
+
+    void report(const std::string &name);
+};
+
+// Load messages start with this; the rest is padding up to the message size
+struct LoadHeader {
+    uint32_t client;
+    uint32_t sequence;
+    uint64_t sentTime;
+};
+
+// Marks the messages sent to get every client connected before the clock starts
+static const uint32_t WarmupSequence = 0xFFFFFFFF;
+
+// How long to keep receiving once the clients stop sending, so that whatever's still in flight isn't counted as lost
+static const unsigned int DrainMilliseconds = 1000;
+
+static uint32_t Percentile(const std::vector<uint32_t> &sorted, double fraction) {
+    if(sorted.empty()) { return 0; }
+    return sorted[std::min((size_t)(fraction * sorted.size()), sorted.size() - 1)];
+}
+
+void BenchmarkResults::report(const std::string &name) {
+    std::sort(latencies.begin(), latencies.end());
+
+    double duration = std::max(seconds, 0.001);
+    uint64_t dropped = (sent > received) ? sent - received : 0;
+
+    Log::EnableChannel(LOG_INFO);
+    Info(name << ": " << sent << " sent, " << received << " received, " << dropped << " dropped (" <<
+         (sent ? 100.0 * dropped / sent : 0.0) << "%), " << sendFailures << " refused by the provider");
+    Info(name << ": " << (uint64_t)(received / duration) << " packets/sec, " << (uint64_t)(bytes / duration) << " bytes/sec over " << seconds << " seconds");
+    Info(name << ": one-way latency p50 " << Percentile(latencies, 0.5) / 1000.0 << "ms, p99 " << Percentile(latencies, 0.99) / 1000.0 <<
+         "ms, p999 " << Percentile(latencies, 0.999) / 1000.0 << "ms, max " << (latencies.empty() ? 0 : latencies.back()) / 1000.0 << "ms");
+}
+
+// What the server's provider counted, for comparison with what the benchmark saw
+static void reportProviderMetrics(const std::string &name, ConnectionProvider &provider, const NetworkMetrics &before) {
+    NetworkMetrics metrics;
+    provider.getMetrics(metrics);
+    metrics = metrics.since(before);
+
+    Info(name << ": server received " << metrics.packetsReceived << " packets in " << metrics.recvCalls << " receive calls, sent " <<
+         metrics.packetsSent << " in " << metrics.sendCalls << " send calls; " << metrics.getDropped() << " dropped, deepest inbound queue " << metrics.inboundHighWater);
+}
+
+// Take everything the server has received, noting which clients have finished warming up
+static void drainServer(ConnectionProvider *server, BenchmarkResults &results, std::vector<bool> *warmedUp) {
+    LoadHeader header;
+    Packet packet;
+    uint64_t now;
+
+    while(server->recvPacket(packet)) {
+        if(packet.size < sizeof(header)) { continue; }
+        memcpy(&header, packet.data, sizeof(header));
+
+        if(header.sequence == WarmupSequence) {
+            if(warmedUp && header.client < warmedUp->size()) { (*warmedUp)[header.client] = true; }
+            continue;
+        }
+
+        now = GetMicroseconds();
+        results.received++;
+        results.bytes += packet.size;
+        results.latencies.push_back((uint32_t)std::min(now - header.sentTime, (uint64_t)0xFFFFFFFF));
+    }
+}
+
+// Every client sends to the server at a steady rate; the server only receives
+static void runProviderBenchmark(ConnectionProvider *server, const std::vector<ConnectionProvider*> &clients, const NetAddress &serverAddr,
+                                 const BenchmarkOptions &options, BenchmarkResults &results) {
+    std::vector<char> message(options.size, 0);
+    std::vector<uint32_t> sequences(clients.size(), 0);
+    std::vector<bool> warmedUp(clients.size(), false);
+    unsigned int c, heard;
+    uint64_t start, now, due;
+    LoadHeader header;
+
+    // Connections (and the server's per-client state) are set up before anything is timed
+    for(c = 0; c < clients.size(); c++) {
+        header.client = c;
+        header.sequence = WarmupSequence;
+        header.sentTime = GetMicroseconds();
+        memcpy(&message[0], &header, sizeof(header));
+        clients[c]->sendPacket(Packet(serverAddr, &message[0], options.size));
+    }
+    start = GetMicroseconds();
+    do {
+        SDL_Delay(10);
+        drainServer(server, results, &warmedUp);
+        heard = (unsigned int)std::count(warmedUp.begin(), warmedUp.end(), true);
+    } while(heard < clients.size() && GetMicroseconds() - start < 10000000);
+    if(heard < clients.size()) {
+        Warn("Only " << heard << " of " << clients.size() << " clients were heard from before the benchmark started");
+    }
+
+    start = GetMicroseconds();
+    while((now = GetMicroseconds()) - start < options.seconds * 1000000ull) {
+        // Catch every client up to where its rate says it should be, however long the last pass took
+        due = (now - start) * options.rate / 1000000;
+        for(c = 0; c < clients.size(); c++) {
+            while(sequences[c] < due) {
+                header.client = c;
+                header.sequence = sequences[c]++;
+                header.sentTime = GetMicroseconds();
+                memcpy(&message[0], &header, sizeof(header));
+
+                results.sent++;
+                if(!clients[c]->sendPacket(Packet(serverAddr, &message[0], options.size))) {
+                    results.sendFailures++;
+                }
+            }
+        }
+
+        drainServer(server, results, 0);
+        SDL_Delay(1);
+    }
+    results.seconds = (GetMicroseconds() - start) / 1000000.0;
+
+    start = GetMicroseconds();
+    while(results.received < results.sent && GetMicroseconds() - start < DrainMilliseconds * 1000ull) {
+        drainServer(server, results, 0);
+        SDL_Delay(1);
+    }
+}
+
+void benchmarkUDP(const BenchmarkOptions &options) {
+    Info("Benchmarking UDP: " << options.clients << " clients sending " << options.rate << " messages of " << options.size << " bytes per second");
+    Log::DisableChannel(LOG_INFO);
+
+    SocketedUDPProvider server(0, options.clients);
+    std::vector<SimpleUDPProvider*> providers;
+    std::vector<ConnectionProvider*> clients;
+    BenchmarkResults results;
+    unsigned int c;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    for(c = 0; c < options.clients; c++) {
+        providers.push_back(new SimpleUDPProvider());
+        clients.push_back(providers.back());
+    }
+
+    NetworkMetrics before;
+    server.getMetrics(before);
+    runProviderBenchmark(&server, clients, serverAddr, options, results);
+    results.report("UDP");
+    reportProviderMetrics("UDP", server, before);
+
+    for(c = 0; c < providers.size(); c++) {
+        delete providers[c];
+    }
+}
+
+void benchmarkTCP(const BenchmarkOptions &options) {
+    Info("Benchmarking TCP: " << options.clients << " clients sending " << options.rate << " messages of " << options.size << " bytes per second");
+    Log::DisableChannel(LOG_INFO);
+
+    ServerProvider server;
+    std::vector<ClientProvider*> providers;
+    std::vector<ConnectionProvider*> clients;
+    BenchmarkResults results;
+    unsigned int c;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    for(c = 0; c < options.clients; c++) {
+        providers.push_back(new ClientProvider());
+        clients.push_back(providers.back());
+    }
+
+    NetworkMetrics before;
+    server.getMetrics(before);
+    runProviderBenchmark(&server, clients, serverAddr, options, results);
+    results.report("TCP");
+    reportProviderMetrics("TCP", server, before);
+
+    for(c = 0; c < providers.size(); c++) {
+        delete providers[c];
+    }
+}
+
+// Counts what the server puts on the wire
+class BenchmarkServer: public GhastlyServer {
+public:
+    BenchmarkServer(unsigned int maxClients, unsigned int shards = DEFAULT_SHARDS): GhastlyServer(maxClients, shards), sent(0), sentBytes(0) {}
+
+    bool sendPacket(const Packet &packet) {
+        sent++;
+        sentBytes += packet.size;
+        return GhastlyServer::sendPacket(packet);
+    }
+
+    uint64_t sent, sentBytes;
+};
+
+// Counts what makes it to the client
+class BenchmarkClient: public GhastlyClient {
+public:
+    BenchmarkClient(): received(0), receivedBytes(0), latestSnapshot(0) {}
+
+    bool recvPacket(Packet &packet) {
+        if(!GhastlyClient::recvPacket(packet)) { return false; }
+        received++;
+        receivedBytes += packet.size;
+        return true;
+    }
+
+    uint64_t received, receivedBytes;
+    SnapshotSequence latestSnapshot;
+};
+
+// The server replicates a world with an entity per client, snapshotting it at the message rate
+// Every entity changes every snapshot; a clock entity carries the time each snapshot was taken, so clients can measure how long it took to reach them
+void benchmarkGhastly(const BenchmarkOptions &options) {
+    static const EntityID ClockEntity = 0;
+
+    Info("Benchmarking Ghastly: " << options.clients << " clients receiving " << options.rate << " snapshots per second of " <<
+         options.clients << " entities of " << options.size << " bytes");
+    Log::DisableChannel(LOG_INFO);
+
+    BenchmarkServer server(options.clients);
+    std::vector<BenchmarkClient*> clients;
+    std::vector<char> state(std::min(std::max(options.size, 4u), GhastlySnapshot::MaxStateSize), 0);
+    BenchmarkResults results;
+    const GhastlySnapshot *snapshot;
+    const char *clockState;
+    unsigned int c, ready, size;
+    uint64_t start, now, last, nextSnapshot, sentTime, sent = 0, sentBytes = 0;
+    uint32_t tick = 0;
+
+    PacketCaptureWriter capture;
+    if(!options.capture.empty() && capture.open(options.capture)) {
+        server.setCapture(&capture);
+    }
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    for(c = 0; c < options.clients; c++) {
+        clients.push_back(new BenchmarkClient());
+        clients[c]->connect(serverAddr);
+    }
+
+    // Wait for every client to be assigned an ID
+    start = last = GetMicroseconds();
+    do {
+        SDL_Delay(10);
+        now = GetMicroseconds();
+        server.update((int)((now - last) / 1000));
+        for(ready = 0, c = 0; c < clients.size(); c++) {
+            clients[c]->update((int)((now - last) / 1000));
+            if(clients[c]->getState() == GhastlyClient::READY) { ready++; }
+        }
+        last = now;
+    } while(ready < clients.size() && now - start < 10000000);
+    if(ready < clients.size()) {
+        Warn("Only " << ready << " of " << clients.size() << " clients connected before the benchmark started");
+    }
+
+    GhastlySnapshot &world = server.getWorldSnapshot();
+    start = last = nextSnapshot = GetMicroseconds();
+    sent = server.sent;
+    sentBytes = server.sentBytes;
+    for(c = 0; c < clients.size(); c++) {
+        clients[c]->received = clients[c]->receivedBytes = 0;
+    }
+
+    while((now = GetMicroseconds()) - start < options.seconds * 1000000ull) {
+        server.update((int)((now - last) / 1000));
+
+        if(now >= nextSnapshot) {
+            tick++;
+            for(c = 0; c < clients.size(); c++) {
+                memcpy(&state[0], &tick, sizeof(tick));
+                world.setEntity(c + 1, &state[0], state.size());
+            }
+            world.setEntity(ClockEntity, (const char*)&now, sizeof(now));
+            server.sendSnapshots();
+            nextSnapshot += 1000000 / std::max(options.rate, 1u);
+        }
+
+        for(c = 0; c < clients.size(); c++) {
+            clients[c]->update((int)((now - last) / 1000));
+
+            snapshot = clients[c]->getSnapshot();
+            if(!snapshot || snapshot->getSequence() == clients[c]->latestSnapshot) { continue; }
+            clients[c]->latestSnapshot = snapshot->getSequence();
+
+            clockState = snapshot->getEntity(ClockEntity, size);
+            if(clockState && size == sizeof(sentTime)) {
+                memcpy(&sentTime, clockState, sizeof(sentTime));
+                results.latencies.push_back((uint32_t)std::min(GetMicroseconds() - sentTime, (uint64_t)0xFFFFFFFF));
+            }
+        }
+
+        last = now;
+        SDL_Delay(1);
+    }
+    results.seconds = (GetMicroseconds() - start) / 1000000.0;
+
+    // Give the last snapshots time to land, without sending any more
+    start = GetMicroseconds();
+    while(GetMicroseconds() - start < DrainMilliseconds * 1000ull) {
+        for(c = 0; c < clients.size(); c++) {
+            clients[c]->update(1);
+        }
+        SDL_Delay(1);
+    }
+
+    // Counted a packet at a time, since that's what can be lost
+    results.sent = server.sent - sent;
+    for(c = 0; c < clients.size(); c++) {
+        results.received += clients[c]->received;
+        results.bytes += clients[c]->receivedBytes;
+    }
+    results.report("Ghastly");
+    Info("Ghastly: " << (server.sentBytes - sentBytes) / std::max((uint64_t)1, server.sent - sent) << " bytes per packet on average");
+
+    for(c = 0; c < clients.size(); c++) {
+        delete clients[c];
+    }
+
+    if(capture.isOpen()) {
+        server.setCapture(0);
+        Info("Ghastly: recorded " << capture.getRecordCount() << " packets to " << options.capture);
+    }
+}
+
+// Only the server's handling of what it received is measured; nothing is snapshotted, since the world isn't part of the capture
+void benchmarkReplay(const BenchmarkOptions &options) {
+    Info("Replaying " << options.capture << " into a Ghastly server with " << options.shards << " shard(s)");
+    Log::DisableChannel(LOG_INFO);
+
+    BenchmarkServer server(std::max(options.clients, (unsigned int)DEFAULT_MAX_CLIENTS), options.shards);
+    ReplayProvider replay;
+    NetworkMetrics metrics;
+    uint64_t start, captureTime = 0;
+    unsigned int updates = 0;
+    double seconds;
+
+    if(!replay.open(options.capture)) { return; }
+    server.setTransport(&replay);
+
+    // Stepping through the capture a tick at a time means each update gets the packets, and the time, that it would have when it was recorded
+    start = GetMicroseconds();
+    while(!replay.isFinished()) {
+        captureTime += 1000000 / DEFAULT_TICK_RATE;
+        replay.stepTo(captureTime);
+        server.update(1000 / DEFAULT_TICK_RATE);
+        updates++;
+    }
+    seconds = std::max((GetMicroseconds() - start) / 1000000.0, 0.000001);
+
+    replay.getMetrics(metrics);
+    Log::EnableChannel(LOG_INFO);
+    Info("Replay: " << metrics.packetsReceived << " packets (" << metrics.bytesReceived << " bytes) covering " << replay.getCaptureTime() / 1000000.0 <<
+         "s of capture in " << seconds << "s over " << updates << " updates");
+    Info("Replay: " << (uint64_t)(metrics.packetsReceived / seconds) << " packets/s, " << seconds * 1000000.0 / std::max(metrics.packetsReceived, 1u) <<
+         "us per packet, " << metrics.packetsSent << " packets sent in response");
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+
+    if(argc > 1) { options.transport = argv[1]; }
+    if(options.transport == "replay") {
+        options.capture = (argc > 2) ? argv[2] : "NetworkBenchmark.gcap";
+        if(argc > 3) { options.shards = std::max(atoi(argv[3]), 1); }
+    } else {
+        if(argc > 2) { options.clients = std::max(atoi(argv[2]), 1); }
+        if(argc > 3) { options.rate = std::max(atoi(argv[3]), 1); }
+        if(argc > 4) { options.size = std::max(atoi(argv[4]), (int)sizeof(LoadHeader)); }
+        if(argc > 5) { options.seconds = std::max(atoi(argv[5]), 1); }
+        if(argc > 6) { options.capture = argv[6]; }
+    }
+
+    Log::Setup();
+    Log::DisableChannel(LOG_DEBUG);
+    Socket::InitializeSocketLayer();
+
+    if(options.transport == "udp" || options.transport == "all") { benchmarkUDP(options); }
+    if(options.transport == "tcp" || options.transport == "all") { benchmarkTCP(options); }
+    if(options.transport == "ghastly" || options.transport == "all") { benchmarkGhastly(options); }
+    if(options.transport == "replay") { benchmarkReplay(options); }
+
+    Socket::ShutdownSocketLayer();
+    Log::Teardown();
+    return 0;
+}
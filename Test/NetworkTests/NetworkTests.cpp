@@ -4,10 +4,15 @@
 #include <Network/ClientProvider.h>
 #include <Network/ServerProvider.h>
 #include <Network/SimpleUDPProvider.h>
+#include <Network/SocketedUDPProvider.h>
 #include <Network/GhastlyClient.h>
 #include <Network/GhastlyServer.h>
+#include <Network/PacketRing.h>
+#include <Network/NetworkReactor.h>
+#include <Network/ReplayProvider.h>
 #include <Base/Assertion.h>
 #include <Base/Log.h>
+#include <limits>
 
 class SimpleConnectionListener: public SocketCreationListener {
 public:
@@ -36,6 +41,33 @@ private:
     bool _cleanup;
 };
 
+// Keeps every connection it's given; called from whichever acceptor took the connection
+class CollectingConnectionListener: public SocketCreationListener {
+public:
+    ~CollectingConnectionListener() {
+        unsigned int c;
+        for(c = 0; c < sockets.size(); c++) {
+            delete sockets[c];
+        }
+    }
+
+    bool onSocketCreation(const NetAddress &client, TCPSocket *newSocket) {
+        sockets.push_back(newSocket);
+        return true;
+    }
+
+    std::vector<TCPSocket*> sockets;
+};
+
+// Holds on to whatever is sent through it, so a test can decide what actually gets delivered
+class CapturingProvider: public ConnectionProvider {
+public:
+    bool sendPacket(const Packet &packet) { packets.push_back(packet); return true; }
+    bool recvPacket(Packet &packet) { return false; }
+
+    std::vector<Packet> packets;
+};
+
 void testUDP(bool blocking) {
     unsigned short portA, portB;
     UDPSocket *socketA, *socketB;
@@ -96,6 +128,70 @@ void testUDP(bool blocking) {
     delete socketB;
 }
 
+void testUDPBatching(bool segmented) {
+    const unsigned int batchSize = 32, packetSize = 100, maxSize = 1024;
+    unsigned int c, received, truncated;
+    int ret;
+
+    Info("Running UDP batching tests (segmentation " << (segmented ? "on" : "off") << ")");
+
+    UDPSocket *socketA = new UDPSocket(), *socketB = new UDPSocket();
+    ASSERT(socketA->openSocket() && socketB->openSocket());
+    socketA->setSegmentationEnabled(segmented && socketA->isSegmentationEnabled());
+
+    NetAddress addrA("127.0.0.1", socketA->getLocalPort()),
+               addrB("127.0.0.1", socketB->getLocalPort());
+
+    // A run of equally sized packets followed by a short one, which can all go out as one segmented send
+    Packet outgoing[batchSize];
+    char data[packetSize];
+    for(c=0; c<batchSize; c++) {
+        memset(data, 'a' + (c % 26), packetSize);
+        outgoing[c] = Packet(addrB, data, (c == batchSize - 1) ? packetSize / 2 : packetSize);
+    }
+    ret = socketA->sendBatch(outgoing, batchSize);
+    ASSERT(ret == (int)batchSize);
+
+    sleep(1);
+
+    Packet incoming[batchSize];
+    received = 0;
+    while(received < batchSize) {
+        for(c=0; c<batchSize; c++) {
+            incoming[c] = Packet(NetAddress(), maxSize + 1);
+        }
+        ret = socketB->recvBatch(incoming, batchSize - received, maxSize, truncated);
+        ASSERT(ret > 0 && truncated == 0);
+
+        for(c=0; (int)c<ret; c++) {
+            ASSERT(incoming[c].addr == addrA);
+            ASSERT(incoming[c].size == outgoing[received].size);
+            ASSERT(memcmp(incoming[c].data, outgoing[received].data, incoming[c].size) == 0);
+            received++;
+        }
+    }
+
+    // Nothing else should be waiting
+    Packet extra(NetAddress(), maxSize + 1);
+    ASSERT(socketB->recvBatch(&extra, 1, maxSize, truncated) == -1);
+    ASSERT(socketB->recvWouldBlock());
+
+    // A datagram too long for the packets is thrown away whole, rather than handed back cut short
+    std::vector<char> oversized(maxSize + 100, 'z');
+    ASSERT(socketA->send(&oversized[0], oversized.size(), addrB));
+    ASSERT(socketA->send(data, packetSize, addrB));
+    sleep(1);
+    for(c=0; c<2; c++) {
+        incoming[c] = Packet(NetAddress(), maxSize + 1);
+    }
+    ret = socketB->recvBatch(incoming, 2, maxSize, truncated);
+    ASSERT(ret == 1 && truncated == 1);
+    ASSERT(incoming[0].size == packetSize && memcmp(incoming[0].data, data, packetSize) == 0);
+
+    delete socketA;
+    delete socketB;
+}
+
 void testTCP(bool blocking) {
     TCPSocket *clientSocket;
     ListenSocket *listenSocket;
@@ -158,6 +254,51 @@ void testTCP(bool blocking) {
     delete listenSocket;
 }
 
+void testListenAdmission(unsigned int acceptors, unsigned int maxClients, unsigned int extraClients) {
+    std::vector<TCPSocket*> clients;
+    unsigned int c;
+
+    Info("Running ListenSocket admission tests with " << acceptors << " acceptors");
+
+    CollectingConnectionListener connectionListener;
+    ListenSocket *listenSocket = new ListenSocket(&connectionListener, acceptors);
+    listenSocket->setBacklog(maxClients + extraClients);
+    listenSocket->setMaxClients(maxClients);
+    ASSERT(listenSocket->startListening());
+#if SYS_PLATFORM == PLATFORM_LINUX
+    ASSERT(listenSocket->getAcceptorCount() == acceptors);
+#endif
+
+    NetAddress serverAddr("127.0.0.1", listenSocket->getLocalPort());
+
+    // Everything past the limit is accepted and closed straight away
+    for(c = 0; c < maxClients + extraClients; c++) {
+        TCPSocket *client = new TCPSocket(true);
+        ASSERT(client->connectSocket(serverAddr));
+        clients.push_back(client);
+    }
+    sleep(1);
+    ASSERT(connectionListener.sockets.size() == maxClients);
+    ASSERT(listenSocket->getActiveClients() == maxClients);
+    ASSERT(listenSocket->getRefusedClients() == extraClients);
+
+    // Freeing a slot makes room for one more
+    listenSocket->releaseClient();
+    TCPSocket *late = new TCPSocket(true);
+    ASSERT(late->connectSocket(serverAddr));
+    clients.push_back(late);
+    sleep(1);
+    ASSERT(connectionListener.sockets.size() == maxClients + 1);
+    ASSERT(listenSocket->getActiveClients() == maxClients);
+    ASSERT(listenSocket->getRefusedClients() == extraClients);
+
+    // Stops within a poll timeout even with nothing left to accept
+    delete listenSocket;
+    for(c = 0; c < clients.size(); c++) {
+        delete clients[c];
+    }
+}
+
 void testTCPBuffer(unsigned int maxPackets) {
     ListenSocket *listenSocket;
     TCPBuffer *clientBuffer, *serverBuffer;
@@ -287,6 +428,87 @@ void testTCPBuffer(unsigned int maxPackets) {
     delete listenSocket;
 }
 
+void testTCPStreaming(unsigned int numFrames) {
+    ListenSocket *listenSocket;
+    TCPSocket *rawSocket;
+    TCPBuffer *buffer;
+    std::string stream;
+    char dataBuffer[64];
+    unsigned int c, size, offset, chunk;
+    uint32_t frameSize;
+    int received;
+
+    Info("Running TCP streaming tests");
+
+    SimpleConnectionListener connectionListener(false);
+    listenSocket = new ListenSocket(&connectionListener);
+    listenSocket->startListening();
+
+    NetAddress serverAddr("127.0.0.1", listenSocket->getLocalPort());
+    rawSocket = new TCPSocket(true);
+    ASSERT(rawSocket->connectSocket(serverAddr));
+    sleep(1);
+    ASSERT(connectionListener.socket);
+
+    buffer = new TCPBuffer(connectionListener.addr, connectionListener.socket);
+    buffer->startBuffering();
+
+    // Build the frames by hand, then write them in chunks that split headers and payloads at arbitrary points
+    for(c = 0; c < numFrames; c++) {
+        size = sprintf_s(dataBuffer, 64, "%u", c);
+        frameSize = size + sizeof(uint32_t);
+        stream.append((const char*)&frameSize, sizeof(uint32_t));
+        stream.append(dataBuffer, size);
+    }
+    for(offset = 0; offset < stream.size(); offset += chunk) {
+        chunk = std::min((unsigned int)(rand() % 7 + 1), (unsigned int)stream.size() - offset);
+        ASSERT(rawSocket->send(stream.data() + offset, chunk));
+        if(rand() % 50 == 0) { SDL_Delay(1); }
+    }
+    sleep(1);
+
+    for(c = 0; c < numFrames; c++) {
+        Packet packet;
+        size = sprintf_s(dataBuffer, 64, "%u", c);
+        ASSERT(buffer->consumePacket(packet));
+        ASSERT(size == packet.size);
+        ASSERT(strncmp(dataBuffer, packet.data, size) == 0);
+    }
+
+    // A burst of small packets should come out as one intact, correctly framed stream
+    for(c = 0; c < numFrames; c++) {
+        size = sprintf_s(dataBuffer, 64, "%u", c);
+        ASSERT(buffer->providePacket(Packet(connectionListener.addr, dataBuffer, size)));
+    }
+    sleep(1);
+
+    stream.clear();
+    char *recvBuffer = (char*)calloc(65536, sizeof(char));
+    rawSocket->setBlockingFlag(false);
+    while(true) {
+        rawSocket->recv(recvBuffer, received, 65536);
+        if(received <= 0) { break; }
+        stream.append(recvBuffer, received);
+    }
+    free(recvBuffer);
+
+    offset = 0;
+    for(c = 0; c < numFrames; c++) {
+        size = sprintf_s(dataBuffer, 64, "%u", c);
+        ASSERT(offset + sizeof(uint32_t) <= stream.size());
+        memcpy(&frameSize, stream.data() + offset, sizeof(uint32_t));
+        ASSERT(frameSize == size + sizeof(uint32_t));
+        ASSERT(strncmp(dataBuffer, stream.data() + offset + sizeof(uint32_t), size) == 0);
+        offset += frameSize;
+    }
+    ASSERT(offset == stream.size());
+
+    buffer->stopBuffering();
+    delete buffer;
+    delete rawSocket;
+    delete listenSocket;
+}
+
 void testPacketBuffering(unsigned int maxPackets) {
     std::queue<Packet> buffer;
     unsigned int c, size, bufferSize;
@@ -316,6 +538,113 @@ void testPacketBuffering(unsigned int maxPackets) {
     free(dataBuffer);
 }
 
+struct PacketRingProducerParams {
+    PacketRing *ring;
+    unsigned int count;
+};
+
+int PacketRingProducer(void *params) {
+    PacketRingProducerParams *p = (PacketRingProducerParams*)params;
+    char dataBuffer[32];
+    unsigned int c, size;
+
+    for(c=0; c<p->count; c++) {
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        Packet packet(NetAddress("127.0.0.1", c), dataBuffer, size);
+        while(!p->ring->push(packet)) {}
+    }
+    return 1;
+}
+
+void testPacketPool() {
+    Info("Running packet pool tests");
+
+    PacketPool::Reserve(4);
+    unsigned int freeBlocks = PacketPool::GetFreeBlocks();
+
+    // Tiny payloads never touch the pool
+    const char *tiny = "tiny";
+    Packet small(NetAddress("127.0.0.1", 1), tiny, (unsigned int)strlen(tiny));
+    ASSERT(PacketPool::GetFreeBlocks() == freeBlocks);
+
+    // Larger payloads take one block, which is shared rather than duplicated by copies
+    char payload[512];
+    memset(payload, 'x', 512);
+    {
+        Packet large(NetAddress("127.0.0.1", 2), payload, 512);
+        ASSERT(PacketPool::GetFreeBlocks() == freeBlocks - 1);
+
+        Packet copy(large), assigned;
+        assigned = copy;
+        ASSERT(copy.data == large.data && assigned.data == large.data);
+        ASSERT(PacketPool::GetFreeBlocks() == freeBlocks - 1);
+
+        // Swapping a pooled packet with an inline one has to carry the inline bytes along
+        Packet inlineCopy(small);
+        copy.swap(inlineCopy);
+        ASSERT(copy.size == small.size && strncmp(copy.data, tiny, copy.size) == 0);
+        ASSERT(inlineCopy.data == large.data && inlineCopy.size == 512);
+        ASSERT(copy.data != small.data);
+    }
+    ASSERT(PacketPool::GetFreeBlocks() == freeBlocks);
+
+    // Packets bigger than a pool block still work
+    char *huge = (char*)calloc(PacketPool::BlockSize * 2, sizeof(char));
+    {
+        Packet big(NetAddress("127.0.0.1", 3), huge, PacketPool::BlockSize * 2);
+        Packet bigCopy = big;
+        ASSERT(bigCopy.data == big.data);
+    }
+    ASSERT(PacketPool::GetFreeBlocks() == freeBlocks);
+    free(huge);
+}
+
+void testPacketRing(unsigned int maxPackets) {
+    unsigned int c, size = 0;
+    char dataBuffer[32];
+    Packet packet;
+
+    Info("Running packet ring tests");
+
+    PacketRing ring(maxPackets);
+    ASSERT(ring.empty());
+    ASSERT(!ring.pop(packet));
+
+    // Fill the ring to capacity; anything beyond that is refused
+    for(c=0; c<maxPackets; c++) {
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        ASSERT(ring.push(Packet(NetAddress("127.0.0.1", c), dataBuffer, size)));
+    }
+    ASSERT(ring.size() == maxPackets);
+    ASSERT(!ring.push(Packet(NetAddress("127.0.0.1", c), dataBuffer, size)));
+
+    for(c=0; c<maxPackets; c++) {
+        ASSERT(ring.pop(packet));
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        ASSERT(size == packet.size);
+        ASSERT(strncmp(packet.data, dataBuffer, size) == 0);
+    }
+    ASSERT(ring.empty());
+
+    // Stream packets through the ring from a second thread and make sure they arrive intact and in order
+    PacketRingProducerParams params;
+    params.ring = &ring;
+    params.count = maxPackets * 64;
+    SDL_Thread *producer = SDL_CreateThread(PacketRingProducer, "PacketRingProducer", (void*)&params);
+
+    for(c=0; c<params.count; c++) {
+        while(!ring.pop(packet)) {}
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        ASSERT(size == packet.size);
+        ASSERT(strncmp(packet.data, dataBuffer, size) == 0);
+        ASSERT(packet.addr == NetAddress("127.0.0.1", c));
+    }
+
+    int status;
+    SDL_WaitThread(producer, &status);
+    ASSERT(ring.empty());
+}
+
 void testUDPBuffer(unsigned int maxPackets) {
     UDPBuffer *server, *client;
     unsigned short serverPort;
@@ -387,6 +716,135 @@ void testUDPBuffer(unsigned int maxPackets) {
     delete server;
 }
 
+void testNetworkReactor(unsigned int maxPackets) {
+    unsigned int c, size;
+    char dataBuffer[32];
+
+    if(!NetworkReactor::IsSupported()) { return; }
+
+    Info("Running NetworkReactor tests");
+
+    NetworkReactor reactor;
+    ASSERT(reactor.start());
+
+    UDPBuffer *server = new UDPBuffer(), *client = new UDPBuffer();
+    NetAddress serverAddr("127.0.0.1", server->getLocalPort()),
+               clientAddr("127.0.0.1", client->getLocalPort());
+
+    // Packets queued before attaching should still go out
+    size = sprintf_s(dataBuffer, 32, "%s", "early");
+    ASSERT(client->providePacket(Packet(serverAddr, dataBuffer, size)));
+
+    ASSERT(reactor.attach(server));
+    ASSERT(reactor.attach(client));
+    ASSERT(reactor.getBufferCount() == 2);
+    ASSERT(!reactor.attach(server));
+
+    for(c=0; c<maxPackets; c++) {
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        ASSERT(client->providePacket(Packet(serverAddr, dataBuffer, size)));
+    }
+    sleep(1);
+
+    Packet packet;
+    ASSERT(server->consumePacket(packet));
+    ASSERT(strncmp(packet.data, "early", packet.size) == 0);
+    for(c=0; c<maxPackets; c++) {
+        ASSERT(server->consumePacket(packet));
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        ASSERT(size == packet.size);
+        ASSERT(strncmp(packet.data, dataBuffer, size) == 0);
+        ASSERT(packet.addr == clientAddr);
+    }
+    ASSERT(!server->consumePacket(packet));
+
+    // Replies travel the other way through the same reactor thread
+    ASSERT(server->providePacket(Packet(clientAddr, "pong", 4)));
+    sleep(1);
+    ASSERT(client->consumePacket(packet));
+    ASSERT(strncmp(packet.data, "pong", 4) == 0);
+
+    server->stopBuffering();
+    client->stopBuffering();
+    ASSERT(reactor.getBufferCount() == 0);
+    ASSERT(!server->isBuffering());
+
+    delete server;
+    delete client;
+    reactor.stop();
+}
+
+void testTokenBucket() {
+    Info("Running token bucket tests");
+
+    TokenBucket unlimited;
+    ASSERT(!unlimited.isLimited());
+    unlimited.consume(1000000);
+    ASSERT(unlimited.hasTokens());
+    ASSERT(unlimited.getDelay() == 0);
+
+    TokenBucket bucket(1000, 100);
+    ASSERT(bucket.hasTokens());
+
+    // A send bigger than the burst overdraws the bucket, and the debt has to be paid back first
+    bucket.consume(600);
+    ASSERT(!bucket.hasTokens());
+    unsigned int delay = bucket.getDelay();
+    ASSERT(delay > 400 && delay <= 600);
+
+    SDL_Delay(delay);
+    ASSERT(bucket.hasTokens());
+    ASSERT(bucket.getDelay() == 0);
+}
+
+void testRateLimiting(bool useReactor) {
+    const unsigned int numPackets = 50, packetSize = 500, rate = 10000;
+    NetworkReactor reactor;
+    unsigned int c, received;
+    char dataBuffer[packetSize];
+    Packet packet;
+
+    if(useReactor && !NetworkReactor::IsSupported()) { return; }
+
+    Info("Running rate limiting tests (" << (useReactor ? "reactor" : "threaded") << ")");
+
+    UDPBuffer *server = new UDPBuffer(), *client = new UDPBuffer();
+    NetAddress serverAddr("127.0.0.1", server->getLocalPort());
+
+    client->setRateLimit(rate);
+    ASSERT(client->getRateLimit() == rate);
+
+    if(useReactor) {
+        ASSERT(reactor.start());
+        ASSERT(reactor.attach(server));
+        ASSERT(reactor.attach(client));
+    } else {
+        server->startBuffering();
+        client->startBuffering();
+    }
+
+    memset(dataBuffer, 'x', packetSize);
+    for(c = 0; c < numPackets; c++) {
+        ASSERT(client->providePacket(Packet(serverAddr, dataBuffer, packetSize)));
+    }
+
+    // Only about a second's worth should have gone out so far; the rest is paced, not dropped
+    sleep(1);
+    received = 0;
+    while(server->consumePacket(packet)) { received++; }
+    ASSERT(received >= (rate / packetSize) / 2 && received <= (rate / packetSize) + 4);
+
+    sleep(3);
+    while(server->consumePacket(packet)) { received++; }
+    ASSERT(received == numPackets);
+
+    server->stopBuffering();
+    client->stopBuffering();
+    delete server;
+    delete client;
+    reactor.stop();
+}
+
 void testTCPConnectionProviders() {
     Info("Running TCPConnectionProvider tests");
 
@@ -411,6 +869,43 @@ void testTCPConnectionProviders() {
     ASSERT(strncmp(bufferPacket.data, messageB, bufferPacket.size) == 0);
 }
 
+void testServerProviderReaping(unsigned int maxClients) {
+    Info("Running ServerProvider connection reaping tests");
+
+    ServerProvider server;
+    ListenSocket *listenSocket = server.getListenSocket();
+    unsigned int c, tries, goodbyes;
+    Packet packet;
+
+    listenSocket->setMaxClients(maxClients);
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+    // Every client comes from a fresh port, so only closing connections makes room for new ones
+    for(c = 0; c < maxClients * 3; c++) {
+        ClientProvider *client = new ClientProvider();
+        ASSERT(client->sendPacket(Packet(serverAddr, "hello", 5)));
+        for(tries = 0; tries < 500 && !server.recvPacket(packet); tries++) { SDL_Delay(10); }
+        ASSERT(tries < 500 && packet.size == 5);
+
+        // A last message sent just before hanging up still arrives, ahead of the close
+        ASSERT(client->sendPacket(Packet(serverAddr, "bye", 3)));
+        SDL_Delay(10);
+        delete client;
+
+        // The place is given back once the server has seen the connection close
+        goodbyes = 0;
+        for(tries = 0; tries < 500 && listenSocket->getActiveClients() > 0; tries++) {
+            while(server.recvPacket(packet)) {
+                ASSERT(packet.size == 3);
+                goodbyes++;
+            }
+            SDL_Delay(10);
+        }
+        ASSERT(listenSocket->getActiveClients() == 0 && goodbyes == 1);
+    }
+    ASSERT(listenSocket->getRefusedClients() == 0);
+}
+
 void testUDPConnectionProviders() {
     Info("Running UDPConnectionProvider tests");
 
@@ -434,6 +929,1515 @@ void testUDPConnectionProviders() {
     ASSERT(strncmp(bufferPacket.data, messageB, bufferPacket.size) == 0);
 }
 
+void testAddressMap(unsigned int entries) {
+    Info("Running AddressMap tests");
+
+    AddressMap<unsigned int> map(4);
+    unsigned int c, *value;
+
+    for(c = 0; c < entries; c++) {
+        ASSERT(map.insert(NetAddress("127.0.0.1", 1000 + c), c));
+    }
+    ASSERT(map.size() == entries);
+    ASSERT(!map.insert(NetAddress("127.0.0.1", 1000), 0));
+
+    // Remove every other entry, then make sure the rest can still be found past the holes
+    for(c = 0; c < entries; c += 2) {
+        ASSERT(map.erase(NetAddress("127.0.0.1", 1000 + c)));
+    }
+    ASSERT(!map.erase(NetAddress("127.0.0.1", 1000)));
+    ASSERT(map.size() == entries / 2);
+
+    for(c = 0; c < entries; c++) {
+        value = map.find(NetAddress("127.0.0.1", 1000 + c));
+        if(c % 2 == 0) {
+            ASSERT(!value);
+        } else {
+            ASSERT(value && *value == c);
+        }
+    }
+
+    // IPv6 addresses are compared by value
+    ASSERT(map.insert(NetAddress("::1", 1000, 6), entries));
+    value = map.find(NetAddress("::1", 1000, 6));
+    ASSERT(value && *value == entries);
+}
+
+void testSocketedUDPProvider(unsigned int numClients) {
+    Info("Running SocketedUDPProvider tests");
+
+    SocketedUDPProvider server;
+    std::vector<SimpleUDPProvider*> clients;
+    char dataBuffer[32];
+    unsigned int c, size;
+    Packet packet;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+    for(c = 0; c < numClients; c++) {
+        clients.push_back(new SimpleUDPProvider());
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        ASSERT(clients[c]->sendPacket(Packet(serverAddr, dataBuffer, size)));
+    }
+    sleep(1);
+
+    // Every client gets its own queue on the one socket
+    std::set<unsigned int> heard;
+    while(server.recvPacket(packet)) {
+        ASSERT(packet.size < 32);
+        memcpy(dataBuffer, packet.data, packet.size);
+        dataBuffer[packet.size] = 0;
+        c = atoi(dataBuffer);
+        ASSERT(packet.addr == NetAddress("127.0.0.1", clients[c]->getLocalPort()));
+        heard.insert(c);
+
+        // Reply with several packets each so clients have to take turns at the socket
+        for(unsigned int r = 0; r < 20; r++) {
+            ASSERT(server.sendPacket(Packet(packet.addr, packet.data, packet.size)));
+        }
+    }
+    ASSERT(heard.size() == numClients);
+    ASSERT(server.getClientCount() == numClients);
+    sleep(1);
+
+    for(c = 0; c < numClients; c++) {
+        size = sprintf_s(dataBuffer, 32, "%u", c);
+        for(unsigned int r = 0; r < 20; r++) {
+            ASSERT(clients[c]->recvPacket(packet));
+            ASSERT(size == packet.size);
+            ASSERT(strncmp(packet.data, dataBuffer, size) == 0);
+        }
+        ASSERT(!clients[c]->recvPacket(packet));
+    }
+
+    // A dropped client still gets what was already queued for it
+    NetAddress droppedAddr("127.0.0.1", clients[0]->getLocalPort());
+    ASSERT(server.sendPacket(Packet(droppedAddr, "bye", 3)));
+    server.dropClient(droppedAddr);
+    ASSERT(server.getClientCount() == numClients - 1);
+    sleep(1);
+    ASSERT(clients[0]->recvPacket(packet));
+    ASSERT(strncmp(packet.data, "bye", 3) == 0);
+
+    // Hearing from it again starts a new client
+    ASSERT(clients[0]->sendPacket(Packet(serverAddr, "0", 1)));
+    sleep(1);
+    ASSERT(server.recvPacket(packet));
+    ASSERT(packet.addr == droppedAddr);
+    ASSERT(server.getClientCount() == numClients);
+
+    for(c = 0; c < numClients; c++) {
+        delete clients[c];
+    }
+}
+
+void testReceiveFairness(unsigned int floodPackets) {
+    Info("Running receive fairness tests");
+
+    SocketedUDPProvider server;
+    SimpleUDPProvider flooder, quiet;
+    unsigned int c, quietHeard = 0, received = 0, lastQuiet = 0;
+    Packet packet;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort()),
+               quietAddr("127.0.0.1", quiet.getLocalPort());
+
+    server.setFairnessCap(4);
+    ASSERT(server.getFairnessCap() == 4);
+
+    for(c = 0; c < floodPackets; c++) {
+        ASSERT(flooder.sendPacket(Packet(serverAddr, "flood", 5)));
+    }
+    sleep(1);
+    for(c = 0; c < 4; c++) {
+        ASSERT(quiet.sendPacket(Packet(serverAddr, "quiet", 5)));
+    }
+    sleep(1);
+
+    // The quiet client's packets shouldn't have to wait behind the whole flood
+    while(server.recvPacket(packet)) {
+        received++;
+        if(packet.addr == quietAddr) {
+            quietHeard++;
+            lastQuiet = received;
+        }
+    }
+    ASSERT(received == floodPackets + 4);
+    ASSERT(quietHeard == 4);
+    ASSERT(lastQuiet <= 8);
+    ASSERT(!server.recvPacket(packet));
+}
+
+void testNetworkMetrics(unsigned int numPackets) {
+    Info("Running network metrics tests");
+
+    NetworkMetrics metrics, earlier, delta;
+    char data[100];
+    unsigned int c, received = 0;
+    Packet packet;
+
+    // A queue nobody is draining fills up, and everything after that is counted as dropped
+    UDPBuffer idle(0, 4);
+    for(c = 0; c < 6; c++) {
+        ASSERT(idle.providePacket(Packet(NetAddress("127.0.0.1", 1), "x", 1)) == (c < 4));
+    }
+    idle.getMetrics(metrics);
+    ASSERT(metrics.outboundHighWater == 4);
+    ASSERT(metrics.dropped[DropOutboundFull] == 2);
+    ASSERT(metrics.getDropped() == 2);
+    ASSERT(metrics.packetsSent == 0 && metrics.sendCalls == 0);
+
+    SimpleUDPProvider client;
+    SocketedUDPProvider server;
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort()),
+               clientAddr("127.0.0.1", client.getLocalPort());
+
+    memset(data, 0, sizeof(data));
+    client.getMetrics(earlier);
+    for(c = 0; c < numPackets; c++) {
+        ASSERT(client.sendPacket(Packet(serverAddr, data, sizeof(data))));
+    }
+    sleep(1);
+    while(server.recvPacket(packet)) { received++; }
+    ASSERT(received == numPackets);
+
+    // Sends are batched, so there are fewer calls than packets
+    client.getMetrics(metrics);
+    delta = metrics.since(earlier);
+    ASSERT(delta.packetsSent == numPackets);
+    ASSERT(delta.bytesSent == numPackets * sizeof(data));
+    ASSERT(delta.sendCalls >= 1 && delta.sendCalls <= numPackets);
+    ASSERT(delta.getDropped() == 0);
+
+    server.getMetrics(metrics);
+    ASSERT(metrics.packetsReceived == numPackets);
+    ASSERT(metrics.bytesReceived == numPackets * sizeof(data));
+    ASSERT(metrics.recvCalls >= 1);
+    ASSERT(metrics.inboundHighWater >= 1 && metrics.inboundHighWater <= numPackets);
+
+    // Each client's share can be picked out, and survives the client being dropped
+    ASSERT(server.getMetrics(clientAddr, metrics));
+    ASSERT(metrics.packetsReceived == numPackets);
+    server.dropClient(clientAddr);
+    ASSERT(!server.getMetrics(clientAddr, metrics));
+    server.getMetrics(metrics);
+    ASSERT(metrics.packetsReceived == numPackets);
+
+    // Counters wrap, but differences between snapshots still come out right
+    earlier.clear();
+    metrics.clear();
+    earlier.bytesSent = 0xFFFFFFF0;
+    metrics.bytesSent = 0x10;
+    ASSERT(metrics.since(earlier).bytesSent == 0x20);
+}
+
+void testPacketCapture() {
+    Info("Running packet capture tests");
+
+    const char *path = "NetworkTests.gcap";
+    PacketCaptureWriter writer;
+    PacketCaptureReader reader;
+    CapturedPacket record;
+    NetAddress ipv4("127.0.0.1", 4000), ipv6("::1", 5000, 6);
+    char data[300];
+    uint64_t lastTime = 0;
+    unsigned int c, sent;
+
+    // Records come back exactly as written, in order
+    for(c = 0; c < sizeof(data); c++) { data[c] = (char)c; }
+    ASSERT(writer.open(path));
+    ASSERT(writer.record(CaptureInbound, Packet(ipv4, data, 5)));
+    ASSERT(writer.record(CaptureOutbound, Packet(ipv6, data, sizeof(data))));
+    ASSERT(writer.record(CaptureInbound, Packet(ipv6, data, 0)));
+    writer.close();
+    ASSERT(!writer.record(CaptureInbound, Packet(ipv4, data, 5)));
+
+    ASSERT(reader.open(path));
+    ASSERT(reader.next(record) && record.direction == CaptureInbound && record.packet.addr == ipv4 && record.packet.size == 5);
+    ASSERT(memcmp(record.packet.data, data, 5) == 0);
+    lastTime = record.time;
+    ASSERT(reader.next(record) && record.direction == CaptureOutbound && record.packet.addr == ipv6 && record.packet.size == sizeof(data));
+    ASSERT(memcmp(record.packet.data, data, sizeof(data)) == 0);
+    ASSERT(record.time >= lastTime);
+    ASSERT(reader.next(record) && record.packet.addr == ipv6 && record.packet.size == 0);
+    ASSERT(!reader.next(record) && !reader.hasFailed());
+    reader.close();
+
+    // Record a client connecting to a server and pinging it
+    {
+        GhastlyServer server(4);
+        GhastlyClient client;
+        NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+        ASSERT(writer.open(path));
+        server.setCapture(&writer);
+        client.connect(serverAddr);
+        for(c = 0; c < 3; c++) {
+            sleep(1);
+            server.update(1);
+            sleep(1);
+            client.update(1);
+        }
+        ASSERT(client.getState() == GhastlyClient::READY);
+        server.setCapture(0);
+        writer.close();
+    }
+    ASSERT(writer.getRecordCount() >= 4);
+
+    // Replaying it into a fresh server has the same effect, as many times as it's done
+    for(c = 0; c < 2; c++) {
+        GhastlyServer server(4);
+        ReplayProvider replay;
+        NetworkMetrics metrics;
+
+        ASSERT(replay.open(path));
+        server.setTransport(&replay);
+        while(!replay.isFinished()) {
+            server.update(1);
+        }
+        ASSERT(server.getHostCount() == 1);
+
+        replay.getMetrics(metrics);
+        ASSERT(metrics.packetsReceived > 0 && metrics.packetsSent > 0);
+        if(c == 0) {
+            sent = metrics.packetsSent;
+        } else {
+            ASSERT(metrics.packetsSent == sent);
+        }
+    }
+
+    // Paced, packets keep their recorded spacing
+    ASSERT(writer.open(path));
+    ASSERT(writer.record(CaptureInbound, Packet(ipv4, data, 5)));
+    SDL_Delay(50);
+    ASSERT(writer.record(CaptureInbound, Packet(ipv4, data, 5)));
+    writer.close();
+    {
+        ReplayProvider replay(true);
+        Packet packet;
+        ASSERT(replay.open(path));
+        ASSERT(replay.recvPacket(packet));
+        ASSERT(!replay.recvPacket(packet));
+        SDL_Delay(60);
+        ASSERT(replay.recvPacket(packet));
+        ASSERT(replay.isFinished() && replay.getCaptureTime() >= 50000);
+    }
+
+    // Stepped, they're held back until the replay reaches them
+    {
+        ReplayProvider replay;
+        Packet packet;
+        ASSERT(replay.open(path));
+        replay.stepTo(25000);
+        ASSERT(replay.recvPacket(packet));
+        ASSERT(!replay.recvPacket(packet));
+        replay.stepTo(1000000);
+        ASSERT(replay.recvPacket(packet));
+        ASSERT(replay.isFinished());
+    }
+
+    remove(path);
+}
+
+void testGhastlyConnection(unsigned int numPayloads) {
+    Info("Running Ghastly connection tests");
+
+    CapturingProvider wireA, wireB;
+    GhastlyConnection a(&wireA, NetAddress("127.0.0.1", 1001)), b(&wireB, NetAddress("127.0.0.1", 1000));
+    unsigned int sent = 0, received = 0, sequenced = 0, latest = 0, steps, c;
+    // Decides which packets get lost, the same way every run
+    uint32_t random = 12345;
+    // Which channel the value went out on, and the value itself
+    uint32_t message[2];
+    Packet payload;
+
+    for(steps = 0; steps < 10000 && (received < numPayloads || a.getUnacknowledged() > 0); steps++) {
+        // Keep a few reliable payloads in flight, alongside a stream of state
+        message[0] = ReliableChannel;
+        for(c = 0; c < 4 && sent < numPayloads && a.getUnacknowledged() < GhastlyConnection::ReliableWindow; c++) {
+            message[1] = sent++;
+            ASSERT(a.send(ReliableChannel, (char*)message, sizeof(message)));
+        }
+        message[0] = SequencedChannel;
+        message[1] = ++sequenced;
+        ASSERT(a.send(SequencedChannel, (char*)message, sizeof(message)));
+
+        a.update(10);
+        b.update(10);
+
+        // Lose a third of the packets each way, and deliver the rest backwards
+        while(!wireA.packets.empty()) {
+            random = random * 1103515245 + 12345;
+            if((random >> 16) % 3 != 0) { ASSERT(b.receive(wireA.packets.back())); }
+            wireA.packets.pop_back();
+        }
+        while(!wireB.packets.empty()) {
+            random = random * 1103515245 + 12345;
+            if((random >> 16) % 3 != 0) { ASSERT(a.receive(wireB.packets.back())); }
+            wireB.packets.pop_back();
+        }
+
+        while(b.nextPayload(payload)) {
+            ASSERT(payload.size == sizeof(message));
+            memcpy(message, payload.data, sizeof(message));
+            if(message[0] == ReliableChannel) {
+                // Every reliable payload arrives once, in order
+                ASSERT(message[1] == received);
+                received++;
+            } else {
+                // Stale state is never delivered
+                ASSERT(message[0] == SequencedChannel && message[1] > latest);
+                latest = message[1];
+            }
+        }
+    }
+    ASSERT(received == numPayloads);
+    ASSERT(a.getUnacknowledged() == 0);
+    ASSERT(!a.hasFailed() && a.getRetransmissions() > 0);
+    ASSERT(a.getRoundTripTime() > 0);
+
+    // A host that never answers eventually fails the connection
+    CapturingProvider nowhere;
+    GhastlyConnection lonely(&nowhere, NetAddress("127.0.0.1", 1002));
+    ASSERT(lonely.send(ReliableChannel, "hello", 5));
+    for(steps = 0; steps < 10000 && !lonely.hasFailed(); steps++) {
+        lonely.update(10);
+    }
+    ASSERT(lonely.hasFailed());
+    ASSERT(!lonely.send(ReliableChannel, "hello", 5));
+}
+
+void testGhastlyBundling(unsigned int numPayloads) {
+    Info("Running Ghastly bundling tests");
+
+    CapturingProvider wireA, wireB;
+    GhastlyConnection a(&wireA, NetAddress("127.0.0.1", 1001)), b(&wireB, NetAddress("127.0.0.1", 1000));
+    char large[180];
+    uint32_t value, expected = 0;
+    unsigned int c;
+    Packet payload;
+
+    // Small messages sent together share datagrams, as many to a datagram as the MTU allows
+    a.setMTU(200);
+    a.hold();
+    for(c = 0; c < numPayloads; c++) {
+        value = c;
+        ASSERT(a.send(c % 2 ? ReliableChannel : UnreliableChannel, (char*)&value, sizeof(value)));
+    }
+    memset(large, 7, sizeof(large));
+    // Too big to share with more than a payload or so, but still fits in a packet
+    ASSERT(a.send(ReliableChannel, large, sizeof(large)));
+    ASSERT(wireA.packets.empty());
+    a.flush();
+
+    ASSERT(wireA.packets.size() > 1 && wireA.packets.size() < numPayloads / 4);
+    for(c = 0; c < wireA.packets.size(); c++) {
+        ASSERT(wireA.packets[c].size <= 200 || wireA.packets[c].size > sizeof(large));
+        ASSERT(b.receive(wireA.packets[c]));
+    }
+
+    // Everything comes back out separately, in order
+    while(b.nextPayload(payload) && payload.size == sizeof(value)) {
+        memcpy(&value, payload.data, sizeof(value));
+        ASSERT(value == expected);
+        expected++;
+    }
+    ASSERT(expected == numPayloads);
+    ASSERT(payload.size == sizeof(large));
+    ASSERT(!b.nextPayload(payload));
+
+    // Acknowledging the bundled packets works just as for separate ones (a single ack reaches back 33 packets)
+    b.update(10);
+    ASSERT(wireB.packets.size() == 1);
+    ASSERT(a.receive(wireB.packets[0]));
+    ASSERT(a.getUnacknowledged() == 0);
+
+    // Bundles that run past their end, or nest, are rejected
+    char malformed[] = { (char)BundleChannel, 10, 0, 0 };
+    ASSERT(!b.receive(Packet(NetAddress("127.0.0.1", 1001), malformed, sizeof(malformed))));
+    char nested[] = { (char)BundleChannel, 1, (char)BundleChannel };
+    ASSERT(!b.receive(Packet(NetAddress("127.0.0.1", 1001), nested, sizeof(nested))));
+}
+
+void testGhastlyLoopback(unsigned int numPayloads) {
+    Info("Running Ghastly loopback tests");
+
+    SimpleUDPProvider wireA, wireB;
+    GhastlyConnection a(&wireA, NetAddress("127.0.0.1", wireB.getLocalPort())), b(&wireB, NetAddress("127.0.0.1", wireA.getLocalPort()));
+    std::vector<char> large(a.getMaxPayloadSize(ReliableChannel));
+    unsigned int received = 0, largest = 0, tries, c;
+    uint32_t message[4];
+    NetworkMetrics metrics;
+    Packet packet, payload;
+
+    // Enough small payloads to fill bundles right up to the MTU, which a real socket has to take whole
+    a.hold();
+    for(c = 0; c < numPayloads; c++) {
+        message[0] = c;
+        ASSERT(a.send(UnreliableChannel, (char*)message, sizeof(message)));
+    }
+    a.flush();
+
+    for(tries = 0; tries < 200 && received < numPayloads; tries++) {
+        SDL_Delay(10);
+        while(wireB.recvPacket(packet)) {
+            ASSERT(packet.size <= a.getMTU());
+            largest = std::max(largest, packet.size);
+            ASSERT(b.receive(packet));
+        }
+        while(b.nextPayload(payload)) {
+            ASSERT(payload.size == sizeof(message));
+            memcpy(message, payload.data, sizeof(message));
+            ASSERT(message[0] == received);
+            received++;
+        }
+    }
+    ASSERT(received == numPayloads);
+    ASSERT(largest > a.getMTU() - sizeof(message) - MaxChannelHeaderSize);
+
+    // The biggest reliable payload goes out as full-MTU fragments, every one of which a single ack covers
+    for(c = 0; c < large.size(); c++) {
+        large[c] = (char)(c * 7);
+    }
+    // The unreliable payload goes first, so the reliable one's fragments are the newest packets and its ack reaches all of them
+    ASSERT(a.send(UnreliableChannel, &large[0], large.size()));
+    ASSERT(a.send(ReliableChannel, &large[0], large.size()));
+    received = 0;
+    for(tries = 0; tries < 200 && (received < 2 || a.getUnacknowledged() > 0); tries++) {
+        SDL_Delay(10);
+        while(wireB.recvPacket(packet)) {
+            ASSERT(b.receive(packet));
+        }
+        while(wireA.recvPacket(packet)) {
+            ASSERT(a.receive(packet));
+        }
+        while(b.nextPayload(payload)) {
+            ASSERT(payload.size == large.size() && memcmp(payload.data, &large[0], large.size()) == 0);
+            received++;
+        }
+        a.update(10);
+        b.update(10);
+    }
+    ASSERT(received == 2 && a.getUnacknowledged() == 0);
+    ASSERT(a.getRetransmissions() == 0);
+
+    wireB.getMetrics(metrics);
+    ASSERT(metrics.getDropped() == 0);
+}
+
+void testGhastlyFragmentation(unsigned int numPayloads) {
+    Info("Running Ghastly fragmentation tests");
+
+    CapturingProvider wireA, wireB;
+    GhastlyConnection a(&wireA, NetAddress("127.0.0.1", 1001)), b(&wireB, NetAddress("127.0.0.1", 1000));
+    std::vector<char> large(10000), huge(a.getMaxPayloadSize() + 1);
+    ASSERT(a.getMaxPayloadSize(ReliableChannel) < a.getMaxPayloadSize());
+    unsigned int received = 0, fragments, drops, steps, c;
+    uint32_t random = 12345;
+    Packet payload;
+
+    fragments = (large.size() + a.getMTU() - MaxChannelHeaderSize - MaxFragmentHeaderSize - 1) / (a.getMTU() - MaxChannelHeaderSize - MaxFragmentHeaderSize);
+    for(c = 0; c < large.size(); c++) {
+        large[c] = (char)(c * 7);
+    }
+
+    // Too big for a packet, so it goes in fragments, none bigger than the MTU
+    ASSERT(a.send(UnreliableChannel, &large[0], large.size()));
+    ASSERT(wireA.packets.size() == fragments);
+    for(c = 0; c < wireA.packets.size(); c++) {
+        ASSERT(wireA.packets[c].size <= a.getMTU());
+    }
+
+    // Fragments can arrive in any order, and come out as the one payload once they're all in
+    for(c = wireA.packets.size(); c > 0; c--) {
+        ASSERT(!b.nextPayload(payload));
+        ASSERT(b.receive(wireA.packets[c - 1]));
+    }
+    wireA.packets.clear();
+    ASSERT(b.nextPayload(payload));
+    ASSERT(payload.size == large.size() && memcmp(payload.data, &large[0], large.size()) == 0);
+    ASSERT(!b.nextPayload(payload));
+
+    // Payloads past the most fragments there can be aren't sent at all
+    ASSERT(!a.send(UnreliableChannel, &huge[0], huge.size()));
+    ASSERT(wireA.packets.empty());
+    // Reliable payloads stop sooner, so a single ack can cover all of their fragments
+    ASSERT(!a.send(ReliableChannel, &huge[0], a.getMaxPayloadSize(ReliableChannel) + 1));
+    ASSERT(wireA.packets.empty());
+
+    // Reliable payloads come through whole and in order despite losing a third of the fragments; only the lost ones are sent again
+    for(c = 0; c < numPayloads; c++) {
+        large[0] = (char)c;
+        ASSERT(a.send(ReliableChannel, &large[0], large.size()));
+    }
+    for(steps = 0; steps < 10000 && (received < numPayloads || a.getUnacknowledged() > 0); steps++) {
+        a.update(10);
+        b.update(10);
+
+        while(!wireA.packets.empty()) {
+            random = random * 1103515245 + 12345;
+            if((random >> 16) % 3 != 0) { ASSERT(b.receive(wireA.packets.back())); }
+            wireA.packets.pop_back();
+        }
+        while(!wireB.packets.empty()) {
+            ASSERT(a.receive(wireB.packets.back()));
+            wireB.packets.pop_back();
+        }
+
+        while(b.nextPayload(payload)) {
+            ASSERT(payload.size == large.size() && payload.data[0] == (char)received);
+            ASSERT(memcmp(payload.data + 1, &large[1], large.size() - 1) == 0);
+            received++;
+        }
+    }
+    ASSERT(received == numPayloads);
+    ASSERT(a.getUnacknowledged() == 0 && a.getRetransmissions() > 0);
+    ASSERT(a.getRetransmissions() < numPayloads * fragments);
+    // More were in flight than fit in the slab at once, so some fragments were turned away until there was room
+    ASSERT(b.getReassemblyDrops() > 0);
+
+    // A payload missing a fragment is given up on, rather than holding on to its room forever
+    drops = b.getReassemblyDrops();
+    ASSERT(a.send(UnreliableChannel, &large[0], large.size()));
+    for(c = 1; c < wireA.packets.size(); c++) {
+        ASSERT(b.receive(wireA.packets[c]));
+    }
+    wireA.packets.clear();
+    b.update(500);
+    ASSERT(b.getReassemblyDrops() == drops);
+    b.update(500);
+    ASSERT(b.getReassemblyDrops() == drops + fragments - 1 && !b.nextPayload(payload));
+
+    // Only the newest sequenced payload matters, so an older one still coming together is dropped once a newer one is in
+    ASSERT(a.send(SequencedChannel, &large[0], large.size()));
+    ASSERT(a.send(SequencedChannel, &large[0], large.size()));
+    for(c = 1; c < wireA.packets.size(); c++) {
+        ASSERT(b.receive(wireA.packets[c]));
+    }
+    ASSERT(b.nextPayload(payload) && !b.nextPayload(payload));
+    // The first fragment of the older one is stale now
+    ASSERT(b.receive(wireA.packets[0]));
+    ASSERT(!b.nextPayload(payload));
+    wireA.packets.clear();
+
+    // Payloads bigger than the peer will make room for are turned away, and never acknowledged
+    GhastlyConnection tight(&wireB, NetAddress("127.0.0.1", 1000));
+    tight.setReassemblyLimit(large.size() / 2);
+    ASSERT(tight.getReassemblyLimit() == large.size() / 2);
+    ASSERT(a.send(ReliableChannel, &large[0], large.size()));
+    for(c = 0; c < wireA.packets.size(); c++) {
+        ASSERT(tight.receive(wireA.packets[c]));
+    }
+    wireA.packets.clear();
+    ASSERT(!tight.nextPayload(payload) && tight.getReassemblyDrops() > 0);
+    wireB.packets.clear();
+    tight.flushAcks();
+    ASSERT(wireB.packets.empty());
+
+    // Fragments that don't agree with the header are rejected
+    char malformed[] = { (char)FragmentChannel, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    ASSERT(!b.receive(Packet(NetAddress("127.0.0.1", 1001), malformed, sizeof(malformed))));
+}
+
+void testGhastlyHostRegistry(unsigned int numHosts) {
+    Info("Running Ghastly host registry tests");
+
+    GhastlyHostRegistry registry(numHosts);
+    std::vector<HostID> ids;
+    GhastlyHostInfo *host;
+    unsigned int c;
+
+    for(c = 0; c < numHosts; c++) {
+        host = registry.add(NetAddress("10.0.0.1", 1000 + c));
+        ASSERT(host);
+        // Client IDs never collide with the reserved ones
+        ASSERT(host->id != GhastlyHost::ID_UNASSIGNED && host->id != GhastlyHost::ID_SERVER);
+        ids.push_back(host->id);
+    }
+    ASSERT(registry.isFull());
+    ASSERT(!registry.add(NetAddress("10.0.0.2", 1000)));
+    ASSERT(!registry.add(NetAddress("10.0.0.1", 1000)));
+
+    for(c = 0; c < numHosts; c++) {
+        host = registry.find(ids[c]);
+        ASSERT(host && host->addr == NetAddress("10.0.0.1", 1000 + c));
+        ASSERT(registry.find(NetAddress("10.0.0.1", 1000 + c)) == host);
+    }
+
+    for(c = 0; c < numHosts; c += 2) {
+        ASSERT(registry.remove(ids[c]));
+        ASSERT(!registry.remove(ids[c]));
+    }
+    ASSERT(registry.size() == numHosts / 2);
+
+    // Reused slots hand out fresh IDs, and the old ones stay dead
+    for(c = 0; c < numHosts; c += 2) {
+        host = registry.add(NetAddress("10.0.0.3", 1000 + c));
+        ASSERT(host && host->id != ids[c]);
+        ASSERT(!registry.find(ids[c]));
+        ASSERT(!registry.find(NetAddress("10.0.0.1", 1000 + c)));
+    }
+    ASSERT(registry.size() == numHosts);
+
+    // Iteration covers every connected host exactly once
+    std::set<HostID> seen;
+    for(c = 0; c < registry.size(); c++) {
+        seen.insert(registry.getHost(c).id);
+    }
+    ASSERT(seen.size() == numHosts);
+}
+
+// An entity update as it might be sent without any bit packing
+struct NaiveEntityUpdate: public Payload {
+    EntityID id;
+    Vector3<float> position, velocity;
+    float yaw;
+    uint32_t health;
+    uint32_t flags;
+
+    NaiveEntityUpdate(): Payload(255), id(0), yaw(0), health(0), flags(0) {}
+};
+
+// The same update, with every field quantized to the range and precision it actually needs
+struct PackedEntityUpdate: public Payload {
+    EntityID id;
+    Vector3<float> position, velocity;
+    float yaw;
+    uint16_t health;
+    uint16_t flags;
+
+    PackedEntityUpdate(): Payload(255), id(0), yaw(0), health(0), flags(0) {}
+
+    template <typename Stream>
+    bool serialize(Stream &stream) {
+        return stream.serializeInteger(id, 0, 0xFFFF) &&
+               stream.serializeVector(position, -512.0f, 512.0f, 1.0f / 8.0f) &&
+               stream.serializeVector(velocity, -32.0f, 32.0f, 1.0f / 4.0f) &&
+               stream.serializeFloat(yaw, 0.0f, 360.0f, 360.0f / 255.0f) &&
+               stream.serializeInteger(health, 0, 100) &&
+               stream.serializeInteger(flags, 0, 15);
+    }
+};
+
+void testBitStream() {
+    Info("Running bit stream tests");
+
+    char buffer[128];
+    uint32_t bits;
+    bool flag;
+    int small;
+    float value;
+    Vector3<float> vector;
+    char bytes[4];
+    unsigned int c;
+
+    // Values of every width round trip, packed tightly
+    {
+        BitWriter writer(buffer, sizeof(buffer));
+        for(c = 1; c <= 32; c++) {
+            bits = (c == 32) ? 0xDEADBEEF : ((1u << c) - 1) & 0x5A5A5A5A;
+            ASSERT(writer.serializeBits(bits, c));
+        }
+        ASSERT(writer.getBitsWritten() == 32 * 33 / 2);
+        ASSERT(writer.getBytesWritten() == (32 * 33 / 2 + 7) / 8);
+
+        BitReader reader(buffer, writer.getBytesWritten());
+        for(c = 1; c <= 32; c++) {
+            ASSERT(reader.serializeBits(bits, c));
+            ASSERT(bits == ((c == 32) ? 0xDEADBEEF : ((1u << c) - 1) & 0x5A5A5A5A));
+        }
+    }
+
+    // Bools, bounded integers, quantized floats and vectors
+    {
+        BitWriter writer(buffer, sizeof(buffer));
+        flag = true;
+        ASSERT(writer.serializeBool(flag));
+        small = -3;
+        ASSERT(writer.serializeInteger(small, -10, 10));
+        value = 1.3f;
+        ASSERT(writer.serializeFloat(value, -4.0f, 4.0f, 0.01f));
+        value = 123.456f;
+        ASSERT(writer.serializeFloat(value));
+        vector = Vector3<float>(-100.0f, 0.5f, 511.9f);
+        ASSERT(writer.serializeVector(vector, -512.0f, 512.0f, 1.0f / 16.0f));
+        memcpy(bytes, "abcd", 4);
+        ASSERT(writer.serializeBytes(bytes, 4));
+        // 1 + 5 + 10 + 32 + 3 * 15 bits, then aligned bytes
+        ASSERT(writer.getBitsWritten() == 96 + 32);
+
+        BitReader reader(buffer, writer.getBytesWritten());
+        ASSERT(reader.serializeBool(flag) && flag);
+        ASSERT(reader.serializeInteger(small, -10, 10) && small == -3);
+        ASSERT(reader.serializeFloat(value, -4.0f, 4.0f, 0.01f) && fabs(value - 1.3f) <= 0.005f);
+        ASSERT(reader.serializeFloat(value) && value == 123.456f);
+        ASSERT(reader.serializeVector(vector, -512.0f, 512.0f, 1.0f / 16.0f));
+        ASSERT(fabs(vector.x + 100.0f) <= 1.0f / 32.0f && fabs(vector.y - 0.5f) <= 1.0f / 32.0f && fabs(vector.z - 511.9f) <= 1.0f / 32.0f);
+        ASSERT(reader.serializeBytes(bytes, 4) && memcmp(bytes, "abcd", 4) == 0);
+        ASSERT(reader.getBitsRemaining() == 0);
+
+        // Reading past the end fails, and keeps failing
+        ASSERT(!reader.serializeBool(flag));
+        ASSERT(reader.hasFailed());
+    }
+
+    // Out of range values can't be written, and aren't accepted when read
+    {
+        BitWriter writer(buffer, sizeof(buffer));
+        small = 11;
+        ASSERT(!writer.serializeInteger(small, -10, 10));
+        ASSERT(writer.hasFailed());
+
+        bits = 31;
+        BitWriter raw(buffer, sizeof(buffer));
+        ASSERT(raw.serializeBits(bits, 5));
+        BitReader reader(buffer, 1);
+        ASSERT(!reader.serializeInteger(small, 0, 20));
+
+        // Nor does anything fit in a full buffer
+        BitWriter full(buffer, 1);
+        bits = 0;
+        ASSERT(!full.serializeBits(bits, 9));
+    }
+
+    // Quantized floats that aren't finite, NaN included, come out as the bottom of their range
+    {
+        float value;
+        BitWriter writer(buffer, sizeof(buffer));
+        value = std::numeric_limits<float>::quiet_NaN();
+        ASSERT(writer.serializeFloat(value, -4.0f, 4.0f, 0.01f));
+        value = std::numeric_limits<float>::infinity();
+        ASSERT(writer.serializeFloat(value, -4.0f, 4.0f, 0.01f));
+
+        BitReader reader(buffer, writer.getBytesWritten());
+        ASSERT(reader.serializeFloat(value, -4.0f, 4.0f, 0.01f) && value == -4.0f);
+        ASSERT(reader.serializeFloat(value, -4.0f, 4.0f, 0.01f) && value == -4.0f);
+    }
+
+    // Payloads go through their serialize methods, and are refused as another type
+    {
+        PingResponse response(1234, 5678), readBack;
+        PingRequest wrongType;
+        unsigned int size = WritePayload(response, buffer, sizeof(buffer));
+        ASSERT(size == 9);
+        ASSERT(ReadPayload(readBack, buffer, size));
+        ASSERT(readBack.client == 1234 && readBack.server == 5678);
+        ASSERT(!ReadPayload(wrongType, buffer, size));
+        ASSERT(!ReadPayload(readBack, buffer, size - 1));
+    }
+
+    // A typical entity update comes out several times smaller than the struct it's held in
+    {
+        PackedEntityUpdate update, readBack;
+        update.id = 4321;
+        update.position = Vector3<float>(100.25f, -20.5f, 3.0f);
+        update.velocity = Vector3<float>(-1.5f, 0.0f, 9.75f);
+        update.yaw = 90.0f;
+        update.health = 73;
+        update.flags = 5;
+
+        unsigned int size = WritePayload(update, buffer, sizeof(buffer));
+        Info("Entity update is " << size << " bytes packed, " << sizeof(NaiveEntityUpdate) << " bytes as a struct");
+        ASSERT(size > 0 && size * 3 <= sizeof(NaiveEntityUpdate));
+
+        ASSERT(ReadPayload(readBack, buffer, size));
+        ASSERT(readBack.id == update.id && readBack.health == update.health && readBack.flags == update.flags);
+        ASSERT(readBack.position.x == update.position.x && readBack.position.y == update.position.y && readBack.position.z == update.position.z);
+        ASSERT(readBack.velocity.x == update.velocity.x && readBack.velocity.z == update.velocity.z);
+        ASSERT(fabs(readBack.yaw - update.yaw) <= 360.0f / 255.0f);
+    }
+
+    // Channel headers only carry the fields they need
+    {
+        ChannelHeader header, readBack;
+        header.channel = AckOnlyChannel;
+        header.hasAck = true;
+        header.ack = 77;
+        header.ackBits = 0xF0F0F0F0;
+
+        BitWriter writer(buffer, sizeof(buffer));
+        ASSERT(header.serialize(writer));
+        ASSERT(writer.getBytesWritten() == 7);
+
+        BitReader reader(buffer, writer.getBytesWritten());
+        ASSERT(readBack.serialize(reader));
+        ASSERT(readBack.channel == AckOnlyChannel && readBack.hasAck && readBack.ack == 77 && readBack.ackBits == 0xF0F0F0F0);
+
+        header.channel = ReliableChannel;
+        header.sequence = 65535;
+        header.channelSequence = 3;
+        BitWriter full(buffer, sizeof(buffer));
+        ASSERT(header.serialize(full));
+        ASSERT(full.getBytesWritten() == MaxChannelHeaderSize);
+    }
+}
+
+void testGhastlySnapshots(unsigned int numEntities) {
+    Info("Running Ghastly snapshot tests");
+
+    GhastlySnapshot world, sent, received, decoded;
+    std::vector<char> buffer(numEntities * 32);
+    char state[16];
+    unsigned int c, size;
+
+    for(c = 0; c < numEntities; c++) {
+        memset(state, c & 0xFF, sizeof(state));
+        // Entities may be set in any order
+        ASSERT(world.setEntity((c * 7) % numEntities + 1, state, sizeof(state)));
+    }
+    ASSERT(world.getEntityCount() == numEntities);
+
+    // With no baseline every entity goes in full
+    // Each record is a 1 bit, the ID (1 bit when it follows the last, 10 for the first), operation (2), size (8) and state, then a bit ends the list
+    size = world.encode(0, &buffer[0], buffer.size(), sent);
+    ASSERT(size == (numEntities * (1 + 1 + 2 + 8 + sizeof(state) * 8) + 9 + 1 + 7) / 8);
+    ASSERT(size < numEntities * (sizeof(EntityID) + 2 + sizeof(state)));
+    ASSERT(sent == world);
+    ASSERT(received.decode(0, &buffer[0], size));
+    ASSERT(received == world);
+
+    // Nothing changed, nothing sent but the end of the list
+    ASSERT(world.encode(&received, &buffer[0], buffer.size(), sent) == 1);
+
+    // Only the bytes that changed are sent
+    memset(state, 0, sizeof(state));
+    state[3] = 1;
+    state[12] = 2;
+    ASSERT(world.setEntity(1, state, sizeof(state)));
+    size = world.encode(&received, &buffer[0], buffer.size(), sent);
+    // 1 + 10 (ID) + 2 (operation) + 8 (size) + 16 (mask) + 16 (bytes) + 1 (end) bits
+    ASSERT(size == 7);
+    ASSERT(decoded.decode(&received, &buffer[0], size));
+    ASSERT(decoded == world);
+
+    // Additions, removals and resized states
+    ASSERT(world.removeEntity(2));
+    ASSERT(!world.removeEntity(2));
+    ASSERT(world.setEntity(numEntities + 10, "new", 3));
+    ASSERT(world.setEntity(3, "smaller", 7));
+    size = world.encode(&decoded, &buffer[0], buffer.size(), sent);
+    ASSERT(received.decode(&decoded, &buffer[0], size));
+    ASSERT(received == world);
+    ASSERT(!received.getEntity(2, size));
+    ASSERT(received.getEntity(3, size) && size == 7 && strncmp(received.getEntity(3, size), "smaller", 7) == 0);
+
+    // What doesn't fit is left for a later snapshot, and sent matches what the receiver ends up with
+    size = world.encode(0, &buffer[0], 200, sent);
+    ASSERT(size <= 200);
+    ASSERT(sent.getEntityCount() > 0 && sent.getEntityCount() < world.getEntityCount());
+    ASSERT(decoded.decode(0, &buffer[0], size));
+    ASSERT(decoded == sent);
+    size = world.encode(&decoded, &buffer[0], buffer.size(), sent);
+    ASSERT(received.decode(&decoded, &buffer[0], size));
+    ASSERT(received == world);
+
+    // Malformed records are refused
+    memset(state, 0, sizeof(state));
+    size = world.encode(0, &buffer[0], buffer.size(), sent);
+    ASSERT(!decoded.decode(0, &buffer[0], size - 1));
+    world.setEntity(1, state, sizeof(state));
+    size = world.encode(&received, &buffer[0], buffer.size(), sent);
+    ASSERT(!decoded.decode(0, &buffer[0], size));
+}
+
+void testSnapshotReplication(unsigned int numEntities) {
+    Info("Running snapshot replication tests");
+
+    GhastlyServer server(4);
+    GhastlyClient client;
+    char state[16];
+    unsigned int c;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+    client.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getState() == GhastlyClient::READY);
+    ASSERT(!client.getSnapshot());
+
+    GhastlySnapshot &world = server.getWorldSnapshot();
+    for(c = 0; c < numEntities; c++) {
+        memset(state, c & 0xFF, sizeof(state));
+        world.setEntity(c, state, sizeof(state));
+    }
+
+    server.sendSnapshots();
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getSnapshot() && *client.getSnapshot() == world);
+    sleep(1);
+    // Take the client's acknowledgement, so the next snapshot is a delta
+    server.update(1);
+
+    state[0] = 42;
+    world.setEntity(0, state, sizeof(state));
+    world.removeEntity(1);
+    server.sendSnapshots();
+    sleep(1);
+    client.update(1);
+    ASSERT(*client.getSnapshot() == world);
+    ASSERT(client.getSnapshot()->getSequence() == 2);
+
+    client.disconnect();
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getHostCount() == 0);
+}
+
+void testGhastlySharding(unsigned int numClients, unsigned int shards) {
+    Info("Running sharded Ghastly server tests with " << numClients << " clients over " << shards << " shards");
+
+    GhastlyServer server(numClients, shards);
+    std::vector<GhastlyClient*> clients;
+    std::set<HostID> ids;
+    char state[16];
+    unsigned int c;
+
+    ASSERT(server.getShardCount() == shards);
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+    for(c = 0; c < numClients; c++) {
+        clients.push_back(new GhastlyClient());
+        clients[c]->connect(serverAddr);
+    }
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    for(c = 0; c < numClients; c++) {
+        clients[c]->update(1);
+        ASSERT(clients[c]->getState() == GhastlyClient::READY);
+        ids.insert(clients[c]->getID());
+    }
+    ASSERT(ids.size() == numClients);
+    ASSERT(server.getHostCount() == numClients);
+
+    // Hosts are spread across every shard
+    for(c = 0; c < shards; c++) {
+        ASSERT(server.getShard(c)->getProcessed() > 0);
+    }
+
+    // Snapshots are sent from the calling thread through the shards' connections
+    GhastlySnapshot &world = server.getWorldSnapshot();
+    for(c = 0; c < 8; c++) {
+        memset(state, c, sizeof(state));
+        world.setEntity(c, state, sizeof(state));
+    }
+    server.sendSnapshots();
+    sleep(1);
+    for(c = 0; c < numClients; c++) {
+        clients[c]->update(1);
+        ASSERT(clients[c]->getSnapshot() && *clients[c]->getSnapshot() == world);
+    }
+
+    // Disconnects are processed on the shards and the hosts released afterwards
+    for(c = 0; c < numClients; c += 2) {
+        clients[c]->disconnect();
+        ASSERT(clients[c]->getState() == GhastlyClient::NOT_CONNECTED);
+    }
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getHostCount() == numClients / 2);
+
+    // The rest time out together, each on its own shard's timers
+    server.update(DEFAULT_IDLE_TIMEOUT + 1000);
+    ASSERT(server.getHostCount() == 0);
+
+    for(c = 0; c < numClients; c++) {
+        delete clients[c];
+    }
+}
+
+// Entities are a position moved by inputs carrying a velocity
+class LinearSimulation: public GhastlySimulation {
+public:
+    void predict(char *state, unsigned int &size, const char *input, unsigned int inputSize, unsigned int duration) {
+        int32_t position, velocity;
+        memcpy(&position, state, sizeof(position));
+        memcpy(&velocity, input, sizeof(velocity));
+        position += velocity * (int32_t)duration;
+        memcpy(state, &position, sizeof(position));
+    }
+
+    void interpolate(const char *from, const char *to, unsigned int size, float t, char *result) {
+        int32_t a, b, position;
+        memcpy(&a, from, sizeof(a));
+        memcpy(&b, to, sizeof(b));
+        position = a + (int32_t)((b - a) * t);
+        memcpy(result, &position, sizeof(position));
+    }
+};
+
+int32_t GetPosition(const char *state) {
+    int32_t position;
+    ASSERT(state);
+    memcpy(&position, state, sizeof(position));
+    return position;
+}
+
+void SetPosition(GhastlySnapshot &snapshot, EntityID id, int32_t position) {
+    snapshot.setEntity(id, (const char*)&position, sizeof(position));
+}
+
+void testGhastlyPrediction() {
+    Info("Running client prediction tests");
+
+    LinearSimulation simulation;
+    GhastlySnapshot snapshot;
+    InputCommands commands;
+    GhastlyInput input;
+    int32_t velocity;
+    unsigned int size, c;
+    char state[GhastlySnapshot::MaxStateSize];
+
+    GhastlyPrediction prediction;
+    prediction.setSimulation(&simulation);
+    prediction.setEntity(7);
+
+    // Nothing to predict from until a snapshot carries the entity
+    velocity = 2;
+    ASSERT(prediction.addInput((const char*)&velocity, sizeof(velocity), 10) == 1);
+    ASSERT(!prediction.getState(size));
+
+    SetPosition(snapshot, 7, 0);
+    prediction.reconcile(0, snapshot);
+    ASSERT(GetPosition(prediction.getState(size)) == 20 && size == sizeof(int32_t));
+    ASSERT(prediction.getCorrections() == 0 && prediction.getReplayed() == 1);
+
+    velocity = 1;
+    ASSERT(prediction.addInput((const char*)&velocity, sizeof(velocity), 10) == 2);
+    ASSERT(GetPosition(prediction.getState(size)) == 30);
+
+    // The server agrees, so nothing is replayed
+    SetPosition(snapshot, 7, 20);
+    prediction.reconcile(1, snapshot);
+    ASSERT(GetPosition(prediction.getState(size)) == 30);
+    ASSERT(prediction.getCorrections() == 0 && prediction.getReplayed() == 1);
+
+    // Only the commands the server hasn't processed go out
+    ASSERT(prediction.getCommands(commands));
+    ASSERT(commands.newest == 2 && commands.count == 1 && commands.commands[0].duration == 10);
+
+    // The server disagrees, and the unprocessed input is replayed on top of its state
+    SetPosition(snapshot, 7, 25);
+    prediction.reconcile(1, snapshot);
+    ASSERT(GetPosition(prediction.getState(size)) == 35);
+    ASSERT(prediction.getCorrections() == 1 && prediction.getReplayed() == 2);
+    // The same snapshot again is no longer a surprise
+    prediction.reconcile(1, snapshot);
+    ASSERT(prediction.getCorrections() == 1);
+
+    SetPosition(snapshot, 7, 35);
+    prediction.reconcile(2, snapshot);
+    ASSERT(prediction.getCorrections() == 1 && prediction.getAcknowledgedInput() == 2);
+    ASSERT(!prediction.getCommands(commands));
+
+    // A packet only holds so many commands, newest last
+    for(c = 0; c < MaxInputsPerPacket * 2; c++) {
+        prediction.addInput((const char*)&velocity, sizeof(velocity), 1);
+    }
+    ASSERT(prediction.getCommands(commands));
+    ASSERT(commands.count == MaxInputsPerPacket && commands.newest == prediction.getLatestInput());
+
+    // Interpolation blends the snapshots either side of the delay, and holds at either end
+    GhastlySnapshotHistory history;
+    GhastlyInterpolation interpolation;
+    interpolation.setSimulation(&simulation);
+    interpolation.setDelay(50);
+    SetPosition(history.record(1), 3, 0);
+    interpolation.record(1, 100);
+    SetPosition(history.record(2), 3, 100);
+    interpolation.record(2, 200);
+    ASSERT(interpolation.sample(history, 3, 200, state, size) && GetPosition(state) == 50);
+    ASSERT(interpolation.sample(history, 3, 300, state, size) && GetPosition(state) == 100);
+    ASSERT(interpolation.sample(history, 3, 120, state, size) && GetPosition(state) == 0);
+    ASSERT(!interpolation.sample(history, 4, 200, state, size));
+
+    // End to end, a client whose predictions the server bears out is never corrected
+    GhastlyServer server(4);
+    GhastlyClient client;
+    InputSequence expected = 1;
+    int32_t position = 0;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    client.setSimulation(&simulation);
+    client.setPredictedEntity(1);
+    client.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getState() == GhastlyClient::READY);
+
+    GhastlySnapshot &world = server.getWorldSnapshot();
+    SetPosition(world, 1, 0);
+    SetPosition(world, 2, 500);
+    server.sendSnapshots();
+    sleep(1);
+    client.update(1);
+    ASSERT(GetPosition(client.getPredictedState(size)) == 0);
+
+    // Two packets before the server hears either, the second repeating the first's command
+    velocity = 3;
+    for(c = 0; c < 2; c++) {
+        ASSERT(client.sendInput((const char*)&velocity, sizeof(velocity), 10) == c + 1);
+        ASSERT(GetPosition(client.getPredictedState(size)) == (int32_t)(c + 1) * 30);
+    }
+    sleep(1);
+    server.update(1);
+
+    // Each command is taken exactly once, in order
+    while(server.nextInput(input)) {
+        ASSERT(input.host == client.getID() && input.sequence == expected++);
+        memcpy(&velocity, input.data, sizeof(velocity));
+        position += velocity * (int32_t)input.duration;
+    }
+    SetPosition(world, 1, position);
+    ASSERT(expected == 3);
+    SetPosition(world, 2, 600);
+    server.sendSnapshots();
+    sleep(1);
+    client.update(1);
+
+    ASSERT(client.getPrediction().getAcknowledgedInput() == 2);
+    ASSERT(client.getPrediction().getCorrections() == 0);
+    ASSERT(GetPosition(client.getPredictedState(size)) == 60);
+    // Other entities come from the snapshots
+    ASSERT(client.getInterpolated(2, state, size));
+
+    // On a link too narrow for the predicted entity's change, its input isn't acknowledged either, so the client doesn't replay from a stale state
+    ASSERT(server.setControlledEntity(client.getID(), 1));
+    server.setSnapshotSize(11);
+    velocity = 1;
+    ASSERT(client.sendInput((const char*)&velocity, sizeof(velocity), 10) == 3);
+    sleep(1);
+    server.update(1);
+    ASSERT(server.nextInput(input) && input.sequence == 3 && !server.nextInput(input));
+    position += 10;
+    SetPosition(world, 1, position);
+    server.sendSnapshots();
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getSnapshot() && GetPosition(client.getSnapshot()->getEntity(1, size)) == 60);
+    ASSERT(client.getPrediction().getAcknowledgedInput() == 2 && client.getPrediction().getCorrections() == 0);
+    ASSERT(GetPosition(client.getPredictedState(size)) == 70);
+
+    // With room for a few changes, the predicted entity goes ahead of the rest, however little it weighs
+    server.setSnapshotSize(40);
+    server.setEntityWeight(1, 0.001f);
+    for(c = 100; c < 140; c++) {
+        SetPosition(world, c, c);
+    }
+    server.sendSnapshots();
+    sleep(1);
+    client.update(1);
+    ASSERT(GetPosition(client.getSnapshot()->getEntity(1, size)) == 70 && !client.getSnapshot()->getEntity(139, size));
+    ASSERT(client.getPrediction().getAcknowledgedInput() == 3 && client.getPrediction().getCorrections() == 0);
+    ASSERT(GetPosition(client.getPredictedState(size)) == 70);
+
+    client.disconnect();
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getHostCount() == 0);
+    ASSERT(!server.nextInput(input));
+}
+
+void testGhastlyPriority(unsigned int numEntities) {
+    Info("Running snapshot priority tests with " << numEntities << " entities");
+
+    GhastlySnapshot view, scheduled, sent;
+    GhastlyPriority priority;
+    std::vector<float> rates(numEntities, 1.0f);
+    std::vector<unsigned int> timesSent(numEntities, 0);
+    char state[16], buffer[128];
+    // Room for three whole records, wherever their IDs fall
+    unsigned int recordBits = GhastlySnapshot::GetRecordBits(state, sizeof(state), 0, 0), budget = recordBits * 3, round, c;
+
+    for(c = 0; c < numEntities; c++) {
+        memset(state, c & 0xFF, sizeof(state));
+        view.setEntity(c, state, sizeof(state));
+    }
+    // The last entity matters most
+    rates[numEntities - 1] = 10.0f;
+
+    ASSERT(priority.schedule(view, rates, 0, 10, budget, scheduled));
+    ASSERT(scheduled.getEntityCount() == 3 && priority.getDeferred() == numEntities - 3);
+    ASSERT(scheduled.getEntityID(0) == 0 && scheduled.getEntityID(1) == 1 && scheduled.getEntityID(2) == numEntities - 1);
+    ASSERT(priority.getPriority(numEntities - 1) == 0 && priority.getPriority(2) == 10.0f);
+
+    // Whatever's scheduled fits the budget, so encode leaves nothing out
+    ASSERT(scheduled.encode(0, buffer, (budget + 1 + 7) / 8, sent) > 0);
+    ASSERT(sent == scheduled);
+
+    // Those passed over rise until it's their turn, but the heavy entity still comes round most often
+    timesSent[0]++;
+    timesSent[1]++;
+    timesSent[numEntities - 1]++;
+    for(round = 0; round < numEntities; round++) {
+        ASSERT(priority.schedule(view, rates, 0, 10, budget, scheduled));
+        for(c = 0; c < scheduled.getEntityCount(); c++) {
+            timesSent[scheduled.getEntityID(c)]++;
+        }
+    }
+    for(c = 0; c < numEntities - 1; c++) {
+        ASSERT(timesSent[c] > 0 && timesSent[c] < timesSent[numEntities - 1]);
+    }
+
+    // Against a baseline, only changes cost anything, and what isn't sent stays as the baseline has it
+    GhastlySnapshot baseline = view;
+    state[0] = 1;
+    view.setEntity(3, state, sizeof(state));
+    view.setEntity(4, state, sizeof(state));
+    view.removeEntity(5);
+    rates.resize(view.getEntityCount(), 1.0f);
+    ASSERT(priority.schedule(view, rates, &baseline, 10, recordBits, scheduled));
+    ASSERT(priority.getDeferred() == 2);
+    ASSERT(!priority.schedule(view, rates, &baseline, 10, recordBits * 3, scheduled));
+    ASSERT(priority.getPriority(3) == 0 && priority.getDeferred() == 0);
+
+    // A required entity goes first, however little priority it has built up
+    rates[3] = 100.0f;
+    ASSERT(priority.schedule(view, rates, &baseline, 10, recordBits, scheduled, 4));
+    ASSERT(scheduled.getEntity(4, c) && scheduled.getEntity(4, c)[0] == 1 && scheduled.getEntity(3, c)[0] != 1);
+
+    // End to end, a client on a slow link catches up on the whole world a piece at a time
+    GhastlyServer server(4);
+    GhastlyClient client;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    client.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getState() == GhastlyClient::READY);
+
+    // More than a whole snapshot holds, let alone what the rate pays for
+    GhastlySnapshot &world = server.getWorldSnapshot();
+    for(c = 0; c < numEntities * 4; c++) {
+        memset(state, c & 0xFF, sizeof(state));
+        world.setEntity(c, state, sizeof(state));
+    }
+    server.setSnapshotRate(4000);
+    for(round = 0; round < numEntities * 2 && !(client.getSnapshot() && *client.getSnapshot() == world); round++) {
+        server.sendSnapshots();
+        SDL_Delay(20);
+        client.update(50);
+        SDL_Delay(20);
+        server.update(50);
+    }
+    ASSERT(client.getSnapshot() && *client.getSnapshot() == world);
+    ASSERT(round > 2);
+
+    client.disconnect();
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getHostCount() == 0);
+}
+
+void testGhastlyLatency() {
+    Info("Running Ghastly latency tests");
+
+    GhastlyLatency latency;
+    unsigned int c;
+
+    ASSERT(latency.getSampleCount() == 0 && latency.getRoundTripTime() == 0);
+
+    // A remote clock 4000ms ahead, 100ms away
+    latency.addSample(1000, 5050, 1100);
+    ASSERT(latency.getSampleCount() == 1);
+    ASSERT(latency.getRoundTripTime() == 100 && latency.getRoundTripVariance() == 50);
+    ASSERT(latency.getClockOffset() == 4000);
+
+    // Steady samples settle the variance and keep the estimates where they are
+    for(c = 0; c < 100; c++) {
+        latency.addSample(2000 + c * 10, 6050 + c * 10, 2100 + c * 10);
+    }
+    ASSERT(fabs(latency.getRoundTripTime() - 100) < 0.01);
+    ASSERT(latency.getRoundTripVariance() < 1);
+    ASSERT(fabs(latency.getClockOffset() - 4000) < 0.01);
+
+    // Jitter shows up as variance, and a remote clock behind ours as a negative offset
+    GhastlyLatency jittery;
+    for(c = 0; c < 100; c++) {
+        jittery.addSample(10000, 9000 + ((c % 2) ? 40 : 10), 10000 + ((c % 2) ? 80 : 20));
+    }
+    ASSERT(jittery.getRoundTripTime() > 20 && jittery.getRoundTripTime() < 80);
+    ASSERT(jittery.getRoundTripVariance() > 10);
+    ASSERT(fabs(jittery.getClockOffset() + 1000) < 1);
+
+    // Clocks wrapping around don't upset anything
+    GhastlyLatency wrapped;
+    wrapped.addSample(0xFFFFFFF0, 0x00000000, 0x00000010);
+    ASSERT(wrapped.getRoundTripTime() == 32 && wrapped.getClockOffset() == 0);
+}
+
+void testGhastlyPing() {
+    Info("Running Ghastly ping tests");
+
+    GhastlyServer server(4);
+    GhastlyClient client;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+    client.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getState() == GhastlyClient::READY);
+    ASSERT(server.getHostCount() == 1);
+
+    // The first ping goes out as soon as the client is connected
+    client.update(1);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    client.update(1);
+
+    const GhastlyLatency &latency = client.getLatency();
+    ASSERT(latency.getSampleCount() == 1);
+    // The round trip includes waiting for the server to get around to the ping
+    ASSERT(latency.getRoundTripTime() >= 1000);
+    // Same machine, same clock, give or take how lopsided the round trip was
+    ASSERT(fabs(latency.getClockOffset()) <= latency.getRoundTripTime() / 2);
+
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getLatency(client.getID()));
+    ASSERT(server.getLatency(client.getID())->getSampleCount() == 1);
+    ASSERT(server.getLatency(client.getID())->getRoundTripTime() >= 1000);
+    ASSERT(!server.getLatency(GhastlyHost::ID_UNASSIGNED));
+}
+
+void testInterestGrid(unsigned int numEntities) {
+    Info("Running interest grid tests");
+
+    InterestGrid grid(16.0f);
+    std::vector<Vector2<float> > positions;
+    std::vector<InterestGrid::Entry> results;
+    std::set<EntityID> expected, found;
+    Vector2<float> position;
+    unsigned int c, q;
+
+    // Scatter entities across every quadrant, including exactly on cell boundaries
+    for(c = 0; c < numEntities; c++) {
+        positions.push_back(Vector2<float>((float)((int)(c * 37 % 401) - 200), (float)((int)(c * 91 % 397) - 198)));
+        grid.insert(c, positions[c]);
+    }
+    grid.build();
+    ASSERT(grid.size() == numEntities);
+
+    for(q = 0; q < 20; q++) {
+        AABB2<float> bounds(Vector2<float>((float)q * 17 - 180, (float)q * 13 - 150), Vector2<float>((float)q * 17 - 100, (float)q * 13 - 64));
+
+        expected.clear();
+        for(c = 0; c < numEntities; c++) {
+            if(bounds.contains(positions[c])) { expected.insert(c); }
+        }
+
+        results.clear();
+        grid.query(bounds, results);
+        found.clear();
+        for(c = 0; c < results.size(); c++) {
+            found.insert(results[c].id);
+        }
+        ASSERT(results.size() == expected.size());
+        ASSERT(found == expected);
+    }
+
+    ASSERT(grid.getPosition(numEntities / 2, position));
+    ASSERT(position.x == positions[numEntities / 2].x && position.y == positions[numEntities / 2].y);
+    ASSERT(!grid.getPosition(numEntities, position));
+
+    // A query over the whole coordinate range only visits the rows that have entities in them, rather than two billion empty ones
+    results.clear();
+    grid.query(AABB2<float>(Vector2<float>(-1e30f, -1e30f), Vector2<float>(1e30f, 1e30f)), results);
+    ASSERT(results.size() == numEntities);
+
+    grid.clear();
+    results.clear();
+    grid.query(AABB2<float>(Vector2<float>(-1000, -1000), Vector2<float>(1000, 1000)), results);
+    ASSERT(results.empty());
+}
+
+void testInterestFiltering() {
+    Info("Running interest filtering tests");
+
+    GhastlyServer server(4);
+    GhastlyClient client;
+    unsigned int c, size;
+    EntityID id;
+
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+
+    client.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    client.update(1);
+    ASSERT(client.getState() == GhastlyClient::READY);
+
+    // A row of entities ten units apart, plus one with no position at all
+    GhastlySnapshot &world = server.getWorldSnapshot();
+    InterestGrid &grid = server.getInterestGrid();
+    for(c = 0; c < 100; c++) {
+        world.setEntity(c, (char*)&c, sizeof(c));
+        grid.insert(c, Vector2<float>((float)c * 10, 0));
+    }
+    id = 1000;
+    world.setEntity(id, (char*)&id, sizeof(id));
+
+    // The view arrives from the client along with its ping
+    client.setView(AABB2<float>(Vector2<float>(-5, -5), Vector2<float>(95, 5)));
+    client.update(1);
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getInterest(client.getID())->hasView());
+
+    server.sendSnapshots();
+    const std::vector<EntityID> &interest = server.getInterest(client.getID())->getEntities();
+    ASSERT(interest.size() == 10 && interest.front() == 0 && interest.back() == 9);
+    sleep(1);
+    client.update(1);
+
+    const GhastlySnapshot *snapshot = client.getSnapshot();
+    ASSERT(snapshot && snapshot->getEntityCount() == 11);
+    ASSERT(snapshot->getEntity(0, size) && snapshot->getEntity(9, size) && snapshot->getEntity(1000, size));
+    ASSERT(!snapshot->getEntity(10, size));
+
+    // Nudging the view along keeps entities that are only just out of it
+    ASSERT(server.setView(client.getID(), AABB2<float>(Vector2<float>(3, -5), Vector2<float>(103, 5))));
+    server.sendSnapshots();
+    ASSERT(interest.size() == 11 && interest.front() == 0 && interest.back() == 10);
+
+    // But not ones that have gone well past the edge
+    ASSERT(server.setView(client.getID(), AABB2<float>(Vector2<float>(60, -5), Vector2<float>(160, 5))));
+    server.sendSnapshots();
+    ASSERT(interest.size() == 12 && interest.front() == 5 && interest.back() == 16);
+
+    // Coming back, they have to be properly inside the view again
+    ASSERT(server.setView(client.getID(), AABB2<float>(Vector2<float>(41, -5), Vector2<float>(141, 5))));
+    server.sendSnapshots();
+    ASSERT(interest.size() == 11 && interest.front() == 5 && interest.back() == 15);
+    sleep(1);
+    client.update(1);
+    snapshot = client.getSnapshot();
+    ASSERT(snapshot->getEntityCount() == 12 && snapshot->getEntity(5, size) && !snapshot->getEntity(4, size) && snapshot->getEntity(1000, size));
+
+    // Views that are huge or not finite are ignored, whether they're set directly or come from the client
+    float infinity = std::numeric_limits<float>::infinity(), nan = std::numeric_limits<float>::quiet_NaN();
+    ASSERT(!server.setView(client.getID(), AABB2<float>(Vector2<float>(0, 0), Vector2<float>(DEFAULT_MAX_VIEW_SIZE * 2, 5))));
+    ASSERT(!server.setView(client.getID(), AABB2<float>(Vector2<float>(-infinity, 0), Vector2<float>(5, 5))));
+    client.setView(AABB2<float>(Vector2<float>(nan, nan), Vector2<float>(nan, nan)));
+    client.setView(AABB2<float>(Vector2<float>(-1e30f, -1e30f), Vector2<float>(1e30f, 1e30f)));
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getInterest(client.getID())->getView().getLowerBound().x == 41);
+}
+
 void testGhastlyProtocolSetup() {
     Info("Running Ghastly protocol setup tests");
 
@@ -481,20 +2485,254 @@ void testGhastlyProtocolSetup() {
     delete client_2;
 }
 
+class SlowTickListener: public GhastlyTickListener {
+public:
+    SlowTickListener(): ticks(0), slowTicks(0) {}
+
+    void onTick(GhastlyHost *host, int elapsed) {
+        ticks++;
+        if(slowTicks > 0) {
+            SDL_Delay(40);
+            slowTicks--;
+        }
+    }
+
+    unsigned int ticks, slowTicks;
+};
+
+void testGhastlyTicks(unsigned int numTicks) {
+    Info("Running Ghastly tick tests");
+
+    // Held packets only reach the provider when flushed
+    CapturingProvider wire;
+    GhastlyConnection connection(&wire, NetAddress("127.0.0.1", 1001));
+    connection.hold();
+    ASSERT(connection.send(UnreliableChannel, "one", 3));
+    ASSERT(connection.send(ReliableChannel, "two", 3));
+    ASSERT(wire.packets.empty());
+    connection.flush();
+    // Bundled together into one datagram
+    ASSERT(wire.packets.size() == 1);
+    ASSERT(!connection.isHolding());
+
+    GhastlyServer server(4);
+    GhastlyClient clientA, clientB;
+    SlowTickListener listener;
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    uint64_t start, taken;
+    unsigned int c;
+
+    // Ticks are spaced out by the tick rate, not by how quickly tick gets called
+    server.setTickRate(50);
+    server.setTickListener(&listener);
+    start = GetMicroseconds();
+    for(c = 0; c < numTicks; c++) {
+        server.tick();
+    }
+    taken = GetMicroseconds() - start;
+    ASSERT(listener.ticks == numTicks && server.getTickCount() == numTicks);
+    // The first tick runs right away
+    ASSERT(taken >= (numTicks - 1) * 20000 - 1000);
+    ASSERT(taken < (numTicks + 5) * 20000);
+    ASSERT(server.getTickOverruns() == 0);
+
+    // Ticks that take too long are counted
+    listener.slowTicks = 2;
+    for(c = 0; c < 4; c++) {
+        server.tick();
+    }
+    ASSERT(server.getTickOverruns() == 2);
+    ASSERT(server.getLastTickDuration() < 20000);
+
+    // Each update only takes in so many packets
+    server.setMaxPacketsPerUpdate(1);
+    clientA.connect(serverAddr);
+    clientB.connect(serverAddr);
+    sleep(1);
+    server.tick();
+    ASSERT(server.getHostCount() == 1);
+    server.tick();
+    ASSERT(server.getHostCount() == 2);
+
+    // Replies from inside a tick go out at the end of it
+    sleep(1);
+    clientA.update(1);
+    clientB.update(1);
+    ASSERT(clientA.getState() == GhastlyClient::READY);
+    ASSERT(clientB.getState() == GhastlyClient::READY);
+}
+
+void testTimerWheel(unsigned int numTimers) {
+    Info("Running timer wheel tests");
+
+    TimerWheel wheel;
+    std::vector<TimerWheel::TimerID> timers;
+    std::vector<uint32_t> deadlines;
+    std::vector<TimerWheel::Expiry> expired;
+    uint32_t random = 54321, delay;
+    unsigned int fired = 0, c;
+
+    // Deadlines spread across every level of the wheel
+    for(c = 0; c < numTimers; c++) {
+        random = random * 1103515245 + 12345;
+        delay = (random >> 8) % (1u << (6 + 4 * (c % 5)));
+        timers.push_back(wheel.create(c));
+        wheel.schedule(timers[c], delay);
+        deadlines.push_back(std::max(delay, 1u));
+    }
+    ASSERT(wheel.size() == numTimers);
+
+    // Every other timer is moved, and every tenth dropped
+    for(c = 0; c < numTimers; c += 2) {
+        deadlines[c] += 100;
+        wheel.schedule(timers[c], deadlines[c]);
+    }
+    for(c = 5; c < numTimers; c += 10) {
+        wheel.cancel(timers[c]);
+        ASSERT(!wheel.isScheduled(timers[c]));
+    }
+
+    // Uneven steps, so expiries land in the middle of them as well as at the end
+    while(wheel.size() > 0) {
+        random = random * 1103515245 + 12345;
+        expired.clear();
+        wheel.advance((random >> 16) % 5000, expired);
+        for(c = 0; c < expired.size(); c++) {
+            ASSERT(expired[c].data % 10 != 5);
+            ASSERT(deadlines[expired[c].data] <= wheel.getTime());
+            ASSERT(!wheel.isScheduled(expired[c].timer));
+            fired++;
+        }
+    }
+    ASSERT(fired == numTimers - numTimers / 10);
+
+    // Each timer comes up exactly on its deadline
+    TimerWheel exact;
+    TimerWheel::TimerID timer = exact.create(7);
+    for(delay = 1; delay < 300000; delay = delay * 3 + 1) {
+        exact.schedule(timer, delay);
+        expired.clear();
+        exact.advance(delay - 1, expired);
+        ASSERT(expired.empty());
+        exact.advance(1, expired);
+        ASSERT(expired.size() == 1 && expired[0].timer == timer && expired[0].data == 7);
+    }
+
+    // Freed timers are reused
+    exact.destroy(timer);
+    ASSERT(exact.create(8) == timer);
+}
+
+void testGhastlyTimeouts() {
+    Info("Running Ghastly timeout tests");
+
+    GhastlyServer server(1);
+    GhastlyClient quiet, silent, late;
+    NetAddress serverAddr("127.0.0.1", server.getLocalPort());
+    HostID silentID;
+    unsigned int c;
+
+    server.setIdleTimeout(500);
+    server.setKeepaliveInterval(100);
+    quiet.setKeepaliveInterval(100);
+    quiet.setPingInterval(1000000);
+
+    // A client that keeps updating stays connected on keepalives alone
+    quiet.connect(serverAddr);
+    for(c = 0; c < 20; c++) {
+        sleep(1);
+        server.update(50);
+        sleep(1);
+        quiet.update(50);
+    }
+    ASSERT(server.getHostCount() == 1);
+    ASSERT(quiet.getState() == GhastlyClient::READY);
+    quiet.disconnect();
+    sleep(1);
+    server.update(1);
+    ASSERT(server.getHostCount() == 0);
+
+    // One that stops is dropped once the timeout passes, freeing its ID for someone else
+    silent.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    silent.update(1);
+    ASSERT(silent.getState() == GhastlyClient::READY);
+    silentID = silent.getID();
+
+    late.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    late.update(1);
+    ASSERT(late.getState() == GhastlyClient::NOT_CONNECTED);
+
+    // Let the rejected client's ack arrive and be dropped before it tries again
+    sleep(1);
+    server.update(450);
+    ASSERT(server.getHostCount() == 1);
+    server.update(100);
+    ASSERT(server.getHostCount() == 0);
+    ASSERT(!server.getConnection(silentID));
+
+    late.connect(serverAddr);
+    sleep(1);
+    server.update(1);
+    sleep(1);
+    late.update(1);
+    ASSERT(late.getState() == GhastlyClient::READY);
+}
+
 int main(int argc, char *argv[]) {
     Log::Setup();
     Socket::InitializeSocketLayer();
 
     testUDP(true);
     testUDP(false);
+    testUDPBatching(false);
+    testUDPBatching(true);
     testTCP(true);
     testTCP(false);
+    testListenAdmission(1, 16, 4);
+    testListenAdmission(4, 64, 8);
     testPacketBuffering(2^16);
+    testPacketPool();
+    testPacketRing(100);
     testUDPBuffer(2^16);
     testTCPBuffer(2^16);
+    testTCPStreaming(2000);
+    testNetworkReactor(100);
+    testTokenBucket();
+    testRateLimiting(false);
+    testRateLimiting(true);
     testTCPConnectionProviders();
+    testServerProviderReaping(4);
     testUDPConnectionProviders();
+    testAddressMap(1000);
+    testSocketedUDPProvider(16);
+    testReceiveFairness(200);
+    testNetworkMetrics(200);
+    testPacketCapture();
+    testGhastlyConnection(2000);
+    testGhastlyBundling(32);
+    testGhastlyLoopback(200);
+    testGhastlyFragmentation(16);
+    testGhastlyHostRegistry(20000);
+    testTimerWheel(5000);
+    testBitStream();
+    testGhastlySnapshots(500);
+    testSnapshotReplication(40);
+    testGhastlySharding(32, 4);
+    testGhastlyPrediction();
+    testGhastlyPriority(40);
+    testGhastlyLatency();
+    testGhastlyPing();
+    testInterestGrid(5000);
+    testInterestFiltering();
     testGhastlyProtocolSetup();
+    testGhastlyTicks(10);
+    testGhastlyTimeouts();
 
     Socket::ShutdownSocketLayer();
     Log::Teardown();